@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Throughput of the two dispatchers (heap and work stealing), with the
+ * real put_task / get_task / run_task:
+ *  - "inject": producer threads (as the reactors) queue small tasks;
+ *  - "spawn":  each task queued by a producer queues a few more from the
+ *              worker running it (as a resumed context does).
+ * Each task burns a few hundred cycles, so that the queueing is what is
+ * measured. The total number of tasks run is checked.
+ *
+ * usage: disp_bench [workers [producers [tasks]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "dispatcher/dispatcher.h"
+#include "locking/atomic_ops.h"
+#include "mock.h"
+
+#define BENCH_WORKERS    4
+#define BENCH_PRODUCERS  2
+#define BENCH_TASKS      (1<<20)
+/* tasks queued by each task of the "spawn" run */
+#define BENCH_SPAWN      3
+/* work done by a task */
+#define BENCH_SPIN       200
+
+static dispatcher_t *disp;
+static volatile int tasks_run;
+static int spawn;
+
+static __thread int worker_stop;
+
+
+static inline void bench_spin(void)
+{
+	volatile int i;
+
+	for( i=0 ; i<BENCH_SPIN ; i++ );
+}
+
+static int leaf_task(void *param)
+{
+	bench_spin();
+	atomic_inc(&tasks_run);
+	return 0;
+}
+
+static int root_task(void *param)
+{
+	int i;
+
+	for( i=0 ; i<spawn ; i++ )
+		put_task_simple(disp, TASK_PRIO_RESUME_EXEC, leaf_task, NULL);
+	return leaf_task(param);
+}
+
+static int stop_task(void *param)
+{
+	worker_stop = 1;
+	return 0;
+}
+
+static void* worker(void *arg)
+{
+	heap_node_t task;
+
+	while (!worker_stop) {
+		get_task(disp, &task);
+		run_task(&task);
+	}
+	return NULL;
+}
+
+static void* producer(void *arg)
+{
+	long i, n;
+
+	n = (long)arg;
+	for( i=0 ; i<n ; i++ )
+		put_task_simple(disp, TASK_PRIO_RESUME_EXEC,
+			spawn ? root_task : leaf_task, NULL);
+	return NULL;
+}
+
+
+static int bench_run(int type, int workers, int producers, long tasks)
+{
+	pthread_t *wt, *pt;
+	double start, t;
+	long expected;
+	int i;
+
+	dispatcher_type = type;
+	if ( (disp=new_dispatcher(workers))==NULL )
+		return -1;
+	wt = malloc(workers * sizeof(pthread_t));
+	pt = malloc(producers * sizeof(pthread_t));
+	if (wt==NULL || pt==NULL)
+		return -1;
+	tasks_run = 0;
+
+	for( i=0 ; i<workers ; i++ )
+		pthread_create(&wt[i], NULL, worker, NULL);
+
+	start = mock_now();
+	for( i=0 ; i<producers ; i++ )
+		pthread_create(&pt[i], NULL, producer, (void*)(tasks/producers));
+	for( i=0 ; i<producers ; i++ )
+		pthread_join(pt[i], NULL);
+
+	expected = (tasks/producers) * producers * (spawn + 1);
+	while (atomic_get(&tasks_run) < expected)
+		sched_yield();
+	t = mock_now() - start;
+
+	/* one stop task per worker - a stopped worker takes no more */
+	for( i=0 ; i<workers ; i++ )
+		put_task_simple(disp, TASK_PRIO_RESUME_EXEC, stop_task, NULL);
+	for( i=0 ; i<workers ; i++ )
+		pthread_join(wt[i], NULL);
+
+	printf("%-6s %-6s %8ld tasks %8.1f ms %8.2f Mtasks/s  max queued %d\n",
+		spawn ? "spawn" : "inject", type==DISPATCHER_STEAL ? "steal" : "heap",
+		expected, t*1e3, expected/t/1e6, disp->stats.max_size);
+
+	destroy_dispatcher(disp);
+	free(wt);
+	free(pt);
+	return (tasks_run==expected) ? 0 : -1;
+}
+
+
+int main(int argc, char **argv)
+{
+	int workers, producers;
+	long tasks;
+
+	workers = (argc>1) ? atoi(argv[1]) : BENCH_WORKERS;
+	producers = (argc>2) ? atoi(argv[2]) : BENCH_PRODUCERS;
+	tasks = (argc>3) ? atol(argv[3]) : BENCH_TASKS;
+	if (workers<=0 || producers<=0 || tasks<producers) {
+		fprintf(stderr, "usage: %s [workers [producers [tasks]]]\n", argv[0]);
+		return 1;
+	}
+	printf("%d workers, %d producers\n", workers, producers);
+
+	for( spawn=0 ; spawn<=BENCH_SPAWN ; spawn+=BENCH_SPAWN ) {
+		/* about the same number of tasks run, with or without spawning */
+		if (bench_run(DISPATCHER_HEAP, workers, producers, tasks/(spawn+1))<0 ||
+		bench_run(DISPATCHER_STEAL, workers, producers, tasks/(spawn+1))<0) {
+			fprintf(stderr, "run failed\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  the two run alternately, best of TRIES runs
+ */
+
+/*
+ * Header name classification: the perfect hash of parse_hname2() against
+ * the old switch (legacy/hname_switch.c), in names/sec.
+ *
+ * In a fixed order the branch predictor learns the switch paths and the
+ * two are close (the switch may still be ahead on a loaded box); the
+ * hash wins when the order changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser/parse_hname2.h"
+#include "parser/scan.h"
+#include "mock.h"
+
+char* hname_switch_parse(char* begin, char* end, struct hdr_field* hdr);
+
+#define ROUNDS  1000
+#define SEQ_LEN 4000
+/* the two are run alternately, TRIES times each; the best run is kept */
+#define TRIES   5
+
+/* the headers of a typical call setup, plus some carrier specific ones */
+static char *hdrs[] = {
+	"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK776asdhds\r\n",
+	"Via: SIP/2.0/TCP 192.168.1.20:5060;branch=z9hG4bK3423a\r\n",
+	"Max-Forwards: 70\r\n",
+	"From: Alice <sip:alice@example.com>;tag=1928301774\r\n",
+	"To: Bob <sip:bob@example.com>\r\n",
+	"Call-ID: a84b4c76e66710@pc33.example.com\r\n",
+	"CSeq: 314159 INVITE\r\n",
+	"Contact: <sip:alice@10.0.0.1:5060>\r\n",
+	"Record-Route: <sip:p1.example.com;lr>\r\n",
+	"Route: <sip:p2.example.com;lr>\r\n",
+	"Content-Type: application/sdp\r\n",
+	"Content-Length: 142\r\n",
+	"Allow: INVITE, ACK, CANCEL, OPTIONS, BYE\r\n",
+	"Supported: replaces, timer\r\n",
+	"User-Agent: softphone 1.0\r\n",
+	"Session-Expires: 1800\r\n",
+	"Min-SE: 90\r\n",
+	"P-Asserted-Identity: <sip:alice@example.com>\r\n",
+	"Privacy: none\r\n",
+	"Proxy-Authorization: Digest username=\"alice\"\r\n",
+	"Accept: application/sdp\r\n",
+	"Expires: 3600\r\n",
+	"Event: presence\r\n",
+	"Diversion: <sip:carol@example.com>;reason=busy\r\n",
+	"v: SIP/2.0/UDP 10.0.0.2\r\n",
+	"f: <sip:a@b>;tag=1\r\n",
+	"t: <sip:c@d>\r\n",
+	"i: 12345@host\r\n",
+	"m: <sip:a@10.0.0.2>\r\n",
+	"l: 0\r\n",
+	"X-Carrier-Id: 42\r\n",
+	"X-Billing-Account: 1234567\r\n",
+	"P-Charging-Vector: icid-value=1234bc9876e\r\n",
+	"P-Access-Network-Info: 3GPP-UTRAN-TDD\r\n",
+	"P-Called-Party-ID: <sip:bob@example.com>\r\n",
+	"X-Trace: off\r\n",
+	"Alert-Info: <http://www.example.com/sounds/moo.wav>\r\n",
+	"Call-Info: <http://wwww.example.com/alice/photo.jpg>\r\n",
+	"Reason: Q.850;cause=16\r\n",
+	"Require: 100rel\r\n",
+};
+
+#define HDRS_NO  (sizeof(hdrs)/sizeof(hdrs[0]))
+
+#define BODY "\r\nv=0\r\no=alice 2890844526 2890844526 IN IP4 10.0.0.1\r\n"
+
+typedef char* (hname_f)(char*, char*, struct hdr_field*);
+
+
+/* "seq" is the order of the names: the table one, or random (so the
+ * branch predictors cannot learn it) */
+static double run(hname_f *f, char **b, char *end, unsigned char *seq,
+														unsigned long *sum)
+{
+	struct hdr_field hf;
+	double start;
+	int i, j;
+
+	start = mock_now();
+	for( i=0 ; i<ROUNDS ; i++ )
+		for( j=0 ; j<SEQ_LEN ; j++ ) {
+			f( b[seq[j]], end, &hf);
+			*sum += hf.type + hf.name.len;
+		}
+	return (double)ROUNDS*SEQ_LEN / (mock_now() - start);
+}
+
+
+static void compare(char *order, char **b, char *end, unsigned char *seq,
+														unsigned long *sum)
+{
+	double r, r_sw, r_ph;
+	int i;
+
+	r_sw = r_ph = 0;
+	for( i=0 ; i<TRIES ; i++ ) {
+		if ((r=run( hname_switch_parse, b, end, seq, sum))>r_sw)
+			r_sw = r;
+		if ((r=run( parse_hname2, b, end, seq, sum))>r_ph)
+			r_ph = r;
+	}
+	printf("  %-13s switch %7.2f Mnames/sec, perfect hash %7.2f"
+		" Mnames/sec (x%.2f)\n", order, r_sw/1e6, r_ph/1e6, r_ph/r_sw);
+}
+
+
+int main(int argc, char **argv)
+{
+	static unsigned char seq[SEQ_LEN];
+	char *b[HDRS_NO], *end;
+	struct hdr_field h1, h2;
+	unsigned long sum = 0;
+	int j, known, err, len;
+	char *msg;
+
+	scan_init();
+
+	/* all in one buffer, as in a received message (the parser gets the
+	 * end of the message, not of the header) */
+	for( j=0,len=0 ; j<HDRS_NO ; j++ )
+		len += strlen(hdrs[j]);
+	msg = malloc( len + sizeof(BODY));
+	for( j=0,len=0 ; j<HDRS_NO ; j++ ) {
+		b[j] = msg + len;
+		len += strlen(hdrs[j]);
+		memcpy( b[j], hdrs[j], strlen(hdrs[j]));
+	}
+	memcpy( msg + len, BODY, sizeof(BODY));
+	end = msg + len + sizeof(BODY) - 1;
+
+	/* the same types and names as the switch (the Accept-Disposition
+	 * header, not known to the switch, is not in the list) */
+	for( j=0,known=0,err=0 ; j<HDRS_NO ; j++ ) {
+		memset( &h1, 0, sizeof(h1));
+		memset( &h2, 0, sizeof(h2));
+		hname_switch_parse( b[j], end, &h1);
+		parse_hname2( b[j], end, &h2);
+		if (h1.type!=h2.type || h1.name.len!=h2.name.len) {
+			fprintf( stderr, "mismatch for <%.*s>: switch %d/%d, hash %d/%d\n",
+				h2.name.len, b[j], h1.type, h1.name.len, h2.type,
+				h2.name.len);
+			err++;
+		}
+		if (h2.type!=HDR_OTHER_T)
+			known++;
+	}
+	if (err)
+		return 1;
+
+	printf("header names: %d (%d known, %d unknown), %d x %d lookups,"
+		" best of %d\n", (int)HDRS_NO, known, (int)HDRS_NO-known, ROUNDS,
+		SEQ_LEN, TRIES);
+
+	for( j=0 ; j<SEQ_LEN ; j++ )
+		seq[j] = j % HDRS_NO;
+	compare( "in order:", b, end, seq, &sum);
+
+	srand(1);
+	for( j=0 ; j<SEQ_LEN ; j++ )
+		seq[j] = rand() % HDRS_NO;
+	compare( "random order:", b, end, seq, &sum);
+
+	return sum==0;
+}
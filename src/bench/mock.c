@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "log.h"
+#include "threading.h"
+#include "mock.h"
+
+int debug = L_ERR;
+int memlog = L_DBG;
+int memdump = L_DBG;
+int log_syslog = 0;
+int log_facility = 0;
+char* log_name = NULL;
+char ctime_buf[256];
+
+declare_tsd( thread_id );
+
+unsigned long mock_allocs = 0;
+
+
+void dprint(char* format, ...)
+{
+	va_list ap;
+
+	va_start( ap, format);
+	vfprintf( stderr, format, ap);
+	va_end( ap);
+}
+
+
+/* as with the real allocators, there is a header before each chunk (the
+ * parser_free() of the parser looks at the word before the chunk) */
+#define MOCK_HDR  16
+
+void *sys_malloc(size_t s, const char *file, const char *function, int line)
+{
+	char *p;
+
+	mock_allocs++;
+	if ( (p=malloc(s + MOCK_HDR))==NULL )
+		return NULL;
+	*(size_t*)p = s;
+	return p + MOCK_HDR;
+}
+
+void *sys_realloc(void *p, size_t s, const char *file, const char *function,
+																	int line)
+{
+	char *n;
+
+	mock_allocs++;
+	if ( (n=realloc(p ? (char*)p - MOCK_HDR : NULL, s + MOCK_HDR))==NULL )
+		return NULL;
+	*(size_t*)n = s;
+	return n + MOCK_HDR;
+}
+
+void sys_free(void *p, const char *file, const char *function, int line)
+{
+	if (p)
+		free((char*)p - MOCK_HDR);
+}
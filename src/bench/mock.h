@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Mock layer for the benchmarks: the core sources are built with the
+ * system malloc (no *_MALLOC defines) and the allocator and the logging
+ * are provided here instead of by mem/ and log.c.
+ */
+
+#ifndef _BENCH_MOCK_H
+#define _BENCH_MOCK_H
+
+#include <time.h>
+
+/* number of sys_malloc() / sys_realloc() calls so far */
+extern unsigned long mock_allocs;
+
+static inline double mock_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+#endif
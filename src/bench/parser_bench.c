@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  parse_sdp / parse_multipart only on the bodies they parse
+ */
+
+/*
+ * Parser benchmark over a corpus of SIP messages (one message per file):
+ * for each message and parser entry point, the messages/sec, the ns per
+ * header (time per message / headers of the message) and the allocations
+ * per message (pkg_malloc calls, see mock.c).
+ *
+ *  - parse_msg      new message, first line and first Via, free
+ *  - parse_headers  the same plus parse_headers(HDR_EOH_F)
+ *  - parse_uri      the R-URI (the To URI for replies)
+ *  - parse_via      all the Via headers
+ *  - parse_to       the To and From headers
+ *  - parse_sdp      the SDP body (also the one in a multipart body); only
+ *                   for an application/sdp or multipart Content-Type
+ *  - parse_multipart  get_all_bodies(); only for a multipart Content-Type
+ *
+ * The last five run on an already parsed message. In the timed runs the
+ * message gets a fresh arena before each run, as when these parsers run
+ * on a new message (its own arena is mostly used up by then).
+ *
+ *   parser_bench [corpus_dir] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "parser/msg_parser.h"
+#include "parser/parse_uri.h"
+#include "parser/parse_to.h"
+#include "parser/parse_via.h"
+#include "parser/parse_multipart.h"
+#include "parser/parse_content.h"
+#include "parser/sdp/sdp.h"
+#include "parser/scan.h"
+#include "mock.h"
+
+#define MAX_MSGS    64
+#define MAX_MSG_LEN 65535
+
+struct bench_msg {
+	char *name;
+	char *buf;
+	unsigned int len;
+	unsigned int hdrs;
+	int mime;                  /* of the Content-Type, 0 if none */
+	struct sip_msg *msg;       /* the parsed message */
+};
+
+/* one run of an entry point; returns <0 if it does not apply */
+typedef int (bench_f)(struct bench_msg *m);
+
+static unsigned long rounds = 20000;
+
+/* set for the timed runs only: the headers parsed on demand by the entry
+ * points (e.g. Content-Type) must stay in the arena of the message */
+static int timed;
+static char arena_mem[1<<20];
+
+
+static struct sip_msg* bench_parse(struct bench_msg *m, hdr_flags_t flags)
+{
+	struct sip_msg *msg;
+
+	msg = new_sip_msg(m->len);
+	if (msg==NULL)
+		return NULL;
+	memcpy(msg->buf, m->buf, m->len);
+	msg->len = m->len;
+	if (parse_msg(msg, 0)!=0 ||
+	(flags && parse_headers(msg, flags, 0)!=0)) {
+		free_sip_msg(msg);
+		return NULL;
+	}
+	return msg;
+}
+
+#define arena_reset(_m) \
+	do { \
+		if (timed) \
+			msg_arena_init(&(_m)->msg->arena, arena_mem, sizeof(arena_mem)); \
+	} while(0)
+
+
+static int b_parse_msg(struct bench_msg *m)
+{
+	struct sip_msg *msg;
+
+	if ( (msg=bench_parse(m, 0))==NULL )
+		return -1;
+	free_sip_msg(msg);
+	return 0;
+}
+
+static int b_parse_headers(struct bench_msg *m)
+{
+	struct sip_msg *msg;
+
+	if ( (msg=bench_parse(m, HDR_EOH_F))==NULL )
+		return -1;
+	free_sip_msg(msg);
+	return 0;
+}
+
+static int b_parse_uri(struct bench_msg *m)
+{
+	struct sip_uri uri;
+	str *s;
+
+	if (m->msg->first_line.type==SIP_REQUEST)
+		s = &m->msg->first_line.u.request.uri;
+	else if (m->msg->to)
+		s = &get_to(m->msg)->uri;
+	else
+		return -1;
+	return parse_uri(s->s, s->len, &uri);
+}
+
+static int b_parse_via(struct bench_msg *m)
+{
+	struct msg_arena *bk;
+	struct hdr_field *hf;
+	struct via_body *vb;
+	char *end;
+	int ret;
+
+	arena_reset(m);
+	end = m->msg->buf + m->msg->len;
+	ret = -1;
+	msg_arena_enter(m->msg, bk);
+	for( hf=m->msg->h_via ; hf ; hf=get_next_header(m->msg, hf) ) {
+		vb = parser_malloc(sizeof(struct via_body));
+		memset(vb, 0, sizeof(struct via_body));
+		ret = (parse_via(hf->body.s, end, vb)==NULL || vb->error!=PARSE_OK) ?
+			-1 : 0;
+		free_via_list(vb);
+		if (ret<0)
+			break;
+	}
+	msg_arena_leave(bk);
+	return ret;
+}
+
+static int b_parse_to(struct bench_msg *m)
+{
+	struct hdr_field *hfs[2];
+	struct msg_arena *bk;
+	struct to_body *tb;
+	char *end;
+	int i, ret;
+
+	hfs[0] = m->msg->to;
+	hfs[1] = m->msg->from;
+	if (hfs[0]==NULL || hfs[1]==NULL)
+		return -1;
+	arena_reset(m);
+	end = m->msg->buf + m->msg->len;
+	ret = 0;
+	msg_arena_enter(m->msg, bk);
+	for( i=0 ; i<2 && ret==0 ; i++ ) {
+		tb = parser_malloc(sizeof(struct to_body));
+		memset(tb, 0, sizeof(struct to_body));
+		if (parse_to(hfs[i]->body.s, end, tb)==NULL || tb->error!=PARSE_OK)
+			ret = -1;
+		free_to(tb);
+	}
+	msg_arena_leave(bk);
+	return ret;
+}
+
+static int b_parse_sdp(struct bench_msg *m)
+{
+	int ret;
+
+	if (m->mime!=((TYPE_APPLICATION<<16)|SUBTYPE_SDP) &&
+	(m->mime>>16)!=TYPE_MULTIPART)
+		return -1;
+	arena_reset(m);
+	ret = parse_sdp(m->msg);
+	free_sdp(&m->msg->sdp);
+	return ret==0 ? 0 : -1;
+}
+
+static int b_parse_multipart(struct bench_msg *m)
+{
+	if ((m->mime>>16)!=TYPE_MULTIPART || get_all_bodies(m->msg)==NULL)
+		return -1;
+	free_multi_body(m->msg->multi);
+	m->msg->multi = NULL;
+	return 0;
+}
+
+static struct {
+	char *name;
+	bench_f *f;
+} entries[] = {
+	{ "parse_msg",       b_parse_msg },
+	{ "parse_headers",   b_parse_headers },
+	{ "parse_uri",       b_parse_uri },
+	{ "parse_via",       b_parse_via },
+	{ "parse_to",        b_parse_to },
+	{ "parse_sdp",       b_parse_sdp },
+	{ "parse_multipart", b_parse_multipart },
+};
+
+#define ENTRIES_NO  (sizeof(entries)/sizeof(entries[0]))
+
+
+static int not_hidden(const struct dirent *de)
+{
+	return de->d_name[0]!='.';
+}
+
+static int load_corpus(char *dir, struct bench_msg *msgs)
+{
+	struct dirent **des;
+	char path[512];
+	FILE *f;
+	int i, n, no;
+
+	if ( (no=scandir(dir, &des, not_hidden, alphasort))<0 ) {
+		perror(dir);
+		return -1;
+	}
+	for( i=0,n=0 ; i<no ; free(des[i]),i++ ) {
+		if (n==MAX_MSGS)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, des[i]->d_name);
+		if ( (f=fopen(path, "r"))==NULL ) {
+			perror(path);
+			continue;
+		}
+		msgs[n].buf = malloc(MAX_MSG_LEN);
+		msgs[n].len = fread(msgs[n].buf, 1, MAX_MSG_LEN, f);
+		fclose(f);
+		msgs[n].name = strdup(des[i]->d_name);
+		n++;
+	}
+	free(des);
+	return n;
+}
+
+
+int main(int argc, char **argv)
+{
+	static struct bench_msg msgs[MAX_MSGS];
+	struct msg_arena own;
+	struct bench_msg *m;
+	unsigned long allocs, r;
+	double start, t;
+	int ok[ENTRIES_NO];
+	int n, i, e;
+
+	if (argc>2)
+		rounds = strtoul(argv[2], 0, 10);
+	if ( (n=load_corpus(argc>1 ? argv[1] : "corpus", msgs))<=0 ) {
+		fprintf(stderr, "empty corpus\n");
+		return 1;
+	}
+	scan_init();
+
+	printf("%-16s %5s  %-16s %12s %9s %11s\n", "message", "hdrs",
+		"entry point", "msgs/sec", "ns/hdr", "allocs/msg");
+	for( i=0 ; i<n ; i++ ) {
+		m = &msgs[i];
+		if ( (m->msg=bench_parse(m, HDR_EOH_F))==NULL ) {
+			fprintf(stderr, "%s: bad message\n", m->name);
+			return 1;
+		}
+		m->hdrs = m->msg->hidx.no;
+		if ( (m->mime=parse_content_type_hdr(m->msg))<0 ) {
+			fprintf(stderr, "%s: bad Content-Type\n", m->name);
+			return 1;
+		}
+		for( e=0 ; e<ENTRIES_NO ; e++ )
+			ok[e] = entries[e].f(m)==0;
+		own = m->msg->arena;
+
+		for( e=0 ; e<ENTRIES_NO ; e++ ) {
+			if (!ok[e]) {
+				printf("%-16s %5u  %-16s %12s %9s %11s\n", m->name, m->hdrs,
+					entries[e].name, "-", "-", "-");
+				continue;
+			}
+			timed = 1;
+			allocs = mock_allocs;
+			start = mock_now();
+			for( r=0 ; r<rounds ; r++ )
+				entries[e].f(m);
+			t = mock_now() - start;
+			timed = 0;
+			printf("%-16s %5u  %-16s %12.0f %9.1f %11.2f\n", m->name,
+				m->hdrs, entries[e].name, rounds/t,
+				t*1e9/rounds/m->hdrs, (double)(mock_allocs-allocs)/rounds);
+		}
+		m->msg->arena = own;
+		free_sip_msg(m->msg);
+	}
+	return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  message parsed out of a shared receive buffer
+ *  2010-09-xx  no zero after the input - the parsers must stop at its end
+ */
+
+/*
+ * libFuzzer target for the parser entry points of parser_bench: the input
+ * is parsed as a whole message (parse_msg, parse_headers(HDR_EOH_F), then
+ * parse_uri, parse_via, parse_to, parse_sdp and parse_multipart on its
+ * parts) and, raw, as a Via / To body and as a URI. The vectorized code is
+ * checked against its reference on the same input:
+ *  - the scan_f kernels against the plain C ones (scan_f_c);
+ *  - parse_uri_fsm() against parse_uri_legacy().
+ * A difference aborts, as a crash would.
+ *
+ * All the parsers get a copy of the input of its exact size, so the
+ * sanitizers catch any read past its end. The message is built as the TCP
+ * reader builds it: in a shared receive buffer referred by
+ * new_sip_msg_shared() - the message may be followed by the next one, not
+ * by a zero, so the parsers must stop at msg->len.
+ *
+ * Built with -DFUZZ_REPLAY, it has a main() replaying the files (or the
+ * files of the directories) given as arguments, without libFuzzer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "parser/msg_parser.h"
+#include "parser/parse_uri.h"
+#include "parser/parse_to.h"
+#include "parser/parse_via.h"
+#include "parser/parse_multipart.h"
+#include "parser/sdp/sdp.h"
+#include "parser/scan.h"
+#include "mock.h"
+
+#define FUZZ_MAX_LEN  65535
+
+#define fuzz_check(_cond, _what) \
+	do { \
+		if (!(_cond)) { \
+			fprintf(stderr, "%s differs\n", _what); \
+			abort(); \
+		} \
+	} while(0)
+
+
+static void fuzz_scan(const char *buf, size_t size)
+{
+	const char *p, *end;
+	int c0, c1, c2, c3;
+	size_t off[4];
+	int i;
+
+	if (size<4)
+		return;
+	c0 = buf[0]; c1 = buf[1]; c2 = buf[2]; c3 = buf[3];
+	end = buf + size;
+	/* a few starting points, for the different alignments and tails */
+	off[0] = 0; off[1] = 1; off[2] = size/2; off[3] = size - 1;
+	for( i=0 ; i<4 ; i++ ) {
+		p = buf + off[i];
+		fuzz_check(scan_f.chr(p, end, c0)==scan_f_c.chr(p, end, c0),
+			"scan chr");
+		fuzz_check(scan_f.any(p, end, c0, c1, c2, c3)==
+			scan_f_c.any(p, end, c0, c1, c2, c3), "scan any");
+		fuzz_check(scan_f.skip(p, end, c0, c1)==scan_f_c.skip(p, end, c0, c1),
+			"scan skip");
+	}
+}
+
+static void fuzz_uri(char *buf, size_t size)
+{
+	struct sip_uri u1, u2;
+	int r1, r2;
+
+	r1 = parse_uri_legacy(buf, size, &u1);
+	r2 = parse_uri_fsm(buf, size, &u2);
+	fuzz_check(r1==r2, "parse_uri return code");
+	if (r1<0)
+		return;
+	/* the "" host of the tel uris may be a different string constant */
+	if (u1.host.len==0 && u2.host.len==0)
+		u1.host.s = u2.host.s = NULL;
+	/* both zero the whole structure first */
+	fuzz_check(memcmp(&u1, &u2, sizeof(u1))==0, "parse_uri result");
+}
+
+static void fuzz_bodies(const uint8_t *data, size_t size)
+{
+	struct via_body *vb;
+	struct to_body *tb;
+	char *buf;
+
+	if ( (buf=malloc(size ? size : 1))==NULL )
+		return;
+	memcpy(buf, data, size);
+
+	vb = pkg_malloc(sizeof(struct via_body));
+	memset(vb, 0, sizeof(struct via_body));
+	parse_via(buf, buf+size, vb);
+	free_via_list(vb);
+
+	tb = pkg_malloc(sizeof(struct to_body));
+	memset(tb, 0, sizeof(struct to_body));
+	parse_to(buf, buf+size, tb);
+	free_to(tb);
+	free(buf);
+}
+
+static void fuzz_msg(const char *data, size_t size)
+{
+	struct sip_uri uri;
+	struct sip_msg_buf *mb;
+	struct sip_msg *msg;
+	struct msg_arena *bk;
+	struct hdr_field *hf;
+	struct via_body *vb;
+	struct to_body *tb;
+	char *end;
+
+	/* as new_sip_msg_buf(), but without the spare byte */
+	if ( (mb=shm_malloc(sizeof(struct sip_msg_buf)+size))==NULL )
+		return;
+	mb->ref = 1;
+	mb->size = size;
+	memcpy(mb->buf, data, size);
+	msg = new_sip_msg_shared(mb, mb->buf, size);
+	/* the message holds the buffer from now on */
+	unref_sip_msg_buf(mb);
+	if (msg==NULL)
+		return;
+	end = msg->buf + size;
+
+	if (parse_msg(msg, 0)!=0 || parse_headers(msg, HDR_EOH_F, 0)!=0)
+		goto done;
+
+	if (msg->first_line.type==SIP_REQUEST)
+		parse_uri(msg->first_line.u.request.uri.s,
+			msg->first_line.u.request.uri.len, &uri);
+
+	msg_arena_enter(msg, bk);
+	for( hf=msg->h_via ; hf ; hf=get_next_header(msg, hf) ) {
+		vb = parser_malloc(sizeof(struct via_body));
+		memset(vb, 0, sizeof(struct via_body));
+		parse_via(hf->body.s, end, vb);
+		free_via_list(vb);
+	}
+	for( hf=msg->to ; hf ; hf=(hf==msg->to) ? msg->from : NULL ) {
+		tb = parser_malloc(sizeof(struct to_body));
+		memset(tb, 0, sizeof(struct to_body));
+		if (parse_to(hf->body.s, end, tb) && tb->error==PARSE_OK)
+			parse_uri(tb->uri.s, tb->uri.len, &uri);
+		free_to(tb);
+	}
+	msg_arena_leave(bk);
+
+	parse_sdp(msg);
+	if (get_all_bodies(msg)) {
+		free_multi_body(msg->multi);
+		msg->multi = NULL;
+	}
+
+done:
+	free_sip_msg(msg);
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static int init = 0;
+	char *buf;
+
+	if (!init) {
+		/* the parse errors are expected, do not print them */
+		debug = L_ALERT - 1;
+		scan_init();
+		init = 1;
+	}
+	if (size>FUZZ_MAX_LEN)
+		return 0;
+
+	if ( (buf=malloc(size ? size : 1))==NULL )
+		return 0;
+	memcpy(buf, data, size);
+
+	fuzz_scan(buf, size);
+	fuzz_uri(buf, size);
+	free(buf);
+
+	fuzz_bodies(data, size);
+	fuzz_msg((const char*)data, size);
+	return 0;
+}
+
+
+#ifdef FUZZ_REPLAY
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+static int replay_file(char *path)
+{
+	static char data[FUZZ_MAX_LEN];
+	size_t size;
+	FILE *f;
+
+	if ( (f=fopen(path, "r"))==NULL ) {
+		perror(path);
+		return 0;
+	}
+	size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+	/* as libFuzzer, so that a crash or a hang shows its input */
+	fprintf(stderr, "Running: %s\n", path);
+	LLVMFuzzerTestOneInput((uint8_t*)data, size);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct dirent *de;
+	char path[512];
+	struct stat st;
+	int i, n;
+	DIR *d;
+
+	for( i=1,n=0 ; i<argc ; i++ ) {
+		if (stat(argv[i], &st)==0 && S_ISDIR(st.st_mode)) {
+			if ( (d=opendir(argv[i]))==NULL )
+				continue;
+			while ( (de=readdir(d))!=NULL ) {
+				if (de->d_name[0]=='.')
+					continue;
+				snprintf(path, sizeof(path), "%s/%s", argv[i], de->d_name);
+				n += replay_file(path);
+			}
+			closedir(d);
+		} else {
+			n += replay_file(argv[i]);
+		}
+	}
+	printf("replayed %d inputs\n", n);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Benchmark of the scanning kernels (parser/scan.h) over a corpus of SIP
+ * messages (one message per file, as for parser_bench), for each kernel
+ * supported by the CPU, with the scans the parser does:
+ *
+ *  - eoh      scan_eoh() - the end of the headers (as the TCP reader
+ *             looks for it)
+ *  - hdr_end  scan_hdr_end() over all the headers, one by one
+ *  - delim    scan_delim() over the headers, from a delimiter to the next
+ *
+ * The ns per message and the MB/s (bytes of the message, headers and
+ * body, for all the scans) are reported; the scans must end at the same
+ * place with all the kernels.
+ *
+ *   scan_bench [corpus_dir] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "parser/scan.h"
+#include "mock.h"
+
+#define MAX_MSGS    64
+#define MAX_MSG_LEN 65535
+
+struct bench_msg {
+	char *name;
+	char *buf;
+	unsigned int len;
+};
+
+/* one scan of a message; returns a checksum of where it stopped */
+typedef unsigned long (scan_bench_f)(const char *p, const char *end);
+
+static unsigned long rounds = 200000;
+
+static char *kernels[] = { "c", "sse2", "avx2" };
+
+
+static unsigned long s_eoh(const char *p, const char *end)
+{
+	const char *resume, *eoh;
+
+	eoh = scan_eoh(p, end, &resume);
+	return eoh ? eoh - p : resume - p;
+}
+
+static unsigned long s_hdr_end(const char *p, const char *end)
+{
+	const char *start, *h;
+	unsigned long sum;
+
+	/* stops at the empty line or at the first header without LF */
+	for( start=p,sum=0 ; p<end && *p!='\r' && *p!='\n' ; p=h, sum+=h-start )
+		if ( (h=scan_hdr_end(p, end))==NULL )
+			break;
+	return sum;
+}
+
+static unsigned long s_delim(const char *p, const char *end)
+{
+	const char *start, *d;
+	unsigned long sum;
+
+	/* to the end of the headers, as a header parser would not go further */
+	if ( (d=scan_eoh(p, end, &start))!=NULL )
+		end = d;
+	for( start=p,sum=0 ; (d=scan_delim(p, end))!=NULL ; p=d+1 )
+		sum += d - start;
+	return sum;
+}
+
+static struct {
+	char *name;
+	scan_bench_f *f;
+} scans[] = {
+	{ "eoh",     s_eoh },
+	{ "hdr_end", s_hdr_end },
+	{ "delim",   s_delim },
+};
+
+#define SCANS_NO  (sizeof(scans)/sizeof(scans[0]))
+
+
+static int not_hidden(const struct dirent *de)
+{
+	return de->d_name[0]!='.';
+}
+
+static int load_corpus(char *dir, struct bench_msg *msgs)
+{
+	struct dirent **des;
+	char path[512];
+	FILE *f;
+	int i, n, no;
+
+	if ( (no=scandir(dir, &des, not_hidden, alphasort))<0 ) {
+		perror(dir);
+		return -1;
+	}
+	for( i=0,n=0 ; i<no ; free(des[i]),i++ ) {
+		if (n==MAX_MSGS)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, des[i]->d_name);
+		if ( (f=fopen(path, "r"))==NULL ) {
+			perror(path);
+			continue;
+		}
+		msgs[n].buf = malloc(MAX_MSG_LEN);
+		msgs[n].len = fread(msgs[n].buf, 1, MAX_MSG_LEN, f);
+		fclose(f);
+		msgs[n].name = strdup(des[i]->d_name);
+		n++;
+	}
+	free(des);
+	return n;
+}
+
+
+int main(int argc, char **argv)
+{
+	static struct bench_msg msgs[MAX_MSGS];
+	static unsigned long ref[MAX_MSGS][SCANS_NO];
+	struct scan_funcs *k;
+	volatile unsigned long sink;
+	unsigned long r, sum;
+	struct bench_msg *m;
+	double start, t;
+	int n, i, s, j;
+
+	if (argc>2)
+		rounds = strtoul(argv[2], 0, 10);
+	if ( (n=load_corpus(argc>1 ? argv[1] : "corpus", msgs))<=0 ) {
+		fprintf(stderr, "empty corpus\n");
+		return 1;
+	}
+
+	printf("%-16s %6s  %-8s %-5s %10s %9s\n", "message", "bytes", "scan",
+		"kernel", "ns/msg", "MB/s");
+	for( i=0 ; i<n ; i++ ) {
+		m = &msgs[i];
+		for( s=0 ; s<(int)SCANS_NO ; s++ ) {
+			for( j=0 ; j<(int)(sizeof(kernels)/sizeof(kernels[0])) ; j++ ) {
+				if ( (k=scan_get(kernels[j]))==NULL ) {
+					printf("%-16s %6u  %-8s %-5s %10s %9s\n", m->name, m->len,
+						scans[s].name, kernels[j], "-", "-");
+					continue;
+				}
+				scan_f = *k;
+				sum = scans[s].f(m->buf, m->buf + m->len);
+				if (j==0) {
+					ref[i][s] = sum;
+				} else if (sum!=ref[i][s]) {
+					fprintf(stderr, "%s: %s with %s differs\n", m->name,
+						scans[s].name, k->name);
+					return 1;
+				}
+				start = mock_now();
+				for( r=0,sink=0 ; r<rounds ; r++ )
+					sink += scans[s].f(m->buf, m->buf + m->len);
+				t = mock_now() - start;
+				printf("%-16s %6u  %-8s %-5s %10.1f %9.1f\n", m->name, m->len,
+					scans[s].name, k->name, t*1e9/rounds,
+					(double)m->len*rounds/t/1e6);
+			}
+		}
+	}
+
+	return 0;
+}
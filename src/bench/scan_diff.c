@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Differential test of the scanning kernels (parser/scan.h): each
+ * vectorized variant supported by the CPU must return the same as the
+ * plain C one, for chr, any and skip.
+ *
+ *  - every length from 0 to MAX_LEN (empty, shorter than a vector, the
+ *    tails after one or more vectors) and every start offset inside a
+ *    64 bytes block (the loads are unaligned);
+ *  - the searched char at each position (first, last, at the vector
+ *    boundaries) and missing; for skip, the first other char at each
+ *    position and none;
+ *  - edge bytes: 0, 0x7f, 0x80, 0xff (passed as an int, as the parser
+ *    passes chars), the same char repeated in "any";
+ *  - random buffers over a small alphabet holding the searched chars.
+ *
+ * The data is copied at the very end of a malloc'ed block of its exact
+ * size, so ASan (the Makefile builds it so) catches any read past "end".
+ *
+ *   scan_diff [random_cases] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser/scan.h"
+#include "mock.h"
+
+#define MAX_LEN     160
+#define MAX_OFF     64
+#define MAX_REPORT  10
+
+static char *kernels[] = { "sse2", "avx2" };
+
+static int edge[] = { 0, 0x7f, 0x80, 0xff, '\n', ':' };
+
+/* weighted towards the chars searched by the random cases */
+static char alphabet[] = "\r\n:, \t\r\n:, \tabcXYZ09\x80\xff";
+
+#define pick(_a)  (_a[rand() % (sizeof(_a)/sizeof(_a[0]))])
+
+static struct scan_funcs *ref;
+static unsigned long checks, diffs;
+
+
+static void report(struct scan_funcs *k, char *what, const char *buf,
+							int len, int off, const char *r1, const char *r2)
+{
+	if (diffs++>=MAX_REPORT)
+		return;
+	fprintf(stderr, "%s %s differs: len %d, offset %d -> %ld / %ld\n",
+		k->name, what, len, off, r1 ? (long)(r1-buf) : -1L,
+		r2 ? (long)(r2-buf) : -1L);
+}
+
+/* runs the three kernels on a copy of [data, data+len) ending exactly at
+ * the end of its block */
+static void check(struct scan_funcs *k, const char *data, int len, int off,
+									int c0, int c1, int c2, int c3)
+{
+	const char *r1, *r2, *p, *end;
+	char *blk;
+
+	if ( (blk=malloc(off+len ? off+len : 1))==NULL )
+		return;
+	memcpy(blk+off, data, len);
+	p = blk + off;
+	end = p + len;
+
+	r1 = ref->chr(p, end, c0);
+	r2 = k->chr(p, end, c0);
+	if (r1!=r2)
+		report(k, "chr", p, len, off, r1, r2);
+
+	r1 = ref->any(p, end, c0, c1, c2, c3);
+	r2 = k->any(p, end, c0, c1, c2, c3);
+	if (r1!=r2)
+		report(k, "any", p, len, off, r1, r2);
+
+	r1 = ref->skip(p, end, c0, c1);
+	r2 = k->skip(p, end, c0, c1);
+	if (r1!=r2)
+		report(k, "skip", p, len, off, r1, r2);
+
+	checks += 3;
+	free(blk);
+}
+
+static void check_kernel(struct scan_funcs *k, unsigned long cases)
+{
+	static char buf[MAX_LEN];
+	unsigned long i;
+	int len, off, pos, e, c;
+
+	for( len=0 ; len<=MAX_LEN ; len++ ) {
+		for( off=0 ; off<MAX_OFF ; off++ ) {
+			/* nothing to find (and, for skip, nothing else than c0) */
+			memset(buf, 'a', len);
+			check(k, buf, len, off, 'x', 'a', 'y', 'z');
+			/* a single match / a single other char, at each position */
+			for( pos=0 ; pos<len ; pos++ ) {
+				buf[pos] = 'x';
+				check(k, buf, len, off, 'x', 'a', 'x', 'x');
+				check(k, buf, len, off, 'a', ' ', 'q', 'x');
+				buf[pos] = 'a';
+			}
+		}
+		/* edge bytes - as searched chars and as data */
+		for( e=0 ; e<(int)(sizeof(edge)/sizeof(edge[0])) ; e++ ) {
+			c = edge[e];
+			memset(buf, (char)c, len);
+			check(k, buf, len, 0, c, c, c, c);
+			check(k, buf, len, 1, (char)c, 'a', 'a', 'a');
+			if (len) {
+				buf[len-1] = 'a';
+				check(k, buf, len, 0, 'a', c, 'b', 'c');
+				check(k, buf, len, 3, c, 0, 0, 0);
+			}
+		}
+	}
+
+	for( i=0 ; i<cases ; i++ ) {
+		len = rand() % (MAX_LEN+1);
+		for( pos=0 ; pos<len ; pos++ )
+			buf[pos] = (rand()%16) ? 'a' + rand()%3 : pick(alphabet);
+		check(k, buf, len, rand() % MAX_OFF, pick(alphabet), pick(alphabet),
+			pick(alphabet), pick(alphabet));
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	struct scan_funcs *k;
+	unsigned long cases;
+	int i, tested;
+
+	cases = (argc>1) ? strtoul(argv[1], 0, 10) : 200000;
+	srand( (argc>2) ? atoi(argv[2]) : 1);
+
+	ref = scan_get("c");
+	for( i=0,tested=0 ; i<(int)(sizeof(kernels)/sizeof(kernels[0])) ; i++ ) {
+		if ( (k=scan_get(kernels[i]))==NULL ) {
+			printf("%-5s not supported, skipped\n", kernels[i]);
+			continue;
+		}
+		checks = diffs = 0;
+		check_kernel(k, cases);
+		printf("%-5s %lu checks, %lu different\n", k->name, checks, diffs);
+		if (diffs)
+			return 1;
+		tested++;
+	}
+
+	return tested ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * URI parsing: the table driven parse_uri_fsm() against the original
+ * parse_uri_legacy(), in URIs/sec, for the R-URIs / Contacts / Routes of
+ * typical traffic and for URIs with long user and parameter parts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser/parse_uri.h"
+#include "mock.h"
+
+#define ROUNDS  200000
+
+static char *typical[] = {
+	"sip:alice@example.com",
+	"sip:bob@192.0.2.4:5060",
+	"sip:bob@192.0.2.4:5060;transport=tcp",
+	"sips:carol@[2001:db8::10]:5061;transport=tls",
+	"sip:+14155551234@gw.example.net;user=phone",
+	"sip:p1.example.com;lr",
+	"sip:10.0.0.1:5060;lr;ftag=1928301774;did=a84.b3d1",
+	"sip:alice@10.0.0.1:5060;transport=udp;rinstance=93b3a0f1d9e2c7a4",
+	"sip:voicemail@ms.example.com;method=INVITE",
+	"tel:+1-201-555-0123",
+	"sip:conf-1234@conference.example.com?Subject=weekly",
+	"sip:proxy.example.com;maddr=239.255.255.1;ttl=15",
+};
+
+static char *longs[] = {
+	"sip:B2BUA_ROUTE_0123456789abcdef0123456789abcdef@sbc.example.com",
+	"sip:alice@pc33.example.com;ob;"
+		"gr=urn:uuid:f81d4fae-7dec-11d0-a765-00a0c91e6bf6",
+	"sip:10.0.0.1:5060;lr;ftag=as5f3d9a2c7e1b4d6f8a0c2e4b6d8f0a2c4e;"
+		"nat=yes;vsf=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+	"sip:+14155551234;npdi;rn=+14155550000;cic=+1-0288@"
+		"carrier-gateway-17.interconnect.example.net;user=phone",
+	"sip:sbc-edge-04.region-west.example.com:5060;transport=tcp;lr;"
+		"r2=on;ftag=a1b2c3d4e5f6a7b8c9d0",
+};
+
+#define N(_a)  (sizeof(_a)/sizeof(_a[0]))
+
+typedef int (parse_uri_f)(char*, int, struct sip_uri*);
+
+static double run(parse_uri_f *f, char **uris, int *lens, int n,
+														unsigned long *sum)
+{
+	struct sip_uri uri;
+	double start;
+	int i, j;
+
+	start = mock_now();
+	for( i=0 ; i<ROUNDS ; i++ )
+		for( j=0 ; j<n ; j++ ) {
+			f(uris[j], lens[j], &uri);
+			*sum += uri.host.len + uri.params.len;
+		}
+	return (double)ROUNDS*n / (mock_now() - start);
+}
+
+static int bench(char *title, char **uris, int n)
+{
+	struct sip_uri u1, u2;
+	unsigned long sum = 0;
+	double r_old, r_new;
+	int lens[16], j;
+
+	for( j=0 ; j<n ; j++ ) {
+		lens[j] = strlen(uris[j]);
+		if (parse_uri_legacy(uris[j], lens[j], &u1)<0 ||
+		parse_uri_fsm(uris[j], lens[j], &u2)<0 ||
+		/* both zero the whole structure first */
+		memcmp(&u1, &u2, sizeof(u1))) {
+			fprintf(stderr, "bad or different result for <%s>\n", uris[j]);
+			return -1;
+		}
+	}
+
+	r_old = run(parse_uri_legacy, uris, lens, n, &sum);
+	r_new = run(parse_uri_fsm, uris, lens, n, &sum);
+	printf("  %-8s legacy %6.2f Muris/sec, table driven %6.2f Muris/sec"
+		" (x%.2f)\n", title, r_old/1e6, r_new/1e6, r_new/r_old);
+	return sum==0;
+}
+
+
+int main(int argc, char **argv)
+{
+	printf("uris: %d typical, %d long, %d rounds\n", (int)N(typical),
+		(int)N(longs), ROUNDS);
+	if (bench("typical", typical, N(typical))!=0 ||
+	bench("long", longs, N(longs))!=0)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Differential test of the URI parsers: parse_uri_fsm() must return the
+ * same as parse_uri_legacy() and, on success, fill the sip_uri the same
+ * way. The URIs are generated from pieces of real ones (all the known
+ * params, ipv6 hosts, user=phone, headers ...) and then mutated (chars
+ * replaced, inserted or deleted, mostly with delimiters), plus random
+ * strings over the URI delimiters.
+ *
+ *   uri_diff [cases] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser/parse_uri.h"
+#include "mock.h"
+
+#define MAX_URI  512
+#define MAX_REPORT  10
+
+static char *schemes[] = { "sip:", "sips:", "tel:", "SIP:", "SiPs:", "TEL:",
+	"sipx:", "sips" };
+static char *users[] = { "alice", "+14155551234", "bob.smith", "a;b",
+	"x?y", "user;tag", "%40esc", "b2bua_0123456789abcdef0123456789abcdef",
+	"1", "", "a=b", "a&b", "u[1]" };
+static char *passwords[] = { "secret", "5060", "", "p@ss", "12ab", "x;y",
+	"0" };
+static char *hosts[] = { "example.com", "10.0.0.1", "[2001:db8::1]",
+	"[::1", "host-1.example.net", "a", "h&x", "]h", "192.0.2.4", "" };
+static char *ports[] = { "5060", "5061", "0", "65535", "99999", "50a", "" };
+static char *params[] = { "transport=udp", "transport=TCP", "Transport=tls",
+	"transport=sctp", "transport=xyz", "transport=", "transport",
+	"transport=udpx", "transport=ud", "transport=u:dp", "lr", "LR", "lr=on",
+	"lr=", "lrx", "l", "ttl=5", "ttl=", "TTL=255", "user=phone",
+	"user=PHONE", "user=ip", "user=", "method=INVITE", "method=",
+	"maddr=239.255.255.1", "maddr=", "maddr", "r2=on", "r2", "ob",
+	"gr=urn:uuid:f81d4fae-7dec-11d0-a765-00a0c91e6bf6", "x=y=z", "=v",
+	"ftag=1928301774", "did=a84.b3d1", "rinstance=93b3a0f1d9e2c7a4",
+	"phone-context=example.com", "tr@nsport=udp", "" };
+static char *headers[] = { "Subject=hi", "Priority=urgent&To=x",
+	"a;b", "h=v:w", "x?y", "" };
+
+/* weighted towards the delimiters */
+static char alphabet[] = "@:;?[]&=@:;?=0123456789aAlLrRtTuUsScCpPdDx.-+%\"<> \t\r\n";
+
+#define pick(_a)  (_a[rand() % (sizeof(_a)/sizeof(_a[0]))])
+
+static int gen(char *b)
+{
+	int n, i, len;
+	char *p;
+
+	p = b;
+	p += sprintf(p, "%s", pick(schemes));
+	if (rand()%4)
+		p += sprintf(p, "%s%s%s@", pick(users), (rand()%4)?"":":",
+			(rand()%4)?"":pick(passwords));
+	p += sprintf(p, "%s", pick(hosts));
+	if (rand()%3==0)
+		p += sprintf(p, ":%s", pick(ports));
+	for( n=rand()%4 ; n ; n-- )
+		p += sprintf(p, ";%s", pick(params));
+	if (rand()%5==0)
+		p += sprintf(p, "?%s", pick(headers));
+	len = p - b;
+
+	/* mutations */
+	for( n=rand()%4 ; n && len ; n-- ) {
+		i = rand() % len;
+		switch (rand()%3) {
+			case 0:
+				b[i] = alphabet[rand() % (sizeof(alphabet)-1)];
+				break;
+			case 1:
+				if (len+1>=MAX_URI) break;
+				memmove(b+i+1, b+i, len-i);
+				b[i] = alphabet[rand() % (sizeof(alphabet)-1)];
+				len++;
+				break;
+			case 2:
+				memmove(b+i, b+i+1, len-i-1);
+				len--;
+				break;
+		}
+	}
+	return len;
+}
+
+static int gen_random(char *b)
+{
+	int i, len;
+
+	memcpy(b, (rand()%2)?"sip:":"sips:", 5);
+	len = 4 + (b[3]=='s') + rand() % 40;
+	for( i=4+(b[3]=='s') ; i<len ; i++ )
+		b[i] = (rand()%8) ? alphabet[rand() % 8] : (char)rand();
+	return len;
+}
+
+
+/* same position in the buffer and length; strings not in the buffer
+ * (the "" host of the tel uris) are only compared by length */
+static int str_eq(str *a, str *b, char *buf)
+{
+	if (a->len!=b->len)
+		return 0;
+	if (a->s==b->s)
+		return 1;
+	return (a->s<buf || a->s>=buf+MAX_URI) && (b->s<buf || b->s>=buf+MAX_URI);
+}
+
+#define URI_STRS(_u) { &(_u)->user, &(_u)->passwd, &(_u)->host, &(_u)->port, \
+	&(_u)->params, &(_u)->headers, &(_u)->transport, &(_u)->ttl, \
+	&(_u)->user_param, &(_u)->maddr, &(_u)->method, &(_u)->lr, &(_u)->r2, \
+	&(_u)->transport_val, &(_u)->ttl_val, &(_u)->user_param_val, \
+	&(_u)->maddr_val, &(_u)->method_val, &(_u)->lr_val, &(_u)->r2_val }
+
+static char *str_names[] = { "user", "passwd", "host", "port", "params",
+	"headers", "transport", "ttl", "user_param", "maddr", "method", "lr",
+	"r2", "transport_val", "ttl_val", "user_param_val", "maddr_val",
+	"method_val", "lr_val", "r2_val" };
+
+/* name of the first different field or NULL */
+static char* uri_diff(struct sip_uri *u1, struct sip_uri *u2, char *buf)
+{
+	str *s1[] = URI_STRS(u1);
+	str *s2[] = URI_STRS(u2);
+	int i;
+
+	if (u1->type!=u2->type)
+		return "type";
+	if (u1->port_no!=u2->port_no)
+		return "port_no";
+	if (u1->proto!=u2->proto)
+		return "proto";
+	for( i=0 ; i<sizeof(s1)/sizeof(s1[0]) ; i++ )
+		if (!str_eq(s1[i], s2[i], buf))
+			return str_names[i];
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	static char buf[MAX_URI];
+	struct sip_uri u1, u2;
+	unsigned long cases, i, ok, diffs;
+	int len, r1, r2;
+	char *field;
+
+	cases = (argc>1) ? strtoul(argv[1], 0, 10) : 2000000;
+	srand( (argc>2) ? atoi(argv[2]) : 1);
+	/* the parse errors are expected, do not print them */
+	debug = L_ALERT - 1;
+
+	for( i=0,ok=0,diffs=0 ; i<cases ; i++ ) {
+		memset(buf, 0, MAX_URI);
+		len = (i%8==7) ? gen_random(buf) : gen(buf);
+
+		r1 = parse_uri_legacy(buf, len, &u1);
+		r2 = parse_uri_fsm(buf, len, &u2);
+		field = 0;
+		if (r1!=r2)
+			field = "return code";
+		else if (r1==0)
+			field = uri_diff(&u1, &u2, buf);
+		else if (u1.type!=u2.type)
+			field = "type";
+		if (field) {
+			if (diffs++<MAX_REPORT)
+				fprintf(stderr, "different %s for <%.*s> (%d/%d)\n",
+					field, len, buf, r1, r2);
+		} else if (r1==0) {
+			ok++;
+		}
+	}
+
+	printf("uris: %lu (%lu parsed, %lu errors), different: %lu\n",
+		cases, ok, cases-ok-diffs, diffs);
+	return diffs!=0;
+}
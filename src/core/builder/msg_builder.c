@@ -22,23 +22,46 @@
  * history:
  * ---------
  *  2010-11-xx  created (vlad)
+ *  2010-09-xx  added headers/bodies allocated from the message arena
+ *  2010-09-xx  construct_msg_iov() - scatter-gather version of construct_msg
+ *  2010-09-xx  added/removed headers kept in sync with the header index
  */
 
 #include "msg_builder.h"
 #include "../parser/parse_hname2.h"
 
+
+/* grows a header body allocated via msg_arena_malloc(), keeping the first
+ * "len" bytes; arena chunks cannot grow, so they are moved */
+static inline char* hdr_body_realloc(struct sip_msg *msg, char *body,
+													int len, int size)
+{
+	char *p;
+
+	if (!msg_arena_owns(body))
+		return shm_realloc( body, size);
+	p = msg_arena_malloc( msg, size);
+	if (p)
+		memcpy( p, body, len);
+	return p;
+}
+
 struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
 		hdr_types_t type,struct hdr_field* after,int flags)
 {
 	struct hdr_field *new,*itr;
+	struct msg_arena *bk;
 	int size_mem;
 	int name_pos = 0;
+	int ret;
 
 #define link_sibling_hdr(_hook, _hdr) \
 	do{ \
 		if (msg->_hook==0) msg->_hook=_hdr;\
 			else {\
-				for(itr=msg->_hook;itr->next_sibling;itr=itr->next_sibling);\
+				itr = hdr_idx_last_hf(&msg->hidx, _hdr->type);\
+				if (itr==NULL) itr = msg->_hook;\
+				for( ; itr->next_sibling ; itr=itr->next_sibling);\
 				itr->next_sibling = _hdr;\
 				_hdr->prev_sibling = itr; \
 			}\
@@ -50,6 +73,15 @@ struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
 		return 0;
 	}
 
+	/* room in the header index */
+	if (hdr_idx_full(&msg->hidx)) {
+		msg_arena_enter( msg, bk);
+		ret = hdr_idx_grow(&msg->hidx);
+		msg_arena_leave( bk);
+		if (ret<0)
+			return 0;
+	}
+
 	size_mem = sizeof(struct hdr_field);
 
 	if (flags & HDR_DUP_NAME)
@@ -58,7 +90,7 @@ struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
 		size_mem += name->len;
 	}
 
-	new = shm_malloc(size_mem);
+	new = msg_arena_malloc(msg, size_mem);
 
 	if (new == 0)
 	{
@@ -77,7 +109,7 @@ struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
 		if (name == 0 || name->s == 0)
 		{
 			LM_ERR("HDR_DUP_NAME sent, but null string provided \n");
-			shm_free(new);
+			msg_arena_free(new);
 			return 0;
 		}
 		else
@@ -91,11 +123,11 @@ struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
 
 	if (flags & HDR_DUP_BODY)
 	{
-		new->body.s = shm_malloc(body->len);
+		new->body.s = msg_arena_malloc(msg, body->len);
 		if (new->body.s == 0)
 		{
 			LM_ERR("no more memory !\n");
-			shm_free(new);
+			msg_arena_free(new);
 			return 0;
 		}
 		/* forced to set free flag */
@@ -232,10 +264,12 @@ struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
 		case HDR_ERROR_T:
 		default:
 			LM_ERR("bad header type %d\n", type);
-			shm_free(new);
+			msg_arena_free(new);
 			return 0;
 		}
 
+	hdr_idx_add(&msg->hidx, new, NULL);
+
 	if (after == NULL)
 	{
 		/* add to head of list */
@@ -310,10 +344,10 @@ int rm_hdr(struct sip_msg *msg,struct hdr_field *removed)
 	}
 
 	if (removed->flags & HDR_FREE_NAME)
-		shm_free(removed->name.s);
+		msg_arena_free(removed->name.s);
 
 	if (removed->flags & HDR_FREE_BODY)
-		shm_free(removed->body.s);
+		msg_arena_free(removed->body.s);
 
 	if (removed->flags & HDR_NOT_ORIG_MSG)
 	/* 2 extra bytes for ": " between name and body,
@@ -323,6 +357,7 @@ int rm_hdr(struct sip_msg *msg,struct hdr_field *removed)
 		msg->new_len -= removed->len;
 
 	clean_hdr_field(removed);
+	hdr_idx_rm(&msg->hidx, removed);
 
 	if (removed == msg->headers)
 	{
@@ -462,7 +497,7 @@ int rm_hdr(struct sip_msg *msg,struct hdr_field *removed)
 			LM_ERR("Unexpected header type %d\n",removed->type);
 	}
 
-	shm_free(removed);
+	msg_arena_free(removed);
 	return 0;
 }
 
@@ -497,7 +532,7 @@ int replace_hdr(struct sip_msg *msg,struct hdr_field *hdr,str *body)
 		/* explicitly added headers */
 		if (hdr->body_buff_size < body->len)
 		{
-			hdr->body.s = shm_realloc(hdr->body.s,body->len);
+			hdr->body.s = hdr_body_realloc(msg,hdr->body.s,0,body->len);
 			if (hdr->body.s == 0)
 			{
 				LM_ERR("no more memory !\n");
@@ -513,7 +548,7 @@ int replace_hdr(struct sip_msg *msg,struct hdr_field *hdr,str *body)
 		/* header from the initial message, or static buffer. 
 		 * either way, allocate new chunk of mem */
 allocate:
-		hdr->body.s = shm_malloc(body->len);
+		hdr->body.s = msg_arena_malloc(msg, body->len);
 		if (hdr->body.s == 0)
 		{
 			LM_ERR("no more memory !\n");
@@ -579,7 +614,8 @@ int alter_hdr(struct sip_msg *msg, struct hdr_field *hdr, int offset, int len,
 		{
 			hdr->body_buff_size = new_buf_size;
 
-			*hdr_body = shm_realloc(*hdr_body,hdr->body_buff_size);
+			*hdr_body = hdr_body_realloc(msg, *hdr_body, *hdr_body_len,
+				hdr->body_buff_size);
 			if (*hdr_body == 0)
 			{
 				LM_ERR("no more memory !\n");
@@ -603,7 +639,7 @@ allocate:
 		/* also make sure to allocate 2 extra bytes for \r\n
 		 * which will otherwise be lost */
 		hdr->body_buff_size = *hdr_body_len + new_body_length - len + 2;
-		*hdr_body = shm_malloc(hdr->body_buff_size);
+		*hdr_body = msg_arena_malloc(msg, hdr->body_buff_size);
 		if (*hdr_body == 0)
 		{
 			LM_ERR("no more memory \n");
@@ -737,3 +773,109 @@ copy_body:
 }
 
 
+#define iov_add(_base, _len) \
+	do { \
+		if ((_len)>0) { \
+			iov[n].iov_base = (void*)(_base); \
+			iov[n].iov_len = (_len); \
+			*len += (_len); \
+			n++; \
+		} \
+	}while(0)
+
+/* same as construct_msg(), but instead of building a new buffer, returns
+ * the list of segments (pointing into msg->buf and into the added/altered
+ * headers) forming the new message; the vector is allocated from the
+ * message arena (use msg_arena_free() on it) and it is valid as long as
+ * the message is not changed or freed */
+struct iovec *construct_msg_iov(struct sip_msg *msg, int *iovcnt, int *len)
+{
+	static char hdr_sep[2] = {':',' '};
+	struct hdr_field *itr;
+	struct iovec *iov;
+	char *run_start, *run_end, *p;
+	int n, size;
+
+	if (msg == 0)
+	{
+		LM_ERR("null pointer provided to construct_msg_iov\n");
+		return 0;
+	}
+
+	/* count the segments: first line (3 if the URI is changed), the runs
+	 * of adjacent original headers, 3 per added header and the body */
+	n = msg->new_uri.s ? 4 : 2;
+	run_end = NULL;
+	for (itr=msg->headers;itr;itr=itr->next)
+	{
+		if (itr->flags & HDR_NOT_ORIG_MSG) {
+			n += 3;
+			run_end = NULL;
+		} else {
+			if (itr->name.s!=run_end)
+				n++;
+			run_end = itr->name.s + itr->len;
+		}
+	}
+
+	iov = (struct iovec*)msg_arena_malloc(msg, n*sizeof(struct iovec));
+	if (iov == 0)
+	{
+		LM_ERR("no more memory for %d segments\n", n);
+		return 0;
+	}
+
+	n = 0;
+	*len = 0;
+
+	/* first line */
+	if (msg->new_uri.s)
+	{
+		p = msg->first_line.u.request.uri.s;
+		size = p - msg->buf;
+		iov_add( msg->buf, size);
+		iov_add( msg->new_uri.s, msg->new_uri.len);
+		p += msg->first_line.u.request.uri.len;
+		iov_add( p, msg->first_line.len - (p - msg->buf));
+	}
+	else
+	{
+		iov_add( msg->buf, msg->first_line.len);
+	}
+
+	/* headers - the original ones are referred in place, in runs as
+	 * long as possible (a removed header breaks the run) */
+	run_start = run_end = NULL;
+	for (itr=msg->headers;itr;itr=itr->next)
+	{
+		if (!(itr->flags & HDR_NOT_ORIG_MSG))
+		{
+			if (itr->name.s!=run_end) {
+				iov_add( run_start, run_end-run_start);
+				run_start = itr->name.s;
+			}
+			run_end = itr->name.s + itr->len;
+			continue;
+		}
+
+		/* header that has been newly added or altered 
+		 * name and body are separate buffers */
+		iov_add( run_start, run_end-run_start);
+		run_start = run_end = NULL;
+
+		iov_add( itr->name.s, itr->name.len);
+		iov_add( hdr_sep, 2);
+		iov_add( itr->body.s, itr->body.len);
+	}
+	iov_add( run_start, run_end-run_start);
+
+	/* body */
+	iov_add( msg->unparsed, (msg->buf + msg->len) - msg->unparsed);
+
+	*iovcnt = n;
+	return iov;
+}
+
+#undef iov_add
+
+
@@ -28,6 +28,7 @@
 #ifndef _CORE_BUILDER_MSG_BUILDER_H
 #define _CORE_BUILDER_MSG_BUILDER_H
 
+#include <sys/uio.h>
 #include "../parser/msg_parser.h"
 
 struct hdr_field* add_hdr(struct sip_msg *msg,str *name,str *body,
@@ -43,5 +44,7 @@ int alter_hdr(struct sip_msg *msg, struct hdr_field *hdr, int offset, int len,
 
 char *construct_msg(struct sip_msg *msg, int *len);
 
+struct iovec *construct_msg_iov(struct sip_msg *msg, int *iovcnt, int *len);
+
 #endif
 
@@ -22,6 +22,8 @@
  * history:
  * ---------
  *  2010-12-xx  created (bogdan)
+ *  2010-09-xx  VIA buffer allocated from the message arena
+ *  2010-09-xx  Via headers looked up via the header index
  */
 
 
@@ -48,18 +50,20 @@
 static inline str* get_sl_branch(struct sip_msg* msg)
 {
 	static str default_branch = str_init("0");
-	struct hdr_field *h_via;
 	struct via_body  *b_via;
+	unsigned short i;
 	str *branch;
 	int via_parsed;
 
 	via_parsed = 0;
 	branch = 0;
 
-	/* first VIA header must be parsed */
-	for( h_via=msg->h_via ; h_via ; h_via=h_via->next_sibling ) {
+	/* first VIA header must be parsed; walk by position, as parsing more
+	 * headers may move the index entries */
+	for( i=hdr_idx_first(&msg->hidx, HDR_VIA_T) ; i ;
+	i=hdr_idx_next(&msg->hidx, i) ) {
 
-		b_via = (struct via_body*)h_via->parsed;
+		b_via = (struct via_body*)hdr_idx_at(&msg->hidx, i)->hf->parsed;
 		for( ; b_via ; b_via=b_via->next ) {
 			/* check if there is any valid branch param */
 			if (b_via->branch==0 || b_via->branch->value.s==0
@@ -111,9 +115,9 @@ int via_builder( struct sip_msg *msg, struct socket_info* send_sock, str *via)
 		+ 1 /*':'*/ + send_sock->port_str.len
 		+ VIA_BRANCH_PARAM_LEN + branch->len + CRLF_LEN;
 
-	via->s = shm_malloc( via->len );
+	via->s = msg_arena_malloc( msg, via->len );
 	if (via->s==NULL) {
-		LM_ERR("out of shm memory\n");
+		LM_ERR("out of memory\n");
 		return -1;
 	}
 
@@ -21,6 +21,7 @@
  * history:
  * ---------
  *  2010-06-xx  created (adragus)
+ *  2010-09-xx  results refused by the dispatcher unpacked by the db thread
  */
 
 #include "db_core.h"
@@ -153,7 +154,7 @@ int continue_query(void *param)
 		goto end;
 
 	sock = funcs->socket(item->connection);
-	submit_task(reactor_in, continue_query, q, TASK_PRIO_READ_IO, sock, 0);
+	submit_task(in_reactor(sock), continue_query, q, TASK_PRIO_READ_IO, sock, 0);
 
 	return 0;
 
@@ -204,7 +205,7 @@ blocking:
 		if (ret >= 0)
 		{
 			sock = funcs->socket(item->connection);
-			submit_task(reactor_in, continue_query, q, TASK_PRIO_READ_IO, sock, 0);
+			submit_task(in_reactor(sock), continue_query, q, TASK_PRIO_READ_IO, sock, 0);
 		}
 	}
 
@@ -282,8 +283,14 @@ void * work(void * arg)
 		/* send the query */
 		send_query(q);
 
-		/* put the result through the dispatcher */
-		put_task_simple(reactor_in->disp, TASK_PRIO_RESUME_EXEC, unpack_result, q);
+		/* put the result through the dispatcher; if refused, it is
+		 * unpacked here, as for the blocking modules */
+		if (put_task_simple(reactor_in->disp, TASK_PRIO_RESUME_EXEC,
+		unpack_result, q) < 0)
+		{
+			LM_WARN("dispatcher refused the result, unpacking it here\n");
+			unpack_result(q);
+		}
 
 		/* if the query was not a SELECT, resubmit the connection into the pool*/
 		if (q->type != OP_RAW && q->type != OP_QUERY)
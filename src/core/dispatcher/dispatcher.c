@@ -21,27 +21,151 @@
  * history:
  * ---------
  *  2010-03-xx  created (adragus)
+ *  2010-09-xx  bounded queue with overload detection and admission
+ *              control per priority class
+ *  2010-09-xx  no spinning in the work stealing put_task
+ *  2010-09-xx  back-off instead of spinning when the queue is full;
+ *              put_task_force and put_task_simple return errors
+ *  2010-09-xx  overload ended by the admitter if drained meanwhile
  */
 
 
 
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
 #include "../mem/mem.h"
 #include "../mem/shm_mem.h"
 #include "../locking/locking.h"
+#include "../locking/atomic_ops.h"
+#include "../threading.h"
 #include "dispatcher.h"
+#include "steal.h"
+
+int dispatcher_type = DISPATCHER_HEAP;
+
+/* max number of queued tasks */
+int dispatcher_size = MAX_TASKS;
+/* overload starts/ends at these fill levels (percents of the size) */
+int dispatcher_high_wm = 80;
+int dispatcher_low_wm = 60;
+
+/* overload policies, per class (see task_prio_class) - timer tasks are
+ * periodic so they may be dropped; resumed contexts must complete;
+ * new incoming work is refused */
+static int dispatcher_policy[TASK_PRIO_CLASSES] = {
+	DISP_POLICY_DROP, DISP_POLICY_WAIT, DISP_POLICY_WAIT, DISP_POLICY_REJECT
+};
+
+char *disp_class_names[TASK_PRIO_CLASSES] = {
+	"timer", "resume_exec", "resume_io", "read_io"
+};
+
+char *disp_policy_names[] = {
+	"wait", "drop", "reject"
+};
+
+/* set for the threads running get_task */
+static declare_tsd( disp_worker );
+
+
+int set_dispatcher_type(char *s)
+{
+	if (strcasecmp(s,"heap")==0) {
+		dispatcher_type = DISPATCHER_HEAP;
+	} else if (strcasecmp(s,"steal")==0) {
+		dispatcher_type = DISPATCHER_STEAL;
+	} else {
+		LM_ERR("invalid dispatcher type <%s> - allowed: heap, steal\n", s);
+		return -1;
+	}
+
+	return 0;
+}
+
 
-/* probably implemented as a heap */
-dispatcher_t* new_dispatcher(void)
+int set_dispatcher_policy(char *s)
 {
-	dispatcher_t* ret = shm_malloc(sizeof (*ret));
+	char *p;
+	int c, i;
 
+	p = strchr(s, ':');
+	if (p == NULL)
+		goto error;
+
+	for (c = 0; c < TASK_PRIO_CLASSES; c++)
+		if (strlen(disp_class_names[c]) == p - s &&
+		strncasecmp(s, disp_class_names[c], p - s) == 0)
+			break;
+	if (c == TASK_PRIO_CLASSES)
+		goto error;
+
+	p++;
+	for (i = DISP_POLICY_WAIT; i <= DISP_POLICY_REJECT; i++)
+		if (strcasecmp(p, disp_policy_names[i]) == 0)
+			break;
+	if (i > DISP_POLICY_REJECT)
+		goto error;
+
+	/* the resumed contexts are in-flight work, they cannot be lost */
+	if (c == task_prio_class(TASK_PRIO_RESUME_EXEC) ||
+	c == task_prio_class(TASK_PRIO_RESUME_IO))
+	{
+		if (i != DISP_POLICY_WAIT)
+		{
+			LM_ERR("class <%s> accepts only the <wait> policy\n",
+				disp_class_names[c]);
+			return -1;
+		}
+	}
+
+	dispatcher_policy[c] = i;
+	return 0;
+error:
+	LM_ERR("invalid dispatcher policy <%s> - expected class:policy, with "
+		"class: timer, resume_exec, resume_io, read_io and "
+		"policy: wait, drop, reject\n", s);
+	return -1;
+}
+
+
+dispatcher_t* new_dispatcher(int workers_no)
+{
+	dispatcher_t* ret;
+
+	if (dispatcher_size <= 0 || dispatcher_low_wm <= 0 ||
+	dispatcher_low_wm >= dispatcher_high_wm || dispatcher_high_wm > 100)
+	{
+		LM_ERR("invalid dispatcher size %d / watermarks %d%%-%d%%\n",
+			dispatcher_size, dispatcher_low_wm, dispatcher_high_wm);
+		return NULL;
+	}
+
+	ret = shm_malloc(sizeof (*ret));
 	if (ret == NULL)
 	{
 		LM_ERR("Allocating dispatcher\n");
 		return NULL;
 	}
+	memset(ret, 0, sizeof (*ret));
 
+	ret->type = dispatcher_type;
 	ret->size = 0;
+	ret->ws = NULL;
+
+	ret->capacity = dispatcher_size;
+	/* the non-worker threads queue only in the injection rings */
+	if (ret->type == DISPATCHER_STEAL && ret->capacity > WS_INJECT_SIZE)
+	{
+		LM_WARN("dispatcher size %d above the work stealing limit, "
+			"using %d\n", ret->capacity, WS_INJECT_SIZE);
+		ret->capacity = WS_INJECT_SIZE;
+	}
+	ret->high_wm = (ret->capacity * dispatcher_high_wm) / 100;
+	ret->low_wm = (ret->capacity * dispatcher_low_wm) / 100;
+	memcpy(ret->policy, dispatcher_policy, sizeof(dispatcher_policy));
+
 	ret->lock = lock_alloc();
 
 	if (ret->lock == NULL)
@@ -54,19 +178,180 @@ dispatcher_t* new_dispatcher(void)
 
 	sem_init(&ret->sem, 0, 0);
 
+	if (ret->type == DISPATCHER_STEAL)
+	{
+		ret->ws = ws_new(workers_no);
+		if (ret->ws == NULL)
+		{
+			LM_ERR("Allocating work stealing scheduler\n");
+			return NULL;
+		}
+	} else
+	{
+		ret->nodes = shm_malloc(ret->capacity * sizeof(heap_node_t));
+		if (ret->nodes == NULL)
+		{
+			LM_ERR("Allocating heap for %d tasks\n", ret->capacity);
+			return NULL;
+		}
+	}
+
+	LM_INFO("using %s dispatcher, size %d (overload %d-%d)\n",
+		(ret->type == DISPATCHER_STEAL) ? "work stealing" : "heap",
+		ret->capacity, ret->low_wm, ret->high_wm);
+
 	return ret;
 }
 
 void destroy_dispatcher(dispatcher_t* disp)
 {
+	struct disp_deferred *dd;
+
+	while ((dd = disp->deferred) != NULL)
+	{
+		disp->deferred = dd->next;
+		shm_free(dd);
+	}
+	if (disp->ws)
+		ws_destroy(disp->ws);
+	if (disp->nodes)
+		shm_free(disp->nodes);
 	lock_destroy(disp->lock);
 	lock_dealloc(disp->lock);
 	sem_destroy(&disp->sem);
 	shm_free(disp);
 }
 
-/* will be called by the reactor thread and timer thread*/
-void put_task(dispatcher_t* d, heap_node_t n)
+/* back-off of the threads waiting for the workers to make room: sleeps
+ * doubling from DISP_WAIT_MIN up to DISP_WAIT_MAX microseconds */
+#define DISP_WAIT_MIN    1
+#define DISP_WAIT_MAX    1000
+/* ring of the work stealing scheduler still full after so many sleeps
+ * (about 100ms) - the task is refused */
+#define WS_PUT_WAITS     100
+
+static inline void disp_backoff(unsigned int *delay)
+{
+	usleep(*delay);
+	if (*delay < DISP_WAIT_MAX)
+		*delay = (*delay * 2 > DISP_WAIT_MAX) ? DISP_WAIT_MAX : *delay * 2;
+}
+
+/* work stealing flavour of put_task; the capacity of the dispatcher is
+ * not above the size of an injection ring (see new_dispatcher), so the
+ * ring of an admitted task is full only while a worker which took a cell
+ * a whole lap ago (and was preempted) did not release it yet */
+static inline int ws_put_task(dispatcher_t* d, heap_node_t *n)
+{
+	unsigned int delay;
+	int pclass, waits;
+
+	pclass = task_prio_class(n->priority);
+
+	delay = DISP_WAIT_MIN;
+	for (waits = 0; ws_put(d->ws, n, pclass) < 0; waits++)
+	{
+		if (waits == WS_PUT_WAITS)
+		{
+			LM_ERR("no room for the task (class %s, %d queued)\n",
+				disp_class_names[pclass], atomic_get(&d->queued));
+			atomic_dec(&d->queued);
+			return -1;
+		}
+		disp_backoff(&delay);
+	}
+
+	/* wake up a worker only if someone may be sleeping */
+	membar_full();
+	if (atomic_get(&d->ws->idle) > 0)
+		sem_post(&d->sem);
+
+	return 0;
+}
+
+/* work stealing flavour of get_task */
+static inline void ws_get_task(dispatcher_t* d, heap_node_t *n)
+{
+	while (ws_get(d->ws, n) < 0)
+	{
+		/* announce we are going to sleep, then check again
+		 * so that a task pushed in the meantime is not lost */
+		atomic_inc(&d->ws->idle);
+		membar_full();
+		if (ws_get(d->ws, n) == 0)
+		{
+			atomic_dec(&d->ws->idle);
+			return;
+		}
+		sem_wait(&d->sem);
+		atomic_dec(&d->ws->idle);
+	}
+}
+
+static void dispatcher_release(dispatcher_t* d);
+
+/* reserves a place in the queue for a task of class pclass
+ * Returns: 0 - reserved ; 1 - task must be dropped ; -1 - task rejected ;
+ *          2 - queue full, the calling worker must run the task itself */
+static inline int admit_task(dispatcher_t* d, int pclass, int force)
+{
+	unsigned int delay;
+	int size;
+
+	delay = DISP_WAIT_MIN;
+
+	for (;;)
+	{
+		size = atomic_get(&d->queued);
+
+		if (size >= d->high_wm)
+		{
+			if (!atomic_get(&d->overloaded) && atomic_cas(&d->overloaded, 0, 1))
+			{
+				atomic_inc(&d->stats.overloads);
+				LM_WARN("dispatcher overloaded (%d queued tasks)\n", size);
+				/* the workers may have drained the queue meanwhile - none
+				 * of them would see the flag and end the overload */
+				if (atomic_get(&d->queued) <= d->low_wm)
+					dispatcher_release(d);
+			}
+			if (!force)
+			{
+				if (d->policy[pclass] == DISP_POLICY_DROP)
+				{
+					atomic_inc(&d->stats.dropped[pclass]);
+					return 1;
+				}
+				if (d->policy[pclass] == DISP_POLICY_REJECT)
+				{
+					atomic_inc(&d->stats.rejected[pclass]);
+					return -1;
+				}
+			}
+		}
+
+		if (size >= d->capacity)
+		{
+			/* a worker waiting here may wait for itself */
+			if (get_tsd(disp_worker))
+				return 2;
+			disp_backoff(&delay);
+			continue;
+		}
+
+		if (atomic_cas(&d->queued, size, size + 1))
+			break;
+	}
+
+	if (size + 1 > d->stats.max_size)
+		d->stats.max_size = size + 1;
+	atomic_inc(&d->stats.queued[pclass]);
+
+	return 0;
+}
+
+/* heap flavour of put_task */
+static inline void heap_put_task(dispatcher_t* d, heap_node_t n)
 {
 
 	heap_node_t *nodes, tmp;
@@ -104,8 +389,103 @@ void put_task(dispatcher_t* d, heap_node_t n)
 
 }
 
-/* will be called by the worker threads */
-void get_task(dispatcher_t* d, heap_node_t * n)
+static inline int do_put_task(dispatcher_t* d, heap_node_t *n, int force)
+{
+	int ret;
+
+	ret = admit_task(d, task_prio_class(n->priority), force);
+	if (ret == 1)
+		return 0;
+	if (ret < 0)
+		return -1;
+	if (ret == 2)
+	{
+		run_task(n);
+		return 0;
+	}
+
+	if (d->type == DISPATCHER_STEAL)
+		return ws_put_task(d, n);
+
+	heap_put_task(d, *n);
+	return 0;
+}
+
+/* will be called by the reactor thread and timer thread*/
+int put_task(dispatcher_t* d, heap_node_t n)
+{
+	return do_put_task(d, &n, 0);
+}
+
+int put_task_force(dispatcher_t* d, heap_node_t n)
+{
+	return do_put_task(d, &n, 1);
+}
+
+/* ends the overload: the parked tasks are queued again */
+static void dispatcher_release(dispatcher_t* d)
+{
+	struct disp_deferred *dd, *next;
+	int n;
+
+	lock_get(d->lock);
+	if (!d->overloaded)
+	{
+		lock_release(d->lock);
+		return;
+	}
+	atomic_set(&d->overloaded, 0);
+	dd = d->deferred;
+	n = d->deferred_no;
+	d->deferred = NULL;
+	d->deferred_no = 0;
+	lock_release(d->lock);
+
+	LM_DBG("dispatcher overload is over, releasing %d tasks\n", n);
+
+	for (; dd; dd = next)
+	{
+		next = dd->next;
+		put_task_force(d, dd->task);
+		shm_free(dd);
+	}
+}
+
+int dispatcher_defer(dispatcher_t* d, heap_node_t n)
+{
+	struct disp_deferred *dd;
+
+	dd = shm_malloc(sizeof(*dd));
+	if (dd == NULL)
+	{
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	dd->task = n;
+
+	lock_get(d->lock);
+	if (!d->overloaded)
+	{
+		lock_release(d->lock);
+		shm_free(dd);
+		put_task_force(d, n);
+		return 0;
+	}
+	dd->next = d->deferred;
+	d->deferred = dd;
+	d->deferred_no++;
+	d->stats.deferred++;
+	lock_release(d->lock);
+
+	/* drained meanwhile, after the last check of the workers ? */
+	if (atomic_get(&d->queued) <= d->low_wm)
+		dispatcher_release(d);
+
+	return 0;
+}
+
+/* heap flavour of get_task */
+static inline void heap_get_task(dispatcher_t* d, heap_node_t * n)
 {
 
 	int cur, size, maxi, maxval, son1, son2;
@@ -161,7 +541,25 @@ void get_task(dispatcher_t* d, heap_node_t * n)
 }
 
 
-void inline put_task_simple(dispatcher_t* d, int priority,
+/* will be called by the worker threads */
+void get_task(dispatcher_t* d, heap_node_t * n)
+{
+	int queued;
+
+	set_tsd(disp_worker, 1);
+
+	if (d->type == DISPATCHER_STEAL)
+		ws_get_task(d, n);
+	else
+		heap_get_task(d, n);
+
+	queued = atomic_dec(&d->queued);
+	if (atomic_get(&d->overloaded) && queued <= d->low_wm)
+		dispatcher_release(d);
+}
+
+
+int put_task_simple(dispatcher_t* d, int priority,
 		fd_callback *cb, void* cb_param)
 {
 	heap_node_t task;
@@ -174,6 +572,6 @@ void inline put_task_simple(dispatcher_t* d, int priority,
 	task.cb = (fd_callback*) cb;
 	task.cb_param = (void*) cb_param;
 
-	put_task(d, task);
+	return put_task(d, task);
 }
 
@@ -21,11 +21,15 @@
  * history:
  * ---------
  *  2010-03-xx  created (adragus)
+ *  2010-09-xx  bounded queue with overload detection and admission
+ *              control per priority class
+ *  2010-09-xx  put_task_force and put_task_simple return errors
  */
 
 
 #include "../reactor/fd_map.h"
 #include "../locking/locking.h"
+#include "../locking/atomic_ops.h"
 #include <semaphore.h>
 
 
@@ -38,30 +42,124 @@
 #define TASK_PRIO_RESUME_IO     2
 #define TASK_PRIO_RESUME_EXEC   3
 
+/* priority classes used by the work stealing scheduler; tasks with higher
+ * priority than TASK_PRIO_RESUME_EXEC (like the timer ones) go first */
+#define TASK_PRIO_CLASSES       4
+
+#define task_prio_class(_prio) \
+	(((_prio)>TASK_PRIO_RESUME_EXEC) ? 0 : \
+	 ((_prio)==TASK_PRIO_RESUME_EXEC) ? 1 : \
+	 ((_prio)==TASK_PRIO_RESUME_IO) ? 2 : 3 )
+
+/* types of dispatchers */
+#define DISPATCHER_HEAP    0   /* single locked heap */
+#define DISPATCHER_STEAL   1   /* per worker queues with work stealing */
+
+/* what to do with a task when the dispatcher is overloaded */
+#define DISP_POLICY_WAIT     0  /* queue it; if full, wait for room */
+#define DISP_POLICY_DROP     1  /* discard it - for tasks owning no data */
+#define DISP_POLICY_REJECT   2  /* refuse it - the producer gets it back */
+
 typedef struct fd_map heap_node_t;
 
+struct ws_sched;
+
+/* task waiting for the overload to be over */
+struct disp_deferred
+{
+	heap_node_t task;
+	struct disp_deferred *next;
+};
+
+struct disp_stats
+{
+	unsigned long queued[TASK_PRIO_CLASSES];
+	unsigned long dropped[TASK_PRIO_CLASSES];
+	unsigned long rejected[TASK_PRIO_CLASSES];
+	unsigned long deferred;
+	unsigned long overloads;
+	int max_size;
+};
+
 typedef struct _dispacther
 {
+	int type;
 	gen_lock_t* lock;
 	sem_t sem;
+	/* heap - only for DISPATCHER_HEAP */
 	int size;
-	heap_node_t nodes[MAX_TASKS];
+	heap_node_t *nodes;
+	/* work stealing scheduler, only for DISPATCHER_STEAL */
+	struct ws_sched *ws;
+
+	/* admission control */
+	int capacity;
+	int high_wm;
+	int low_wm;
+	int policy[TASK_PRIO_CLASSES];
+	volatile int queued;
+	volatile int overloaded;
+	/* tasks parked until the overload is over (under lock) */
+	struct disp_deferred *deferred;
+	int deferred_no;
+
+	struct disp_stats stats;
 
 }dispatcher_t;
 
-/* probably implemented as a heap */
-dispatcher_t* new_dispatcher();
+extern int dispatcher_type;
+extern int dispatcher_size;
+extern int dispatcher_high_wm;
+extern int dispatcher_low_wm;
+
+extern char *disp_class_names[TASK_PRIO_CLASSES];
+extern char *disp_policy_names[];
+
+/* sets the dispatcher type - used from cfg */
+int set_dispatcher_type(char *s);
+
+/* sets the overload policy of a class, as "class:policy" - used from cfg */
+int set_dispatcher_policy(char *s);
+
+/* workers_no is the number of worker threads which will call get_task */
+dispatcher_t* new_dispatcher(int workers_no);
 
 void destroy_dispatcher(dispatcher_t* disp);
 
-/* will be called by the reactor thread and timer thread*/
-void put_task(dispatcher_t* d, heap_node_t n);
+/* will be called by the reactor thread and timer thread;
+ * the task is subject to the overload policy of its class.
+ * Returns 0 if queued (or dropped), -1 if rejected */
+int put_task(dispatcher_t* d, heap_node_t n);
+
+/* same as put_task, but the task is queued no matter the overload;
+ * used for fd events (the fd is out of the reactor).
+ * Returns 0 if queued (or run by the calling worker), -1 on error */
+int put_task_force(dispatcher_t* d, heap_node_t n);
+
+/* parks the task until the dispatcher is no longer overloaded;
+ * the task is queued right away if there is no overload */
+int dispatcher_defer(dispatcher_t* d, heap_node_t n);
+
+/* true if the high watermark was reached and the low one not yet */
+#define dispatcher_overloaded(_d)  atomic_get(&(_d)->overloaded)
 
 /* will be called by the worker threads */
 void get_task(dispatcher_t* d, heap_node_t *n);
 
-void inline put_task_simple(dispatcher_t* d, int priority,
+/* put_task for a plain callback; returns as put_task */
+int put_task_simple(dispatcher_t* d, int priority,
 		fd_callback *cb, void* cb_param);
 
+static inline void run_task(heap_node_t *task)
+{
+	if (task->flags & CALLBACK_COMPLEX_F)
+	{
+		fd_callback_complex * f = (fd_callback_complex *) task->cb;
+		f(task->last_reactor, task->fd, task->cb_param);
+	} else
+	{
+		task->cb(task->cb_param);
+	}
+}
 
 #endif
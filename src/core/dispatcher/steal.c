@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  bounded number of steal retries
+ */
+
+#include <string.h>
+
+#include "../mem/mem.h"
+#include "../mem/shm_mem.h"
+#include "../locking/atomic_ops.h"
+#include "../threading.h"
+#include "steal.h"
+
+#define WS_LOCAL_MASK   (WS_LOCAL_SIZE-1)
+#define WS_INJECT_MASK  (WS_INJECT_SIZE-1)
+
+/* passes over the victims when the steals keep losing races; a lost race
+ * means some other thread got the task, so giving up loses nothing */
+#define WS_STEAL_RETRIES  4
+
+struct ws_worker {
+	struct ws_deque q[TASK_PRIO_CLASSES];
+	/* seed for choosing the victim when stealing */
+	unsigned int seed;
+};
+
+/* slot of the current thread in the scheduler:
+ *   0 - not looked up yet ; -1 - no slot (not a worker) ; >0 - slot+1 */
+static declare_tsd( ws_slot );
+
+
+
+/*************************** local deque ******************************/
+
+/* owner only */
+static inline int deque_push(struct ws_deque *q, heap_node_t *n)
+{
+	long b, t;
+
+	b = q->bottom;
+	t = atomic_get(&q->top);
+	if (b - t >= WS_LOCAL_SIZE)
+		return -1;
+
+	q->nodes[b & WS_LOCAL_MASK] = *n;
+	/* node must be visible before the new bottom */
+	membar_full();
+	atomic_set(&q->bottom, b+1);
+
+	return 0;
+}
+
+/* owner only */
+static inline int deque_pop(struct ws_deque *q, heap_node_t *n)
+{
+	long b, t;
+	int ret;
+
+	b = q->bottom - 1;
+	atomic_set(&q->bottom, b);
+	membar_full();
+	t = atomic_get(&q->top);
+
+	if (t > b) {
+		/* empty */
+		atomic_set(&q->bottom, b+1);
+		return -1;
+	}
+
+	*n = q->nodes[b & WS_LOCAL_MASK];
+	if (t != b)
+		return 0;
+
+	/* last element - race against the thieves */
+	ret = atomic_cas(&q->top, t, t+1) ? 0 : -1;
+	atomic_set(&q->bottom, b+1);
+	return ret;
+}
+
+/* any thread
+ * Returns: 0 - got a node ; -1 - empty ; 1 - lost a race, retry */
+static inline int deque_steal(struct ws_deque *q, heap_node_t *n)
+{
+	heap_node_t tmp;
+	long b, t;
+
+	t = atomic_get(&q->top);
+	membar_full();
+	b = atomic_get(&q->bottom);
+
+	if (t >= b)
+		return -1;
+
+	tmp = q->nodes[t & WS_LOCAL_MASK];
+	if (!atomic_cas(&q->top, t, t+1))
+		return 1;
+
+	*n = tmp;
+	return 0;
+}
+
+
+
+/*************************** injection ring ***************************/
+
+static inline void ring_init(struct ws_ring *r)
+{
+	unsigned long i;
+
+	r->head = r->tail = 0;
+	for( i=0 ; i<WS_INJECT_SIZE ; i++ )
+		r->cells[i].seq = i;
+}
+
+static inline int ring_push(struct ws_ring *r, heap_node_t *n)
+{
+	struct ws_cell *cell;
+	unsigned long pos;
+	long dif;
+
+	pos = atomic_get(&r->tail);
+	for(;;) {
+		cell = &r->cells[pos & WS_INJECT_MASK];
+		dif = (long)atomic_get(&cell->seq) - (long)pos;
+		if (dif==0) {
+			if (atomic_cas(&r->tail, pos, pos+1))
+				break;
+		} else if (dif<0) {
+			/* full */
+			return -1;
+		}
+		pos = atomic_get(&r->tail);
+	}
+
+	cell->node = *n;
+	membar_full();
+	atomic_set(&cell->seq, pos+1);
+
+	return 0;
+}
+
+static inline int ring_pop(struct ws_ring *r, heap_node_t *n)
+{
+	struct ws_cell *cell;
+	unsigned long pos;
+	long dif;
+
+	pos = atomic_get(&r->head);
+	for(;;) {
+		cell = &r->cells[pos & WS_INJECT_MASK];
+		dif = (long)atomic_get(&cell->seq) - (long)(pos+1);
+		if (dif==0) {
+			if (atomic_cas(&r->head, pos, pos+1))
+				break;
+		} else if (dif<0) {
+			/* empty */
+			return -1;
+		}
+		pos = atomic_get(&r->head);
+	}
+
+	*n = cell->node;
+	membar_full();
+	atomic_set(&cell->seq, pos+WS_INJECT_SIZE);
+
+	return 0;
+}
+
+
+
+/***************************** scheduler ******************************/
+
+struct ws_sched* ws_new(int workers_no)
+{
+	struct ws_sched *ws;
+	int i, c;
+
+	if (workers_no<=0) {
+		LM_ERR("invalid number of workers %d\n", workers_no);
+		return NULL;
+	}
+
+	ws = (struct ws_sched*)shm_malloc( sizeof(struct ws_sched) );
+	if (ws==NULL) {
+		LM_ERR("no more shm memory\n");
+		return NULL;
+	}
+	memset( ws, 0, sizeof(struct ws_sched));
+
+	ws->workers = (struct ws_worker*)shm_malloc
+		( workers_no*sizeof(struct ws_worker) );
+	if (ws->workers==NULL) {
+		LM_ERR("no more shm memory for %d workers\n", workers_no);
+		shm_free(ws);
+		return NULL;
+	}
+	ws->workers_no = workers_no;
+
+	for( i=0 ; i<workers_no ; i++ ) {
+		for( c=0 ; c<TASK_PRIO_CLASSES ; c++ )
+			ws->workers[i].q[c].top = ws->workers[i].q[c].bottom = 0;
+		ws->workers[i].seed = i + 1;
+	}
+
+	for( c=0 ; c<TASK_PRIO_CLASSES ; c++ )
+		ring_init( &ws->inject[c] );
+
+	LM_DBG("work stealing scheduler with %d workers created\n", workers_no);
+
+	return ws;
+}
+
+
+void ws_destroy(struct ws_sched *ws)
+{
+	shm_free(ws->workers);
+	shm_free(ws);
+}
+
+
+static inline struct ws_worker* ws_get_self(struct ws_sched *ws)
+{
+	long slot;
+
+	slot = get_tsd( ws_slot );
+	if (slot>0)
+		return &ws->workers[slot-1];
+	return NULL;
+}
+
+
+/* takes a worker slot for the calling thread (first get_task) */
+static inline struct ws_worker* ws_register_self(struct ws_sched *ws)
+{
+	long slot;
+
+	slot = atomic_inc( &ws->registered );
+	if (slot>ws->workers_no) {
+		LM_WARN("more workers than slots (%d), thread will run without"
+			" local queues\n", ws->workers_no);
+		set_tsd( ws_slot, -1);
+		return NULL;
+	}
+	set_tsd( ws_slot, slot);
+	return &ws->workers[slot-1];
+}
+
+
+int ws_put(struct ws_sched *ws, heap_node_t *n, int pclass)
+{
+	struct ws_worker *self;
+
+	/* a worker keeps the tasks it generates in its own deque */
+	if ( (self=ws_get_self(ws))!=NULL && deque_push(&self->q[pclass],n)==0)
+		return 0;
+
+	return ring_push( &ws->inject[pclass], n);
+}
+
+
+static inline int ws_steal(struct ws_sched *ws, struct ws_worker *self,
+													heap_node_t *n, int pclass)
+{
+	unsigned int start;
+	int i, retry, tries, ret;
+
+	if (self) {
+		self->seed = self->seed*1103515245 + 12345;
+		start = (self->seed>>16) % ws->workers_no;
+	} else {
+		start = 0;
+	}
+
+	tries = 0;
+	do {
+		retry = 0;
+		for( i=0 ; i<ws->workers_no ; i++ ) {
+			struct ws_worker *victim;
+
+			victim = &ws->workers[(start+i) % ws->workers_no];
+			if (victim==self)
+				continue;
+			ret = deque_steal( &victim->q[pclass], n);
+			if (ret==0)
+				return 0;
+			if (ret==1)
+				retry = 1;
+		}
+	} while(retry && ++tries<WS_STEAL_RETRIES);
+
+	return -1;
+}
+
+
+int ws_get(struct ws_sched *ws, heap_node_t *n)
+{
+	struct ws_worker *self;
+	int c;
+
+	if ( (self=ws_get_self(ws))==NULL && get_tsd(ws_slot)==0 )
+		self = ws_register_self(ws);
+
+	for( c=0 ; c<TASK_PRIO_CLASSES ; c++ ) {
+		if (self && deque_pop( &self->q[c], n)==0)
+			return 0;
+		if (ring_pop( &ws->inject[c], n)==0)
+			return 0;
+		if (ws_steal( ws, self, n, c)==0)
+			return 0;
+	}
+
+	return -1;
+}
+
+
+int ws_size(struct ws_sched *ws)
+{
+	long size;
+	int i, c;
+
+	size = 0;
+	for( c=0 ; c<TASK_PRIO_CLASSES ; c++ ) {
+		size += atomic_get(&ws->inject[c].tail) -
+			atomic_get(&ws->inject[c].head);
+		for( i=0 ; i<ws->workers_no ; i++ )
+			size += atomic_get(&ws->workers[i].q[c].bottom) -
+				atomic_get(&ws->workers[i].q[c].top);
+	}
+
+	return (size<0) ? 0 : (int)size;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Work-stealing scheduler for the dispatcher:
+ *  - each worker owns one deque per priority class; the owner pushes and
+ *    pops at the bottom, the other workers steal from the top;
+ *  - threads which are not workers (reactors, timer) push into a
+ *    lock-free injection ring (one per priority class);
+ *  - priority classes are served in order, there is no ordering inside
+ *    a class.
+ */
+
+#ifndef _CORE_DISPATCHER_STEAL_H
+#define _CORE_DISPATCHER_STEAL_H
+
+#include "dispatcher.h"
+
+/* size (power of 2) of the local deque of a worker, per class */
+#define WS_LOCAL_SIZE    (1<<10)
+/* size (power of 2) of the injection ring, per class */
+#define WS_INJECT_SIZE   (1<<12)
+
+#define WS_CACHE_LINE    64
+
+/* Chase-Lev deque - single owner, multiple thieves */
+struct ws_deque {
+	volatile long top;
+	char _pad1[WS_CACHE_LINE - sizeof(long)];
+	volatile long bottom;
+	char _pad2[WS_CACHE_LINE - sizeof(long)];
+	struct fd_map nodes[WS_LOCAL_SIZE];
+};
+
+/* bounded multi-producer / multi-consumer ring */
+struct ws_cell {
+	volatile unsigned long seq;
+	struct fd_map node;
+};
+
+struct ws_ring {
+	volatile unsigned long head;
+	char _pad1[WS_CACHE_LINE - sizeof(long)];
+	volatile unsigned long tail;
+	char _pad2[WS_CACHE_LINE - sizeof(long)];
+	struct ws_cell cells[WS_INJECT_SIZE];
+};
+
+struct ws_worker;
+
+struct ws_sched {
+	/* number of worker slots */
+	int workers_no;
+	/* how many workers took a slot so far */
+	volatile int registered;
+	/* how many workers are (about to be) blocked in sem_wait */
+	volatile int idle;
+	struct ws_worker *workers;
+	struct ws_ring inject[TASK_PRIO_CLASSES];
+};
+
+
+struct ws_sched* ws_new(int workers_no);
+
+void ws_destroy(struct ws_sched *ws);
+
+/* returns 0 on success, -1 if the task could not be queued */
+int ws_put(struct ws_sched *ws, heap_node_t *n, int pclass);
+
+/* returns 0 if a task was fetched, -1 if all queues are empty */
+int ws_get(struct ws_sched *ws, heap_node_t *n);
+
+/* number of queued tasks (approximate) */
+int ws_size(struct ws_sched *ws);
+
+#endif
@@ -31,6 +31,8 @@
 
 extern int dns_try_ipv6;
 
+/* the first IN and OUT reactors - to be used only for their (shared)
+ * dispatcher; the ops on fds go to in_reactor(fd) / out_reactor(fd) */
 extern reactor_t *reactor_in;
 extern reactor_t *reactor_out;
 
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*!
+ * \file
+ * \brief OpenSIPS atomic operations
+ *
+ * Thin wrappers over the compiler atomic builtins, to be used for
+ * the lock-free structures (counters, queues) shared between threads.
+ *
+ * - atomic_get(p)            - reads *p (no reordering by compiler)
+ * - atomic_set(p,v)          - writes v in *p (no reordering by compiler)
+ * - atomic_add(p,v)          - adds v to *p and returns the new value
+ * - atomic_inc(p)/dec(p)     - +1/-1 over *p and returns the new value
+ * - atomic_cas(p,old,new)    - sets *p to new only if *p is old;
+ *                              returns true on success
+ * - membar_full()            - full memory barrier
+ */
+
+#ifndef _atomic_ops_h
+#define _atomic_ops_h
+
+#define atomic_get(_p)       (*(volatile __typeof__(*(_p)) *)(_p))
+
+#define atomic_set(_p,_v) \
+	do { \
+		*(volatile __typeof__(*(_p)) *)(_p) = (_v); \
+	}while(0)
+
+#define atomic_add(_p,_v)    __sync_add_and_fetch((_p),(_v))
+
+#define atomic_inc(_p)       __sync_add_and_fetch((_p),1)
+
+#define atomic_dec(_p)       __sync_sub_and_fetch((_p),1)
+
+#define atomic_cas(_p,_old,_new) \
+	__sync_bool_compare_and_swap((_p),(_old),(_new))
+
+#define membar_full()        __sync_synchronize()
+
+/* compiler only barrier */
+#define membar_compiler()    __asm__ __volatile__("" : : : "memory")
+
+#endif
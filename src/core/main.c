@@ -45,6 +45,7 @@
 #include "daemonize.h"
 #include "threading.h"
 #include "timer.h"
+#include "timer_wheel.h"
 #include "config.h"
 #include "modules.h"
 #include "mem/mem.h"
@@ -54,7 +55,10 @@
 #include "reactor/reactor.h"
 #include "parser/msg_parser.h"
 #include "parser/parse_content.h"
+#include "parser/scan.h"
+#include "parser/parse_hname2.h"
 #include "resolve/resolve.h"
+#include "resolve/dns_cache.h"
 #include "db/db_to_user.h"
 #include "msg_handler.h"
 #include "mi/mi_core.h"
@@ -77,6 +81,9 @@ static unsigned long shmem_size = SHM_MEM_SIZE;
 /* name of the core config file */
 static char *cfg_file = CFG_FILE;
 
+/* reactors serving the listener shards (see listen_shards) */
+static reactor_t **shard_reactors = NULL;
+
 
 /**************************  GLOBAL VARIABLES *****************************/
 
@@ -128,6 +135,11 @@ static char *pgid_file = NULL;
 static config_param_t core_params[] = {
 	{"daemon",       &become_daemon,    PARAM_TYPE_INT,        0},
 	{"children",     &children,         PARAM_TYPE_INT,        0},
+	{"dispatcher",   set_dispatcher_type, PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
+	{"dispatcher_size",    &dispatcher_size,    PARAM_TYPE_INT,  0},
+	{"dispatcher_high_wm", &dispatcher_high_wm, PARAM_TYPE_INT,  0},
+	{"dispatcher_low_wm",  &dispatcher_low_wm,  PARAM_TYPE_INT,  0},
+	{"dispatcher_policy",  set_dispatcher_policy, PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
 	{"working_dir",  &working_dir,      PARAM_TYPE_STRING,     0},
 	{"chroot_dir",   &chroot_dir,       PARAM_TYPE_STRING,     0},
 	{"user",         &sys_user,         PARAM_TYPE_STRING,     0},
@@ -135,6 +147,13 @@ static config_param_t core_params[] = {
 	{"do_coredump",  &do_coredump,      PARAM_TYPE_INT,        0},
 	{"rt_coredump",  &rt_coredump,      PARAM_TYPE_INT,        0},
 	{"open_files",   &open_files_limit, PARAM_TYPE_INT,        0},
+	{"reactor_max_fds",  &reactor_max_fds,  PARAM_TYPE_INT,    0},
+	{"reactor_ev_batch", &reactor_ev_batch, PARAM_TYPE_INT,    0},
+	{"reactors_in",      &reactors_in,      PARAM_TYPE_INT,    0},
+	{"reactors_out",     &reactors_out,     PARAM_TYPE_INT,    0},
+	{"reactor_policy",   set_reactor_policy, PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
+	{"reactor_inline_budget", &reactor_inline_budget, PARAM_TYPE_INT, 0},
+	{"header_name",  add_hdr_name,      PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
 	{"pid_file",     &pid_file,         PARAM_TYPE_STRING,     0},
 	{"pgid_file",    &pgid_file,        PARAM_TYPE_STRING,     0},
 	{0, 0, 0, 0}
@@ -163,6 +182,9 @@ static param_section_t log_section = {
 static config_param_t net_params[] = {
 	{"listen",         register_listener, PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
 	{"dns_try_ipv6",   &dns_try_ipv6,     PARAM_TYPE_INT, 0},
+	{"dns_cache_size", &dns_cache_size,   PARAM_TYPE_INT, 0},
+	{"dns_neg_ttl",    &dns_neg_ttl,      PARAM_TYPE_INT, 0},
+	{"dns_max_ttl",    &dns_max_ttl,      PARAM_TYPE_INT, 0},
 	{"net_tos",        set_net_tos,       PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
 	#ifdef USE_MCAST
 	{"mcast_ttl",      &mcast_ttl,        PARAM_TYPE_INT, 0},
@@ -170,12 +192,18 @@ static config_param_t net_params[] = {
 	#endif
 	{"udp_maxbuffer",  &udp_maxbuffer,    PARAM_TYPE_INT, 0},
 	{"udp_min_size",   &udp_min_size,     PARAM_TYPE_INT, 0},
+	{"udp_batch_size", &udp_batch_size,   PARAM_TYPE_INT, 0},
+	{"listen_shards",     &listen_shards,     PARAM_TYPE_INT, 0},
+	{"listen_shards_pin", &listen_shards_pin, PARAM_TYPE_INT, 0},
 	{"tcp_max_size",   &tcp_max_size,     PARAM_TYPE_INT, 0},
 	{"tcp_via_alias",  &tcp_via_alias,    PARAM_TYPE_INT, 0},
 	{"tcp_lifetime",   &tcp_lifetime,     PARAM_TYPE_INT, 0},
 	{"tcp_write_timeout",     &tcp_write_timeout,      PARAM_TYPE_INT, 0},
 	{"tcp_vconnect_timeout",  &tcp_connect_timeout,    PARAM_TYPE_INT, 0},
 	{"tcp_max_connections",   &tcp_max_connections,    PARAM_TYPE_INT, 0},
+	{"tcp_pool_size",  &tcp_pool_size,    PARAM_TYPE_INT, 0},
+	{"tcp_pool_policy", set_tcp_pool_policy, PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
+	{"tcp_pool_peer",  add_tcp_pool_peer, PARAM_TYPE_STRING|PARAM_TYPE_FUNC,0},
 	{0, 0, 0, 0}
 };
 
@@ -220,14 +248,7 @@ static void* worker_thread(void *dispatcher)
 		get_task((dispatcher_t*) dispatcher, &task);
 
 		/* run the task */
-		if (task.flags & CALLBACK_COMPLEX_F)
-		{
-			fd_callback_complex * f = (fd_callback_complex *) task.cb;
-			f(task.last_reactor, task.fd, task.cb_param);
-		} else
-		{
-			task.cb(task.cb_param);
-		}
+		run_task(&task);
 	}
 	return NULL;
 }
@@ -235,19 +256,27 @@ static void* worker_thread(void *dispatcher)
 
 static void do_shutdown(void)
 {
+	int c;
+
 	/* all threads are stoped at this point -> destroy everything */
 
 	/* destroy the reactors & dispatchers */
-	if (reactor_in) {
-		if (reactor_in->disp)
-			destroy_dispatcher(reactor_in->disp);
-		destroy_reactor(reactor_in);
+	if (reactor_in && reactor_in->disp)
+		destroy_dispatcher(reactor_in->disp);
+	destroy_reactors();
+	if (shard_reactors) {
+		for (c = 0; c < listen_shards; c++)
+			if (shard_reactors[c])
+				destroy_reactor(shard_reactors[c]);
+		shm_free(shard_reactors);
 	}
-	if (reactor_out)
-		destroy_reactor(reactor_out);
 
 	/* destroy timer */
 	destroy_timer();
+	destroy_timer_wheel();
+
+	/* destroy the protos first, they may keep data in the listeners */
+	destroy_protos();
 
 	/* destroy all listeners */
 	destroy_all_listeners();
@@ -256,7 +285,6 @@ static void do_shutdown(void)
 
 	db_core_destroy();
 
-	destroy_protos();
 	destroy_all_core_module();
 	shm_status();
 	/* done */
@@ -277,6 +305,7 @@ int main(int argc, char** argv)
 	char *tmp;
 	int cfg_log_syslog = log_syslog;
 	int c;
+	long cpus;
 	FILE *cfg_stream;
 	dispatcher_t * dispatcher;
 
@@ -371,6 +400,9 @@ int main(int argc, char** argv)
 
 	init_random();
 
+	/* pick the parser scanning kernels for this CPU */
+	scan_init();
+
 
 	/***************** LOAD CONFIG FILE ********************/
 	global_append_section( &core_section );
@@ -455,6 +487,12 @@ int main(int argc, char** argv)
 	LM_INFO("using %ld Mb shared memory\n", shmem_size);
 
 
+	/* init the wheel for the per object timers (used by the network) */
+	if (init_timer_wheel()<0) {
+		LM_ERR("failed to init the timer wheel\n");
+		goto error0;
+	}
+
 	/*************** INIT NETWORK LISTNERS ******************/
 
 	/* initialize the holders for known protocols */
@@ -483,24 +521,37 @@ int main(int argc, char** argv)
 
 	/***************** REACTOR INIT ********************/
 
-	dispatcher = new_dispatcher();
+	dispatcher = new_dispatcher(children);
 
 	if( dispatcher == NULL ){
 		LM_ERR("failed to create dispatcher\n");
 		goto error0;
 	}
 
-	/* create reactor */
-	reactor_in = new_reactor(REACTOR_IN, dispatcher);
-	if (reactor_in == NULL) {
-		LM_ERR("failed to create in reactor\n");
+	/* create the reactors (sets reactor_in and reactor_out) */
+	if (init_reactors(dispatcher) < 0) {
+		LM_ERR("failed to create reactors\n");
 		goto error0;
 	}
 
-	reactor_out = new_reactor(REACTOR_OUT, dispatcher);
-	if (reactor_out == NULL) {
-		LM_ERR("failed to create out reactor\n");
-		goto error0;
+	/* one reactor per listener shard */
+	if (listen_shards > 1) {
+		shard_reactors = shm_malloc(listen_shards * sizeof(reactor_t*));
+		if (shard_reactors == NULL) {
+			LM_ERR("no more shm memory\n");
+			goto error0;
+		}
+		memset(shard_reactors, 0, listen_shards * sizeof(reactor_t*));
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		for (c = 0; c < listen_shards; c++) {
+			shard_reactors[c] = new_reactor(REACTOR_IN, dispatcher);
+			if (shard_reactors[c] == NULL) {
+				LM_ERR("failed to create reactor for shard %d\n", c);
+				goto error0;
+			}
+			if (listen_shards_pin && cpus > 0)
+				shard_reactors[c]->cpu = c % cpus;
+		}
 	}
 
 	/* init DNS resolver */
@@ -538,16 +589,18 @@ int main(int argc, char** argv)
 	for (c = 0; c < children; c++)
 		pt_create_thread("worker", worker_thread, dispatcher);
 
-	/* Start the reactor in thread */
-	if (reactor_start(reactor_in, "reactor in")<0) {
-		LM_ERR("failed to start reactor\n");
+	/* Start the reactor in and out threads */
+	if (start_reactors()<0) {
+		LM_ERR("failed to start reactors\n");
 		goto error0;
 	}
 
-	/* Start the reactor out thread */
-	if (reactor_start(reactor_out, "reactor out")<0) {
-		LM_ERR("failed to start reactor\n");
-		goto error0;
+	/* Start the reactors of the listener shards */
+	for (c = 0; shard_reactors && c < listen_shards; c++) {
+		if (reactor_start(shard_reactors[c], "reactor shard")<0) {
+			LM_ERR("failed to start reactor for shard %d\n", c);
+			goto error0;
+		}
 	}
 
 	/* start timer thread */
@@ -577,10 +630,14 @@ int main(int argc, char** argv)
 	/* activate network listeners */
 	for( c=PROTO_UDP ; c<PROTO_MAX ; c++ ) {
 		struct socket_info *si;
-		for (si=protos[c].listeners ; si ; si=si->next)
-			submit_task(reactor_in,
+		for (si=protos[c].listeners ; si ; si=si->next) {
+			si->reactor = (si->shards>1) ?
+				shard_reactors[si->shard] : in_reactor(si->socket);
+			submit_task(si->reactor,
 				(fd_callback*)protos[c].funcs.event_handler,
-				(void*)si, TASK_PRIO_READ_IO, si->socket, 0);
+				(void*)si, TASK_PRIO_READ_IO, si->socket,
+				protos[c].funcs.event_flags);
+		}
 	}
 
 	/* simply stay and wait for any signals */
@@ -25,6 +25,7 @@
  *  2003-06-29  added shm_realloc & replaced shm_resize (andrei)
  *  2003-11-19  reverted shm_resize to the old version, using
  *               realloc causes terrible fragmentation  (andrei)
+ *  2010-09-xx  per-thread fragment caches with SHM_TCACHE
  */
 
 
@@ -125,6 +126,11 @@ void shm_mem_destroy();
 #define shm_unlock()  lock_release(mem_lock)
 
 
+#ifdef SHM_TCACHE
+#include "shm_tcache.h"
+#endif
+
+
 #ifdef DBG_QM_MALLOC
 
 #ifdef __SUNPRO_C
@@ -140,7 +146,13 @@ inline static void* _shm_malloc(unsigned int size,
 	const char *file, const char *function, int line )
 {
 	void *p;
-	
+
+#ifdef SHM_TCACHE
+	if ( (p=shm_tcache_get(size))!=NULL )
+		return p;
+	if (size<=TC_MAX_SIZE)
+		return shm_tcache_refill(size, file, function, line);
+#endif
 	shm_lock();
 	p=MY_MALLOC(shm_block, size, file, function, line );
 	shm_unlock();
@@ -169,12 +181,24 @@ inline static void* _shm_realloc(void *ptr, unsigned int size,
 #define shm_free_unsafe( _p  ) \
 	MY_FREE( shm_block, (_p), __FILE__, __FUNCTION__, __LINE__ )
 
+#ifdef SHM_TCACHE
+#define shm_free(_p) \
+do { \
+		void *__shm_p = (void*)(_p); \
+		if (shm_tcache_put(__shm_p)!=0) { \
+			shm_lock(); \
+			shm_free_unsafe( __shm_p); \
+			shm_unlock(); \
+		} \
+}while(0)
+#else
 #define shm_free(_p) \
 do { \
 		shm_lock(); \
 		shm_free_unsafe( (_p)); \
 		shm_unlock(); \
 }while(0)
+#endif
 
 
 
@@ -194,7 +218,13 @@ void* _shm_resize(void* ptr, unsigned int size, const char* f, const char* fn,
 inline static void* shm_malloc(unsigned int size)
 {
 	void *p;
-	
+
+#ifdef SHM_TCACHE
+	if ( (p=shm_tcache_get(size))!=NULL )
+		return p;
+	if (size<=TC_MAX_SIZE)
+		return shm_tcache_refill(size);
+#endif
 	shm_lock();
 	p=shm_malloc_unsafe(size);
 	shm_unlock();
@@ -215,12 +245,24 @@ inline static void* shm_realloc(void *ptr, unsigned int size)
 
 #define shm_free_unsafe( _p ) MY_FREE(shm_block, (_p))
 
+#ifdef SHM_TCACHE
+#define shm_free(_p) \
+do { \
+		void *__shm_p = (void*)(_p); \
+		if (shm_tcache_put(__shm_p)!=0) { \
+			shm_lock(); \
+			shm_free_unsafe( __shm_p ); \
+			shm_unlock(); \
+		} \
+}while(0)
+#else
 #define shm_free(_p) \
 do { \
 		shm_lock(); \
 		shm_free_unsafe( _p ); \
 		shm_unlock(); \
 }while(0)
+#endif
 
 
 
@@ -232,12 +274,22 @@ void* _shm_resize(void* ptr, unsigned int size);
 #endif
 
 
+#ifdef SHM_TCACHE
 #define shm_status() \
 do { \
 		shm_lock(); \
 		MY_STATUS(shm_block); \
+		shm_tcache_status(); \
 		shm_unlock(); \
 }while(0)
+#else
+#define shm_status() \
+do { \
+		shm_lock(); \
+		MY_STATUS(shm_block); \
+		shm_unlock(); \
+}while(0)
+#endif
 
 
 #define shm_info(mi) \
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+
+#include "mem.h"
+
+#if !defined(SYSTEM_MALLOC) && defined(SHM_TCACHE)
+
+#include "shm_mem.h"
+#include "shm_tcache.h"
+
+__thread struct shm_tcache shm_tc;
+
+/* global stats - updated only with mem_lock held */
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long refills;
+	unsigned long flushes;
+	unsigned long puts;
+	unsigned long cached;  /* fragments in all the thread caches */
+} tc_stats;
+
+
+/* adds the local counters of the thread to the global ones
+ * (mem_lock must be held) */
+static inline void tc_report(void)
+{
+	tc_stats.hits += shm_tc.hits;
+	tc_stats.puts += shm_tc.puts;
+	tc_stats.cached += shm_tc.puts;
+	tc_stats.cached -= shm_tc.hits;
+	shm_tc.hits = shm_tc.puts = 0;
+}
+
+
+/* frees "n" fragments from the list of the class (mem_lock must be held) */
+#ifdef DBG_QM_MALLOC
+static inline void tc_flush(struct tc_bin *bin, unsigned int n,
+		const char *file, const char *func, int line)
+#else
+static inline void tc_flush(struct tc_bin *bin, unsigned int n)
+#endif
+{
+	void *p;
+
+	while (n && (p=bin->head)!=NULL) {
+		bin->head = *(void**)p;
+		bin->count--;
+		shm_tc.bytes -= TC_FRAG_SIZE(p);
+		tc_stats.cached--;
+		#ifdef DBG_QM_MALLOC
+		MY_FREE( shm_block, p, file, func, line);
+		#else
+		MY_FREE( shm_block, p);
+		#endif
+		n--;
+	}
+}
+
+
+#ifdef DBG_QM_MALLOC
+void* shm_tcache_refill(unsigned int size,
+		const char *file, const char *func, int line)
+#else
+void* shm_tcache_refill(unsigned int size)
+#endif
+{
+	struct tc_bin *bin;
+	unsigned long csize;
+	unsigned int n, i;
+	void *ret;
+	void *p;
+	int idx;
+
+	idx = tc_class_up(size);
+	bin = &shm_tc.bins[idx];
+	csize = tc_class_size(idx);
+	n = tc_class_batch(idx);
+
+	shm_lock();
+
+	tc_report();
+	tc_stats.misses++;
+	tc_stats.refills++;
+
+	#ifdef DBG_QM_MALLOC
+	ret = MY_MALLOC( shm_block, csize, file, func, line);
+	#else
+	ret = MY_MALLOC( shm_block, csize);
+	#endif
+	if (ret==NULL) {
+		/* maybe the exact size still fits */
+		#ifdef DBG_QM_MALLOC
+		ret = MY_MALLOC( shm_block, size, file, func, line);
+		#else
+		ret = MY_MALLOC( shm_block, size);
+		#endif
+		goto done;
+	}
+
+	/* pre-allocate the rest of the batch (do not go over the hoard limit) */
+	for( i=1 ; i<n && shm_tc.bytes+csize<=TC_MAX_HOARD ; i++ ) {
+		#ifdef DBG_QM_MALLOC
+		p = MY_MALLOC( shm_block, csize, file, func, line);
+		#else
+		p = MY_MALLOC( shm_block, csize);
+		#endif
+		if (p==NULL)
+			break;
+		*(void**)p = bin->head;
+		bin->head = p;
+		bin->count++;
+		shm_tc.bytes += TC_FRAG_SIZE(p);
+		tc_stats.cached++;
+	}
+
+done:
+	shm_unlock();
+	return ret;
+}
+
+
+#ifdef DBG_QM_MALLOC
+void shm_tcache_flush_bin(int idx, const char *file, const char *func,
+																	int line)
+#else
+void shm_tcache_flush_bin(int idx)
+#endif
+{
+	unsigned int n;
+	int i;
+
+	/* keep one batch in the list */
+	n = tc_class_batch(idx);
+	n = (shm_tc.bins[idx].count>n) ? shm_tc.bins[idx].count-n : 0;
+
+	shm_lock();
+
+	tc_report();
+	tc_stats.flushes++;
+
+	#ifdef DBG_QM_MALLOC
+	tc_flush( &shm_tc.bins[idx], n, file, func, line);
+	#else
+	tc_flush( &shm_tc.bins[idx], n);
+	#endif
+
+	/* still hoarding too much -> empty all the lists */
+	if (shm_tc.bytes>TC_MAX_HOARD) {
+		for( i=0 ; i<TC_CLASSES ; i++ ) {
+			#ifdef DBG_QM_MALLOC
+			tc_flush( &shm_tc.bins[i], shm_tc.bins[i].count, file, func,line);
+			#else
+			tc_flush( &shm_tc.bins[i], shm_tc.bins[i].count);
+			#endif
+		}
+	}
+
+	shm_unlock();
+}
+
+
+void shm_tcache_flush_all(void)
+{
+	int i;
+
+	shm_lock();
+
+	tc_report();
+	for( i=0 ; i<TC_CLASSES ; i++ ) {
+		#ifdef DBG_QM_MALLOC
+		tc_flush( &shm_tc.bins[i], shm_tc.bins[i].count,
+			__FILE__, __FUNCTION__, __LINE__);
+		#else
+		tc_flush( &shm_tc.bins[i], shm_tc.bins[i].count);
+		#endif
+	}
+
+	shm_unlock();
+}
+
+
+void shm_tcache_status(void)
+{
+	unsigned long total;
+
+	/* count also what the calling thread did not report yet */
+	tc_report();
+
+	total = tc_stats.hits + tc_stats.misses;
+	LM_GEN1(memdump, "thread caches (%d classes, up to %d bytes):\n",
+		TC_CLASSES, TC_MAX_SIZE);
+	LM_GEN1(memdump, " hits= %lu, misses= %lu, hit ratio= %lu%%\n",
+		tc_stats.hits, tc_stats.misses,
+		total ? (tc_stats.hits*100/total) : 0);
+	LM_GEN1(memdump, " refills= %lu, flushes= %lu, frees into cache= %lu\n",
+		tc_stats.refills, tc_stats.flushes, tc_stats.puts);
+	LM_GEN1(memdump, " cached fragments= %lu (approx)\n", tc_stats.cached);
+}
+
+#endif /* SHM_TCACHE */
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Per-thread cache of shm fragments (compiled in with -DSHM_TCACHE).
+ *
+ * Each thread keeps, per size class, a list of fragments already
+ * allocated from the shm pool. shm_malloc() is served from the list of
+ * its class without taking mem_lock; when the list is empty it is
+ * refilled with a batch of fragments under a single lock. shm_free()
+ * puts the fragment back in the list of its class (by the real size of
+ * the fragment, as found in its header); when a list grows over its
+ * limit or the thread hoards too much memory, a batch is flushed back to
+ * the pool, again under a single lock.
+ *
+ * The fragments kept in the caches are seen as used by the back end
+ * allocator (q_malloc/f_malloc).
+ */
+
+#ifndef _shm_tcache_h
+#define _shm_tcache_h
+
+#ifdef SHM_TCACHE
+
+#ifdef VQ_MALLOC
+#	error "SHM_TCACHE is not supported with VQ_MALLOC"
+#endif
+
+#ifdef F_MALLOC
+#	include "f_malloc.h"
+#	define TC_FRAG_SIZE(_p) \
+		(((struct fm_frag*)((char*)(_p)-sizeof(struct fm_frag)))->size)
+#else
+#	include "q_malloc.h"
+#	define TC_FRAG_SIZE(_p) \
+		(((struct qm_frag*)((char*)(_p)-sizeof(struct qm_frag)))->size)
+#endif
+
+/* size classes: 16 bytes steps up to 128, then 4 classes per power of 2,
+ * up to TC_MAX_SIZE; bigger requests go directly to the pool */
+#define TC_SMALL_CLASSES  8
+#define TC_SMALL_MAX      128
+#define TC_MAX_SIZE       4096
+#define TC_CLASSES        28
+
+/* how many bytes are moved to/from the pool in a batch */
+#ifndef TC_BATCH_BYTES
+#define TC_BATCH_BYTES    4096
+#endif
+#define TC_BATCH_MIN      2
+#define TC_BATCH_MAX      32
+
+/* max number of bytes a thread may keep in all its lists */
+#ifndef TC_MAX_HOARD
+#define TC_MAX_HOARD      (256*1024)
+#endif
+
+
+struct tc_bin {
+	void *head;
+	unsigned int count;
+};
+
+struct shm_tcache {
+	struct tc_bin bins[TC_CLASSES];
+	/* bytes kept in all the lists */
+	unsigned long bytes;
+	/* not yet reported to the global stats */
+	unsigned long hits;
+	unsigned long puts;
+};
+
+extern __thread struct shm_tcache shm_tc;
+
+
+#define tc_log2(_x) \
+	((int)(sizeof(unsigned long)*8-1) - __builtin_clzl((unsigned long)(_x)))
+
+/* smallest class able to hold "size" bytes (size<=TC_MAX_SIZE) */
+static inline int tc_class_up(unsigned long size)
+{
+	int b;
+
+	if (size<=TC_SMALL_MAX)
+		return (size==0) ? 0 : ((size+15)>>4) - 1;
+	b = tc_log2(size-1);
+	return TC_SMALL_CLASSES + (b-7)*4 + (int)((size-1)>>(b-2)) - 4;
+}
+
+/* size of the fragments in a class */
+static inline unsigned long tc_class_size(int idx)
+{
+	if (idx<TC_SMALL_CLASSES)
+		return (idx+1)<<4;
+	idx -= TC_SMALL_CLASSES;
+	return ((unsigned long)(4 + idx%4 + 1)) << (idx/4 + 5);
+}
+
+static inline unsigned int tc_class_batch(int idx)
+{
+	unsigned long n;
+
+	n = TC_BATCH_BYTES / tc_class_size(idx);
+	if (n<TC_BATCH_MIN) return TC_BATCH_MIN;
+	if (n>TC_BATCH_MAX) return TC_BATCH_MAX;
+	return n;
+}
+
+
+#ifdef DBG_QM_MALLOC
+void* shm_tcache_refill(unsigned int size,
+		const char *file, const char *func, int line);
+void shm_tcache_flush_bin(int idx,
+		const char *file, const char *func, int line);
+#define TC_DBG_ARGS  , __FILE__, __FUNCTION__, __LINE__
+#else
+void* shm_tcache_refill(unsigned int size);
+void shm_tcache_flush_bin(int idx);
+#define TC_DBG_ARGS
+#endif
+
+/* returns the fragments kept by the calling thread to the pool;
+ * to be called when a thread ends */
+void shm_tcache_flush_all(void);
+
+/* dumps the cache stats (with mem_lock held) */
+void shm_tcache_status(void);
+
+
+/* pops a fragment from the list of the size class; NULL if none */
+static inline void* shm_tcache_get(unsigned int size)
+{
+	struct tc_bin *bin;
+	void *p;
+
+	if (size>TC_MAX_SIZE)
+		return NULL;
+	bin = &shm_tc.bins[tc_class_up(size)];
+	if ((p=bin->head)==NULL)
+		return NULL;
+	bin->head = *(void**)p;
+	bin->count--;
+	shm_tc.bytes -= TC_FRAG_SIZE(p);
+	shm_tc.hits++;
+	return p;
+}
+
+/* keeps the fragment in the thread cache; returns -1 if the fragment
+ * must be freed into the pool */
+static inline int _shm_tcache_put(void *p
+#ifdef DBG_QM_MALLOC
+		, const char *file, const char *func, int line
+#endif
+		)
+{
+	unsigned long size;
+	int idx;
+
+	if (p==NULL)
+		return -1;
+	size = TC_FRAG_SIZE(p);
+	if (size<(1<<4) || size>TC_MAX_SIZE)
+		return -1;
+	/* biggest class not bigger than the fragment */
+	idx = tc_class_up(size);
+	if (tc_class_size(idx)>size)
+		idx--;
+
+	*(void**)p = shm_tc.bins[idx].head;
+	shm_tc.bins[idx].head = p;
+	shm_tc.bins[idx].count++;
+	shm_tc.bytes += size;
+	shm_tc.puts++;
+
+	if (shm_tc.bins[idx].count>2*tc_class_batch(idx) ||
+	shm_tc.bytes>TC_MAX_HOARD)
+		shm_tcache_flush_bin(idx
+#ifdef DBG_QM_MALLOC
+			, file, func, line
+#endif
+			);
+	return 0;
+}
+
+#ifdef DBG_QM_MALLOC
+#define shm_tcache_put(_p) _shm_tcache_put((_p), __FILE__, __FUNCTION__, \
+	__LINE__)
+#else
+#define shm_tcache_put(_p) _shm_tcache_put(_p)
+#endif
+
+#endif /* SHM_TCACHE */
+
+#endif
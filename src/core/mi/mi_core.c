@@ -21,6 +21,10 @@
  * history:
  * ---------
  *  2010-03-28  addepted to 2.0 (bogdan)
+ *  2010-09-xx  dispatcher command added
+ *  2010-09-xx  timer command added
+ *  2010-09-xx  reactors command added
+ *  2010-09-xx  inline callback stats in the reactors command
  */
 
 
@@ -44,6 +48,9 @@
 #include "../globals.h"
 #include "../utils.h"
 #include "../threading.h"
+#include "../reactor/reactor.h"
+#include "../dispatcher/dispatcher.h"
+#include "../timer.h"
 #include "mi.h"
 
 
@@ -311,6 +318,190 @@ static struct mi_root *mi_debug(struct mi_root *cmd, void *param)
 
 
 
+static struct mi_root *mi_dispatcher(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *rpl;
+	struct mi_node *node;
+	struct mi_attr *attr;
+	dispatcher_t *d;
+	char *p;
+	int len;
+	int c;
+
+	if (reactor_in==NULL || reactor_in->disp==NULL)
+		return init_mi_tree( 500, MI_SSTR("Dispatcher not running"));
+	d = reactor_in->disp;
+
+	rpl_tree = init_mi_tree( 200, MI_SSTR(MI_OK));
+	if (rpl_tree==0)
+		return 0;
+	rpl = &rpl_tree->node;
+
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Size"), "%d",
+		d->queued);
+	if (node==0)
+		goto error;
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Capacity"), "%d",
+		d->capacity);
+	if (node==0)
+		goto error;
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Max size"), "%d",
+		d->stats.max_size);
+	if (node==0)
+		goto error;
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Watermarks"), "%d-%d",
+		d->low_wm, d->high_wm);
+	if (node==0)
+		goto error;
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Overloaded"), "%s",
+		dispatcher_overloaded(d) ? "yes" : "no");
+	if (node==0)
+		goto error;
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Overloads"), "%lu",
+		d->stats.overloads);
+	if (node==0)
+		goto error;
+	node = addf_mi_node_child( rpl, 0, MI_SSTR("Deferred"), "%d",
+		d->deferred_no);
+	if (node==0)
+		goto error;
+	p = int2str( d->stats.deferred, &len);
+	attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Total"), p, len);
+	if (attr==0)
+		goto error;
+
+	for ( c=0 ; c<TASK_PRIO_CLASSES ; c++ ) {
+		node = add_mi_node_child( rpl, 0, MI_SSTR("Class"),
+			disp_class_names[c], strlen(disp_class_names[c]));
+		if (node==0)
+			goto error;
+
+		p = disp_policy_names[d->policy[c]];
+		attr = add_mi_attr( node, 0, MI_SSTR("Policy"), p, strlen(p));
+		if (attr==0)
+			goto error;
+
+		p = int2str( d->stats.queued[c], &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Queued"), p, len);
+		if (attr==0)
+			goto error;
+
+		p = int2str( d->stats.dropped[c], &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Dropped"), p, len);
+		if (attr==0)
+			goto error;
+
+		p = int2str( d->stats.rejected[c], &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Rejected"), p, len);
+		if (attr==0)
+			goto error;
+	}
+
+	return rpl_tree;
+error:
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
+
+
+
+static struct mi_root *mi_timer(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *rpl;
+	struct timer_stats st;
+
+	get_timer_stats(&st);
+
+	rpl_tree = init_mi_tree( 200, MI_SSTR(MI_OK));
+	if (rpl_tree==0)
+		return 0;
+	rpl = &rpl_tree->node;
+
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Uptime_ms"), "%llu",
+	get_mticks())==0)
+		goto error;
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Tick_us"), "%d",
+	UTIMER_TICK)==0)
+		goto error;
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Ticks"), "%lu",
+	st.ticks)==0)
+		goto error;
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Late_ticks"), "%lu",
+	st.late)==0)
+		goto error;
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Skipped_ticks"), "%lu",
+	st.skipped)==0)
+		goto error;
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Avg_lateness_us"), "%llu",
+	st.ticks ? st.sum_lateness/st.ticks : 0)==0)
+		goto error;
+	if (addf_mi_node_child( rpl, 0, MI_SSTR("Max_lateness_us"), "%llu",
+	st.max_lateness)==0)
+		goto error;
+
+	return rpl_tree;
+error:
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
+
+
+
+/* per reactor stats; the event rate is computed over the time since the
+ * previous call of the command (or since startup) */
+static struct mi_root *mi_reactors(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node;
+	reactor_t *r;
+	utime_t now, dt;
+	unsigned long events;
+	int type, i;
+
+	rpl_tree = init_mi_tree( 200, MI_SSTR(MI_OK));
+	if (rpl_tree==0)
+		return 0;
+
+	now = get_mticks();
+
+	for( type=REACTOR_IN ; type<=REACTOR_OUT ; type++ ) {
+		for( i=0 ; (r=get_reactor(type,i))!=NULL ; i++ ) {
+			node = addf_mi_node_child( &rpl_tree->node, 0,
+				MI_SSTR("Reactor"), "%s %d",
+				(type==REACTOR_IN)?"in":"out", i);
+			if (node==0)
+				goto error;
+
+			events = r->events;
+			dt = now - r->last_ms;
+			if (addf_mi_attr( node, 0, MI_SSTR("Fds"), "%d", r->fds)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Loops"), "%lu", r->loops)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Events"), "%lu", events)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Events_per_sec"), "%llu",
+				dt ? (utime_t)(events-r->last_events)*1000/dt : 0)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Inlined"), "%lu",
+				r->inlined)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Inline_over_budget"), "%lu",
+				r->inline_over)==0 )
+				goto error;
+			r->last_events = events;
+			r->last_ms = now;
+		}
+	}
+
+	return rpl_tree;
+error:
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
+
+
+
 static mi_funcs_t mi_core_cmds[] = {
 	{ "uptime",      mi_uptime,     MI_NO_INPUT_FLAG,  0,  init_mi_uptime },
 	{ "version",     mi_version,    MI_NO_INPUT_FLAG,  0,  0 },
@@ -320,6 +511,9 @@ static mi_funcs_t mi_core_cmds[] = {
 	{ "ps",          mi_ps,         MI_NO_INPUT_FLAG,  0,  0 },
 	{ "kill",        mi_kill,       MI_NO_INPUT_FLAG,  0,  0 },
 	{ "debug",       mi_debug,                     0,  0,  0 },
+	{ "dispatcher",  mi_dispatcher, MI_NO_INPUT_FLAG,  0,  0 },
+	{ "timer",       mi_timer,      MI_NO_INPUT_FLAG,  0,  0 },
+	{ "reactors",    mi_reactors,   MI_NO_INPUT_FLAG,  0,  0 },
 	{ 0, 0, 0, 0, 0}
 };
 
@@ -63,13 +63,15 @@ int mi_writer(reactor_t *rec,int fd,void *param)
 	shm_free(response);
 	/* fifo used because reply fd different from
 	 * source fd */
-	if (fd != wrap->fd)
+	if (fd != wrap->fd) {
+		remove_fd(out_reactor(fd), fd);
 		close(fd);
+	}
 
 	/* process other MI commands on this fd */
 	wrap->current_comm_len = 0;
 	wrap->mi_buf_pos = 0;
-	submit_task(reactor_in,(fd_callback *)mi_listener,wrap,
+	submit_task(in_reactor(wrap->fd),(fd_callback *)mi_listener,wrap,
 			TASK_PRIO_READ_IO,wrap->fd,0);
 	return 0;
 }
@@ -123,10 +125,10 @@ int mi_listener(void *param)
 		new_conn->current_comm_len = 0;
 		new_conn->mi_buf_pos = 0;
 
-		submit_task(reactor_in,(fd_callback *)mi_listener,new_conn,
+		submit_task(in_reactor(connect_fd),(fd_callback *)mi_listener,new_conn,
 				TASK_PRIO_READ_IO,connect_fd,0);
 reaccept:
-		submit_task(reactor_in,(fd_callback *)mi_listener,wrap,
+		submit_task(in_reactor(wrap->fd),(fd_callback *)mi_listener,wrap,
 			TASK_PRIO_READ_IO,wrap->fd,0);
 		return 0;
 	}
@@ -148,6 +150,7 @@ read_command:
 	else if (bytes_recv == -2)
 	{
 		/* other end closed socket */
+		remove_fd(in_reactor(wrap->fd), wrap->fd);
 		close(wrap->fd);
 		shm_free(wrap);
 		return 0;
@@ -171,7 +174,7 @@ read_command:
 		/* go back to reactor
 		 * maybe command hasn't been received in one piece
 		 */
-		submit_task(reactor_in,(fd_callback *)mi_listener,wrap,
+		submit_task(in_reactor(fd),(fd_callback *)mi_listener,wrap,
 				TASK_PRIO_READ_IO,fd,0);
 		return 0;
 	}
@@ -312,7 +315,7 @@ valid:
 		if (mi_cmd)
 			free_mi_tree(mi_cmd);
 
-		submit_task(reactor_out,(fd_callback *)mi_writer,response,
+		submit_task(out_reactor(reply_fd),(fd_callback *)mi_writer,response,
 				TASK_PRIO_READ_IO,reply_fd,CALLBACK_COMPLEX_F);
 		return 0;
 	}
@@ -332,7 +335,7 @@ close_fd:
 force_exit:
 	*current_comm_len = 0;
 	wrap->mi_buf_pos = 0;
-	submit_task(reactor_in,(fd_callback *)mi_listener,wrap,
+	submit_task(in_reactor(fd),(fd_callback *)mi_listener,wrap,
 			TASK_PRIO_READ_IO,fd,0);
 	return 0;
 }
@@ -195,10 +195,10 @@ int mod_init(void)
 	}
 
 	if (fifo_fd > 0)
-		submit_task(reactor_in,(fd_callback *)mi_listener, &fifo,
+		submit_task(in_reactor(fifo_fd),(fd_callback *)mi_listener, &fifo,
 				TASK_PRIO_READ_IO,fifo_fd,0);
 	if (socket_fd > 0)
-		submit_task(reactor_in,(fd_callback *)mi_listener, &sock,
+		submit_task(in_reactor(socket_fd),(fd_callback *)mi_listener, &sock,
 				TASK_PRIO_READ_IO,socket_fd,0);
 
 	return 0;
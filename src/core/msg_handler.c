@@ -21,6 +21,7 @@
  * history:
  * ---------
  *  2010-06-xx  created (bogdan)
+ *  2010-09-xx  scatter-gather output, if the protocol supports it
  */
 
 
@@ -31,6 +32,7 @@
 #include "parser/parse_uri.h"
 #include "builder/msg_builder.h"
 #include "builder/via_builder.h"
+#include "parser/msg_arena.h"
 
 #include "db/db_to_user.h"
 #include "db/db_res.h"
@@ -40,7 +42,7 @@ static  int cleanup(struct osips_ctx *ctx, void *b, int ret_code)
 {
 	LM_DBG("MSG DONE : ret code is %d context: %p message: %p\n",
 		 ret_code, ctx, ctx->msg);
-	if (b) shm_free(b);
+	if (b) msg_arena_free(b);
 	context_destroy( ctx );
 	return 0;
 }
@@ -76,8 +78,9 @@ static void handle_msg_continue(void *arg, unsigned short port,
 	struct osips_ctx *ctx = (struct osips_ctx *)arg;
 	union sockaddr_union su;
 	struct sip_msg* msg = ctx->msg;
+	struct iovec *iov;
 	char *buf;
-	int n,size;
+	int n,size,iovcnt;
 	str via_name = {"Via",3};
 	str body;
 
@@ -118,6 +121,28 @@ static void handle_msg_continue(void *arg, unsigned short port,
 		
 	}
 
+	hostent2su( &su, he, 0, port );
+	free_hostent(he);
+	shm_free(he);
+
+	if (protos[msg->rcv.proto].funcs.writev_message) {
+		/* build the message as segments pointing in the received buffer
+		 * and in the added headers - no copying */
+		iov = construct_msg_iov( msg, &iovcnt, &size);
+		if (iov==NULL) {
+			LM_ERR("failed to build iovec\n");
+			goto error;
+		}
+
+		async( ctx, cleanup, iov, n,
+			protos[msg->rcv.proto].funcs.writev_message,
+			msg->rcv.bind_address,
+			iov, iovcnt, size,
+			&su , NULL/*extra*/ );
+
+		return;
+	}
+
 	/* build message */
 	buf = construct_msg( msg, &size);
 	if (buf==NULL) {
@@ -125,10 +150,6 @@ static void handle_msg_continue(void *arg, unsigned short port,
 		goto error;
 	}
 
-	hostent2su( &su, he, 0, port );
-	free_hostent(he);
-	shm_free(he);
-
 	async( ctx, cleanup, buf, n,
 		protos[msg->rcv.proto].funcs.write_message,
 		msg->rcv.bind_address,
@@ -21,6 +21,9 @@
  * history:
  * ---------
  *  2010-01-xx  created (bogdan)
+ *  2010-09-xx  udp_batch_size added
+ *  2010-09-xx  listen_shards, listen_shards_pin added
+ *  2010-09-xx  outbound TCP pool params added
  */
 
 #include <sys/types.h>
@@ -28,9 +31,12 @@
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <string.h>
 #include <strings.h>
 
 #include "../log.h"
+#include "../mem/mem.h"
+#include "net_params.h"
 
 
 int tcp_max_connections = 2048;
@@ -49,6 +55,16 @@ unsigned int udp_maxbuffer = 256*1024;
 /* minimum amount of data to be considered a package */
 unsigned int udp_min_size = 21;
 
+/* how many datagrams to read per wakeup (recvmmsg); 1 - no batching */
+unsigned int udp_batch_size = 1;
+
+/* how many SO_REUSEPORT sockets (each with its own reactor) to open
+ * for each UDP/TCP listener; 1 - no sharding */
+int listen_shards = 1;
+
+/* pin the reactor of each shard on a CPU (shard index modulo CPUs) */
+int listen_shards_pin = 0;
+
 /* maximum size of the SIP message over TCP */
 unsigned int tcp_max_size = 512*1024;
 
@@ -61,6 +77,17 @@ unsigned int tcp_write_timeout = 10 ; /* 10 seconds */
 
 unsigned int tcp_connect_timeout = 10 ; /* 10 seconds */
 
+/* max number of outbound connections to a peer (same source socket and
+ * destination) used in parallel; 0 - no pooling, any connection to the
+ * destination is used */
+unsigned int tcp_pool_size = 0;
+
+/* how a connection of the pool is picked */
+int tcp_pool_policy = TCP_POOL_ROUND_ROBIN;
+
+/* peers to open the pool to at startup */
+struct net_str_list *tcp_pool_peers = NULL;
+
 
 int set_net_tos(char *s)
 {
@@ -96,3 +123,51 @@ int set_net_tos(char *s)
 }
 
 
+int set_tcp_pool_policy(char *s)
+{
+	if (strcasecmp(s,"round-robin")==0) {
+		tcp_pool_policy = TCP_POOL_ROUND_ROBIN;
+	} else if (strcasecmp(s,"least-queued")==0) {
+		tcp_pool_policy = TCP_POOL_LEAST_QUEUED;
+	} else {
+		LM_ERR("invalid TCP pool policy %s - allowed: "
+			"round-robin, least-queued\n", s);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int add_tcp_pool_peer(char *s)
+{
+	struct net_str_list *p;
+	struct net_str_list *it;
+	int len;
+
+	if (s==NULL || (len=strlen(s))==0) {
+		LM_ERR("NULL or empty TCP pool peer\n");
+		return -1;
+	}
+
+	/* the string is copied in the same chunk */
+	p = (struct net_str_list*)shm_malloc(sizeof(struct net_str_list)+len+1);
+	if (p==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	p->s = (char*)(p+1);
+	memcpy( p->s, s, len+1);
+	p->next = NULL;
+
+	/* keep the config order */
+	for( it=tcp_pool_peers ; it && it->next ; it=it->next );
+	if (it==NULL)
+		tcp_pool_peers = p;
+	else
+		it->next = p;
+
+	return 0;
+}
+
+
@@ -21,6 +21,9 @@
  * history:
  * ---------
  *  2010-01-xx  created (bogdan)
+ *  2010-09-xx  udp_batch_size added
+ *  2010-09-xx  listen_shards, listen_shards_pin added
+ *  2010-09-xx  outbound TCP pool params added
  */
 
 
@@ -40,6 +43,12 @@ extern unsigned int udp_maxbuffer;
 
 extern unsigned int udp_min_size;
 
+extern unsigned int udp_batch_size;
+
+extern int listen_shards;
+
+extern int listen_shards_pin;
+
 extern unsigned int tcp_max_size;
 
 extern unsigned int tcp_via_alias;
@@ -50,11 +59,35 @@ extern unsigned int tcp_write_timeout;
 
 extern unsigned int tcp_connect_timeout;
 
+/* outbound TCP connection pool (see tcp_pool_size) */
+#define TCP_POOL_MAX            32
+#define TCP_POOL_ROUND_ROBIN    0
+#define TCP_POOL_LEAST_QUEUED   1
+
+struct net_str_list {
+	char *s;
+	struct net_str_list *next;
+};
+
+extern unsigned int tcp_pool_size;
+
+extern int tcp_pool_policy;
+
+extern struct net_str_list *tcp_pool_peers;
+
 
 /* Parses and sets the network TOS - used from cfg
  */
 int set_net_tos(char *s);
 
+/* Sets the policy for picking a connection of an outbound TCP pool
+ */
+int set_tcp_pool_policy(char *s);
+
+/* Adds a peer ("ip:port") to pre-open the TCP pool to, at startup
+ */
+int add_tcp_pool_peer(char *s);
+
 
 
 #endif
@@ -21,6 +21,8 @@
  * history:
  * ---------
  *  2010-01-xx  created (bogdan)
+ *  2010-09-xx  vectored write function (writev_message)
+ *  2010-09-xx  reactor flags for the event handler (event_flags)
  */
 
 
@@ -127,6 +129,7 @@ int load_proto_lib( unsigned short proto );
 
 /********************** PROTO interface stuff ***************************/
 
+#include <sys/uio.h>
 #include "socket.h"
 #include "../parser/msg_parser.h"
 
@@ -140,6 +143,13 @@ typedef int (*proto_write)(void *ctx, struct socket_info *src,
 			char *buf, unsigned int len,
 			union sockaddr_union*  to, void *extra);
 
+/* same as proto_write, but the data is given as "iovcnt" segments
+ * totalizing "len" bytes; the segments must stay valid until the write
+ * completes (the function may return async) */
+typedef int (*proto_writev)(void *ctx, struct socket_info *src,
+			struct iovec *iov, int iovcnt, unsigned int len,
+			union sockaddr_union*  to, void *extra);
+
 typedef int (*proto_event_handler)(struct socket_info *si);
 
 struct proto_funcs {
@@ -149,6 +159,9 @@ struct proto_funcs {
 	proto_init_listener init_listener;
 	proto_event_handler event_handler;
 	proto_write         write_message;
+	proto_writev        writev_message;
+	/* reactor flags for the event handler (CALLBACK_*_F) */
+	int                 event_flags;
 };
 
 struct proto_interface {
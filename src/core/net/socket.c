@@ -30,6 +30,7 @@
 #include <sys/uio.h>  /* writev*/
 #include <netdb.h>
 #include <stdlib.h> /*exit() */
+#include <limits.h>
 
 
 #include "../utils.h"
@@ -37,6 +38,7 @@
 #include "socket.h"
 #include "proto.h"
 #include "resolver.h"
+#include "net_params.h"
 
 
 struct socket_info *registered_listeners = NULL;
@@ -192,6 +194,36 @@ int register_listener(char *s)
 }
 
 
+/* clones a fixed listener into the shards 1..listen_shards-1 of its
+ * group, linked right after it; the strings are shared with the master */
+static int shard_listener(struct socket_info *si)
+{
+	struct socket_info *shard;
+	struct socket_info *prev;
+	int i;
+
+	prev = si;
+	for( i=1 ; i<listen_shards ; i++ ) {
+		shard = (struct socket_info*)shm_malloc
+			(sizeof(struct socket_info)+si->name.len+1);
+		if (shard==NULL) {
+			LM_ERR("no more shm memory\n");
+			return -1;
+		}
+		memcpy( shard, si, sizeof(struct socket_info)+si->name.len+1);
+		shard->name.s = (char*)(shard+1);
+		shard->host.s = shard->name.s + (si->host.s - si->name.s);
+		shard->shard = i;
+
+		shard->next = prev->next;
+		prev->next = shard;
+		prev = shard;
+	}
+
+	return 0;
+}
+
+
 int fix_all_listeners(void)
 {
 	struct socket_info *si;
@@ -200,6 +232,11 @@ int fix_all_listeners(void)
 	char *tmp;
 	int len;
 
+	if (listen_shards<1 || listen_shards>USHRT_MAX) {
+		LM_ERR("invalid listen_shards %d\n", listen_shards);
+		return -1;
+	}
+
 	/* init all registered listeners */
 	for( si=registered_listeners ; si ; si=si->next ) {
 		LM_DBG("Passing through %p to %p\n", si, registered_listeners);
@@ -278,6 +315,29 @@ int fix_all_listeners(void)
 		}
 		#endif /* USE_MCAST */
 
+		si->shard_master = si;
+		si->shard = 0;
+		si->shards = 1;
+
+		/* open the listener as a group of SO_REUSEPORT sockets */
+		if ( listen_shards>1 && !(si->flags&SI_FLAG_IS_MCAST) &&
+		(si->proto==PROTO_NONE || si->proto==PROTO_UDP ||
+		si->proto==PROTO_TCP) ) {
+		#ifdef SO_REUSEPORT
+			si->shards = listen_shards;
+			if (shard_listener(si)<0)
+				goto error;
+			LM_DBG("listener <%s> sharded in %d sockets\n",
+				si->name.s, listen_shards);
+			/* skip the shards */
+			while (si->next && si->next->shard_master==si->shard_master)
+				si = si->next;
+		#else
+			LM_WARN("SO_REUSEPORT not supported, listener <%s> not "
+				"sharded\n", si->name.s);
+		#endif
+		}
+
 		LM_DBG("listener <%s> succesfully fixed\n",si->name.s);
 	}
 
@@ -359,13 +419,15 @@ void destroy_all_listeners(void)
 		for( si=protos[proto].listeners ; si ; si=next ) {
 			next = si->next;
 
-			/* destroy listener */
-			if (si->port_str.s)
-				shm_free(si->port_str.s);
-			if (si->address_str.s)
-				shm_free(si->address_str.s);
-			if (si->sock_str.s)
-				shm_free(si->sock_str.s);
+			/* destroy listener (shards share the strings of the master) */
+			if (si->shard==0) {
+				if (si->port_str.s)
+					shm_free(si->port_str.s);
+				if (si->address_str.s)
+					shm_free(si->address_str.s);
+				if (si->sock_str.s)
+					shm_free(si->sock_str.s);
+			}
 			shm_free(si);
 		}
 	}
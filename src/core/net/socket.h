@@ -31,6 +31,8 @@
 
 #define MAX_PORT_LEN 7 /*!< ':' + max 5 letters + \\0 */
 
+struct _reactor;
+
 struct socket_info {
 	str name; /*!< name - eg.: foo.bar or 10.0.0.1 , allocated in the same
 	               mem chunk at the structure, NULL terminated */
@@ -45,6 +47,14 @@ struct socket_info {
 	unsigned int flags; /*!< SI_IS_IP | SI_IS_LO | SI_IS_MCAST */
 	union sockaddr_union su;
 	str sock_str;
+	void *proto_data; /*!< data private to the protocol (released by
+	                       the destroy function of the protocol) */
+	/* shard group - same listener opened as several SO_REUSEPORT sockets */
+	struct socket_info *shard_master; /*!< first socket of the group
+	                                       (itself if not sharded) */
+	unsigned short shard;  /*!< index in the group */
+	unsigned short shards; /*!< size of the group, 1 if not sharded */
+	struct _reactor *reactor; /*!< reactor serving the socket */
 	//str adv_sock_str;
 	//str adv_name_str; /* Advertised name of this interface */
 	//str adv_port_str; /* Advertised port of this interface */
@@ -135,7 +145,9 @@ int register_listener(char *s);
 int auto_register_listeners(void);
 
 
-/* Fixes (ip resolving, optimizations) all registered listeners
+/* Fixes (ip resolving, optimizations) all registered listeners;
+ * listeners which may be sharded (see listen_shards) are also expanded
+ * here into groups of sockets
  */
 int fix_all_listeners(void);
 
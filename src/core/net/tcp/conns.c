@@ -21,13 +21,20 @@
  * history:
  * ---------
  *  2010-03-xx  created (bogdan)
+ *  2010-09-xx  resizable, lock striped hash tables; atomic ref counter
+ *  2010-09-xx  timeouts enforced by a per connection timer on the timer
+ *              wheel instead of scanning the whole table
+ *  2010-09-xx  cache of free pending write nodes
+ *  2010-09-xx  fds routed to their reactor (in_reactor/out_reactor)
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 
 #include "../../mem/mem.h"
 #include "../../locking/locking.h"
+#include "../../locking/atomic_ops.h"
 #include "../../globals.h"
 #include "../../log.h"
 #include "../../timer.h"
@@ -37,70 +44,237 @@
 #include "../../dispatcher/dispatcher.h"
 #include "conns.h"
 
-#define TCP_HASH_SIZE  1024
+/* the hash tables start with TCP_HASH_SIZE buckets and double their size
+ * each time they get more than TCP_HASH_LOAD connections per bucket;
+ * the buckets are protected by TCP_HASH_LOCKS locks (bucket "h" by
+ * lock "h % TCP_HASH_LOCKS") */
+#define TCP_HASH_SIZE      1024
+#define TCP_HASH_MAX_SIZE  (1<<20)
+#define TCP_HASH_LOCKS     256
+#define TCP_HASH_LOAD      2
 
-static int tcp_connections_no = 0;
+struct tcp_conn_table {
+	struct tcp_conn **buckets;
+	/* number of buckets, power of 2 and >= TCP_HASH_LOCKS */
+	unsigned int size;
+	/* number of linked connections */
+	volatile int count;
+	/* where the links of this table are in the tcp_conn */
+	unsigned int link_offset;
+	gen_lock_t locks[TCP_HASH_LOCKS];
+};
 
-static unsigned int last_tcp_id;
+static volatile int tcp_connections_no = 0;
 
-static struct tcp_conn *hash_id_conns[TCP_HASH_SIZE];
+static volatile unsigned int last_tcp_id;
 
-static struct tcp_conn *hash_ip_conns[TCP_HASH_SIZE];
+static struct tcp_conn_table id_table;
 
-static gen_lock_t hash_id_lock;
+static struct tcp_conn_table ip_table;
 
-static gen_lock_t hash_ip_lock;
+/* up to TCP_PW_CACHE free pending write nodes are kept for reuse */
+#define TCP_PW_CACHE       1024
 
+static struct {
+	gen_lock_t lock;
+	struct tcp_pending_writes *free;
+	unsigned int no;
+} pw_cache;
 
-#define tcp_hash(_no1,_no2)  ((_no1+_no2)%TCP_HASH_SIZE)
 
-#define tcp_hash_add_unsafe(_conn,_type,_h) \
-	do {\
-		if (hash_##_type##_conns[_h]==NULL) {\
-			_conn->_type##_next=NULL;\
-		} else {\
-			_conn->_type##_next = hash_##_type##_conns[_h];\
-			hash_##_type##_conns[_h]->_type##_prev=_conn;\
-		};\
-		_conn->_type##_prev = NULL;\
-		hash_##_type##_conns[_h] = _conn;\
-	}while(0)
+#define tcp_link(_t,_conn) \
+	((struct tcp_conn_link*)((char*)(_conn) + (_t)->link_offset))
 
-#define tcp_hash_rm_unsafe(_conn,_type,_h) \
-	do {\
-		if (_conn->_type##_next)\
-			_conn->_type##_next->_type##_prev = _conn->_type##_prev;\
-		if (_conn->_type##_prev)\
-			_conn->_type##_prev->_type##_next = _conn->_type##_next;\
-		else\
-			hash_##_type##_conns[_h] = _conn->_type##_next;\
-	}while(0)
+#define tcp_lock_bucket(_t,_h) \
+	lock_get( &(_t)->locks[(_h)&(TCP_HASH_LOCKS-1)] )
 
+#define tcp_unlock_bucket(_t,_h) \
+	lock_release( &(_t)->locks[(_h)&(TCP_HASH_LOCKS-1)] )
 
-static int tcp_timer_routine(void *param);
+/* the table (its size) may change only with all the locks held, so the
+ * bucket must be computed with the lock of the hash value taken */
+#define tcp_bucket(_t,_h) \
+	((_t)->buckets[(_h)&((_t)->size-1)])
 
 
-int init_tcp_conns(void)
+static inline unsigned int tcp_id_hash(unsigned int id)
 {
-	/* init conn hash locks */
-	if (lock_init(&hash_id_lock)==0){
-		LM_ERR("failed to init lock for hash_id\n");
-		return -1;
+	/* ids are consecutive - a multiplicative hash spreads them evenly */
+	return id * 2654435761u;
+}
+
+
+/* hash over the full address (IPv4 or IPv6) and the port */
+static inline unsigned int tcp_ip_hash(struct ip_addr *ip,
+													unsigned short port)
+{
+	unsigned int h;
+	int i;
+
+	h = port;
+	for( i=0 ; i<(int)(ip->len/4) ; i++ ) {
+		h ^= ip->u.addr32[i];
+		h *= 0x9e3779b1u;
+		h ^= h >> 15;
 	}
-	if (lock_init(&hash_ip_lock)==0){
-		LM_ERR("failed to init lock for hash_ip\n");
+	return h;
+}
+
+
+/* links the conn in its bucket (bucket lock must be held) */
+static inline void tcp_hash_add_unsafe(struct tcp_conn_table *t,
+														struct tcp_conn *conn)
+{
+	struct tcp_conn_link *l = tcp_link(t,conn);
+	struct tcp_conn **b = &tcp_bucket(t,l->hash);
+
+	l->prev = NULL;
+	l->next = *b;
+	if (*b)
+		tcp_link(t,*b)->prev = conn;
+	*b = conn;
+}
+
+
+/* unlinks the conn from its bucket (bucket lock must be held) */
+static inline void tcp_hash_rm_unsafe(struct tcp_conn_table *t,
+														struct tcp_conn *conn)
+{
+	struct tcp_conn_link *l = tcp_link(t,conn);
+
+	if (l->next)
+		tcp_link(t,l->next)->prev = l->prev;
+	if (l->prev)
+		tcp_link(t,l->prev)->next = l->next;
+	else
+		tcp_bucket(t,l->hash) = l->next;
+}
+
+
+static int tcp_table_init(struct tcp_conn_table *t, unsigned int link_offset)
+{
+	int i;
+
+	t->buckets = (struct tcp_conn**)
+		shm_malloc(TCP_HASH_SIZE*sizeof(struct tcp_conn*));
+	if (t->buckets==NULL) {
+		LM_ERR("no more shm memory\n");
 		return -1;
 	}
+	memset( t->buckets, 0, TCP_HASH_SIZE*sizeof(struct tcp_conn*));
+	t->size = TCP_HASH_SIZE;
+	t->count = 0;
+	t->link_offset = link_offset;
+
+	for( i=0 ; i<TCP_HASH_LOCKS ; i++ ) {
+		if (lock_init(&t->locks[i])==0){
+			LM_ERR("failed to init lock for hash\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/* doubles the number of buckets of the table; all the bucket locks are
+ * taken (always in the same order), so nobody may walk the table */
+static void tcp_table_grow(struct tcp_conn_table *t)
+{
+	struct tcp_conn **old, **new;
+	struct tcp_conn *conn, *next;
+	unsigned int old_size, size;
+	unsigned int h;
+	int i;
+
+	for( i=0 ; i<TCP_HASH_LOCKS ; i++ )
+		lock_get( &t->locks[i] );
+
+	old = t->buckets;
+	old_size = t->size;
+	/* check again, maybe other thread already did it */
+	if (atomic_get(&t->count)<=(int)(old_size*TCP_HASH_LOAD) ||
+	old_size>=TCP_HASH_MAX_SIZE) {
+		old = NULL;
+		goto done;
+	}
+
+	size = old_size<<1;
+	new = (struct tcp_conn**)shm_malloc(size*sizeof(struct tcp_conn*));
+	if (new==NULL) {
+		LM_WARN("no more shm memory to grow the TCP hash to %u\n", size);
+		old = NULL;
+		goto done;
+	}
+	memset( new, 0, size*sizeof(struct tcp_conn*));
+
+	t->buckets = new;
+	t->size = size;
+	for( h=0 ; h<old_size ; h++ ) {
+		for( conn=old[h] ; conn ; conn=next ) {
+			next = tcp_link(t,conn)->next;
+			tcp_hash_add_unsafe( t, conn);
+		}
+	}
+	LM_DBG("TCP hash %p grown to %u buckets\n", t, size);
+
+done:
+	for( i=TCP_HASH_LOCKS-1 ; i>=0 ; i-- )
+		lock_release( &t->locks[i] );
+	if (old)
+		shm_free(old);
+}
+
+
+static inline void tcp_table_add(struct tcp_conn_table *t,
+														struct tcp_conn *conn)
+{
+	unsigned int h = tcp_link(t,conn)->hash;
+
+	tcp_lock_bucket(t,h);
+	tcp_hash_add_unsafe( t, conn);
+	tcp_unlock_bucket(t,h);
+
+	if (atomic_inc(&t->count)>(int)(t->size*TCP_HASH_LOAD) &&
+	t->size<TCP_HASH_MAX_SIZE)
+		tcp_table_grow(t);
+}
+
+
+static inline void tcp_table_rm(struct tcp_conn_table *t,
+														struct tcp_conn *conn)
+{
+	unsigned int h = tcp_link(t,conn)->hash;
+
+	tcp_lock_bucket(t,h);
+	tcp_hash_rm_unsafe( t, conn);
+	tcp_unlock_bucket(t,h);
+
+	atomic_dec(&t->count);
+}
+
+
+static int tcp_conn_timeout(void *param);
+
 
-	/* timer routine for timeouts */
-	if (register_timer( tcp_timer_routine, NULL/*param*/, 2 /*interval*/)!=0) {
-		LM_ERR("failed to register timer function\n");
+int init_tcp_conns(void)
+{
+	/* init conn hashes */
+	if (tcp_table_init( &id_table,
+	offsetof(struct tcp_conn,id_link))!=0 ||
+	tcp_table_init( &ip_table,
+	offsetof(struct tcp_conn,ip_link))!=0 ) {
+		LM_ERR("failed to init the TCP hashes\n");
 		return -1;
 	}
 
 	last_tcp_id = rand();
 
-	/* */
+	if (lock_init( &pw_cache.lock )==0) {
+		LM_ERR("failed to init the pending writes lock\n");
+		return -1;
+	}
+	pw_cache.free = NULL;
+	pw_cache.no = 0;
 
 	return 0;
 }
@@ -113,67 +287,63 @@ static inline void free_tcp_conn(struct tcp_conn *conn)
 
 	LM_DBG("freeing connection %p (fd=%d)\n",conn,conn->socket);
 	/* close the socket */
-	if (conn->socket)
+	if (conn->socket) {
+		remove_fd(in_reactor(conn->socket), conn->socket);
+		remove_fd(out_reactor(conn->socket), conn->socket);
 		close(conn->socket);
-	/* free pending read */
-	if (conn->read.msg)
-		shm_free(conn->read.msg);
+	}
+	/* release the receive buffer */
+	if (conn->read.buf)
+		unref_sip_msg_buf(conn->read.buf);
 	/* free pending writes */
 	for( pw=conn->write.first ; pw ; pw=pw_next ) {
 		pw_next = pw->next;
-		shm_free(pw);
+		tcp_pw_free(pw);
 	}
-	lock_destroy(&conn->write_lock);
+	lock_destroy(&conn->state_lock);
 	shm_free(conn);
-	tcp_connections_no--;  //make it atomic - FIXME
+	atomic_dec(&tcp_connections_no);
 }
 
 
 void remove_tcp_conn(struct tcp_conn *conn, int extra_ref)
 {
-	unsigned int h;
+	int ref;
 
 	/* unlink it asap */
-	lock_get( &hash_id_lock );
-	h = tcp_hash(conn->id,0);
-	tcp_hash_rm_unsafe(conn,id,h);
-	conn->ref -= extra_ref;
-	lock_release( &hash_id_lock );
+	tcp_table_rm( &id_table, conn);
+	tcp_table_rm( &ip_table, conn);
 
-	lock_get( &hash_ip_lock );
-	h = tcp_hash(conn->rcv.src_ip.u.addr32[0],conn->rcv.src_port);
-	tcp_hash_rm_unsafe(conn,ip,h);
-	lock_release( &hash_ip_lock );
+	/* stop the timer - if still pending, release its ref too */
+	extra_ref += wtimer_del( &conn->timer);
 
 	/* conn is no longer in hash (cannot be found and aquired), so if ref==0
 	 * we can safely free it */
-	if (conn->ref==0)
+	ref = extra_ref ? atomic_add(&conn->ref, -extra_ref) : atomic_get(&conn->ref);
+	if (ref==0)
 		free_tcp_conn(conn);
 }
 
 
 void unref_tcp_conn(struct tcp_conn *conn)
 {
-	lock_get(&hash_id_lock);
-	conn->ref--;
+	int ref;
+
+	ref = atomic_dec(&conn->ref);
 	LM_DBG("connection %p (fd=%d) gets ref cnt to %d\n",
-		conn,conn->socket,conn->ref);
-	if (conn->ref==0) {
-		lock_release(&hash_id_lock);
+		conn,conn->socket,ref);
+	if (ref==0)
 		free_tcp_conn(conn);
-		return;
-	}
-	lock_release(&hash_id_lock);
 }
 
 
 void ref_tcp_conn(struct tcp_conn *conn)
 {
-	lock_get(&hash_id_lock);
-	conn->ref++;
+	int ref;
+
+	ref = atomic_inc(&conn->ref);
 	LM_DBG("connection %p (fd=%d) gets ref cnt to %d\n",
-		conn,conn->socket,conn->ref);
-	lock_release(&hash_id_lock);
+		conn,conn->socket,ref);
 }
 
 
@@ -183,18 +353,71 @@ void destroy_tcp_conns(void)
 {
 	struct tcp_conn *conn;
 	struct tcp_conn *cnext;
-	int h;
-
-	for( h=0 ; h<TCP_HASH_SIZE ; h++) {
-		for( conn=hash_id_conns[h]; conn ; conn=cnext ) {
-			cnext = conn->id_next;
-			/* free the connection */
-			free_tcp_conn(conn);
+	struct tcp_pending_writes *pw;
+	unsigned int h;
+	int i;
+
+	if (id_table.buckets) {
+		for( h=0 ; h<id_table.size ; h++) {
+			for( conn=id_table.buckets[h]; conn ; conn=cnext ) {
+				cnext = conn->id_link.next;
+				/* free the connection */
+				free_tcp_conn(conn);
+			}
 		}
+		shm_free(id_table.buckets);
+		id_table.buckets = NULL;
+	}
+	if (ip_table.buckets) {
+		shm_free(ip_table.buckets);
+		ip_table.buckets = NULL;
+	}
+
+	for( i=0 ; i<TCP_HASH_LOCKS ; i++ ) {
+		lock_destroy(&id_table.locks[i]);
+		lock_destroy(&ip_table.locks[i]);
+	}
+
+	while (pw_cache.free) {
+		pw = pw_cache.free;
+		pw_cache.free = pw->next;
+		shm_free(pw);
+	}
+	lock_destroy(&pw_cache.lock);
+}
+
+
+struct tcp_pending_writes* tcp_pw_alloc(void)
+{
+	struct tcp_pending_writes *pw;
+
+	lock_get(&pw_cache.lock);
+	if ( (pw=pw_cache.free)!=NULL ) {
+		pw_cache.free = pw->next;
+		pw_cache.no--;
+		lock_release(&pw_cache.lock);
+		return pw;
 	}
+	lock_release(&pw_cache.lock);
 
-	lock_destroy(&hash_id_lock);
-	lock_destroy(&hash_ip_lock);
+	return (struct tcp_pending_writes*)shm_malloc
+		(sizeof(struct tcp_pending_writes));
+}
+
+
+void tcp_pw_free(struct tcp_pending_writes *pw)
+{
+	lock_get(&pw_cache.lock);
+	if (pw_cache.no<TCP_PW_CACHE) {
+		pw->next = pw_cache.free;
+		pw_cache.free = pw;
+		pw_cache.no++;
+		lock_release(&pw_cache.lock);
+		return;
+	}
+	lock_release(&pw_cache.lock);
+
+	shm_free(pw);
 }
 
 
@@ -203,20 +426,20 @@ struct tcp_conn* create_tcp_conn( int s, union sockaddr_union *src_su,
 						struct socket_info *dst_si, tcp_conn_state init_state)
 {
 	struct tcp_conn *conn;
-	int h;
 
-	if (tcp_connections_no>=tcp_max_connections) {
+	if (atomic_inc(&tcp_connections_no)>tcp_max_connections) {
 		LM_ERR("maximum number of connections exceeded: %d/%d\n",
-			tcp_connections_no, tcp_max_connections);
+			tcp_connections_no-1, tcp_max_connections);
+		atomic_dec(&tcp_connections_no);
 		close(s);
 		return NULL;
 	}
-	tcp_connections_no++;  //make it atomic - FIXME
 
 	/* allocate structure */
 	conn = (struct tcp_conn*)shm_malloc(sizeof(struct tcp_conn));
 	if (conn==NULL){
 		LM_ERR("no more pkg memory\n");
+		atomic_dec(&tcp_connections_no);
 		return NULL;
 	}
 	memset(conn, 0, sizeof(struct tcp_conn));
@@ -244,23 +467,27 @@ struct tcp_conn* create_tcp_conn( int s, union sockaddr_union *src_su,
 	LM_DBG("new tcp connection with: %s:%d\n",
 		ip_addr2a(&conn->rcv.src_ip),conn->rcv.src_port);
 
+	/* refed by the hash and by the timer */
+	conn->ref = 2;
+	/* 0 is reserved for "no ID" */
+	do {
+		conn->id = atomic_inc(&last_tcp_id);
+	}while(conn->id==0);
+	conn->id_link.hash = tcp_id_hash(conn->id);
+	conn->ip_link.hash = tcp_ip_hash(&conn->rcv.src_ip, conn->rcv.src_port);
+
+	/* arm the timer before the conn may be found by others */
+	wtimer_init( &conn->timer, tcp_conn_timeout, conn);
+	wtimer_add( &conn->timer, tcp_lifetime*1000);
+
 	/* add to the hashes */
-	lock_get( &hash_id_lock );
-	/* refed by the hash */
-	conn->ref = 1;
-	conn->id = last_tcp_id;
-	h = tcp_hash(conn->id,0);
-	tcp_hash_add_unsafe(conn,id,h);
-	lock_release( &hash_id_lock );
-
-	lock_get( &hash_ip_lock );
-	h = tcp_hash(conn->rcv.src_ip.u.addr32[0],conn->rcv.src_port);
-	tcp_hash_add_unsafe(conn,ip,h);
-	lock_release( &hash_ip_lock );
+	tcp_table_add( &id_table, conn);
+	tcp_table_add( &ip_table, conn);
 
 	return conn;
 error:
 	shm_free(conn);
+	atomic_dec(&tcp_connections_no);
 	return NULL;
 }
 
@@ -277,43 +504,41 @@ struct tcp_conn *search_tcp_conn(unsigned int id, union sockaddr_union *to)
 
 	/* if an ID is available, search for it */
 	if (id!=0) {
-		hash = tcp_hash( id, 0);
-		lock_get( &hash_id_lock );
-		for( conn=hash_id_conns[hash] ; conn ; conn=conn->id_next ) {
+		hash = tcp_id_hash(id);
+		tcp_lock_bucket( &id_table, hash);
+		for( conn=tcp_bucket(&id_table,hash) ; conn ;
+		conn=conn->id_link.next ) {
 			if (conn->id == id) {
 				if (conn->state==TCP_CONN_TERM)
 					break;
 				/* validate the connection with ip and port! */
 				if ( ip_addr_cmp(&ip,&conn->rcv.src_ip) &&
 				(port==conn->rcv.src_port || port==conn->port_alias) ) {
-					conn->ref++;
-					lock_release( &hash_id_lock );
+					atomic_inc(&conn->ref);
+					tcp_unlock_bucket( &id_table, hash);
 					return conn;
 				}
 				/* conn id failed to match */
 				break;
 			}
 		}
-		lock_release( &hash_id_lock );
+		tcp_unlock_bucket( &id_table, hash);
 		/* conn id not found */
 	}
 
 	/* search based on destination information (ip and port) */
-	hash = tcp_hash(ip.u.addr32[0],port);
-	lock_get( &hash_ip_lock );
-	for( conn=hash_ip_conns[hash] ; conn ; conn=conn->ip_next ) {
-		if ( conn->state!=TCP_CONN_TERM && ip_addr_cmp(&ip,&conn->rcv.src_ip)
-		&& (port==conn->rcv.src_port || port==conn->port_alias) ) {
-			/* WARNING - take care, this is the only place where both
-			 * locks are taken in the same time - be aware of dead-locks! */
-			lock_get( &hash_id_lock );
-			conn->ref++;
-			lock_release( &hash_id_lock );
-			lock_release( &hash_ip_lock );
+	hash = tcp_ip_hash( &ip, port);
+	tcp_lock_bucket( &ip_table, hash);
+	for( conn=tcp_bucket(&ip_table,hash) ; conn ; conn=conn->ip_link.next ) {
+		if ( conn->ip_link.hash==hash && conn->state!=TCP_CONN_TERM &&
+		ip_addr_cmp(&ip,&conn->rcv.src_ip) &&
+		(port==conn->rcv.src_port || port==conn->port_alias) ) {
+			atomic_inc(&conn->ref);
+			tcp_unlock_bucket( &ip_table, hash);
 			return conn;
 		}
 	}
-	lock_release( &hash_ip_lock );
+	tcp_unlock_bucket( &ip_table, hash);
 
 	return NULL;
 }
@@ -340,58 +565,70 @@ static inline void resume_pending_writes(struct tcp_conn *conn)
 		task.priority = TASK_PRIO_RESUME_EXEC;
 		task.cb = (fd_callback*)resume_write_on_failue;
 		task.cb_param = (void*)pw->ctx;
-		put_task( reactor_out->disp, task);
+		task.last_reactor = NULL;
+		/* the context must be resumed, whatever the overload */
+		if (put_task_force( reactor_out->disp, task)<0)
+			resume_write_on_failue(pw->ctx);
 	}
 }
 
 
-static int tcp_timer_routine( void *param)
+/* connection timer - if the deadline was pushed further meanwhile, the
+ * timer is just re-armed (the deadlines are only moved back lazily, so
+ * updating them on every read or write costs nothing) */
+static int tcp_conn_timeout(void *param)
 {
-	struct tcp_conn *conn;
-	struct tcp_conn *cnext;
-	int now;
-	int h;
+	struct tcp_conn *conn = (struct tcp_conn*)param;
+	unsigned int now;
 
 	now = get_ticks();
 
-	for( h=0 ; h<TCP_HASH_SIZE ; h++) {
-
-		lock_get( &hash_id_lock );
-
-		for( conn=hash_id_conns[h]; conn ; conn=cnext ) {
-			cnext = conn->id_next;
-			/* check connection timeout */
-			if (conn->timeout<=now) {
-				/* timeout on connection activity -> if connection is valid,
-				 * fire the OUT reactor to resume (with error) the write 
-				 * context and the IN reactor to stop the read operation */
-				conn->timeout = 0;
-				if ( set_conn_state(conn, TCP_CONN_TERM)!=-1 ) {
-					LM_DBG("Terminating conn %p (%d) (time=%d)\n",
-						conn,conn->socket,now);
-					conn->ref++;
-					break;
-				}
-			}
-		}
-
-		lock_release( &hash_id_lock );
+	if (conn->state!=TCP_CONN_TERM && conn->timeout>now) {
+		wtimer_add( &conn->timer, (conn->timeout-now)*1000);
+		/* terminated meanwhile (and the timer not found by the remover) ?
+		 * keep the ref only if the timer is still ours */
+		if (conn->state!=TCP_CONN_TERM || wtimer_del(&conn->timer)==0)
+			return 0;
+		unref_tcp_conn(conn);
+		return 0;
+	}
 
-		if (conn) {
-			/* fire OUT reactor */
-			fire_fd( reactor_out, conn->socket);
-			/* fire IN reactor */
-			fire_fd( reactor_in, conn->socket);
-			remove_tcp_conn(conn, 1);
-			/* force checking again the same hash */
-			h--;
-		}
+	/* timeout on connection activity -> if connection is valid,
+	 * fire the OUT reactor to resume (with error) the write
+	 * context and the IN reactor to stop the read operation */
+	conn->timeout = 0;
+	if ( set_conn_state(conn, TCP_CONN_TERM)!=-1 ) {
+		LM_DBG("Terminating conn %p (%d) (time=%d)\n",
+			conn,conn->socket,now);
+		/* fire OUT reactor */
+		fire_fd( out_reactor(conn->socket), conn->socket);
+		/* fire IN reactor */
+		fire_fd( in_reactor(conn->socket), conn->socket);
+		/* the ref of the timer goes with the conn */
+		remove_tcp_conn(conn, 1);
+	} else {
+		/* already terminated by somebody else - drop the timer ref */
+		unref_tcp_conn(conn);
 	}
 
 	return 0;
 }
 
 
+void tcp_conn_set_timeout(struct tcp_conn *conn, unsigned int timeout)
+{
+	unsigned int old;
+
+	old = conn->timeout;
+	conn->timeout = get_ticks() + timeout;
+
+	/* the timer fires no later than the old deadline - move it only if
+	 * the new deadline is before that */
+	if (conn->timeout<old)
+		wtimer_mod( &conn->timer, timeout*1000);
+}
+
+
 /*
  * Returns:
  *    0 - change can be performed
@@ -21,6 +21,13 @@
  * history:
  * ---------
  *  2010-03-xx  created (bogdan)
+ *  2010-09-xx  pending writes may be vectors of segments
+ *  2010-09-xx  resizable, lock striped hash tables; atomic ref counter
+ *  2010-09-xx  per connection timer on the timer wheel
+ *  2010-09-xx  shared receive buffer instead of a growing message
+ *  2010-09-xx  count of pending writes (used by the outbound pools)
+ *  2010-09-xx  pending writes allocated from a cache of free nodes and
+ *              sent in batches (no more upload to the active write)
  */
 
 #ifndef _CORE_TCP_CONNS_H
@@ -29,6 +36,7 @@
 #include "../../locking/locking.h"
 #include "../../parser/msg_parser.h"
 #include "../socket.h"
+#include "../../timer_wheel.h"
 
 typedef enum {TCP_CONN_READY=1,
 			  TCP_CONN_WRITING,
@@ -38,11 +46,20 @@ typedef enum {TCP_CONN_READY=1,
 
 struct tcp_pending_writes {
 	void *ctx;
+	/* data to write - either a buffer, either a vector of segments */
 	char * buf;
+	struct iovec *iov;
+	int iovcnt;
 	unsigned int len;
 	struct tcp_pending_writes *next;
 };
 
+struct tcp_conn_link {
+	struct tcp_conn *next;
+	struct tcp_conn *prev;
+	unsigned int hash;
+};
+
 struct tcp_conn {
 	/* connection ID - stored in replies and used for faster search */
 	unsigned int id;
@@ -50,18 +67,27 @@ struct tcp_conn {
 	gen_lock_t state_lock;
 	/* state of the connection */
 	tcp_conn_state state;
+	/* deadline (in ticks) for the current op or for the idle conn */
 	unsigned int timeout;
-	/* ref conter - how many threads are currently using this connection */
+	/* timer enforcing "timeout" - it holds a ref while pending */
+	struct wheel_timer timer;
+	/* ref conter - how many threads are currently using this connection
+	 * (changed only with atomic ops) */
 	volatile int ref;
 	/* network  info */
 	int socket;
 	struct receive_info rcv;
 	unsigned short port_alias;
-	/* read info - what was read so far */
+	/* read info - receive buffer, shared with the messages framed in it;
+	 * all the positions are offsets in the buffer */
 	struct _in_data {
-		struct sip_msg *msg;
-		unsigned int msg_len;
-		unsigned int size;
+		struct sip_msg_buf *buf;
+		unsigned int start;    /* start of the current message */
+		unsigned int end;      /* end of the data read so far */
+		unsigned int scan;     /* where the search for the end of the
+		                        * headers resumes */
+		unsigned int msg_len;  /* len of the current message, 0 if the
+		                        * headers are not complete yet */
 	}read;
 	/* write info - pending writes */
 	struct _out_data {
@@ -69,12 +95,11 @@ struct tcp_conn {
 		unsigned int offset;
 		struct tcp_pending_writes *first;
 		struct tcp_pending_writes *last;
+		unsigned int pending_no;   /* writes queued behind the active one */
 	}write;
 	/* linking in the hash tables (ID based and IP based) */
-	struct tcp_conn *id_next;
-	struct tcp_conn *id_prev;
-	struct tcp_conn *ip_next;
-	struct tcp_conn *ip_prev;
+	struct tcp_conn_link id_link;
+	struct tcp_conn_link ip_link;
 };
 
 
@@ -109,6 +134,10 @@ struct tcp_conn *search_tcp_conn(unsigned int id,
 		union sockaddr_union *to);
 
 
+/* sets the connection to time out "timeout" seconds from now */
+void tcp_conn_set_timeout(struct tcp_conn *conn, unsigned int timeout);
+
+
 /*
  * Tries to set a new state for a TCP connection
  * Returns:
@@ -119,6 +148,12 @@ struct tcp_conn *search_tcp_conn(unsigned int id,
 int set_conn_state(struct tcp_conn *conn, tcp_conn_state new_state);
 
 
+/* pending write nodes - taken from / returned to a cache of free nodes */
+struct tcp_pending_writes* tcp_pw_alloc(void);
+
+void tcp_pw_free(struct tcp_pending_writes *pw);
+
+
 /*
  * adds a new pending write to the transaction
  * WARNING: requires external locking over the connection
@@ -127,14 +162,13 @@ int set_conn_state(struct tcp_conn *conn, tcp_conn_state new_state);
  *   -1 - failure (shm)
  */
 static inline int conn_add_pending_write(struct tcp_conn *conn, char * buf,
-												unsigned int len, void *ctx)
+				struct iovec *iov, int iovcnt, unsigned int len, void *ctx)
 {
 	struct tcp_pending_writes *added;
 
 	LM_DBG("pending write on conn %p (%d)\n", conn, conn->id);
 
-	added = (struct tcp_pending_writes*)shm_malloc
-					(sizeof(struct tcp_pending_writes));
+	added = tcp_pw_alloc();
 	if (added==NULL) {
 		LM_ERR("no more shm memory\n");
 		return -1;
@@ -142,35 +176,19 @@ static inline int conn_add_pending_write(struct tcp_conn *conn, char * buf,
 
 	added->ctx = ctx;
 	added->buf = buf;
+	added->iov = iov;
+	added->iovcnt = iovcnt;
 	added->len = len;
 
 	added->next = NULL;
 	if (conn->write.first==NULL) {conn->write.first = added;}
 	else {conn->write.last->next = added;}
 	conn->write.last = added;
+	conn->write.pending_no++;
 
 	return 0;
 }
 
 
-/*
- * consumes the next pending write and move it as active write.
- * WARNING: requires external locking over the connection
- */
-static inline void conn_upload_next_write(struct tcp_conn *conn)
-{
-	struct tcp_pending_writes *old;
-
-	LM_DBG("uploading next write on conn %p (%d)\n", conn, conn->id);
-
-	old = conn->write.first;
-	conn->write.active = *old;
-	conn->write.offset = 0;
-	conn->write.first = old->next;
-	if (conn->write.first==NULL)
-		conn->write.last = NULL;
-	shm_free(old);
-}
-
 #endif
 
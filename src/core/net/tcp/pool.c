@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  tcp_pool_find() - lookup without creating the peer
+ *  2010-09-xx  slots reserved while their connection is opened
+ *  2010-09-xx  a slot whose connection is gone is freed, even if other
+ *              connections to the peer are alive
+ */
+
+#include <string.h>
+
+#include "../../log.h"
+#include "../../mem/mem.h"
+#include "../../utils.h"
+#include "../../mi/mi.h"
+#include "../../locking/atomic_ops.h"
+#include "pool.h"
+
+/* the peers are never removed, so the table does not need to grow */
+#define TCP_POOL_BUCKETS  256
+
+static struct tcp_pool {
+	/* serializes the inserts; the lookups go without it */
+	gen_lock_t lock;
+	struct tcp_peer * volatile buckets[TCP_POOL_BUCKETS];
+	unsigned int peers;
+} *tcp_pool = NULL;
+
+
+static struct mi_root* mi_tcp_pool(struct mi_root *cmd, void *param);
+
+static mi_funcs_t mi_tcp_pool_cmds[] = {
+	{ "tcp_pool",    mi_tcp_pool,  MI_NO_INPUT_FLAG,  0,  0 },
+	{ 0, 0, 0, 0, 0}
+};
+
+
+int init_tcp_pool(void)
+{
+	tcp_pool = (struct tcp_pool*)shm_malloc(sizeof(struct tcp_pool));
+	if (tcp_pool==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset( tcp_pool, 0, sizeof(struct tcp_pool));
+	if (lock_init( &tcp_pool->lock )==0) {
+		LM_ERR("failed to init the TCP pool lock\n");
+		goto error;
+	}
+
+	if (register_mi_mod( "tcp", mi_tcp_pool_cmds)<0) {
+		LM_ERR("failed to register MI commands\n");
+		goto error;
+	}
+
+	return 0;
+error:
+	shm_free(tcp_pool);
+	tcp_pool = NULL;
+	return -1;
+}
+
+
+void destroy_tcp_pool(void)
+{
+	struct tcp_peer *peer;
+	struct tcp_peer *next;
+	int i;
+
+	if (tcp_pool==NULL)
+		return;
+
+	for( i=0 ; i<TCP_POOL_BUCKETS ; i++ ) {
+		for( peer=tcp_pool->buckets[i] ; peer ; peer=next ) {
+			next = peer->next;
+			lock_destroy( &peer->lock );
+			shm_free(peer);
+		}
+	}
+	lock_destroy( &tcp_pool->lock );
+	shm_free(tcp_pool);
+	tcp_pool = NULL;
+}
+
+
+static inline unsigned int tcp_peer_hash(struct socket_info *source,
+												union sockaddr_union *to)
+{
+	struct ip_addr ip;
+	unsigned int h;
+	int i;
+
+	ip.len = 0;
+	su2ip_addr( &ip, to);
+	h = su_getport(to) ^ (unsigned int)(unsigned long)source;
+	for( i=0 ; i<(int)(ip.len/4) ; i++ ) {
+		h ^= ip.u.addr32[i];
+		h *= 0x9e3779b1u;
+		h ^= h >> 15;
+	}
+	return h;
+}
+
+
+static inline struct tcp_peer* tcp_peer_lookup(struct tcp_peer *peer,
+		struct socket_info *source, union sockaddr_union *to, unsigned int h)
+{
+	for( ; peer ; peer=peer->next )
+		if (peer->hash==h && peer->source==source && su_cmp(&peer->dst,to))
+			return peer;
+	return NULL;
+}
+
+
+struct tcp_peer* tcp_pool_find(struct socket_info *source,
+													union sockaddr_union *to)
+{
+	unsigned int h;
+
+	if (source->shard_master)
+		source = source->shard_master;
+
+	h = tcp_peer_hash( source, to);
+	return tcp_peer_lookup( tcp_pool->buckets[h % TCP_POOL_BUCKETS],
+		source, to, h);
+}
+
+
+struct tcp_peer* tcp_pool_peer(struct socket_info *source,
+													union sockaddr_union *to)
+{
+	struct tcp_peer *peer;
+	unsigned int h;
+	int b;
+
+	/* all the shards of a listener share the same pool */
+	if (source->shard_master)
+		source = source->shard_master;
+
+	h = tcp_peer_hash( source, to);
+	b = h % TCP_POOL_BUCKETS;
+
+	/* the peers are only added at the head of the bucket and never
+	 * removed, so the lookup is safe without locking */
+	peer = tcp_peer_lookup( tcp_pool->buckets[b], source, to, h);
+	if (peer)
+		return peer;
+
+	lock_get( &tcp_pool->lock );
+
+	/* added meanwhile ? */
+	peer = tcp_peer_lookup( tcp_pool->buckets[b], source, to, h);
+	if (peer)
+		goto done;
+
+	peer = (struct tcp_peer*)shm_malloc(sizeof(struct tcp_peer));
+	if (peer==NULL) {
+		LM_ERR("no more shm memory\n");
+		goto done;
+	}
+	memset( peer, 0, sizeof(struct tcp_peer));
+	lock_init( &peer->lock );
+	peer->source = source;
+	peer->dst = *to;
+	peer->hash = h;
+	peer->next = tcp_pool->buckets[b];
+	/* the peer must be complete before being visible to the readers */
+	membar_full();
+	tcp_pool->buckets[b] = peer;
+	tcp_pool->peers++;
+
+done:
+	lock_release( &tcp_pool->lock );
+	return peer;
+}
+
+
+/* the connection in slot "k" (referenced), NULL if gone - only the one
+ * with the id of the slot: search_tcp_conn() falls back to any other
+ * connection to the peer, maybe one of the other slots */
+static inline struct tcp_conn* tcp_pool_conn(struct tcp_peer *peer, int k)
+{
+	struct tcp_conn *conn;
+
+	conn = search_tcp_conn( peer->ids[k], &peer->dst);
+	if (conn && conn->id!=peer->ids[k]) {
+		unref_tcp_conn(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+/* how busy a connection is - the active write plus the queued ones */
+#define tcp_conn_load(_c) \
+	((_c)->state==TCP_CONN_WRITING ? 1+(_c)->write.pending_no : 0)
+
+
+struct tcp_conn* tcp_pool_select(struct tcp_peer *peer, int *slot)
+{
+	struct tcp_conn *conns[TCP_POOL_MAX];
+	struct tcp_conn *best;
+	unsigned int load, best_load;
+	int i, k, n;
+
+	*slot = -1;
+	best = NULL;
+	best_load = 0;
+	n = 0;
+	memset( conns, 0, sizeof(conns));
+
+	/* start from a different slot each time (round-robin) */
+	for( i=0 ; i<tcp_pool_size ; i++ ) {
+		k = (peer->rr + i) % tcp_pool_size;
+		/* being opened by somebody else -> neither free nor usable */
+		if (peer->opening & (1u<<k))
+			continue;
+		if (peer->ids[k]==0) {
+			if (*slot<0)
+				*slot = k;
+			continue;
+		}
+		conns[k] = tcp_pool_conn( peer, k);
+		if (conns[k]==NULL || conns[k]->state==TCP_CONN_TERM) {
+			/* connection gone -> free the slot */
+			if (conns[k]) {
+				unref_tcp_conn(conns[k]);
+				conns[k] = NULL;
+			}
+			peer->ids[k] = 0;
+			if (*slot<0)
+				*slot = k;
+			continue;
+		}
+		n++;
+		load = tcp_conn_load(conns[k]);
+		if (load==0) {
+			/* idle connection - nothing better than this */
+			best = conns[k];
+			break;
+		}
+		if (best==NULL || (tcp_pool_policy==TCP_POOL_LEAST_QUEUED &&
+		load<best_load)) {
+			best = conns[k];
+			best_load = load;
+		}
+	}
+
+	/* all busy, but we may still open a new connection */
+	if (best && best_load!=0 && *slot>=0)
+		best = NULL;
+
+	/* release the connections we do not use */
+	for( k=0 ; k<tcp_pool_size ; k++ )
+		if (conns[k] && conns[k]!=best)
+			unref_tcp_conn(conns[k]);
+
+	if (best) {
+		peer->rr++;
+		*slot = -1;
+	}
+
+	LM_DBG("peer %p: %d alive conns, selected %p, free slot %d\n",
+		peer, n, best, *slot);
+
+	return best;
+}
+
+
+int tcp_pool_parse_peer(char *s, union sockaddr_union *su)
+{
+	struct ip_addr ip;
+	str host;
+	char *p;
+	unsigned short port;
+	int err;
+
+	p = strrchr( s, ':');
+	if (p==NULL || p==s) {
+		LM_ERR("missing port in TCP pool peer <%s>\n", s);
+		return -1;
+	}
+	port = str2s( p+1, strlen(p+1), &err);
+	if (err!=0 || port==0) {
+		LM_ERR("bad port in TCP pool peer <%s>\n", s);
+		return -1;
+	}
+
+	host.s = s;
+	host.len = p - s;
+	if (host.len>2 && host.s[0]=='[' && host.s[host.len-1]==']') {
+		host.s++;
+		host.len -= 2;
+		err = str2ip6( &host, &ip);
+	} else {
+		err = str2ip( &host, &ip);
+	}
+	if (err!=0) {
+		LM_ERR("bad IP in TCP pool peer <%s> (only IPs are accepted)\n", s);
+		return -1;
+	}
+
+	return init_su( su, &ip, port);
+}
+
+
+static struct mi_root* mi_tcp_pool(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node;
+	struct tcp_peer *peer;
+	struct tcp_conn *conn;
+	struct ip_addr ip;
+	unsigned int conns, busy, pending;
+	int i, k;
+
+	rpl_tree = init_mi_tree( 200, MI_SSTR(MI_OK));
+	if (rpl_tree==0)
+		return 0;
+
+	for( i=0 ; i<TCP_POOL_BUCKETS ; i++ ) {
+		for( peer=tcp_pool->buckets[i] ; peer ; peer=peer->next ) {
+
+			conns = busy = pending = 0;
+			tcp_pool_lock(peer);
+			for( k=0 ; k<tcp_pool_size ; k++ ) {
+				if (peer->ids[k]==0 || (conn=tcp_pool_conn( peer, k))==NULL)
+					continue;
+				conns++;
+				if (conn->state==TCP_CONN_WRITING) {
+					busy++;
+					pending += conn->write.pending_no;
+				}
+				unref_tcp_conn(conn);
+			}
+			tcp_pool_unlock(peer);
+
+			memset( &ip, 0, sizeof(ip));
+			su2ip_addr( &ip, &peer->dst);
+			node = addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Peer"),
+				"%s:%d", ip_addr2a(&ip), su_getport(&peer->dst));
+			if (node==0)
+				goto error;
+
+			if (add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Source"),
+			peer->source->sock_str.s, peer->source->sock_str.len)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Conns"), "%u", conns)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Busy"), "%u", busy)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Pending"), "%u", pending)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Writes"), "%lu",
+				peer->writes)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Opened"), "%lu",
+				peer->opened)==0 ||
+			addf_mi_attr( node, 0, MI_SSTR("Queued"), "%lu",
+				peer->queued)==0 )
+				goto error;
+		}
+	}
+
+	return rpl_tree;
+error:
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  tcp_pool_find() - lookup without creating the peer
+ */
+
+/*
+ * Pools of outbound TCP connections (enabled by tcp_pool_size).
+ *
+ * A peer is a (source socket, destination) pair; it has up to
+ * tcp_pool_size slots, each holding the ID of a connection opened to the
+ * peer. The pool does not keep references to the connections - a slot is
+ * validated with search_tcp_conn() and freed if its connection is gone.
+ *
+ * A slot is reserved (marked as opening) with the lock of the peer held
+ * and the connection is opened after releasing it; the concurrent sends
+ * to a peer with a connection being opened wait for it and queue on it
+ * instead of opening one each.
+ */
+
+#ifndef _TCP_POOL_H
+#define _TCP_POOL_H
+
+#include "../../locking/locking.h"
+#include "../net_params.h"
+#include "../socket.h"
+#include "conns.h"
+
+struct tcp_peer {
+	struct socket_info *source;
+	union sockaddr_union dst;
+	unsigned int hash;
+	/* protects the slots and the counters */
+	gen_lock_t lock;
+	unsigned int rr;
+	/* IDs of the pooled connections (0 - free slot) */
+	unsigned int ids[TCP_POOL_MAX];
+	/* bitmask of the slots with a connection being opened */
+	unsigned int opening;
+	/* stats */
+	unsigned long writes;   /* writes sent via the pool */
+	unsigned long opened;   /* connections opened */
+	unsigned long queued;   /* writes queued behind other writes */
+	struct tcp_peer *next;
+};
+
+
+int init_tcp_pool(void);
+
+void destroy_tcp_pool(void);
+
+/* gets the peer for a source socket and destination, NULL if none yet */
+struct tcp_peer* tcp_pool_find(struct socket_info *source,
+		union sockaddr_union *to);
+
+/* gets the peer (created if needed) for a source socket and destination */
+struct tcp_peer* tcp_pool_peer(struct socket_info *source,
+		union sockaddr_union *to);
+
+/* picks a connection of the peer (returned with a ref) or, if a new one
+ * must be opened, returns NULL and the slot to store it in ("*slot" is -1
+ * if the pool has no free slot and no connection - only while the other
+ * slots are being opened); the lock of the peer must be held */
+struct tcp_conn* tcp_pool_select(struct tcp_peer *peer, int *slot);
+
+#define tcp_pool_lock(_peer)    lock_get( &(_peer)->lock )
+#define tcp_pool_unlock(_peer)  lock_release( &(_peer)->lock )
+
+#define tcp_pool_reserve(_peer, _slot)  ((_peer)->opening |= 1u<<(_slot))
+#define tcp_pool_unreserve(_peer, _slot) ((_peer)->opening &= ~(1u<<(_slot)))
+
+/* parses a configured peer ("ip:port" or "[ipv6]:port") */
+int tcp_pool_parse_peer(char *s, union sockaddr_union *su);
+
+#endif
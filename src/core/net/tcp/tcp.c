@@ -21,6 +21,25 @@
  * history:
  * ---------
  *  2010-03-xx  created (bogdan)
+ *  2010-09-xx  sharded listeners (SO_REUSEPORT)
+ *  2010-09-xx  messages allocated together with their parsing arena,
+ *              a growing message is copied, not realloc'ed
+ *  2010-09-xx  vectored writes (writev_message)
+ *  2010-09-xx  connection timeouts set via tcp_conn_set_timeout()
+ *  2010-09-xx  incremental framing in a shared receive buffer; the
+ *              messages are handed off without copying
+ *  2010-09-xx  pools of outbound connections (tcp_pool_size), with merged
+ *              connects and warm-up
+ *  2010-09-xx  queued writes coalesced in a single sendmsg()
+ *  2010-09-xx  fds routed to their reactor (in_reactor/out_reactor)
+ *  2010-09-xx  accept run by the reactor thread (CALLBACK_INLINE_F)
+ *  2010-09-xx  end of headers found with scan_eoh()
+ *  2010-09-xx  messages read are queued no matter the overload
+ *  2010-09-xx  the messages handed off are zero terminated
+ *  2010-09-xx  all the messages handed off without copying, as slices of
+ *              the receive buffer (the parsers stop at msg->len)
+ *  2010-09-xx  existing connections reused before opening pooled ones
+ *  2010-09-xx  pooled connections opened without the lock of the peer
  */
 
 /*TODO
@@ -31,6 +50,7 @@
 #include <stdlib.h> /*exit() */
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
 
 #include "../../log.h"
 #include "../../mem/mem.h"
@@ -41,10 +61,12 @@
 #include "../../context_api.h"
 #include "../../timer.h"
 #include "../../parser/parse_content.h"
+#include "../../parser/scan.h"
 #include "../net_params.h"
 #include "../proto.h"
 #include "../socket.h"
 #include "conns.h"
+#include "pool.h"
 
 static int tcp_init(void);
 
@@ -56,6 +78,9 @@ static int tcp_accept(struct socket_info *si);
 
 static int a_tcp_write(void *ctx, struct socket_info *source,
 		char *buf, unsigned int len, union sockaddr_union* to, void *extra);
+static int a_tcp_writev(void *ctx, struct socket_info *source,
+		struct iovec *iov, int iovcnt, unsigned int len,
+		union sockaddr_union* to, void *extra);
 
 
 struct proto_interface interface = {
@@ -68,20 +93,59 @@ struct proto_interface interface = {
 		tcp_destroy,             /* tcp destroy function */
 		tcp_init_listener,       /* init listener function */
 		tcp_accept,              /* tcp default event handler */
-		a_tcp_write              /* tcp write function */
+		a_tcp_write,             /* tcp write function */
+		a_tcp_writev,            /* tcp vectored write function */
+		CALLBACK_INLINE_F        /* accept is run by the reactor */
 	}
 };
 
 
 
+static int tcp_pool_warmup(void *param);
+
+/* fires once, at startup, to open the connections of tcp_pool_peer */
+static struct wheel_timer tcp_pool_warmup_timer;
+
+
 static int tcp_init(void)
 {
-	return init_tcp_conns();
+	union sockaddr_union su;
+	struct net_str_list *l;
+
+	if (init_tcp_conns()<0)
+		return -1;
+
+	if (tcp_pool_size<=0)
+		return 0;
+
+	if (tcp_pool_size>TCP_POOL_MAX) {
+		LM_WARN("tcp_pool_size %d too big, using %d\n",
+			tcp_pool_size, TCP_POOL_MAX);
+		tcp_pool_size = TCP_POOL_MAX;
+	}
+
+	if (init_tcp_pool()<0) {
+		LM_ERR("failed to init the TCP connection pool\n");
+		return -1;
+	}
+
+	if (tcp_pool_peers) {
+		/* check the peers now, the warm-up is done later */
+		for( l=tcp_pool_peers ; l ; l=l->next )
+			if (tcp_pool_parse_peer( l->s, &su)<0)
+				return -1;
+		wtimer_init( &tcp_pool_warmup_timer, tcp_pool_warmup, NULL);
+		wtimer_add( &tcp_pool_warmup_timer, 0);
+	}
+
+	return 0;
 }
 
 
 static void tcp_destroy(void)
 {
+	wtimer_del( &tcp_pool_warmup_timer );
+	destroy_tcp_pool();
 	destroy_tcp_conns();
 }
 
@@ -132,6 +196,14 @@ static int tcp_init_listener(struct socket_info *si)
 		LM_ERR("setsockopt %s\n", strerror(errno));
 		goto error;
 	}
+#ifdef SO_REUSEPORT
+	/* listener sharded in several sockets */
+	if (si->shards>1 && setsockopt(si->socket, SOL_SOCKET, SO_REUSEPORT,
+				(void*)&optval, sizeof(optval))==-1) {
+		LM_ERR("setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+		goto error;
+	}
+#endif
 
 	/* tos */
 	optval = net_tos;
@@ -230,16 +302,129 @@ again:
 
 
 
-#define TCP_READ_CHUNK  4098
-#define TCP_READ_MINFREE 16
+/* the receive buffer starts with TCP_READ_CHUNK bytes and grows (by
+ * TCP_READ_CHUNK steps) only if a single message does not fit in it */
+#define TCP_READ_CHUNK  4096
+#define TCP_READ_MINFREE 512
+
+/* makes room in the receive buffer for a new read */
+static int tcp_rbuf_prepare(struct tcp_conn *conn)
+{
+	struct sip_msg_buf *rb, *old;
+	unsigned int pending;
+	unsigned int size;
+
+	old = conn->read.buf;
+	if (old && old->size >= conn->read.end + TCP_READ_MINFREE)
+		return 0;
+
+	pending = old ? conn->read.end - conn->read.start : 0;
+
+	/* nobody else uses the buffer -> just move the partial message (if
+	 * any) to the beginning; the complete messages were handed off */
+	if (old && old->ref==1 && old->size - pending >= TCP_READ_MINFREE) {
+		if (pending)
+			memmove( old->buf, old->buf+conn->read.start, pending);
+		goto rebase;
+	}
+
+	/* new buffer (the old one goes with the last message using it) */
+	size = ((pending+TCP_READ_MINFREE)/TCP_READ_CHUNK + 1) * TCP_READ_CHUNK;
+	if (conn->read.msg_len > size)
+		size = ((conn->read.msg_len-1)/TCP_READ_CHUNK + 1) * TCP_READ_CHUNK;
+	if (size > tcp_max_size + TCP_READ_CHUNK) {
+		LM_WARN("TCP message from %s larger than %d\n -> discarding\n",
+			ip_addr2a(&conn->rcv.src_ip), tcp_max_size);
+		return -1;
+	}
+
+	rb = new_sip_msg_buf(size);
+	if (rb==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	if (pending)
+		memcpy( rb->buf, old->buf+conn->read.start, pending);
+	if (old)
+		unref_sip_msg_buf(old);
+	conn->read.buf = rb;
+
+rebase:
+	if (conn->read.scan < conn->read.start)
+		conn->read.scan = conn->read.start;
+	conn->read.scan -= conn->read.start;
+	conn->read.start = 0;
+	conn->read.end = pending;
+	return 0;
+}
+
+
+/* looks for the empty line ending the headers, starting from "*scan";
+ * returns the offset of the body or 0 if not found yet (and "*scan" is
+ * set to the position to resume from) */
+static inline unsigned int tcp_find_eoh(char *buf, unsigned int *scan,
+															unsigned int end)
+{
+	const char *resume;
+	char *p;
+
+	p = scan_eoh( buf+*scan, buf+end, &resume);
+	if (p)
+		return p - buf;
+
+	*scan = resume - buf;
+	return 0;
+}
+
+
+/* gets the value of the Content-Length header (long or compact form) out
+ * of the headers, without parsing them; -1 if missing or malformed */
+static inline int tcp_content_length(char *p, char *end)
+{
+	int len;
+
+	/* the first line is skipped */
+	while ( (p=memchr(p, '\n', end-p))!=NULL ) {
+		p++;
+		if (end-p>14 && strncasecmp(p, "content-length", 14)==0) {
+			p += 14;
+		} else if (end-p>1 && (*p=='l' || *p=='L') &&
+		(p[1]==':' || p[1]==' ' || p[1]=='\t')) {
+			p++;
+		} else
+			continue;
+
+		while (p<end && (*p==' ' || *p=='\t')) p++;
+		if (p>=end || *p!=':')
+			continue;
+		for( p++ ; p<end && (*p==' ' || *p=='\t') ; p++ );
+
+		if (p>=end || *p<'0' || *p>'9')
+			return -1;
+		for( len=0 ; p<end && *p>='0' && *p<='9' ; p++ ) {
+			len = len*10 + (*p-'0');
+			if (len>tcp_max_size)
+				return -1;
+		}
+		return len;
+	}
+
+	return -1;
+}
+
+
 static int tcp_event_read( void *param )
 {
 	struct tcp_conn *conn = (struct tcp_conn*)param;
-	int n,len,eof,available;
+	struct sip_msg_buf *rb;
 	struct sip_msg *msg;
+	unsigned int eoh;
+	int len,eof,clen;
 
 	LM_DBG("read event on conn %p (%d) fd=%d\n", conn, conn->id, conn->socket);
 
+	msg = NULL;
+
 	if (conn->state==TCP_CONN_TERM) {
 		/* connection terminated by other thread -> simply unref the conn
 		 * without resubmitting it to the IN reactor */
@@ -247,51 +432,15 @@ static int tcp_event_read( void *param )
 		return 0;
 	}
 
-	if (conn->read.msg==NULL) {
-		/* starting a new message */
-
-		LM_DBG("New message\n");
-
-		conn->read.msg = (struct sip_msg*)shm_malloc
-			( sizeof(struct sip_msg) + TCP_READ_CHUNK );
-		if (conn->read.msg==NULL) {
-			LM_ERR("no more shm memory\n");
-			goto terminate_conn;
-		}
-		memset(conn->read.msg , 0, sizeof(struct sip_msg));
-		conn->read.msg->buf = (char*)(conn->read.msg+1);
-		conn->read.size = TCP_READ_CHUNK;
-		available = TCP_READ_CHUNK;
-	} else {
-
-		LM_DBG("Existing message\n");
-
-		/* already existing message */
-		available = conn->read.size - conn->read.msg->len;
-		if (available<TCP_READ_MINFREE) {
-			/* increase the buffer */
-			if (conn->read.size + TCP_READ_CHUNK > tcp_max_size) {
-				LM_WARN("TCP message from %s larger than %d\n -> discarding\n",
-					ip_addr2a(&conn->rcv.src_ip), tcp_max_size);
-				goto terminate_conn;
-			}
-			conn->read.msg = (struct sip_msg*)shm_realloc( conn->read.msg,
-				sizeof(struct sip_msg) + conn->read.size + TCP_READ_CHUNK);
-			if (conn->read.msg==NULL) {
-				LM_ERR("no more shm memory\n");
-				goto terminate_conn;
-			}
-			conn->read.size += TCP_READ_CHUNK;
-			available += TCP_READ_CHUNK;
-		}
-	}
+	if (tcp_rbuf_prepare(conn)<0)
+		goto terminate_conn;
+	rb = conn->read.buf;
 
-	len = tcp_read( conn->socket, conn->read.msg->buf+conn->read.msg->len,
-		available, &eof);
+	len = tcp_read( conn->socket, rb->buf+conn->read.end,
+		rb->size-conn->read.end, &eof);
 
 
 	/* process whatever was read */
-	msg = NULL;
 	if (len<0) {
 		/* error on reading */
 		goto terminate_conn;
@@ -300,39 +449,57 @@ static int tcp_event_read( void *param )
 			goto terminate_conn;
 	} else {
 
-		/* more data was read -> resume parsing */
-		conn->read.msg->len += len;
-again_message:
-		if ( conn->read.msg->eoh == NULL) {
-			/* not all headers parsed yet */
-			LM_DBG("not all hdrs parsed-> forcing EOH\n");
-			n = parse_msg( conn->read.msg, HDR_EOH_F );
-
-			LM_DBG("parsing returned:%d\n",n);
+		conn->read.end += len;
+
+		/* frame all the messages completed by this read */
+		while (1) {
+			if (conn->read.msg_len==0) {
+				/* skip the CRLFs (keepalives) before a message */
+				while (conn->read.start<conn->read.end &&
+				(rb->buf[conn->read.start]=='\r' ||
+				rb->buf[conn->read.start]=='\n'))
+					conn->read.start++;
+				if (conn->read.scan<conn->read.start)
+					conn->read.scan = conn->read.start;
+
+				eoh = tcp_find_eoh( rb->buf, &conn->read.scan, conn->read.end);
+				if (eoh==0) {
+					if (conn->read.end-conn->read.start > tcp_max_size) {
+						LM_WARN("TCP message from %s larger than %d\n"
+							" -> discarding\n",
+							ip_addr2a(&conn->rcv.src_ip), tcp_max_size);
+						goto terminate_conn;
+					}
+					break;
+				}
 
-			if (n<0)
-				goto terminate_conn;
-			if (n==0 && conn->read.msg->eoh ) {
-				LM_DBG("all hdrs parsed\n");
-				/* all headers found -> check the Content-Len*/
-				if (conn->read.msg->content_length==NULL)
-				{
-					LM_DBG("header len = %ld content_length = %p\n",
-						 conn->read.msg->eoh - conn->read.msg->buf,
-						 conn->read.msg->content_length );
+				clen = tcp_content_length( rb->buf+conn->read.start,
+					rb->buf+eoh);
+				if (clen<0) {
+					LM_ERR("missing or bad Content-Length in message from "
+						"%s\n", ip_addr2a(&conn->rcv.src_ip));
+					goto terminate_conn;
+				}
+				conn->read.msg_len = eoh - conn->read.start + clen;
+				if (conn->read.msg_len > tcp_max_size) {
+					LM_WARN("TCP message from %s larger than %d\n"
+						" -> discarding\n",
+						ip_addr2a(&conn->rcv.src_ip), tcp_max_size);
 					goto terminate_conn;
 				}
-				conn->read.msg_len = get_content_length(conn->read.msg) +
-					get_body(conn->read.msg) - conn->read.msg->buf; 
 			}
-		}
-		/* entire message read ? */
-		if (conn->read.msg->eoh && conn->read.msg_len<=conn->read.msg->len ) {
+
+			/* entire message read ? */
+			if (conn->read.end-conn->read.start < conn->read.msg_len)
+				break;
+
 			LM_DBG("msg completed\n");
 			/* message completed -> update conn lifetime */
 			if (conn->state!=TCP_CONN_WRITING)
-				conn->timeout = get_ticks() + tcp_lifetime;
-			/* detache the message */
+				tcp_conn_set_timeout(conn, tcp_lifetime);
+			/* the previous message goes to a worker, the last one is
+			 * handled by us; a message read from the stream cannot be
+			 * refused - the overload stops the reading instead (below) */
 			if (msg!=NULL) {
 				heap_node_t  task;
 				task.fd = 0;
@@ -340,44 +507,35 @@ again_message:
 				task.priority = TASK_PRIO_READ_IO;
 				task.cb = (fd_callback*)handle_new_msg;
 				task.cb_param = (void*)msg;
-				put_task( reactor_in->disp, task);
+				task.last_reactor = NULL;
+				if (put_task_force( reactor_in->disp, task)<0)
+					handle_new_msg(msg);
 				msg = NULL;
 			}
-			msg = conn->read.msg;
+
+			/* the message keeps pointing into the receive buffer; it may
+			 * be followed by the next one, the parsers stop at its len */
+			msg = new_sip_msg_shared( rb, rb->buf+conn->read.start,
+				conn->read.msg_len);
+			conn->read.start += conn->read.msg_len;
+			conn->read.scan = conn->read.start;
+			conn->read.msg_len = 0;
+			if (msg==NULL)
+				goto terminate_conn;
+
+			if (parse_msg( msg, HDR_VIA1_F)!=0 || msg->via1==NULL) {
+				LM_ERR("bad SIP message read from %s -> discarding\n",
+					ip_addr2a(&conn->rcv.src_ip));
+				free_sip_msg(msg);
+				msg = NULL;
+				continue;
+			}
+
 			/* fill in last network data */
 			msg->rcv = conn->rcv;
 			msg->rcv.proto_reserved1 = conn->id;
 			msg->rcv.proto_reserved2 = 0;
 			conn->port_alias = msg->via1->port;
-			/* check if actually read more than a message !! */
-			if ( conn->read.msg_len/*msg len*/ < msg->len /*read len*/ ) {
-				/* pending data */
-				n = msg->len - conn->read.msg_len;
-				len = ((n/TCP_READ_CHUNK)+1)*TCP_READ_CHUNK;
-				/* adjust len of current read message */
-				msg->len = conn->read.msg_len;
-				LM_DBG("extra data (%d)-> New message\n",n);
-				/* create a new message for extra data */
-				conn->read.msg = (struct sip_msg*)shm_malloc
-					( sizeof(struct sip_msg) + len );
-				if (conn->read.msg==NULL) {
-					LM_ERR("no more shm memory\n");
-					goto terminate_conn;
-				}
-				memset(conn->read.msg , 0, sizeof(struct sip_msg));
-				conn->read.msg->buf = (char*)(conn->read.msg+1);
-				conn->read.msg->len = n;
-				conn->read.size = len;
-				conn->read.msg_len = 0;
-				memcpy( conn->read.msg->buf, msg->buf+msg->len, n);
-
-				goto again_message;
-			} else {
-				/* no extra data -> detach msg from conn */
-				conn->read.msg = NULL;
-				conn->read.size = 0;
-				conn->read.msg_len = 0;
-			}
 		}
 		/* continue reading */
 	}
@@ -387,9 +545,26 @@ again_message:
 	 *             so under state lock*/
 	lock_tcp_conn(conn);
 	if (!eof && conn->state!=TCP_CONN_TERM) {
-		LM_DBG("submit IN on conn %p (%d)\n", conn, conn->id);
-		submit_task(reactor_in, (fd_callback*)tcp_event_read, (void*)conn,
-			TASK_PRIO_READ_IO, conn->socket, 0);
+		if (dispatcher_overloaded(reactor_in->disp)) {
+			/* stop reading until the overload is over; the read is
+			 * retried as a task, so a TERM state is still seen */
+			heap_node_t  task;
+			LM_DBG("overloaded, holding IN on conn %p (%d)\n",
+				conn, conn->id);
+			task.fd = conn->socket;
+			task.flags = 0;
+			task.priority = TASK_PRIO_READ_IO;
+			task.cb = (fd_callback*)tcp_event_read;
+			task.cb_param = (void*)conn;
+			task.last_reactor = NULL;
+			if (dispatcher_defer(reactor_in->disp, task)<0)
+				submit_task(in_reactor(conn->socket), (fd_callback*)tcp_event_read,
+					(void*)conn, TASK_PRIO_READ_IO, conn->socket, 0);
+		} else {
+			LM_DBG("submit IN on conn %p (%d)\n", conn, conn->id);
+			submit_task(in_reactor(conn->socket), (fd_callback*)tcp_event_read,
+				(void*)conn, TASK_PRIO_READ_IO, conn->socket, 0);
+		}
 	} else {
 		LM_DBG("NO submit IN for conn %p (%d)\n", conn, conn->id);
 		unref_tcp_conn(conn);
@@ -404,10 +579,12 @@ again_message:
 	return 0;
 
 terminate_conn:
+	if (msg)
+		free_sip_msg(msg);
 	/* set TERMINATE state (conn no longer in IN reactor) */
 	if (set_conn_state( conn, TCP_CONN_TERM)!=-1) {
 		/* force timeout on any waiting write */
-		conn->timeout = get_ticks();
+		tcp_conn_set_timeout(conn, 0);
 		/* remove connection from conn tables */
 		remove_tcp_conn(conn,1);
 	}
@@ -435,8 +612,8 @@ static int tcp_accept(struct socket_info *si)
 
 	/* network op done, re-submit the listening socket */
 	LM_DBG("submit in on socket %d\n", si->socket);
-	submit_task(reactor_in, (fd_callback *) tcp_accept, (void*)si,
-		TASK_PRIO_READ_IO, si->socket, 0);
+	submit_read_task(si->reactor, (fd_callback *) tcp_accept, (void*)si,
+		TASK_PRIO_READ_IO, si->socket, CALLBACK_INLINE_F);
 
 	/* handle new socket */
 	if (init_tcp_socket(s)<0){
@@ -446,7 +623,9 @@ static int tcp_accept(struct socket_info *si)
 	}
 
 	/* add socket to TCP list */
-	if ( (conn=create_tcp_conn( s, &su, si, TCP_CONN_READY))==NULL ) {
+	/* all the shards of a listener are seen as one socket */
+	if ( (conn=create_tcp_conn( s, &su, si->shard_master,
+	TCP_CONN_READY))==NULL ) {
 		LM_ERR("add_new_conn failed, closing socket\n");
 		close(s);
 		return -1;
@@ -454,7 +633,7 @@ static int tcp_accept(struct socket_info *si)
 
 	/* add socket to the reactor */
 	LM_DBG("submit in on conn %p (%d)\n", conn, conn->id);
-	submit_task(reactor_in, tcp_event_read, (void*)conn,
+	submit_task(in_reactor(s), tcp_event_read, (void*)conn,
 		TASK_PRIO_READ_IO, s, 0);
 
 	return 0;
@@ -463,11 +642,81 @@ static int tcp_accept(struct socket_info *si)
 
 static int a_tcp_send_resume(struct tcp_conn *conn);
 
+static int a_tcp_send_queue(struct tcp_conn *conn);
+
 
-static inline int a_tcp_send(struct tcp_conn *conn, char *buf, unsigned len,
-												unsigned int offset, void *ctx)
+/* the active write of the connection is done - goes for the queued writes
+ * (if any) or releases the connection; the ref of the writer is passed to
+ * the queued writes or dropped */
+static inline void tcp_write_done(struct tcp_conn *conn)
 {
 	heap_node_t  task;
+
+	tcp_conn_set_timeout(conn, tcp_lifetime);
+	/* change the state WRITING -> READY (if allowed) */
+	if (set_conn_state( conn, TCP_CONN_READY)==1 ) {
+		/* we still have pending writes */
+		conn->write.offset = 0;
+		unlock_tcp_conn( conn );
+		/* create a new task to send all of them on this fd */
+		task.fd = conn->socket;
+		task.flags = 0;
+		task.priority = TASK_PRIO_RESUME_EXEC;
+		task.cb = (fd_callback*)a_tcp_send_queue;
+		task.cb_param = (void*)conn;
+		task.last_reactor = NULL;
+		/* the queued writes cannot be refused - their contexts wait */
+		if (put_task_force( reactor_out->disp, task)<0)
+			a_tcp_send_queue(conn);
+		/* ref is passed to the following writes */
+	} else {
+		/* no other writes to be done, done, unref conn */
+		unref_tcp_conn( conn );
+	}
+}
+
+
+/* max number of segments pushed with a single sendmsg() */
+#define TCP_IOV_MAX  64
+
+/* writes the segments of the vector, skipping the first "offset" bytes */
+static inline int tcp_sendv(int s, struct iovec *iov, int iovcnt,
+														unsigned int offset)
+{
+	struct iovec v[TCP_IOV_MAX];
+	struct msghdr mh;
+	int i, k;
+
+	/* skip the segments already written */
+	for( i=0 ; i<iovcnt && offset>=iov[i].iov_len ; i++ )
+		offset -= iov[i].iov_len;
+	for( k=0 ; i<iovcnt && k<TCP_IOV_MAX ; i++,k++ )
+		v[k] = iov[i];
+	if (k==0)
+		return 0;
+	v[0].iov_base = (char*)v[0].iov_base + offset;
+	v[0].iov_len -= offset;
+
+	memset( &mh, 0, sizeof(mh));
+	mh.msg_iov = v;
+	mh.msg_iovlen = k;
+
+	return sendmsg( s, &mh,
+		#ifdef MSG_NOSIGNAL
+		MSG_NOSIGNAL
+		#else
+		0
+		#endif
+		);
+}
+
+
+/* sends "len" bytes from "buf" or, if "iov" is set, from the vector of
+ * segments, starting from "offset" */
+static inline int a_tcp_send(struct tcp_conn *conn, char *buf,
+		struct iovec *iov, int iovcnt, unsigned len,
+		unsigned int offset, void *ctx)
+{
 	int n;
 	int x;
 
@@ -481,6 +730,9 @@ static inline int a_tcp_send(struct tcp_conn *conn, char *buf, unsigned len,
 		x = 0 ;//rand() % 4 ;
 		LM_DBG("------%d\n",x);
 		if (x==0) {
+		if (iov)
+			n = tcp_sendv(conn->socket, iov, iovcnt, offset);
+		else
 		n = send(conn->socket, buf+offset, len-offset,
 			#ifdef MSG_NOSIGNAL
 			MSG_NOSIGNAL
@@ -505,11 +757,13 @@ static inline int a_tcp_send(struct tcp_conn *conn, char *buf, unsigned len,
 					 * and wait for write indication */
 					conn->write.active.ctx = ctx;
 					conn->write.active.buf = buf;
+					conn->write.active.iov = iov;
+					conn->write.active.iovcnt = iovcnt;
 					conn->write.active.len = len;
 					conn->write.offset = offset;
-					conn->timeout = get_ticks() + tcp_write_timeout;
+					tcp_conn_set_timeout(conn, tcp_write_timeout);
 					LM_DBG("submit out on conn %p (%d)\n", conn, conn->id);
-					submit_task(reactor_out,
+					submit_task(out_reactor(conn->socket),
 						(fd_callback*)a_tcp_send_resume,
 						(void*)conn, TASK_PRIO_RESUME_IO, conn->socket, 0);
 					unlock_tcp_conn(conn);
@@ -527,7 +781,7 @@ static inline int a_tcp_send(struct tcp_conn *conn, char *buf, unsigned len,
 				if( set_conn_state( conn, TCP_CONN_TERM)!=-1) {
 					remove_tcp_conn(conn,1);
 					/* fire the IN reactor */
-					fire_fd( reactor_in, conn->socket);
+					fire_fd( in_reactor(conn->socket), conn->socket);
 				}
 				return -1;
 			}
@@ -537,27 +791,157 @@ static inline int a_tcp_send(struct tcp_conn *conn, char *buf, unsigned len,
 		offset += n;
 		if (offset==len) {
 			/* complete buffer was written - success */
-			conn->timeout = get_ticks() + tcp_lifetime;
 			LM_DBG("write completed on conn %p (%d)\n", conn, conn->id);
-			/* change the state WRITING -> READY (if allowed) */
-			if (set_conn_state( conn, TCP_CONN_READY)==1 ) {
-				/* we still have pending writes */
-				conn_upload_next_write(conn);
-				unlock_tcp_conn( conn );
-				/* create a new task to resume writes on this fd */
-				task.fd = conn->socket;
-				task.flags = 0;
-				task.priority = TASK_PRIO_RESUME_EXEC;
-				task.cb = (fd_callback*)a_tcp_send_resume;
-				task.cb_param = (void*)conn;
-				put_task( reactor_out->disp, task);
-				/* ref is passed to the following writes */
+			tcp_write_done(conn);
+			return 0;
+		}
+
+		/* still have something to write -> try again */
+	} while (1);
+
+	return 0;
+}
+
+
+/* max bytes pushed with a single sendmsg() out of the queued writes */
+#define TCP_BATCH_BYTES  (64*1024)
+
+/* sends the queued writes of the connection, as many as possible with a
+ * single sendmsg() (up to TCP_IOV_MAX segments or TCP_BATCH_BYTES), and
+ * resumes in one pass the contexts of the writes fully sent; the first
+ * "write.offset" bytes of the first queued write were already sent */
+static int a_tcp_send_queue(struct tcp_conn *conn)
+{
+	struct iovec v[TCP_IOV_MAX];
+	struct msghdr mh;
+	struct tcp_pending_writes *pw;
+	struct tcp_pending_writes *done;
+	struct tcp_pending_writes **last;
+	unsigned int offset, size;
+	int i, k, n;
+
+	do {
+		if (conn->state==TCP_CONN_TERM) {
+			/* connection terminated by other thread -> simply unref it */
+			unref_tcp_conn( conn );
+			return -1;
+		}
+
+		/* gather the queued writes in a single vector */
+		lock_tcp_conn(conn);
+		offset = conn->write.offset;
+		size = 0;
+		k = 0;
+		for( pw=conn->write.first ; pw && k<TCP_IOV_MAX &&
+		size<TCP_BATCH_BYTES ; pw=pw->next ) {
+			if (pw->iov) {
+				for( i=0 ; i<pw->iovcnt && k<TCP_IOV_MAX ; i++ ) {
+					if (offset>=pw->iov[i].iov_len) {
+						offset -= pw->iov[i].iov_len;
+						continue;
+					}
+					v[k].iov_base = (char*)pw->iov[i].iov_base + offset;
+					v[k].iov_len = pw->iov[i].iov_len - offset;
+					size += v[k++].iov_len;
+					offset = 0;
+				}
 			} else {
-				/* no other writes to be done, done, unref conn */
-				unref_tcp_conn( conn );
+				v[k].iov_base = pw->buf + offset;
+				v[k].iov_len = pw->len - offset;
+				size += v[k++].iov_len;
+				offset = 0;
 			}
+		}
+		unlock_tcp_conn(conn);
+
+		LM_DBG("sending %d queued segments (%u bytes) on conn %p (%d)\n",
+			k, size, conn, conn->id);
+
+		memset( &mh, 0, sizeof(mh));
+		mh.msg_iov = v;
+		mh.msg_iovlen = k;
+
+		n = sendmsg( conn->socket, &mh,
+			#ifdef MSG_NOSIGNAL
+			MSG_NOSIGNAL
+			#else
+			0
+			#endif
+			);
+
+		if (n<0) {
+			if (errno==EINTR)
+				continue;
+			if (errno==EAGAIN || errno==EWOULDBLOCK) {
+				/* blocking -> wait for write indication */
+				lock_tcp_conn(conn);
+				if (conn->state!=TCP_CONN_TERM) {
+					tcp_conn_set_timeout(conn, tcp_write_timeout);
+					LM_DBG("submit out on conn %p (%d)\n", conn, conn->id);
+					submit_task(out_reactor(conn->socket),
+						(fd_callback*)a_tcp_send_queue,
+						(void*)conn, TASK_PRIO_RESUME_IO, conn->socket, 0);
+					unlock_tcp_conn(conn);
+					return 1;
+				}
+				unlock_tcp_conn(conn);
+				unref_tcp_conn(conn);
+				return -1;
+			}
+			LM_ERR("failed to send: (%d) %s\n", errno, strerror(errno));
+			/* write failure -> trash the connection; the queued writes
+			 * are resumed with failure by the state change */
+			if( set_conn_state( conn, TCP_CONN_TERM)!=-1) {
+				remove_tcp_conn(conn,1);
+				/* fire the IN reactor */
+				fire_fd( in_reactor(conn->socket), conn->socket);
+			} else {
+				unref_tcp_conn(conn);
+			}
+			return -1;
+		}
+
+		/* take out the writes fully sent */
+		done = NULL;
+		last = &done;
+		lock_tcp_conn(conn);
+		if (conn->state==TCP_CONN_TERM) {
+			/* the queued writes were already resumed with failure */
+			unlock_tcp_conn(conn);
+			unref_tcp_conn(conn);
+			return -1;
+		}
+		n += conn->write.offset;
+		while ( (pw=conn->write.first)!=NULL && (unsigned int)n>=pw->len ) {
+			n -= pw->len;
+			conn->write.first = pw->next;
+			conn->write.pending_no--;
+			*last = pw;
+			last = &pw->next;
+		}
+		*last = NULL;
+		if (conn->write.first==NULL)
+			conn->write.last = NULL;
+		conn->write.offset = n;
+		unlock_tcp_conn(conn);
+
+		if (done) {
+			tcp_conn_set_timeout(conn, tcp_lifetime);
+			/* resume the contexts of the completed writes */
+			while ( (pw=done)!=NULL ) {
+				done = pw->next;
+				if (pw->ctx)
+					context_resume( pw->ctx, 0);
+				tcp_pw_free(pw);
+			}
+		}
+
+		/* change the state WRITING -> READY (if nothing left) */
+		if (set_conn_state( conn, TCP_CONN_READY)!=1 ) {
+			unref_tcp_conn( conn );
 			return 0;
 		}
+		unlock_tcp_conn( conn );
 
 		/* still have something to write -> try again */
 	} while (1);
@@ -575,7 +959,8 @@ static int a_tcp_send_resume(struct tcp_conn *conn)
 	ctx = conn->write.active.ctx;
 
 	/* if we are here, it means the socket is ready for writting */
-	if ((n=a_tcp_send( conn, conn->write.active.buf, conn->write.active.len,
+	if ((n=a_tcp_send( conn, conn->write.active.buf, conn->write.active.iov,
+	conn->write.active.iovcnt, conn->write.active.len,
 	conn->write.offset, ctx )) == 1 ) {
 		/* write still blocking - just wait */
 		return 1;
@@ -583,19 +968,42 @@ static int a_tcp_send_resume(struct tcp_conn *conn)
 
 	/* current write completed (with success or failure) ->
 	 * resume the context execution */
-	context_resume( ctx ,n );
+	if (ctx)
+		context_resume( ctx ,n );
 
 	return 0;
 }
 
 
+/* the connect completed - start reading and do the write that triggered
+ * the connect (if any, the pool warm-up connects have none) */
+static int tcp_connect_complete(struct tcp_conn *conn)
+{
+	/* set the fd for read also and make an extra ref for it */
+	ref_tcp_conn(conn);
+
+	LM_DBG("submit in on conn %p (%d)\n", conn, conn->id);
+	submit_task(in_reactor(conn->socket), (fd_callback*)tcp_event_read, (void*)conn,
+		TASK_PRIO_READ_IO, conn->socket, 0);
+
+	if (conn->write.active.len==0) {
+		/* nothing to write, but writes may be queued meanwhile */
+		tcp_write_done(conn);
+		return 0;
+	}
+
+	/* go for write */
+	return a_tcp_send_resume( conn );
+}
+
+
 static int a_tcp_connect_done(struct tcp_conn *conn)
 {
 	int err;
 	unsigned int err_len;
 	void *ctx;
 
-	conn->timeout = get_ticks() + tcp_connect_timeout;  //FIXME
+	tcp_conn_set_timeout(conn, tcp_connect_timeout);  //FIXME
 
 	if (conn->state==TCP_CONN_TERM) {
 		/* connection terminated by other thread -> simply unref the conn */
@@ -610,51 +1018,48 @@ static int a_tcp_connect_done(struct tcp_conn *conn)
 		if (err==EINPROGRESS || err==EALREADY) {
 			/* try again */
 			LM_DBG("submit out on conn %p (%d)\n", conn, conn->id);
-			conn->timeout = get_ticks() + tcp_connect_timeout;
-			submit_task(reactor_out, (fd_callback*)a_tcp_connect_done,
+			tcp_conn_set_timeout(conn, tcp_connect_timeout);
+			submit_task(out_reactor(conn->socket), (fd_callback*)a_tcp_connect_done,
 				(void*)conn, TASK_PRIO_RESUME_IO, conn->socket,0);
 			return 1;
 		}
 		LM_ERR("failed to get connect error (%d) %s\n", err, strerror(err));
 		ctx = conn->write.active.ctx;
 
-		/* trash connection and resume all pending contexts */
+		/* trash connection and resume all pending contexts;
+		 * the ref of the writer goes with the conn */
 		set_conn_state( conn, TCP_CONN_TERM);
-		remove_tcp_conn(conn,0);
+		remove_tcp_conn(conn,1);
 
 		/* proceed with execution of the context */
-		context_resume( ctx , -1/*error*/ );
+		if (ctx)
+			context_resume( ctx , -1/*error*/ );
 
 		return -1;
 	}
 
-	/* connect succesfully done -> 
-	 * set the fd for read also and make an extra ref for write */
-	ref_tcp_conn(conn);
-
-	LM_DBG("submit in on conn %p (%d)\n", conn, conn->id);
-	submit_task(reactor_in, (fd_callback*)tcp_event_read, (void*)conn,
-		TASK_PRIO_READ_IO, conn->socket, 0);
-
-	/* go for write */
-	return a_tcp_send_resume( conn );
+	/* connect succesfully done */
+	return tcp_connect_complete( conn );
 }
 
 
-static int a_tcp_connect(void *ctx, struct socket_info* source,
-			char *buf, unsigned len, union sockaddr_union *to)
+/* opens a new connection from "source" to "to", with the given write as
+ * active write (there is no write if "len" is 0); the connection is
+ * returned in WRITING state, with a ref for the writer */
+static struct tcp_conn* tcp_conn_open(void *ctx, struct socket_info* source,
+			char *buf, struct iovec *iov, int iovcnt, unsigned len,
+			union sockaddr_union *to)
 {
 	int sock;
 	socklen_t local_su_len;
 	union sockaddr_union local_su;
 	struct tcp_conn* conn;
-	int n;
 
 	/* create new stream socket */
 	sock = socket( AF2PF(to->s.sa_family), SOCK_STREAM, 0);
 	if (sock==-1) {
 		LM_ERR("socket failed with (%d) %s\n", errno, strerror(errno));
-		return -1;
+		return NULL;
 	}
 
 	/* init the socket*/
@@ -682,12 +1087,26 @@ static int a_tcp_connect(void *ctx, struct socket_info* source,
 
 	conn->write.active.ctx = ctx;
 	conn->write.active.buf = buf;
+	conn->write.active.iov = iov;
+	conn->write.active.iovcnt = iovcnt;
 	conn->write.active.len = len;
 	conn->write.offset = 0;
 
-	/* start the connect procedure */
+	return conn;
+error:
+	close(sock);
+	return NULL;
+}
+
+
+/* starts the connect procedure on a connection opened by tcp_conn_open()
+ * - THIS IS ASYNC CALL */
+static int tcp_conn_connect(struct tcp_conn *conn, union sockaddr_union *to)
+{
+	int n;
+
 	do {
-		n = connect( sock, &to->s, sockaddru_len(*to) );
+		n = connect( conn->socket, &to->s, sockaddru_len(*to) );
 		if (n==-1) {
 			/* connect failed */
 			if (errno==EINTR) {
@@ -696,43 +1115,196 @@ static int a_tcp_connect(void *ctx, struct socket_info* source,
 			}
 			if (errno==EINPROGRESS || errno==EALREADY) {
 				/* connect will block -> suspend */
-				conn->timeout = get_ticks() + tcp_connect_timeout;
+				tcp_conn_set_timeout(conn, tcp_connect_timeout);
 				LM_DBG("submit out on conn %p (%d)\n", conn, conn->id);
-				submit_task(reactor_out, (fd_callback*)a_tcp_connect_done,
+				submit_task(out_reactor(conn->socket), (fd_callback*)a_tcp_connect_done,
 					(void*)conn, TASK_PRIO_RESUME_IO, conn->socket, 0);
 				return 1;
 			}
 			LM_ERR("connect failed with (%d) %s\n", errno, strerror(errno));
-			goto error2;
+			goto error;
 		}
 	}while(n!=0);
 
-	/* connect succesfully completed without context switching -> 
-	 * proceed with writing */
-	return a_tcp_send_resume( conn );
+	/* connect succesfully completed without context switching ->
+	 * proceed with reading and writing */
+	return tcp_connect_complete( conn );
 
-error2:
-	/* trash the connection */
-	remove_tcp_conn(conn,0);
-	return -1;
 error:
-	close(sock);
+	/* trash the connection (the ref of the writer goes with it) */
+	set_conn_state( conn, TCP_CONN_TERM);
+	remove_tcp_conn(conn,1);
 	return -1;
 }
 
 
+static int a_tcp_connect(void *ctx, struct socket_info* source,
+			char *buf, struct iovec *iov, int iovcnt, unsigned len,
+			union sockaddr_union *to)
+{
+	struct tcp_conn* conn;
 
-static int a_tcp_write(void *ctx, struct socket_info *source,
-				char *buf, unsigned len, union sockaddr_union* to, void *extra)
+	conn = tcp_conn_open( ctx, source, buf, iov, iovcnt, len, to);
+	if (conn==NULL)
+		return -1;
+
+	return tcp_conn_connect( conn, to);
+}
+
+
+/* sends via the pool of connections to the destination - the write goes
+ * on an idle connection, on a new one (if the pool is not full) or it is
+ * queued on one of the busy connections */
+static int a_tcp_pool_write(void *ctx, struct socket_info *source,
+		char *buf, struct iovec *iov, int iovcnt, unsigned len,
+		union sockaddr_union* to)
+{
+	struct tcp_peer *peer;
+	struct tcp_conn *conn;
+	int slot;
+	int n;
+
+	peer = tcp_pool_peer( source, to);
+	if (peer==NULL)
+		return a_tcp_connect( ctx, source, buf, iov, iovcnt, len, to);
+
+	/* selecting under the lock of the peer, so concurrent writes do not
+	 * open more connections than needed */
+	tcp_pool_lock(peer);
+	peer->writes++;
+
+	while ( (conn=tcp_pool_select( peer, &slot))==NULL && peer->opening ) {
+		/* a connection is being opened -> wait to queue on it */
+		tcp_pool_unlock(peer);
+		sched_yield();
+		tcp_pool_lock(peer);
+	}
+
+	if (conn==NULL) {
+		if (slot<0) {
+			tcp_pool_unlock(peer);
+			LM_CRIT("BUG - no free slot and no connection in pool %p\n", peer);
+			return -1;
+		}
+		/* the syscalls of the opening are done without the lock */
+		tcp_pool_reserve( peer, slot);
+		tcp_pool_unlock(peer);
+		conn = tcp_conn_open( ctx, source, buf, iov, iovcnt, len, to);
+		tcp_pool_lock(peer);
+		tcp_pool_unreserve( peer, slot);
+		if (conn==NULL) {
+			tcp_pool_unlock(peer);
+			return -1;
+		}
+		peer->ids[slot] = conn->id;
+		peer->opened++;
+		tcp_pool_unlock(peer);
+		/* the conn is WRITING, so the other writes will queue on it */
+		return tcp_conn_connect( conn, to);
+	}
+
+	if (set_conn_state( conn, TCP_CONN_WRITING)==1 ) {
+		/* all connections busy -> queue on the selected one */
+		n = conn_add_pending_write( conn, buf, iov, iovcnt, len, ctx);
+		unlock_tcp_conn( conn );
+		peer->queued++;
+		tcp_pool_unlock(peer);
+		unref_tcp_conn( conn );
+		return (n==0)?1:-1;
+	}
+
+	tcp_pool_unlock(peer);
+
+	return a_tcp_send( conn, buf, iov, iovcnt, len, 0, ctx);
+}
+
+
+/* opens the pooled connections to the tcp_pool_peer destinations,
+ * without waiting for traffic */
+static int tcp_pool_warmup(void *param)
 {
+	struct net_str_list *l;
+	union sockaddr_union to;
+	struct socket_info *si;
+	struct tcp_peer *peer;
 	struct tcp_conn *conn;
+	int i, n;
+
+	for( l=tcp_pool_peers ; l ; l=l->next ) {
+		if (tcp_pool_parse_peer( l->s, &to)<0)
+			continue;
+
+		/* use the first TCP listener of the same family */
+		for( si=protos[PROTO_TCP].listeners ; si ; si=si->next )
+			if (si->address.af==to.s.sa_family)
+				break;
+		if (si==NULL) {
+			LM_ERR("no TCP listener to connect to pool peer <%s>\n", l->s);
+			continue;
+		}
+
+		peer = tcp_pool_peer( si, &to);
+		if (peer==NULL)
+			continue;
+
+		n = 0;
+		for( i=0 ; i<tcp_pool_size ; i++ ) {
+			tcp_pool_lock(peer);
+			if (peer->ids[i] || (peer->opening & (1u<<i))) {
+				tcp_pool_unlock(peer);
+				continue;
+			}
+			tcp_pool_reserve( peer, i);
+			tcp_pool_unlock(peer);
+
+			conn = tcp_conn_open( NULL, si, NULL, NULL, 0, 0, &to);
+
+			tcp_pool_lock(peer);
+			tcp_pool_unreserve( peer, i);
+			if (conn) {
+				peer->ids[i] = conn->id;
+				peer->opened++;
+			}
+			tcp_pool_unlock(peer);
+
+			if (conn==NULL)
+				break;
+			if (tcp_conn_connect( conn, &to)>=0)
+				n++;
+		}
+
+		LM_INFO("warm-up: %d connections opened to pool peer <%s>\n",
+			n, l->s);
+	}
+
+	return 0;
+}
+
+
+static inline int a_tcp_write_any(void *ctx, struct socket_info *source,
+		char *buf, struct iovec *iov, int iovcnt, unsigned len,
+		union sockaddr_union* to, void *extra)
+{
+	struct tcp_conn *conn;
+	int pool;
 	int n;
 
-	/* any existing connection to the destination? */
+	/* no specific connection required -> the pool may be used */
+	pool = (tcp_pool_size>0 && extra==NULL);
+
+	/* a destination already pooled is served by its pool */
+	if (pool && tcp_pool_find( source, to))
+		return a_tcp_pool_write( ctx, source, buf, iov, iovcnt, len, to);
+
+	/* any existing connection to the destination? (like the one opened
+	 * by the destination itself) */
 	conn = search_tcp_conn( (unsigned int)(long)extra, to );
 	if (conn==NULL) {
+		/* none -> a pooled one, if pooling */
+		if (pool)
+			return a_tcp_pool_write( ctx, source, buf, iov, iovcnt, len, to);
 		/* open a new TCP connection to destination - THIS IS ASYNC CALL */
-		return a_tcp_connect( ctx, source, buf, len, to);
+		return a_tcp_connect( ctx, source, buf, iov, iovcnt, len, to);
 	}
 
 	/* proceed with writing */
@@ -741,7 +1313,7 @@ static int a_tcp_write(void *ctx, struct socket_info *source,
 	   other writing in progress ? */
 	if (set_conn_state( conn, TCP_CONN_WRITING)==1 ) {
 		/* we cannot write right now :( -> queue on connection */
-		n = conn_add_pending_write( conn, buf, len, ctx);
+		n = conn_add_pending_write( conn, buf, iov, iovcnt, len, ctx);
 		unlock_tcp_conn( conn );
 		/* unref connection (from search function) */
 		unref_tcp_conn( conn );
@@ -750,7 +1322,22 @@ static int a_tcp_write(void *ctx, struct socket_info *source,
 	}
 
 	/* we have the connection and write permission also :) */
-	return a_tcp_send( conn, buf, len, 0, ctx);
+	return a_tcp_send( conn, buf, iov, iovcnt, len, 0, ctx);
+}
+
+
+static int a_tcp_write(void *ctx, struct socket_info *source,
+				char *buf, unsigned len, union sockaddr_union* to, void *extra)
+{
+	return a_tcp_write_any( ctx, source, buf, NULL, 0, len, to, extra);
+}
+
+
+static int a_tcp_writev(void *ctx, struct socket_info *source,
+		struct iovec *iov, int iovcnt, unsigned int len,
+		union sockaddr_union* to, void *extra)
+{
+	return a_tcp_write_any( ctx, source, NULL, iov, iovcnt, len, to, extra);
 }
 
 
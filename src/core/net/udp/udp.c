@@ -21,11 +21,23 @@
  * history:
  * ---------
  *  2010-02-xx  created (bogdan)
+ *  2010-09-xx  batched receive with recvmmsg (udp_batch_size)
+ *  2010-09-xx  sharded listeners (SO_REUSEPORT)
+ *  2010-09-xx  messages allocated together with their parsing arena
+ *  2010-09-xx  vectored write (sendmsg)
+ *  2010-09-xx  short datagrams copied out of the receive slots; with no
+ *              free slot, the socket is read again after a delay
  */
 
+#ifdef __OS_linux
+#define _GNU_SOURCE  /* recvmmsg */
+#define HAVE_RECVMMSG
+#endif
 
 #include "errno.h"
 #include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
 
 #include "../../log.h"
 #include "../../globals.h"
@@ -33,18 +45,30 @@
 #include "../../version.h"
 #include "../../msg_handler.h"
 #include "../../reactor/reactor.h"
+#include "../../timer_wheel.h"
+#include "../../mi/mi.h"
 #include "../net_params.h"
 #include "../proto.h"
 #include "../socket.h"
 
 
+static int udp_init(void);
+
+static void udp_destroy(void);
+
 static int udp_init_listener(struct socket_info *si);
 
 static int udp_read(struct socket_info *si);
 
+static int udp_read_retry(void *param);
+
 static int udp_write(void *ctx, struct socket_info *source,
 		char *buf, unsigned len, union sockaddr_union*  to, void *extra);
 
+static int udp_writev(void *ctx, struct socket_info *source,
+		struct iovec *iov, int iovcnt, unsigned int len,
+		union sockaddr_union*  to, void *extra);
+
 
 struct proto_interface interface = {
 	"UDP",                       /* proto name */
@@ -52,15 +76,148 @@ struct proto_interface interface = {
 	OPENSIPS_COMPILE_FLAGS,      /* compile flags */
 	{                            /* functions */
 		5060,                    /* default protocol */
-		NULL,                    /* init function */
-		NULL,                    /* destroy function */
+		udp_init,                /* init function */
+		udp_destroy,             /* destroy function */
 		udp_init_listener,       /* init listener function */
 		udp_read,                /* default event handler */
-		udp_write                /* udp write function */
+		udp_write,               /* udp write function */
+		udp_writev,              /* udp vectored write function */
+		0                        /* event handler flags */
 	}
 };
 
 
+/* size of a receive slot - max size of a datagram */
+#define UDP_SLOT_SIZE     (1<<16)
+#define UDP_MAX_BATCH     1024
+/* datagrams up to this size are copied into their message, so that the
+ * slot is reused; only the bigger ones are kept in (and pin) the slot */
+#define UDP_COPY_MAX      (1<<13)
+/* delay before reading again when no receive slot could be freed (ms) */
+#define UDP_RETRY_DELAY   100
+/* fill statistics - batches are counted per quarter of the batch size */
+#define UDP_FILL_BUCKETS  4
+
+/* per socket receive ring, used for the batched reads; only the thread
+ * holding the fd (one-shot in the reactor) uses it. The datagrams are
+ * received straight into the slot buffers; the big ones stay there and
+ * their messages point into them (no copy), the others are copied. A slot
+ * still used by a message gets a new buffer before the next read, a free
+ * one is reused as it is */
+struct udp_rcv_ring {
+	unsigned int size;
+	struct mmsghdr *msgs;
+	struct sip_msg_buf **bufs;
+	struct iovec *iov;
+	union sockaddr_union *from;
+	/* reads again later if no slot could be freed (out of memory) */
+	struct wheel_timer retry;
+	/* fill statistics */
+	unsigned long batches;
+	unsigned long datagrams;
+	unsigned long full;
+	unsigned long fill[UDP_FILL_BUCKETS];
+};
+
+
+static struct mi_root* mi_udp_stats(struct mi_root *cmd, void *param);
+
+static mi_funcs_t mi_udp_cmds[] = {
+	{ "udp_stats",   mi_udp_stats,  MI_NO_INPUT_FLAG,  0,  0 },
+	{ 0, 0, 0, 0, 0}
+};
+
+
+static int udp_init(void)
+{
+	if (udp_batch_size==0 || udp_batch_size>UDP_MAX_BATCH) {
+		LM_ERR("invalid udp_batch_size %u (1..%d allowed)\n",
+			udp_batch_size, UDP_MAX_BATCH);
+		return -1;
+	}
+#ifndef HAVE_RECVMMSG
+	if (udp_batch_size>1) {
+		LM_WARN("recvmmsg not available, ignoring udp_batch_size\n");
+		udp_batch_size = 1;
+	}
+#endif
+
+	if (register_mi_mod( "udp", mi_udp_cmds)<0) {
+		LM_ERR("unable to register UDP MI cmds\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void free_rcv_ring(struct udp_rcv_ring *r)
+{
+	unsigned int i;
+
+	wtimer_del( &r->retry);
+	for( i=0 ; i<r->size ; i++ )
+		if (r->bufs[i])
+			unref_sip_msg_buf(r->bufs[i]);
+	shm_free(r);
+}
+
+
+static struct udp_rcv_ring* new_rcv_ring(unsigned int size)
+{
+	struct udp_rcv_ring *r;
+	unsigned int i;
+	char *p;
+
+	/* the ring and its arrays in a single chunk */
+	p = (char*)shm_malloc( sizeof(struct udp_rcv_ring) +
+		size * (sizeof(struct mmsghdr) + sizeof(struct sip_msg_buf*) +
+			sizeof(struct iovec) + sizeof(union sockaddr_union)) );
+	if (p==NULL) {
+		LM_ERR("no more shm memory for %u receive slots\n", size);
+		return NULL;
+	}
+
+	r = (struct udp_rcv_ring*)p;
+	memset( r, 0, sizeof(struct udp_rcv_ring));
+	r->size = size;
+	r->msgs = (struct mmsghdr*)(r+1);
+	r->bufs = (struct sip_msg_buf**)(r->msgs+size);
+	r->iov = (struct iovec*)(r->bufs+size);
+	r->from = (union sockaddr_union*)(r->iov+size);
+
+	memset( r->msgs, 0, size*sizeof(struct mmsghdr));
+	memset( r->bufs, 0, size*sizeof(struct sip_msg_buf*));
+	for( i=0 ; i<size ; i++ ) {
+		r->bufs[i] = new_sip_msg_buf(UDP_SLOT_SIZE);
+		if (r->bufs[i]==NULL) {
+			free_rcv_ring(r);
+			return NULL;
+		}
+		r->iov[i].iov_base = r->bufs[i]->buf;
+		r->iov[i].iov_len = UDP_SLOT_SIZE;
+		r->msgs[i].msg_hdr.msg_iov = &r->iov[i];
+		r->msgs[i].msg_hdr.msg_iovlen = 1;
+		r->msgs[i].msg_hdr.msg_name = &r->from[i];
+	}
+
+	return r;
+}
+
+
+static void udp_destroy(void)
+{
+	struct socket_info *si;
+
+	for( si=protos[PROTO_UDP].listeners ; si ; si=si->next ) {
+		if (si->proto_data) {
+			free_rcv_ring( (struct udp_rcv_ring*)si->proto_data );
+			si->proto_data = NULL;
+		}
+	}
+}
+
+
 /**
  * Tries to find the maximum receiver buffer size. This value is
  * system dependend, thus it need to detected on startup.
@@ -225,6 +382,14 @@ static int udp_init_listener(struct socket_info *si)
 		LM_ERR("setsockopt: %s\n", strerror(errno));
 		goto error;
 	}
+#ifdef SO_REUSEPORT
+	/* listener sharded in several sockets */
+	if (si->shards>1 && setsockopt(si->socket, SOL_SOCKET, SO_REUSEPORT,
+					(void*)&optval, sizeof(optval)) ==-1){
+		LM_ERR("setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+		goto error;
+	}
+#endif
 	/* tos */
 	optval = net_tos;
 	if (setsockopt(si->socket, IPPROTO_IP, IP_TOS, (void*)&optval, 
@@ -295,13 +460,216 @@ static int udp_init_listener(struct socket_info *si)
 					" local address, try site local or global\n");
 		goto error;
 	}
+
+	if (udp_batch_size>1) {
+		si->proto_data = new_rcv_ring(udp_batch_size);
+		if (si->proto_data==NULL)
+			goto error;
+		wtimer_init( &((struct udp_rcv_ring*)si->proto_data)->retry,
+			udp_read_retry, si);
+		LM_DBG("reading up to %u datagrams per wakeup on %.*s\n",
+			udp_batch_size, si->sock_str.len, si->sock_str.s);
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/**
+ * Fills in the receive info of a message read on si;
+ * \returns 0 on success, -1 if the message is to be dropped
+ */
+static inline int udp_fill_rcv(struct socket_info *si, struct sip_msg *m)
+{
+	struct receive_info *ri = &m->rcv;
+
+	su2ip_addr( &ri->src_ip, &ri->src_su);
+	ri->src_port = su_getport( &ri->src_su );
+
+	if (ri->src_port==0){
+		LM_INFO("dropping 0 port packet from %s\n", ip_addr2a( &ri->src_ip ));
+		return -1;
+	}
+
+	ri->bind_address = si;
+	ri->dst_port = si->port;
+	ri->dst_ip = si->address;
+	ri->proto = PROTO_UDP;
+	ri->proto_reserved1 = ri->proto_reserved2=0;
+
 	return 0;
+}
 
+
+/**
+ * Parses and passes to the upper level a message built by udp_read;
+ * the message is consumed. Also used as task for the batched reads.
+ */
+static int udp_handle_msg(void *param)
+{
+	struct sip_msg *m = (struct sip_msg*)param;
+	int n;
+
+	/* parse the message */
+	n = parse_msg(m,0);
+	if (n>0) {
+		LM_ERR("incomplet SIP message read via UDP -> discard\n");
+		goto error;
+	}
+	if (n<0) {
+		LM_ERR("bad SIP message read -> discarding\n");
+		goto error;
+	}
+
+	/* pass the message to upper level */
+	handle_new_msg(m);
+
+	return 0;
 error:
+	free_sip_msg(m);
 	return -1;
 }
 
 
+/**
+ * Gives the fd back to the reactor, once the delay for freeing receive
+ * slots is over (wheel timer callback).
+ */
+static int udp_read_retry(void *param)
+{
+	struct socket_info *si = (struct socket_info*)param;
+
+	submit_read_task(si->reactor, (fd_callback*)udp_read,
+		(void*)si, TASK_PRIO_READ_IO, si->socket, 0);
+	return 0;
+}
+
+
+#ifdef HAVE_RECVMMSG
+/**
+ * Reads all available datagrams (up to the batch size) with a single
+ * recvmmsg; the first message is handled in this thread, the others
+ * are passed as tasks.
+ */
+static int udp_read_batch(struct socket_info *si, struct udp_rcv_ring *r)
+{
+	struct sip_msg *ms[UDP_MAX_BATCH];
+	struct sip_msg_buf *mb;
+	struct sip_msg *m;
+	heap_node_t task;
+	unsigned int i, k, len, vlen;
+	int n;
+
+	/* the slots still used by messages of the previous reads get new
+	 * buffers; if out of memory, read only into the ones before */
+	for( vlen=0 ; vlen<r->size ; vlen++ ) {
+		if (r->bufs[vlen]->ref!=1) {
+			mb = new_sip_msg_buf(UDP_SLOT_SIZE);
+			if (mb==NULL)
+				break;
+			unref_sip_msg_buf(r->bufs[vlen]);
+			r->bufs[vlen] = mb;
+			r->iov[vlen].iov_base = mb->buf;
+		}
+		r->msgs[vlen].msg_hdr.msg_namelen = sizeof(union sockaddr_union);
+	}
+	if (vlen==0) {
+		/* the fd is still readable - giving it back right away would
+		 * only spin here; wait for some memory to be freed */
+		LM_ERR("no free receive slot, reading again in %dms\n",
+			UDP_RETRY_DELAY);
+		if (wtimer_add( &r->retry, UDP_RETRY_DELAY)<0)
+			submit_read_task(si->reactor, (fd_callback*)udp_read,
+				(void*)si, TASK_PRIO_READ_IO, si->socket, 0);
+		return -1;
+	}
+
+	do {
+		n = recvmmsg( si->socket, r->msgs, vlen, MSG_DONTWAIT, NULL);
+	} while (n==-1 && errno==EINTR);
+
+	if (n<=0) {
+		if (n==-1 && errno!=EAGAIN && errno!=EWOULDBLOCK &&
+		errno!=ECONNREFUSED)
+			LM_ERR("recvmmsg says [%d] %s\n", errno, strerror(errno));
+		submit_read_task(si->reactor, (fd_callback*)udp_read,
+			(void*)si, TASK_PRIO_READ_IO, si->socket, 0);
+		return (n==0) ? 0 : -1;
+	}
+
+	/* fill statistics */
+	r->batches++;
+	r->datagrams += n;
+	if ((unsigned int)n==r->size)
+		r->full++;
+	r->fill[ ((n-1)*UDP_FILL_BUCKETS)/r->size ]++;
+
+	/* build the messages - on top of the slots (no copy) for the big
+	 * datagrams, copied for the others, which leave the slots free */
+	for( i=0,k=0 ; i<(unsigned int)n ; i++ ) {
+		len = r->msgs[i].msg_len;
+		if (len<udp_min_size) {
+			LM_DBG("probing packet received len = %d\n", len);
+			continue;
+		}
+		if (r->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			LM_ERR("truncated datagram (%d) -> discard\n", len);
+			continue;
+		}
+
+		mb = r->bufs[i];
+		if (len<=UDP_COPY_MAX) {
+			m = new_sip_msg( len);
+			if (m) {
+				memcpy( m->buf, mb->buf, len);
+				m->len = len;
+			}
+		} else {
+			mb->buf[len] = 0;
+			m = new_sip_msg_shared( mb, mb->buf, len);
+		}
+		if (m==NULL){
+			/* the next ones may still fit */
+			LM_ERR("could not allocate message, dropping datagram\n");
+			continue;
+		}
+		memcpy( &m->rcv.src_su, &r->from[i], sizeof(union sockaddr_union));
+
+		if (udp_fill_rcv( si, m)<0) {
+			free_sip_msg(m);
+			continue;
+		}
+		ms[k++] = m;
+	}
+
+	/* done with reading from network -> resubmit the fd for other reads */
+	submit_read_task(si->reactor, (fd_callback*)udp_read,
+		(void*)si, TASK_PRIO_READ_IO, si->socket, 0);
+
+	if (k==0)
+		return 0;
+
+	task.fd = -1;
+	task.flags = 0;
+	task.priority = TASK_PRIO_READ_IO;
+	task.cb = udp_handle_msg;
+	task.last_reactor = NULL;
+	for( i=1 ; i<k ; i++ ) {
+		task.cb_param = (void*)ms[i];
+		if (put_task( reactor_in->disp, task)<0) {
+			LM_DBG("overloaded, dropping UDP message\n");
+			free_sip_msg(ms[i]);
+		}
+	}
+
+	return udp_handle_msg( ms[0] );
+}
+#endif
+
+
 /**
  * Read message from the network
  * \returns read len or -1 for errors
@@ -315,6 +683,11 @@ static int udp_read(struct socket_info *si)
 	int n;
 	char tmp;
 
+#ifdef HAVE_RECVMMSG
+	if (si->proto_data)
+		return udp_read_batch( si, (struct udp_rcv_ring*)si->proto_data);
+#endif
+
 	/* get the len of the datagram */
 	do {
 
@@ -336,19 +709,18 @@ static int udp_read(struct socket_info *si)
 
 	} while(n<0);
 
-	/* allocate buffer for sip_msg + buffer */
-	m = (struct sip_msg*)shm_malloc( sizeof(struct sip_msg) + n );
+	/* allocate buffer for sip_msg + parsing arena + buffer */
+	m = new_sip_msg( n );
 	if (m==NULL){
 		LM_ERR("could not allocate receive buffer\n");
 		// FIXME - flush the read event
 		read(si->socket, &n, 4);
 		goto error1;
 	}
-	memset(m, 0, sizeof(struct sip_msg) + n);
+	memset(m->buf, 0, n);
 
 	ri = &m->rcv;
 
-	m->buf = (char*)(m+1);
 	m->len = n;
 
 	/* do the actual data read */
@@ -372,8 +744,9 @@ static int udp_read(struct socket_info *si)
 
 	} while(n<0);
 
-	/* done with reading from network -> resubmit the fd for other reads */
-	submit_task(reactor_in, (fd_callback*)udp_read,
+	/* done with reading from network -> resubmit the fd for other reads
+	 * (held back while overloaded, the kernel will queue/drop for us) */
+	submit_read_task(si->reactor, (fd_callback*)udp_read,
 		(void*)si, TASK_PRIO_READ_IO, si->socket, 0);
 
 	if (m->len<udp_min_size) {
@@ -381,51 +754,93 @@ static int udp_read(struct socket_info *si)
 		goto error;
 	}
 
-	su2ip_addr( &ri->src_ip, &ri->src_su);
-	ri->src_port = su_getport( &ri->src_su );
-
-	if (ri->src_port==0){
-		LM_INFO("dropping 0 port packet from %s\n", ip_addr2a( &ri->src_ip ));
+	if (udp_fill_rcv( si, m)<0)
 		goto error;
-	}
-
-	ri->bind_address = si;
-	ri->dst_port = si->port;
-	ri->dst_ip = si->address;
-	ri->proto = PROTO_UDP;
-	ri->proto_reserved1 = ri->proto_reserved2=0;
-
-	/* parse the message */
-	n = parse_msg(m,0);
-	if (n>0) {
-		LM_ERR("incomplet SIP message read via UDP -> discard\n");
-		goto error2;
-	}
-	if (n<0) {
-		LM_ERR("bad SIP message read -> discarding\n");
-		goto error2;
-	}
 
-	/* this will not change the pointer as we are shriking the memory 
-	 * block to exactly used size */
-
-	/* pass the message to upper level */
-	handle_new_msg(m);
-
-	return 0;
+	/* parse the message and pass it to upper level */
+	return udp_handle_msg(m);
 
 error:
 	shm_free(m);
 error1:
 	return -1;
-error2:
-	free_sip_msg(m);
-	return -1;
 }
 
 
 
 
+static struct mi_root* mi_udp_stats(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node;
+	struct mi_attr *attr;
+	struct socket_info *si;
+	struct udp_rcv_ring *r;
+	char *p;
+	int len, i;
+
+	rpl_tree = init_mi_tree( 200, MI_SSTR(MI_OK));
+	if (rpl_tree==0)
+		return 0;
+
+	for( si=protos[PROTO_UDP].listeners ; si ; si=si->next ) {
+		node = add_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Socket"),
+			si->sock_str.s, si->sock_str.len);
+		if (node==0)
+			goto error;
+
+		if (si->shards>1) {
+			p = int2str( (unsigned long)si->shard, &len);
+			attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Shard"), p, len);
+			if (attr==0)
+				goto error;
+		}
+
+		r = (struct udp_rcv_ring*)si->proto_data;
+		if (r==NULL) {
+			attr = add_mi_attr( node, 0, MI_SSTR("Batch"), "1", 1);
+			if (attr==0)
+				goto error;
+			continue;
+		}
+
+		p = int2str( (unsigned long)r->size, &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Batch"), p, len);
+		if (attr==0)
+			goto error;
+
+		p = int2str( r->batches, &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Reads"), p, len);
+		if (attr==0)
+			goto error;
+
+		p = int2str( r->datagrams, &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Datagrams"),p,len);
+		if (attr==0)
+			goto error;
+
+		p = int2str( r->full, &len);
+		attr = add_mi_attr( node, MI_DUP_VALUE, MI_SSTR("Full"), p, len);
+		if (attr==0)
+			goto error;
+
+		/* reads per fill level: up to 25%, 50%, 75%, 100% of the batch */
+		for( i=0 ; i<UDP_FILL_BUCKETS ; i++ ) {
+			if (addf_mi_node_child( node, 0, MI_SSTR("Fill"), "%d%% %lu",
+			(i+1)*100/UDP_FILL_BUCKETS, r->fill[i])==0)
+				goto error;
+		}
+	}
+
+	return rpl_tree;
+error:
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
+
+
+
 /**
  * Main UDP send function, called from msg_send.
  * \see msg_send 
@@ -455,3 +870,37 @@ again:
 	}
 	return n;
 }
+
+
+/**
+ * Vectored UDP send function - the datagram is gathered by the kernel
+ * from the given segments (sendmsg), no need to build it in a buffer.
+ * \return -1 on error, the return value from sendmsg on success
+ */
+static int udp_writev(void *ctx, struct socket_info *source,
+		struct iovec *iov, int iovcnt, unsigned int len,
+		union sockaddr_union* to, void *extra)
+{
+	struct msghdr mh;
+	int n;
+
+	memset( &mh, 0, sizeof(mh));
+	mh.msg_name = &to->s;
+	mh.msg_namelen = sockaddru_len(*to);
+	mh.msg_iov = iov;
+	mh.msg_iovlen = iovcnt;
+
+again:
+	n=sendmsg(source->socket, &mh, 0);
+	if (n==-1){
+		LM_ERR("sendmsg(sock,%d segs,%d bytes,%p,%d): %s(%d)\n", iovcnt, len,
+				to, (int)mh.msg_namelen, strerror(errno),errno);
+		if (errno==EINTR) goto again;
+		if (errno==EINVAL) {
+			LM_CRIT("invalid sendmsg parameters\n"
+			"one possible reason is the server is bound to localhost and\n"
+			"attempts to send to the net\n");
+		}
+	}
+	return n;
+}
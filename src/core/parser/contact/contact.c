@@ -28,6 +28,7 @@
 
 #include <string.h>        /* memset */
 #include "../../mem/mem.h" /* pkg_malloc, pkg_free */
+#include "../msg_arena.h"  /* parser_malloc, parser_free */
 #include "../../log.h"
 #include "../../trim.h"    /* trim_leading, trim_trailing */
 #include "contact.h"
@@ -189,7 +190,7 @@ int parse_contacts(str* _s, contact_t** _c)
 
 	while(1) {
 		/* Allocate and clear contact structure */
-		c = (contact_t*)pkg_malloc(sizeof(contact_t));
+		c = (contact_t*)parser_malloc(sizeof(contact_t));
 		if (c == 0) {
 			LM_ERR("no pkg memory left\n");
 			goto error;
@@ -266,7 +267,7 @@ int parse_contacts(str* _s, contact_t** _c)
 	}
 
  error:
-	if (c) pkg_free(c);
+	if (c) parser_free(c);
 	free_contacts(_c); /* Free any contacts created so far */
 	return -1;
 
@@ -292,7 +293,7 @@ void free_contacts(contact_t** _c)
 		if (ptr->params) {
 			free_params(ptr->params);
 		}
-		pkg_free(ptr);
+		parser_free(ptr);
 	}
 }
 
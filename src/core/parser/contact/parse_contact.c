@@ -78,7 +78,7 @@ int parse_contact(struct hdr_field* _h)
 		return 0;  /* Already parsed */
 	}
 
-	b = (contact_body_t*)pkg_malloc(sizeof(contact_body_t));
+	b = (contact_body_t*)parser_malloc(sizeof(contact_body_t));
 	if (b == 0) {
 		LM_ERR("no pkg memory left\n");
 		return -1;
@@ -88,7 +88,7 @@ int parse_contact(struct hdr_field* _h)
 
 	if (contact_parser(_h->body.s, _h->body.len, b) < 0) {
 		LM_ERR("failed to parse contact\n");
-		pkg_free(b);
+		parser_free(b);
 		/* TODO -error
 		set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 			"error parsing CONTACT headers");
@@ -111,7 +111,7 @@ void free_contact(contact_body_t** _c)
 		free_contacts(&((*_c)->contacts));
 	}
 	
-	pkg_free(*_c);
+	parser_free(*_c);
 	*_c = 0;
 }
 
@@ -37,7 +37,7 @@ static inline int new_credentials(struct hdr_field* _h)
 {
 	auth_body_t* b;
 
-	b = (auth_body_t*)pkg_malloc(sizeof(auth_body_t));
+	b = (auth_body_t*)parser_malloc(sizeof(auth_body_t));
 	if (b == 0) {
 		LM_ERR("no pkg memory left\n");
 		return -1;
@@ -92,7 +92,7 @@ int parse_credentials(struct hdr_field* _h)
  */
 void free_credentials(auth_body_t** _b)
 {
-	pkg_free(*_b);
+	parser_free(*_b);
 	*_b = 0;
 }
 
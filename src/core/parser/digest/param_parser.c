@@ -72,7 +72,8 @@
  * (Sparc for example)
  */
 #define READ(val) \
-(*(val + 0) + (*(val + 1) << 8) + (*(val + 2) << 16) + (*(val + 3) << 24))
+((unsigned char)*(val + 0) + ((unsigned char)*(val + 1) << 8) + \
+	((unsigned char)*(val + 2) << 16) + ((unsigned)(unsigned char)*(val + 3) << 24))
 
 
 #define name_CASE                      \
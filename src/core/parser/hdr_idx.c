@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+#include <string.h>
+
+#include "../log.h"
+#include "msg_arena.h"
+#include "hdr_idx.h"
+
+/* enough for most of the messages - a single allocation */
+#define HDR_IDX_INIT  32
+
+
+int hdr_idx_grow(struct hdr_idx *idx)
+{
+	struct hdr_idx_e *e;
+	unsigned int size;
+
+	if (idx->no < idx->size)
+		return 0;
+
+	if (idx->size==HDR_IDX_MAX) {
+		LM_ERR("too many headers (%d)\n", idx->size);
+		return -1;
+	}
+	size = idx->size ? 2*idx->size : HDR_IDX_INIT;
+	if (size > HDR_IDX_MAX)
+		size = HDR_IDX_MAX;
+
+	/* arena chunks cannot grow, the entries are moved */
+	e = parser_malloc( size * sizeof(struct hdr_idx_e) );
+	if (e==NULL) {
+		LM_ERR("no more memory for %d header index entries\n", size);
+		return -1;
+	}
+	if (idx->e) {
+		memcpy( e, idx->e, idx->no * sizeof(struct hdr_idx_e));
+		parser_free(idx->e);
+	}
+	idx->e = e;
+	idx->size = size;
+
+	return 0;
+}
+
+
+void hdr_idx_rm(struct hdr_idx *idx, struct hdr_field *hf)
+{
+	struct hdr_idx_e *e;
+	unsigned short i, prev;
+
+	if (hf->idx==0 || hf->idx>idx->no || hdr_idx_at(idx, hf->idx)->hf!=hf)
+		return;
+	e = hdr_idx_at(idx, hf->idx);
+
+	for( prev=0,i=idx->first[e->type] ; i && i!=hf->idx ;
+	prev=i,i=hdr_idx_next(idx, i) );
+	if (i==0) {
+		LM_CRIT("BUG - header %d not linked into the index\n", hf->idx);
+		return;
+	}
+
+	if (prev)
+		hdr_idx_at(idx, prev)->next = e->next;
+	else
+		idx->first[e->type] = e->next;
+	if (idx->last[e->type]==hf->idx)
+		idx->last[e->type] = prev;
+
+	e->next = 0;
+	e->hf = NULL;
+	hf->idx = 0;
+}
+
+
+void hdr_idx_free(struct hdr_idx *idx)
+{
+	if (idx->e)
+		parser_free(idx->e);
+	memset( idx, 0, sizeof(struct hdr_idx));
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  chains for the header names registered at startup
+ */
+
+/*
+ * Per-message header index: one compact entry per header, in a contiguous
+ * array (taken from the message arena), filled by parse_headers() in the
+ * same pass that creates the hdr_field structures. The entries of the same
+ * type are chained by position, so looking for a header type starts right
+ * at its first occurrence and walks only the headers of that type, without
+ * touching the other hdr_field structures.
+ *
+ * Positions are 1 based; 0 stands for "none", so a zeroed index (as in a
+ * freshly allocated sip_msg) is a valid empty one.
+ *
+ * The unknown headers with a name registered via register_hdr_name() are
+ * chained under HDR_DYN_T(id) instead of HDR_OTHER_T.
+ *
+ * The offsets describe the header as received (relative to msg->buf);
+ * the headers added by the builder have no offsets and the current name,
+ * body and parsed body are always in the hdr_field (e->hf).
+ */
+
+#ifndef _PARSER_HDR_IDX_H
+#define _PARSER_HDR_IDX_H
+
+#include "hf.h"
+#include "parse_hname2.h"
+
+#define HDR_IDX_NO_OFF    ((unsigned int)-1)
+#define HDR_IDX_MAX       0xffff
+#define HDR_IDX_TYPES     (HDR_EOH_T + 1 + HDR_DYN_MAX)
+
+struct hdr_idx_e {
+	unsigned char type;         /* hdr_types_t or HDR_DYN_T() */
+	unsigned char unused;
+	unsigned short next;        /* next header of the same type, 0 if last */
+	unsigned short name_len;
+	unsigned short body_len;
+	unsigned int name_off;      /* offsets in msg->buf or HDR_IDX_NO_OFF */
+	unsigned int body_off;
+	struct hdr_field *hf;       /* NULL once the header is removed */
+};
+
+struct hdr_idx {
+	struct hdr_idx_e *e;
+	unsigned short no;
+	unsigned short size;
+	unsigned short first[HDR_IDX_TYPES];
+	unsigned short last[HDR_IDX_TYPES];
+};
+
+
+/* makes room for one more entry; to be called before hdr_idx_add() */
+int hdr_idx_grow(struct hdr_idx *idx);
+
+/* removes a header from the chain of its type */
+void hdr_idx_rm(struct hdr_idx *idx, struct hdr_field *hf);
+
+/* releases the entries (the index itself is part of the sip_msg) */
+void hdr_idx_free(struct hdr_idx *idx);
+
+
+#define hdr_idx_full(_idx)  ((_idx)->no==(_idx)->size)
+
+#define hdr_idx_at(_idx, _i)  (&(_idx)->e[(_i)-1])
+
+#define hdr_idx_first(_idx, _type)  ((_idx)->first[_type])
+
+#define hdr_idx_next(_idx, _i)  (hdr_idx_at(_idx, _i)->next)
+
+/* last indexed header of the given type or NULL */
+#define hdr_idx_last_hf(_idx, _type) \
+	((_idx)->last[_type] ? hdr_idx_at(_idx, (_idx)->last[_type])->hf : NULL)
+
+/* first indexed header of the given type or NULL */
+#define hdr_idx_first_hf(_idx, _type) \
+	((_idx)->first[_type] ? hdr_idx_at(_idx, (_idx)->first[_type])->hf : NULL)
+
+/* appends a header; "buf" is the received message if the header comes
+ * from it, NULL otherwise. There must be room (see hdr_idx_grow()) */
+static inline void hdr_idx_add(struct hdr_idx *idx, struct hdr_field *hf,
+																	char *buf)
+{
+	struct hdr_idx_e *e;
+	unsigned short i;
+	int type, id;
+
+	type = hf->type;
+	if (type==HDR_OTHER_T && hname_dyn_no &&
+	(id=get_hdr_name_id(hf->name.s, hf->name.len))>=0)
+		type = HDR_DYN_T(id);
+
+	i = ++idx->no;
+	e = hdr_idx_at(idx, i);
+	e->type = type;
+	e->next = 0;
+	e->name_len = hf->name.len;
+	e->body_len = hf->body.len;
+	if (buf) {
+		e->name_off = hf->name.s - buf;
+		e->body_off = hf->body.s - buf;
+	} else {
+		e->name_off = e->body_off = HDR_IDX_NO_OFF;
+	}
+	e->hf = hf;
+	hf->idx = i;
+
+	if (idx->last[type])
+		hdr_idx_at(idx, idx->last[type])->next = i;
+	else
+		idx->first[type] = i;
+	idx->last[type] = i;
+}
+
+/* name of an indexed header, from the received buffer if possible */
+#define hdr_idx_name_s(_e, _buf) \
+	((_e)->name_off!=HDR_IDX_NO_OFF ? (_buf)+(_e)->name_off : (_e)->hf->name.s)
+
+#endif
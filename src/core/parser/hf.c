@@ -22,6 +22,7 @@
  * History:
  * -------
  * 2006-02-17 Session-Expires, Min-SE (dhsueh@somanetworks.com)
+ * 2010-09-xx  parsed structures released via the message arena
  */
 
 /**
@@ -137,7 +138,7 @@ void clean_hdr_field(struct hdr_field* hf)
 			break;
 
 		case HDR_ACCEPT_T:
-			pkg_free(hf->parsed);
+			parser_free(hf->parsed);
 			break;
 
 		case HDR_ACCEPTLANGUAGE_T:
@@ -215,8 +216,8 @@ void free_hdr_field_lst(struct hdr_field* hf)
 		hf=hf->next;
 		clean_hdr_field(foo);
 		if (foo->flags & HDR_FREE_BODY)
-			shm_free(foo->body.s);
-		pkg_free(foo);
+			msg_arena_free(foo->body.s);
+		parser_free(foo);
 	}
 }
 
@@ -23,6 +23,7 @@
  * ---------
  * 2006-02-17 Session-Expires, Min-SE (dhsueh@somanetworks.com)
  * 2006-03-02 header of same type are linked as sibling (bogdan)
+ * 2010-09-xx  position of the header in the header index
  */
 
 /**
@@ -163,6 +164,7 @@ struct hdr_field {
 	short len;              /**< length from hdr start until EoHF (incl.CRLF) */
 	short body_buff_size;	/**< body buffer size, if explicitly allocated */
 	short flags;			/**< flags for duplicating / freeing name and body */
+	unsigned short idx;		/**< position in the header index, 0 if none */
 	void* parsed;           /**< Parsed data structures */
 	struct hdr_field* next; /**< Next header field in the list */
 	struct hdr_field* prev;
@@ -0,0 +1,144 @@
+#!/bin/sh
+#
+# Generates hname_hash.h - the perfect hash table of the known header
+# names used by parse_hname2() (see "make hname_hash").
+#
+# The hash uses only the length and the first two chars of the name
+# (lower-cased; the second one is 0 for the compact names), which are
+# known before the end of the name is found; the coefficients are
+# searched until no two names collide.
+#
+# To add a header name, add a "name TYPE" line below and regenerate.
+#
+#  History:
+#  --------
+#  2010-09-xx  created
+#
+
+SIZE=128
+
+awk -v size=$SIZE '
+BEGIN {
+	for (i = 0; i < 256; i++)
+		ord[sprintf("%c", i)] = i;
+}
+
+/^[ \t]*(#|$)/ { next }
+
+{
+	name = tolower($1);
+	if (name in types) {
+		print "duplicate name " name > "/dev/stderr";
+		exit 1;
+	}
+	types[name] = $2;
+	names[n++] = name;
+	len = length(name);
+	if (len > maxlen) maxlen = len;
+	key = len " " substr(name, 1, 2);
+	if (key in keys) {
+		print "\"" name "\" and \"" keys[key] "\" have the same length" \
+			" and first two chars" > "/dev/stderr";
+		exit 1;
+	}
+	keys[key] = name;
+	c0[name] = ord[substr(name, 1, 1)];
+	c1[name] = len > 1 ? ord[substr(name, 2, 1)] : 0;
+}
+
+END {
+	for (a = 1; a < size && !found; a++)
+	for (b = 1; b < size && !found; b++)
+	for (c = 1; c < size && !found; c++) {
+		split("", slot);
+		for (i = 0; i < n; i++) {
+			nm = names[i];
+			h = (c0[nm]*a + c1[nm]*b + length(nm)*c) % size;
+			if (h in slot) break;
+			slot[h] = nm;
+		}
+		if (i == n) {
+			found = 1;
+			A = a; B = b; C = c;
+		}
+	}
+	if (!found) {
+		print "no perfect hash found, increase SIZE" > "/dev/stderr";
+		exit 1;
+	}
+
+	print "/*";
+	print " * generated by hname_gen.sh - DO NOT EDIT";
+	print " */";
+	print "";
+	print "#ifndef _PARSER_HNAME_HASH_H";
+	print "#define _PARSER_HNAME_HASH_H";
+	print "";
+	printf "#define HNAME_HASH_SIZE  %d\n", size;
+	printf "#define HNAME_MAX_LEN    %d\n", maxlen;
+	print "";
+	print "/* \"_c0\" and \"_c1\" are the first two chars, lower-cased */";
+	printf "#define HNAME_HASH(_c0, _c1, _len) \\\n";
+	printf "\t(((_c0)*%d + (_c1)*%d + (_len)*%d) & (HNAME_HASH_SIZE-1))\n", \
+		A, B, C;
+	print "";
+	print "static const struct hname_ent hname_tab[HNAME_HASH_SIZE] = {";
+	for (h = 0; h < size; h++)
+		if (h in slot)
+			printf "\t[%3d] = { %-24s %2d, %s },\n", h,
+				"\"" slot[h] "\",", length(slot[h]), types[slot[h]];
+	print "};";
+	print "";
+	print "#endif";
+}
+' <<EOF
+# full names
+Via                     HDR_VIA_T
+From                    HDR_FROM_T
+To                      HDR_TO_T
+CSeq                    HDR_CSEQ_T
+Call-ID                 HDR_CALLID_T
+Contact                 HDR_CONTACT_T
+Max-Forwards            HDR_MAXFORWARDS_T
+Route                   HDR_ROUTE_T
+Record-Route            HDR_RECORDROUTE_T
+Path                    HDR_PATH_T
+Content-Type            HDR_CONTENTTYPE_T
+Content-Length          HDR_CONTENTLENGTH_T
+Authorization           HDR_AUTHORIZATION_T
+Expires                 HDR_EXPIRES_T
+Proxy-Authorization     HDR_PROXYAUTH_T
+Supported               HDR_SUPPORTED_T
+Proxy-Require           HDR_PROXYREQUIRE_T
+Unsupported             HDR_UNSUPPORTED_T
+Allow                   HDR_ALLOW_T
+Event                   HDR_EVENT_T
+Accept                  HDR_ACCEPT_T
+Accept-Language         HDR_ACCEPTLANGUAGE_T
+Organization            HDR_ORGANIZATION_T
+Priority                HDR_PRIORITY_T
+Subject                 HDR_SUBJECT_T
+User-Agent              HDR_USERAGENT_T
+Accept-Disposition      HDR_ACCEPTDISPOSITION_T
+Content-Disposition     HDR_CONTENTDISPOSITION_T
+Diversion               HDR_DIVERSION_T
+Remote-Party-ID         HDR_RPID_T
+Refer-To                HDR_REFER_TO_T
+Session-Expires         HDR_SESSION_EXPIRES_T
+Min-SE                  HDR_MIN_SE_T
+P-Preferred-Identity    HDR_PPI_T
+P-Asserted-Identity     HDR_PAI_T
+Privacy                 HDR_PRIVACY_T
+Retry-After             HDR_RETRY_AFTER_T
+# compact forms
+v                       HDR_VIA_T
+f                       HDR_FROM_T
+t                       HDR_TO_T
+i                       HDR_CALLID_T
+m                       HDR_CONTACT_T
+l                       HDR_CONTENTLENGTH_T
+k                       HDR_SUPPORTED_T
+c                       HDR_CONTENTTYPE_T
+o                       HDR_EVENT_T
+x                       HDR_SESSION_EXPIRES_T
+EOF
@@ -0,0 +1,65 @@
+/*
+ * generated by hname_gen.sh - DO NOT EDIT
+ */
+
+#ifndef _PARSER_HNAME_HASH_H
+#define _PARSER_HNAME_HASH_H
+
+#define HNAME_HASH_SIZE  128
+#define HNAME_MAX_LEN    20
+
+/* "_c0" and "_c1" are the first two chars, lower-cased */
+#define HNAME_HASH(_c0, _c1, _len) \
+	(((_c0)*1 + (_c1)*17 + (_len)*59) & (HNAME_HASH_SIZE-1))
+
+static const struct hname_ent hname_tab[HNAME_HASH_SIZE] = {
+	[  1] = { "proxy-require",         13, HDR_PROXYREQUIRE_T },
+	[  6] = { "content-type",          12, HDR_CONTENTTYPE_T },
+	[  9] = { "p-preferred-identity",  20, HDR_PPI_T },
+	[ 26] = { "accept-disposition",    18, HDR_ACCEPTDISPOSITION_T },
+	[ 28] = { "remote-party-id",       15, HDR_RPID_T },
+	[ 29] = { "session-expires",       15, HDR_SESSION_EXPIRES_T },
+	[ 30] = { "c",                      1, HDR_CONTENTTYPE_T },
+	[ 31] = { "privacy",                7, HDR_PRIVACY_T },
+	[ 32] = { "via",                    3, HDR_VIA_T },
+	[ 33] = { "f",                      1, HDR_FROM_T },
+	[ 34] = { "max-forwards",          12, HDR_MAXFORWARDS_T },
+	[ 35] = { "content-disposition",   19, HDR_CONTENTDISPOSITION_T },
+	[ 36] = { "i",                      1, HDR_CALLID_T },
+	[ 37] = { "authorization",         13, HDR_AUTHORIZATION_T },
+	[ 38] = { "k",                      1, HDR_SUPPORTED_T },
+	[ 39] = { "l",                      1, HDR_CONTENTLENGTH_T },
+	[ 40] = { "m",                      1, HDR_CONTACT_T },
+	[ 42] = { "o",                      1, HDR_EVENT_T },
+	[ 47] = { "t",                      1, HDR_TO_T },
+	[ 48] = { "retry-after",           11, HDR_RETRY_AFTER_T },
+	[ 49] = { "v",                      1, HDR_VIA_T },
+	[ 51] = { "x",                      1, HDR_SESSION_EXPIRES_T },
+	[ 52] = { "allow",                  5, HDR_ALLOW_T },
+	[ 69] = { "organization",          12, HDR_ORGANIZATION_T },
+	[ 72] = { "min-se",                 6, HDR_MIN_SE_T },
+	[ 73] = { "to",                     2, HDR_TO_T },
+	[ 75] = { "supported",              9, HDR_SUPPORTED_T },
+	[ 76] = { "unsupported",           11, HDR_UNSUPPORTED_T },
+	[ 77] = { "path",                   4, HDR_PATH_T },
+	[ 78] = { "p-asserted-identity",   19, HDR_PAI_T },
+	[ 85] = { "subject",                7, HDR_SUBJECT_T },
+	[ 86] = { "accept",                 6, HDR_ACCEPT_T },
+	[ 90] = { "priority",               8, HDR_PRIORITY_T },
+	[ 95] = { "contact",                7, HDR_CONTACT_T },
+	[ 98] = { "event",                  5, HDR_EVENT_T },
+	[ 99] = { "proxy-authorization",   19, HDR_PROXYAUTH_T },
+	[100] = { "from",                   4, HDR_FROM_T },
+	[102] = { "user-agent",            10, HDR_USERAGENT_T },
+	[105] = { "accept-language",       15, HDR_ACCEPTLANGUAGE_T },
+	[107] = { "record-route",          12, HDR_RECORDROUTE_T },
+	[112] = { "diversion",              9, HDR_DIVERSION_T },
+	[113] = { "call-id",                7, HDR_CALLID_T },
+	[114] = { "cseq",                   4, HDR_CSEQ_T },
+	[120] = { "route",                  5, HDR_ROUTE_T },
+	[122] = { "expires",                7, HDR_EXPIRES_T },
+	[124] = { "content-length",        14, HDR_CONTENTLENGTH_T },
+	[127] = { "refer-to",               8, HDR_REFER_TO_T },
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Per-message arena: a bump allocator carved out of the same memory block
+ * as the sip_msg and its receive buffer. The parsed structures (hdr_field,
+ * via_body, to_body, params...) and the headers added by the builder are
+ * taken from it and all go away with the single free of the sip_msg.
+ *
+ * Every chunk is prefixed by a magic word, so parser_free() can tell the
+ * arena chunks (nothing to do) from the ones which had to fall back on
+ * pkg_malloc because the arena was exhausted or missing.
+ *
+ * The parsers which do not get the sip_msg (parse_via(), parse_to()...)
+ * use the arena selected by the calling thread with msg_arena_enter().
+ */
+
+#ifndef _PARSER_MSG_ARENA_H
+#define _PARSER_MSG_ARENA_H
+
+#include "../mem/mem.h"
+
+struct msg_arena {
+	char *start;
+	char *cur;
+	char *end;
+};
+
+/* arena size for a message of "_len" bytes (the parsed structures of a
+ * typical request take 3-4 times the size of the message) */
+#define MSG_ARENA_FACTOR  4
+#define MSG_ARENA_MIN     2048
+#define MSG_ARENA_SIZE(_len) \
+	MSG_ARENA_ROUND( (_len)*MSG_ARENA_FACTOR + MSG_ARENA_MIN )
+
+#define MSG_ARENA_ALIGN   (sizeof(long))
+#define MSG_ARENA_ROUND(_s) \
+	(((_s)+MSG_ARENA_ALIGN-1) & ~(MSG_ARENA_ALIGN-1))
+
+/* odd and huge - cannot be mistaken for the tail of a fragment header
+ * of the memory allocator (size, pointer, check pattern) */
+#define MSG_ARENA_MAGIC   ((unsigned long)0xa7e4a7e4a7e4a7e5ULL)
+#define MSG_ARENA_HDR     (sizeof(unsigned long))
+
+/* arena used by the parsers in the current thread (NULL if none) */
+extern __thread struct msg_arena *msg_arena_cur;
+
+
+static inline void msg_arena_init(struct msg_arena *a, char *mem,
+															unsigned int size)
+{
+	a->start = a->cur = mem;
+	a->end = mem + size;
+}
+
+#define msg_arena_fits(_a, _s) \
+	( (unsigned long)((_a)->end - (_a)->cur) >= \
+		MSG_ARENA_ROUND(_s) + MSG_ARENA_HDR )
+
+/* the caller must check msg_arena_fits() first */
+static inline void* msg_arena_alloc(struct msg_arena *a, unsigned int size)
+{
+	char *p;
+
+	p = a->cur;
+	a->cur += MSG_ARENA_ROUND(size) + MSG_ARENA_HDR;
+	*(unsigned long*)p = MSG_ARENA_MAGIC;
+	return p + MSG_ARENA_HDR;
+}
+
+#define msg_arena_owns(_p) \
+	( ((unsigned long*)(_p))[-1] == MSG_ARENA_MAGIC )
+
+
+/* allocates from the arena of the message, falls back on pkg memory */
+#define msg_arena_malloc(_msg, _s) \
+	( msg_arena_fits( &(_msg)->arena, (_s)) ? \
+		msg_arena_alloc( &(_msg)->arena, (_s)) : pkg_malloc(_s) )
+
+/* allocates from the arena of the current thread, falls back on
+ * pkg memory */
+#define parser_malloc(_s) \
+	( (msg_arena_cur && msg_arena_fits( msg_arena_cur, (_s))) ? \
+		msg_arena_alloc( msg_arena_cur, (_s)) : pkg_malloc(_s) )
+
+/* frees a chunk got via msg_arena_malloc()/parser_malloc() or pkg_malloc()
+ * (arena chunks are released together with the message) */
+#define parser_free(_p) \
+	do { \
+		void *__pf = (void*)(_p); \
+		if (__pf==NULL || !msg_arena_owns(__pf)) \
+			pkg_free(__pf); \
+	}while(0)
+
+#define msg_arena_free parser_free
+
+
+/* selects the arena of the message for the parsers called by the current
+ * thread; the previous arena is saved in "_bk" */
+#define msg_arena_enter(_msg, _bk) \
+	do { \
+		_bk = msg_arena_cur; \
+		msg_arena_cur = &(_msg)->arena; \
+	}while(0)
+
+#define msg_arena_leave(_bk) \
+	do { \
+		msg_arena_cur = _bk; \
+	}while(0)
+
+#endif
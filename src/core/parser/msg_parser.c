@@ -35,6 +35,13 @@
  *  2006-11-28 Added statistic support for bad message headers.
  *             (Jeffrey Magder - SOMA Networks)
  *  2008-09-09 Added sdp parsing support (osas)
+ *  2010-09-xx  messages may point into a shared (ref counted) buffer
+ *  2010-09-xx  parsed structures allocated from the per-message arena
+ *  2010-09-xx  bad Via / CSeq bodies freed (leaked out of the arena)
+ *  2010-09-xx  end of header found with the vectorized kernels (scan.h)
+ *  2010-09-xx  headers indexed by type while parsed (hdr_idx.h)
+ *  2010-09-xx  no read past the end of the buffer (first line, header end)
+ *  2010-09-xx  spare byte of the shared buffers zeroed
  */
 
 
@@ -43,11 +50,13 @@
 
 #include "msg_parser.h"
 #include "parser_f.h"
+#include "scan.h"
 #include "../utils.h"
 //#include "../error.h"
 #include "../log.h"
 //#include "../data_lump_rpl.h"
 #include "../mem/mem.h"
+#include "../locking/atomic_ops.h"
 //#include "../error.h"
 #include "../globals.h"
 //#include "../core_stats.h"
@@ -66,6 +75,9 @@
 /* number of via's encountered */
 int via_cnt;
 
+/* arena used by the parsers running in this thread */
+__thread struct msg_arena *msg_arena_cur = NULL;
+
 /* returns pointer to next header line, and fill hdr_f ;
  * if at end of header returns pointer to the last crlf  (always buf)*/
 char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
@@ -94,7 +106,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 	}
 
 	/* eliminate leading whitespace */
-	tmp = eat_lws_end(tmp, end);
+	tmp = scan_lws_end(tmp, end);
 	if (tmp >= end)
 	{
 		LM_ERR("hf empty\n");
@@ -108,7 +120,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 	switch (hdr->type)
 	{
 	case HDR_VIA_T:
-		vb = pkg_malloc(sizeof (struct via_body));
+		vb = parser_malloc(sizeof (struct via_body));
 		if (vb == 0)
 		{
 			LM_ERR("out of pkg memory\n");
@@ -119,6 +131,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 		tmp = parse_via(tmp, end, vb);
 		if (vb->error == PARSE_ERROR)
 		{
+			free_via_list(vb);
 			/* TODO - errors
 			LM_ERR("bad via\n");
 			free_via_list(vb);
@@ -134,7 +147,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 		hdr->body.len = tmp - hdr->body.s;
 		break;
 	case HDR_CSEQ_T:
-		cseq_b = pkg_malloc(sizeof (struct cseq_body));
+		cseq_b = parser_malloc(sizeof (struct cseq_body));
 		if (cseq_b == 0)
 		{
 			LM_ERR("out of pkg memory\n");
@@ -145,9 +158,10 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 		tmp = parse_cseq(tmp, end, cseq_b);
 		if (cseq_b->error == PARSE_ERROR)
 		{
+			parser_free(cseq_b);
 			/*TODO - error
 			LM_ERR("bad cseq\n");
-			pkg_free(cseq_b);
+			parser_free(cseq_b);
 			set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 				"error parsing CSeq`");
 			set_err_reply(400, "bad CSeq header");
@@ -162,7 +176,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 			   cseq_b->method.len, cseq_b->method.s);
 		break;
 	case HDR_TO_T:
-		to_b = pkg_malloc(sizeof (struct to_body));
+		to_b = parser_malloc(sizeof (struct to_body));
 		if (to_b == 0)
 		{
 			LM_ERR("out of pkg memory\n");
@@ -173,7 +187,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 		tmp = parse_to(tmp, end, to_b);
 		if (to_b->error == PARSE_ERROR)
 		{
-			pkg_free(to_b);
+			parser_free(to_b);
 			/* TODO - error
 			LM_ERR("bad to header\n");
 			set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
@@ -242,22 +256,15 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 	case HDR_OTHER_T:
 		/* just skip over it */
 		hdr->body.s = tmp;
-		/* find end of header */
-		/* find lf */
-		do
+		/* find end of header (lf not followed by whitespace) */
+		match = scan_hdr_end(tmp, end);
+		if (match == NULL)
 		{
-			match = q_memchr(tmp, '\n', end - tmp);
-			if (match)
-			{
-				match++;
-			} else
-			{
-				LM_ERR("bad body for <%s>(%d)\n", hdr->name.s, hdr->type);
-				tmp = end;
-				goto error_bad_hdr;
-			}
-			tmp = match;
-		} while (match < end && ((*match == ' ') || (*match == '\t')));
+			LM_ERR("bad body for <%.*s>(%d)\n", hdr->name.len,
+				hdr->name.s, hdr->type);
+			tmp = end;
+			goto error_bad_hdr;
+		}
 		tmp = match;
 		hdr->body.len = match - hdr->body.s;
 		break;
@@ -299,7 +306,7 @@ error_bad_hdr:
    give you the first occurrence of a header you are interested in,
    look at check_transaction_quadruple
  */
-int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
+static int _parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 {
 	struct hdr_field *hf;
 	struct hdr_field *itr;
@@ -313,7 +320,9 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 	do{ \
 		if (msg->_hook==0) msg->_hook=_hdr;\
 			else {\
-				for(itr=msg->_hook;itr->next_sibling;itr=itr->next_sibling);\
+				itr = hdr_idx_last_hf(&msg->hidx, _hdr->type);\
+				if (itr==NULL) itr = msg->_hook;\
+				for( ; itr->next_sibling ; itr=itr->next_sibling);\
 				itr->next_sibling = _hdr;\
 				_hdr->prev_sibling = itr;\
 			}\
@@ -340,6 +349,7 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 		for (sc = tmp; sc + 1 < end; sc++)
 		{
 			if (*sc == '\r' && *(sc + 1) == '\n' && ( sc == tmp
+			    || sc + 2 == end
 			    || ( *(sc + 2) != ' ' && *(sc + 2) != '\t' && *(sc + 2) != 0 )))
 			{
 				have_header = 1;
@@ -353,7 +363,7 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 			return 1;
 		}
 
-		hf = pkg_malloc(sizeof (struct hdr_field));
+		hf = parser_malloc(sizeof (struct hdr_field));
 		if (hf == 0)
 		{
 			//TODO -error
@@ -364,6 +374,8 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 			goto error;
 		}
 		memset(hf, 0, sizeof (struct hdr_field));
+		if (hdr_idx_full(&msg->hidx) && hdr_idx_grow(&msg->hidx)<0)
+			goto error;
 		hf->type = HDR_ERROR_T;
 		rest = get_hdr_field(tmp, msg->buf + msg->len, hf);
 		switch (hf->type)
@@ -374,7 +386,7 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 		case HDR_EOH_T:
 			msg->eoh = tmp; /* or rest?*/
 			msg->parsed_flag |= HDR_EOH_F;
-			pkg_free(hf);
+			parser_free(hf);
 			goto skip;
 		case HDR_OTHER_T: /*do nothing*/
 			break;
@@ -545,6 +557,7 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 			LM_CRIT("unknown header type %d\n", hf->type);
 			goto error;
 		}
+		hdr_idx_add(&msg->hidx, hf, msg->buf);
 		/* add the header to the list*/
 		if (msg->last_header == 0)
 		{
@@ -571,11 +584,24 @@ skip:
 error:
 	//ser_error=E_BAD_REQ;//TODO -error
 
-	if (hf) pkg_free(hf);
+	if (hf) parser_free(hf);
 	if (next) msg->parsed_flag |= orig_flag;
 	return -1;
 }
 
+int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
+{
+	struct msg_arena *bk;
+	int ret;
+
+	/* all the header parsers allocate from the arena of the message */
+	msg_arena_enter( msg, bk);
+	ret = _parse_headers( msg, flags, next);
+	msg_arena_leave( bk);
+
+	return ret;
+}
+
 /* returns 
  *		0 if ok,
  *		-1 for errors
@@ -598,8 +624,8 @@ int parse_msg(struct sip_msg* msg, hdr_flags_t flags)
 		fl = &(msg->first_line);
 
 		/* eat crlf from the beginning */
-		for (tmp = buf; (*tmp == '\n' || *tmp == '\r') &&
-			(unsigned int) (tmp - buf) < len; tmp++);
+		for (tmp = buf; (unsigned int) (tmp - buf) < len &&
+			(*tmp == '\n' || *tmp == '\r'); tmp++);
 		offset = tmp - buf;
 
 		msg->unparsed = parse_first_line(tmp, len - offset, fl);
@@ -666,6 +692,73 @@ void free_reply_lump( struct lump_rpl *lump)
 }
  */
 
+/* allocates a sip_msg, its arena and a buffer of "len" bytes (plus a zero
+ * terminator) as a single memory chunk (only the sip_msg structure is
+ * zeroed) */
+struct sip_msg* new_sip_msg(unsigned int len)
+{
+	struct sip_msg *msg;
+	unsigned int arena;
+
+	arena = MSG_ARENA_SIZE(len);
+	msg = (struct sip_msg*)pkg_malloc( sizeof(struct sip_msg) + arena + len + 1);
+	if (msg==NULL) {
+		LM_ERR("no more pkg memory (%d)\n", len);
+		return NULL;
+	}
+	memset( msg, 0, sizeof(struct sip_msg));
+	msg_arena_init( &msg->arena, (char*)(msg+1), arena);
+	msg->buf = (char*)(msg+1) + arena;
+	msg->buf[len] = 0;
+
+	return msg;
+}
+
+struct sip_msg* new_sip_msg_shared(struct sip_msg_buf *mb, char *buf,
+															unsigned int len)
+{
+	struct sip_msg *msg;
+	unsigned int arena;
+
+	arena = MSG_ARENA_SIZE(len);
+	msg = (struct sip_msg*)pkg_malloc( sizeof(struct sip_msg) + arena );
+	if (msg==NULL) {
+		LM_ERR("no more pkg memory (%d)\n", len);
+		return NULL;
+	}
+	memset( msg, 0, sizeof(struct sip_msg));
+	msg_arena_init( &msg->arena, (char*)(msg+1), arena);
+	msg->buf = buf;
+	msg->len = len;
+	msg->shared_buf = mb;
+	atomic_inc(&mb->ref);
+
+	return msg;
+}
+
+struct sip_msg_buf* new_sip_msg_buf(unsigned int size)
+{
+	struct sip_msg_buf *mb;
+
+	/* one more byte, to zero terminate the data */
+	mb = (struct sip_msg_buf*)shm_malloc( sizeof(struct sip_msg_buf)+size+1 );
+	if (mb==NULL) {
+		LM_ERR("no more shm memory (%d)\n", size);
+		return NULL;
+	}
+	mb->ref = 1;
+	mb->size = size;
+	mb->buf[size] = 0;
+
+	return mb;
+}
+
+void unref_sip_msg_buf(struct sip_msg_buf *mb)
+{
+	if (atomic_dec(&mb->ref)==0)
+		shm_free(mb);
+}
+
 void free_sip_msg(struct sip_msg* msg)
 {
 	if (msg->new_uri.s)
@@ -684,6 +777,7 @@ void free_sip_msg(struct sip_msg* msg)
 		msg->path_vec.len = 0;
 	}
 	if (msg->headers) free_hdr_field_lst(msg->headers);
+	hdr_idx_free(&msg->hidx);
 	if (msg->sdp) free_sdp(&(msg->sdp));
 	/* TODO - lumps
 	if (msg->add_rm)      free_lump_list(msg->add_rm);
@@ -695,6 +789,8 @@ void free_sip_msg(struct sip_msg* msg)
 		free_multi_body(msg->multi);
 		msg->multi = 0;
 	}
+	if (msg->shared_buf)
+		unref_sip_msg_buf(msg->shared_buf);
 
 	pkg_free(msg);
 
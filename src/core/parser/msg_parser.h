@@ -38,6 +38,16 @@
 #include "parse_multipart.h"
 #include "hf.h"
 #include "sdp/sdp.h"
+#include "msg_arena.h"
+#include "hdr_idx.h"
+
+
+/* receive buffer shared by the messages pointing into it (ref counted) */
+struct sip_msg_buf {
+	volatile int ref;
+	unsigned int size;
+	char buf[0];
+};
 
 
 /* convenience short-cut macros */
@@ -157,6 +167,7 @@ struct sip_msg {
 	struct hdr_field* headers;     /* All the parsed headers*/
 	struct hdr_field* last_header; /* Pointer to the last parsed header*/
 	hdr_flags_t parsed_flag;       /* Already parsed header field types */
+	struct hdr_idx hidx;           /* index of the headers, by type */
 
 	/* Via, To, CSeq, Call-Id, From, end of header*/
 	/* pointers to the first occurrences of these headers;
@@ -255,6 +266,13 @@ struct sip_msg {
 
 	/* create a route HF out of this path vector */
 	str path_vec;
+
+	/* memory for the parsed structures (released with the message) */
+	struct msg_arena arena;
+
+	/* shared buffer "buf" points into (NULL if buf is part of the
+	 * message chunk) */
+	struct sip_msg_buf *shared_buf;
 };
 
 
@@ -272,6 +290,18 @@ struct multi_body * get_all_bodies(struct sip_msg * );
 
 char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr);
 
+struct sip_msg* new_sip_msg(unsigned int len);
+
+/* message whose data is already in a shared buffer (not copied); the
+ * data may be followed by more data (like the next message of a TCP
+ * stream), the parsers do not look past buf+len */
+struct sip_msg* new_sip_msg_shared(struct sip_msg_buf *mb, char *buf,
+															unsigned int len);
+
+struct sip_msg_buf* new_sip_msg_buf(unsigned int size);
+
+void unref_sip_msg_buf(struct sip_msg_buf *mb);
+
 void free_sip_msg(struct sip_msg* msg);
 
 /* make sure all HFs needed for transaction identification have been
@@ -315,17 +345,48 @@ inline static char* get_body(struct sip_msg *msg)
 inline static struct hdr_field *get_header_by_name( struct sip_msg *msg,
 													char *s, unsigned int len)
 {
-	struct hdr_field *hdr;
-
-	for( hdr=msg->headers ; hdr ; hdr=hdr->next ) {
-		if (hdr->type==HDR_OTHER_T && len==hdr->name.len
-		&& strncasecmp(hdr->name.s,s,len)==0)
-			return hdr;
+	struct hdr_idx_e *e;
+	unsigned short i;
+	int id;
+
+	/* a registered name has its own chain */
+	if (hname_dyn_no && (id=get_hdr_name_id(s, len))>=0)
+		return hdr_idx_first_hf(&msg->hidx, HDR_DYN_T(id));
+
+	/* only the unknown headers, straight from the index */
+	for( i=hdr_idx_first(&msg->hidx, HDR_OTHER_T) ; i ;
+	i=hdr_idx_next(&msg->hidx, i) ) {
+		e = hdr_idx_at(&msg->hidx, i);
+		if (len==e->name_len
+		&& strncasecmp(hdr_idx_name_s(e, msg->buf),s,len)==0)
+			return e->hf;
 	}
 	return NULL;
 }
 
 
+/*
+ * First header with a name registered via register_hdr_name() - "id" is
+ * the value returned by it (no parsing done)
+ */
+#define get_header_by_id(_msg, _id) \
+		hdr_idx_first_hf(&(_msg)->hidx, HDR_DYN_T(_id))
+
+/*
+ * Next header of the same type as "hf" (or with the same registered
+ * name); NULL if none was parsed yet
+ */
+inline static struct hdr_field *get_next_header( struct sip_msg *msg,
+													struct hdr_field *hf)
+{
+	unsigned short i;
+
+	if (hf->idx==0 || (i=hdr_idx_next(&msg->hidx, hf->idx))==0)
+		return NULL;
+	return hdr_idx_at(&msg->hidx, i)->hf;
+}
+
+
 /*
  * Make a private copy of the string and assign it to new_uri (new RURI)
  */
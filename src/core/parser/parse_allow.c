@@ -64,7 +64,7 @@ int parse_allow(struct sip_msg *msg)
 			continue;
 		}
 
-		ab = (struct allow_body*)pkg_malloc(sizeof(struct allow_body));
+		ab = (struct allow_body*)parser_malloc(sizeof(struct allow_body));
 		if (ab == 0) {
 			LM_ERR("out of pkg_memory\n");
 			return -1;
@@ -89,7 +89,7 @@ int parse_allow(struct sip_msg *msg)
 
 error:
 	if(ab!=0)
-		pkg_free(ab);
+		parser_free(ab);
 	return -1;
 }
 
@@ -28,6 +28,7 @@
 #define PARSE_ALLOW_H
 
 #include "../mem/mem.h"
+#include "msg_arena.h"
 #include "msg_parser.h"
 
  
@@ -54,7 +55,7 @@ int parse_allow( struct sip_msg *msg);
 static inline void free_allow(struct allow_body **ab)
 {
 	if (ab && *ab) {
-		pkg_free(*ab);
+		parser_free(*ab);
 		*ab = 0;
 	}
 }
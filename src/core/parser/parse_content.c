@@ -24,6 +24,8 @@
  * the mime type (bogdan)
  * 2003-08-04 CPL subtype added (bogdan)
  * 2003-08-05 parse_accept_hdr function added (bogdan)
+ * 2010-09-xx the params of a bad Content-Type are freed
+ * 2010-09-xx a Content-Length overflowing an int is an error
  */
 
 
@@ -32,6 +34,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <limits.h>
 #include "../mem/mem.h"
 #include "../log.h"
 #include "../str.h"
@@ -238,6 +241,8 @@ char* parse_content_length( char* buffer, char* end, int* length)
 	size = 0;
 	number = 0;
 	while (p<end && *p>='0' && *p<='9') {
+		if (number > (INT_MAX-9)/10)
+			goto error;
 		number = number*10 + (*p)-'0';
 		size ++;
 		p++;
@@ -425,7 +430,7 @@ int parse_content_type_hdr( struct sip_msg *msg )
 	if ( msg->content_type->parsed!=0)
 		return get_content_type(msg);
 
-	rez = (content_t*) pkg_malloc(sizeof (content_t));
+	rez = (content_t*) parser_malloc(sizeof (content_t));
 	if (rez == NULL)
 	{
 		LM_ERR("Unable to allocate memory\n");
@@ -455,7 +460,7 @@ int parse_content_type_hdr( struct sip_msg *msg )
 	return mime;
 
 parse_error:
-	pkg_free(rez);
+	free_contenttype(&rez);
 	/* TODO - error
 	set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 		"error parsing CT-TYPE header");
@@ -524,7 +529,7 @@ int parse_accept_hdr( struct sip_msg *msg )
 	}
 
 	/* copy and link the mime buffer into the message */
-	msg->accept->parsed = (void*)pkg_malloc((nr_mimes+1)*sizeof(int));
+	msg->accept->parsed = (void*)parser_malloc((nr_mimes+1)*sizeof(int));
 	if (msg->accept->parsed==0) {
 		LM_ERR("no more pkg memory\n");
 		goto error;
@@ -552,7 +557,7 @@ void free_contenttype(content_t ** con)
 	{
 		if((*con)->params)
 			free_params((*con)->params);
-		pkg_free(*con);
+		parser_free(*con);
 	}
 	*con = 0;
 }
@@ -32,6 +32,7 @@
 #include "parse_def.h"
 #include "parse_methods.h"
 #include "../mem/mem.h"
+#include "msg_arena.h"
 
 /*
  * Parse CSeq header field
@@ -99,5 +100,5 @@ error:
 
 void free_cseq(struct cseq_body* cb)
 {
-	pkg_free(cb);
+	parser_free(cb);
 }
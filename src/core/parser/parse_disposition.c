@@ -343,10 +343,10 @@ void free_disposition( struct disposition **disp)
 	/* free the params */
 	while((*disp)->params) {
 		param = (*disp)->params->next;
-		pkg_free( (*disp)->params);
+		parser_free( (*disp)->params);
 		(*disp)->params = param;
 	}
-	pkg_free( *disp );
+	parser_free( *disp );
 	*disp = 0;
 }
 
@@ -380,7 +380,7 @@ int parse_content_disposition( struct sip_msg *msg )
 	}
 
 	/* parse the body */
-	disp = (struct disposition*)pkg_malloc(sizeof(struct disposition));
+	disp = (struct disposition*)parser_malloc(sizeof(struct disposition));
 	if (disp==0) {
 		LM_ERR("no more pkg memory\n");
 		goto error;
@@ -51,7 +51,7 @@ int parse_diversion_header(struct sip_msg *msg)
 
 	/* bad luck! :-( - we have to parse it */
 	/* first, get some memory */
-	diversion_b = pkg_malloc(sizeof(struct to_body));
+	diversion_b = parser_malloc(sizeof(struct to_body));
 	if (diversion_b == 0) {
 		LM_ERR("out of pkg_memory\n");
 		goto error;
@@ -63,7 +63,7 @@ int parse_diversion_header(struct sip_msg *msg)
 		msg->diversion->body.s + msg->diversion->body.len + 1, diversion_b);
 	if (diversion_b->error == PARSE_ERROR) {
 		LM_ERR("bad diversion header\n");
-		pkg_free(diversion_b);
+		parser_free(diversion_b);
 		goto error;
 	}
 	msg->diversion->parsed = diversion_b;
@@ -34,6 +34,7 @@
 #include <string.h>        /* memset */
 #include <stdio.h>         /* printf */
 #include "../mem/mem.h"    /* pkg_malloc, pkg_free */
+#include "msg_arena.h"     /* parser_malloc, parser_free */
 #include "../log.h"
 #include "../trim.h"       /* trim_leading */
 #include "../utils.h"
@@ -162,7 +163,7 @@ int parse_event(struct hdr_field* _h)
 		return 0;
 	}
 
-	e = (event_t*)pkg_malloc(sizeof(event_t));
+	e = (event_t*)parser_malloc(sizeof(event_t));
 	if (e == 0) {
 		LM_ERR("no pkg memory left\n");
 		return -1;
@@ -171,7 +172,7 @@ int parse_event(struct hdr_field* _h)
 	memset(e, 0, sizeof(event_t));
 
 	if (event_parser(_h->body.s, _h->body.len, e) < 0) {
-		pkg_free(e);
+		parser_free(e);
 		/*TODO - error
 		LM_ERR("event_parser failed\n");
 		set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
@@ -195,7 +196,7 @@ void free_event(event_t** _e)
 	{	
 		if((*_e)->params)
 			free_params((*_e)->params);
-		pkg_free(*_e);
+		parser_free(*_e);
 	}	
 	*_e = 0;
 }
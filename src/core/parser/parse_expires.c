@@ -31,6 +31,7 @@
 #include <stdio.h>          /* printf */
 #include <string.h>         /* memset */
 #include "../mem/mem.h"     /* pkg_malloc, pkg_free */
+#include "msg_arena.h"      /* parser_malloc, parser_free */
 #include "../log.h"
 #include "../trim.h"        /* trim_leading */
 #include "../utils.h"
@@ -77,7 +78,7 @@ int parse_expires(struct hdr_field* _h)
 		return 0;  /* Already parsed */
 	}
 
-	e = (exp_body_t*)pkg_malloc(sizeof(exp_body_t));
+	e = (exp_body_t*)parser_malloc(sizeof(exp_body_t));
 	if (e == 0) {
 		LM_ERR("no pkg memory left\n");
 		return -1;
@@ -92,7 +93,7 @@ int parse_expires(struct hdr_field* _h)
 			"error parsing EXPIRE header");
 		set_err_reply(400, "bad headers");
 		 * */
-		pkg_free(e);
+		parser_free(e);
 		return -2;
 	}
 	
@@ -106,7 +107,7 @@ int parse_expires(struct hdr_field* _h)
  */
 void free_expires(exp_body_t** _e)
 {
-	pkg_free(*_e);
+	parser_free(*_e);
 	*_e = 0;
 }
 
@@ -1,7 +1,7 @@
 /* 
  * $Id: parse_hname2.c 5891 2009-07-20 12:53:09Z bogdan_iancu $ 
  *
- * Fast 32-bit Header Field Name Parser
+ * Header Field Name Parser
  *
  * Copyright (C) 2001-2003 FhG Fokus
  *
@@ -27,249 +27,280 @@
  * 2003-01-27 next baby-step to removing ZT - PRESERVE_ZT (jiri)
  * 2003-05-01 added support for Accept HF (janakj)
  * 2006-02-17 Session-Expires, Min-SE (dhsueh@somanetworks.com)
+ * 2010-09-xx ':' of unknown headers found with scan_chr()
+ * 2010-09-xx names classified via a generated perfect hash (hname_gen.sh)
+ *            instead of the case_*.h switches; names registered at
+ *            startup get their own type in the header index
+ * 2010-09-xx aligned table entries, cheaper case folding, the second half
+ *            of the name compared only for names above 16 bytes
  */
 
 
+#include <string.h>
+
+#include "../mem/mem.h"
+#include "../log.h"
 #include "parse_hname2.h"
-#include "keys.h"
-#include "../utils.h"  /* q_memchr */
+#include "scan.h"
 
-#define LOWER_BYTE(b) ((b) | 0x20)
-#define LOWER_DWORD(d) ((d) | 0x20202020)
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HNAME_SSE2
+#include <emmintrin.h>
+#endif
 
-/*
- * Skip all white-chars and return position of the first
- * non-white char
- */
-static inline char* skip_ws(char* p, unsigned int size)
+/* the names are zero padded and aligned, so they can be loaded as
+ * 2 x 16 bytes */
+#define HNAME_SIZE  32
+
+struct hname_ent {
+	char name[HNAME_SIZE];
+	unsigned char len;
+	unsigned char type;
+} __attribute__((aligned(16)));
+
+#include "hname_hash.h"
+
+#if HNAME_MAX_LEN >= HNAME_SIZE
+#error "header names too long for HNAME_SIZE"
+#endif
+
+/* lower-cases letters only (unlike "|0x20", which turns CR into '-') */
+#define HNAME_LOWER(_c) \
+	((unsigned char)((_c)-'A')<26 ? (unsigned char)((_c)|0x20) : \
+		(unsigned char)(_c))
+
+#define hname_hash(_s, _len) \
+	HNAME_HASH( (unsigned char)((_s)[0]|0x20), \
+		((_len)>1 ? (unsigned char)((_s)[1]|0x20) : 0), (_len))
+
+/* names registered at startup (lower-cased) and their hash table; the
+ * table holds id+1, 0 is a free slot */
+static str hname_dyn[HDR_DYN_MAX];
+static unsigned char hname_dyn_tab[HNAME_HASH_SIZE];
+int hname_dyn_no = 0;
+
+
+static inline int hname_eq(const char *s, const char *lname, int len)
 {
-	char* end;
-	
-	end = p + size;
-	for(; p < end; p++) {
-		if ((*p != ' ') && (*p != '\t')) return p;
-	}
-	return p;
+	int i;
+
+	for( i=0 ; i<len ; i++ )
+		if (HNAME_LOWER(s[i])!=(unsigned char)lname[i])
+			return 0;
+	return 1;
 }
-	
-/*
- * Parser macros
- */
-#include "case_via.h"      /* Via */
-#include "case_from.h"     /* From */
-#include "case_to.h"       /* To */
-#include "case_cseq.h"     /* CSeq */
-#include "case_call.h"     /* Call-ID */
-#include "case_cont.h"     /* Contact, Content-Type, Content-Length,
-                              Content-Purpose, Content-Action,
-                              Content-Disposition */
-#include "case_rout.h"     /* Route */
-#include "case_max.h"      /* Max-Forwards */
-#include "case_reco.h"     /* Record-Route */
-#include "case_path.h"     /* Path */
-#include "case_auth.h"     /* Authorization */
-#include "case_expi.h"     /* Expires */
-#include "case_prox.h"     /* Proxy-Authorization, Proxy-Require */
-#include "case_allo.h"     /* Allow */
-#include "case_unsu.h"     /* Unsupported */
-#include "case_even.h"     /* Event */
-#include "case_acce.h"     /* Accept, Accept-Language */
-#include "case_orga.h"     /* Organization */
-#include "case_prio.h"     /* Priority */
-#include "case_subj.h"     /* Subject */
-#include "case_user.h"     /* User-Agent */
-#include "case_supp.h"     /* Supported */
-#include "case_dive.h"     /* Diversion */
-#include "case_remo.h"     /* Remote-Party-ID */
-#include "case_refe.h"     /* Refer-To */
-#include "case_sess.h"     /* Session-Expires */
-#include "case_min_.h"     /* Min-SE */
-#include "case_p_pr.h"     /* P-Preferred-Identity */
-#include "case_p_as.h"     /* P-Asserted-Identity */
-#include "case_priv.h"     /* Privacy */
-#include "case_retr.h"     /* Retry-After */
-
-
-#define READ(val) \
-(*(val + 0) + (*(val + 1) << 8) + (*(val + 2) << 16) + (*(val + 3) << 24))
-
-
-#define FIRST_QUATERNIONS       \
-	case _via1_: via1_CASE; \
-	case _from_: from_CASE; \
-	case _to12_: to12_CASE; \
-	case _cseq_: cseq_CASE; \
-	case _call_: call_CASE; \
-	case _cont_: cont_CASE; \
-	case _rout_: rout_CASE; \
-	case _max__: max_CASE;  \
-	case _reco_: reco_CASE; \
-	case _via2_: via2_CASE; \
-	case _auth_: auth_CASE; \
-	case _supp_: supp_CASE; \
-	case _expi_: expi_CASE; \
-	case _prox_: prox_CASE; \
-	case _allo_: allo_CASE; \
-	case _path_: path_CASE; \
-	case _unsu_: unsu_CASE; \
-	case _even_: even_CASE; \
-	case _acce_: acce_CASE; \
-	case _orga_: orga_CASE; \
-	case _prio_: prio_CASE; \
-	case _subj_: subj_CASE; \
-	case _user_: user_CASE; \
-	case _dive_: dive_CASE; \
-	case _remo_: remo_CASE; \
-	case _refe_: refe_CASE; \
-	case _sess_: sess_CASE; \
-	case _min__: min__CASE; \
-	case _p_pr_: p_pr_CASE; \
-	case _p_as_: p_as_CASE; \
-	case _priv_: priv_CASE; \
-	case _retr_: retr_CASE; \
-
-
-#define PARSE_COMPACT(id)          \
-        switch(*(p + 1)) {         \
-        case ' ':                  \
-	        hdr->type = id;    \
-	        p += 2;            \
-	        goto dc_end;       \
-	                           \
-        case ':':                  \
-	        hdr->type = id;    \
-	        hdr->name.len = 1; \
-	        return (p + 2);    \
-        }                            
+
+/* type of a header name (without the white spaces before ':') */
+static inline hdr_types_t hname_type(const char *s, int len)
+{
+	const struct hname_ent *e;
+
+	if (len>HNAME_MAX_LEN || len==0)
+		return HDR_OTHER_T;
+	e = &hname_tab[hname_hash(s, len)];
+	if (e->len==len && hname_eq(s, e->name, len))
+		return e->type;
+	return HDR_OTHER_T;
+}
+
+
+#ifdef HNAME_SSE2
+
+/* lower-cases the letters: 'A'..'Z' moved to -128..-103 by the add are
+ * the only bytes below -102 */
+static inline __m128i hname_fold(__m128i v)
+{
+	__m128i up;
+
+	up = _mm_cmplt_epi8( _mm_add_epi8( v, _mm_set1_epi8(0x80-'A')),
+		_mm_set1_epi8(-128+26));
+	return _mm_or_si128( v, _mm_and_si128( up, _mm_set1_epi8(0x20)));
+}
+
+/* same as hname_type(), with the first 32 bytes of the name already
+ * loaded in "v0" and "v1" */
+static inline hdr_types_t hname_type_v(const char *s, int len,
+													__m128i v0, __m128i v1)
+{
+	const struct hname_ent *e;
+	unsigned int m;
+
+	if (len>HNAME_MAX_LEN || len==0)
+		return HDR_OTHER_T;
+	e = &hname_tab[hname_hash(s, len)];
+
+	m = _mm_movemask_epi8( _mm_cmpeq_epi8( hname_fold(v0),
+			_mm_load_si128((const __m128i*)e->name)));
+	/* most of the names fit in the first half */
+	if (len>16)
+		m |= (unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8(
+			hname_fold(v1), _mm_load_si128((const __m128i*)(e->name+16))))
+			<< 16;
+	return ((m | (~0U << len)) == ~0U && e->len==len) ?
+		e->type : HDR_OTHER_T;
+}
+
+#endif
+
 
 char* parse_hname2(char* begin, char* end, struct hdr_field* hdr)
 {
-	register char* p;
-	register unsigned int val;
+	char *p;
+	char *n;
 
 	if ((end - begin) < 4) {
 		hdr->type = HDR_ERROR_T;
 		return begin;
 	}
 
-	p = begin;
-
-	val = LOWER_DWORD(READ(p));
-	hdr->name.s = begin;
+#ifdef HNAME_SSE2
+	/* the ':' of all the known names is in the first 32 bytes */
+	if ((end - begin) >= 32) {
+		__m128i v0, v1, c;
+		unsigned int m, ws;
+		int len;
 
-	switch(val) {
-	FIRST_QUATERNIONS;
-
-	default:
-		switch(LOWER_BYTE(*p)) {
-		case 't':                           
-			switch(LOWER_BYTE(*(p + 1))) {          
-			case 'o':                   
-			case ' ':                   
-				hdr->type = HDR_TO_T; 
-				p += 2;             
-				goto dc_end;        
-				
-			case ':':                   
-				hdr->type = HDR_TO_T; 
-				hdr->name.len = 1;  
-				return (p + 2);     
-			}                           
-			break;
-
-		case 'v': PARSE_COMPACT(HDR_VIA_T);           break;
-		case 'f': PARSE_COMPACT(HDR_FROM_T);          break;
-		case 'i': PARSE_COMPACT(HDR_CALLID_T);        break;
-		case 'm': PARSE_COMPACT(HDR_CONTACT_T);       break;
-		case 'l': PARSE_COMPACT(HDR_CONTENTLENGTH_T); break;
-		case 'k': PARSE_COMPACT(HDR_SUPPORTED_T);     break;
-		case 'c': PARSE_COMPACT(HDR_CONTENTTYPE_T);   break;
-		case 'o': PARSE_COMPACT(HDR_EVENT_T);         break;
-		case 'x': PARSE_COMPACT(HDR_SESSION_EXPIRES_T); break;
+		v0 = _mm_loadu_si128((const __m128i*)begin);
+		v1 = _mm_loadu_si128((const __m128i*)(begin+16));
+		c = _mm_set1_epi8(':');
+		m = _mm_movemask_epi8( _mm_cmpeq_epi8( v0, c)) |
+			(unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8( v1, c)) << 16;
+		if (m) {
+			len = __builtin_ctz(m);
+			hdr->name.s = begin;
+			hdr->name.len = len;
+			/* white spaces before ':' (rare) */
+			if (len && (begin[len-1]==' ' || begin[len-1]=='\t')) {
+				c = _mm_set1_epi8(' ');
+				ws = _mm_movemask_epi8( _mm_cmpeq_epi8( v0, c)) |
+					(unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8( v1, c)) << 16;
+				c = _mm_set1_epi8('\t');
+				ws |= _mm_movemask_epi8( _mm_cmpeq_epi8( v0, c)) |
+					(unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8( v1, c)) << 16;
+				for( ; len && (ws & (1U<<(len-1))) ; len-- );
+			}
+			hdr->type = hname_type_v( begin, len, v0, v1);
+			return (begin + hdr->name.len + 1);
 		}
+		p = scan_chr(begin + 32, end, ':');
 		goto other;
-        }
-
-	/* Double colon hasn't been found yet */
- dc_end:
-	p = skip_ws(p, end - p);
-	if (*p != ':') {   
-	        goto other;
-	} else {
-		hdr->name.len = p - hdr->name.s;
+	}
+#endif
+
+	p = scan_chr(begin, end, ':');
+	if (p) {
+		hdr->name.s = begin;
+		hdr->name.len = p - begin;
+		for( n=p ; n>begin && (n[-1]==' ' || n[-1]=='\t') ; n-- );
+		hdr->type = hname_type(begin, n - begin);
 		return (p + 1);
 	}
 
-	/* Unknown header type */
- other:    
-	p = q_memchr(p, ':', end - p);
+#ifdef HNAME_SSE2
+other:
+#endif
 	if (!p) {        /* No double colon found, error.. */
 		hdr->type = HDR_ERROR_T;
 		hdr->name.s = 0;
 		hdr->name.len = 0;
 		return 0;
-	} else {
-		hdr->type = HDR_OTHER_T;
-		hdr->name.len = p - hdr->name.s;
-		return (p + 1);
 	}
+	/* too long to be a known one */
+	hdr->type = HDR_OTHER_T;
+	hdr->name.s = begin;
+	hdr->name.len = p - begin;
+	return (p + 1);
 }
 
 char *parse_name_only(char* begin, char* end, struct hdr_field* hdr)
 {
-	register char* p;
-	register unsigned int val;
-
-	if ((end - begin) < 2) {
+	if (end <= begin) {
 		hdr->type = HDR_ERROR_T;
 		return begin;
 	}
 
-	p = begin;
-
-	val = LOWER_DWORD(READ(p));
 	hdr->name.s = begin;
+	hdr->name.len = end - begin;
+	hdr->type = hname_type(begin, end - begin);
+	return end;
+}
 
-	switch(val) {
-	FIRST_QUATERNIONS;
-
-	default:
-		switch(LOWER_BYTE(*p)) {
-		case 't':                           
-			switch(LOWER_BYTE(*(p + 1))) {          
-			case 'o':                   
-			case ' ':                   
-				hdr->type = HDR_TO_T; 
-				p += 2;             
-				goto dc_end;        
-				
-			case ':':                   
-				hdr->type = HDR_TO_T; 
-				hdr->name.len = 1;  
-				return (p + 2);     
-			}                           
-			break;
-
-		case 'v': PARSE_COMPACT(HDR_VIA_T);           break;
-		case 'f': PARSE_COMPACT(HDR_FROM_T);          break;
-		case 'i': PARSE_COMPACT(HDR_CALLID_T);        break;
-		case 'm': PARSE_COMPACT(HDR_CONTACT_T);       break;
-		case 'l': PARSE_COMPACT(HDR_CONTENTLENGTH_T); break;
-		case 'k': PARSE_COMPACT(HDR_SUPPORTED_T);     break;
-		case 'c': PARSE_COMPACT(HDR_CONTENTTYPE_T);   break;
-		case 'o': PARSE_COMPACT(HDR_EVENT_T);         break;
-		case 'x': PARSE_COMPACT(HDR_SESSION_EXPIRES_T); break;
-		}
-		goto other;
-        }
 
-dc_end:
-//	hdr->name.len = p - hdr->name.s;
-	return (p + 1);
+int get_hdr_name_id(char *s, int len)
+{
+	unsigned int h;
+	int id;
 
-	/* Unknown header type */
-other:    
-	hdr->type = HDR_OTHER_T;
-	hdr->name.len = p - hdr->name.s;
-	return (p + 1);
+	for( ; len>0 && (s[len-1]==' ' || s[len-1]=='\t') ; len-- );
+	if (len==0)
+		return -1;
+
+	for( h=hname_hash(s, len) ; (id=hname_dyn_tab[h])!=0 ;
+	h=(h+1)&(HNAME_HASH_SIZE-1) ) {
+		id--;
+		if (hname_dyn[id].len==len && hname_eq(s, hname_dyn[id].s, len))
+			return id;
+	}
+	return -1;
+}
+
+
+int register_hdr_name(str *name)
+{
+	unsigned int h;
+	int id, i, len;
+
+	if (name==NULL || name->s==NULL) {
+		LM_ERR("NULL header name\n");
+		return -1;
+	}
+	for( len=name->len ;
+	len>0 && (name->s[len-1]==' ' || name->s[len-1]=='\t') ; len-- );
+	if (len==0) {
+		LM_ERR("empty header name\n");
+		return -1;
+	}
+
+	if (hname_type(name->s, len)!=HDR_OTHER_T) {
+		LM_ERR("<%.*s> is a known header, it has its own type\n",
+			len, name->s);
+		return -1;
+	}
+
+	if ((id=get_hdr_name_id(name->s, len))>=0)
+		return id;
+
+	if (hname_dyn_no==HDR_DYN_MAX) {
+		LM_ERR("too many header names registered (max %d)\n", HDR_DYN_MAX);
+		return -1;
+	}
+
+	id = hname_dyn_no;
+	hname_dyn[id].s = (char*)shm_malloc(len);
+	if (hname_dyn[id].s==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	for( i=0 ; i<len ; i++ )
+		hname_dyn[id].s[i] = HNAME_LOWER(name->s[i]);
+	hname_dyn[id].len = len;
+
+	/* at most HDR_DYN_MAX of HNAME_HASH_SIZE slots are used */
+	for( h=hname_hash(name->s, len) ; hname_dyn_tab[h]!=0 ;
+	h=(h+1)&(HNAME_HASH_SIZE-1) );
+	hname_dyn_tab[h] = id + 1;
+	hname_dyn_no++;
+
+	LM_DBG("header <%.*s> registered with id %d\n", len, name->s, id);
+	return id;
+}
+
+
+int add_hdr_name(char *s)
+{
+	str name;
+
+	name.s = s;
+	name.len = s ? strlen(s) : 0;
+	return register_hdr_name(&name)<0 ? -1 : 0;
 }
@@ -1,7 +1,7 @@
 /* 
  * $Id: parse_hname2.h 5891 2009-07-20 12:53:09Z bogdan_iancu $ 
  *
- * Fast 32-bit Header Field Name Parser
+ * Header Field Name Parser
  *
  * Copyright (C) 2001-2003 FhG Fokus
  *
@@ -30,9 +30,32 @@
 
 
 /*
- * Fast 32-bit header field name parser
+ * Header field name parser
  */
 char* parse_hname2(char* begin, char* end, struct hdr_field* hdr);
 char* parse_name_only(char* begin, char* end, struct hdr_field* hdr);
 
+
+/*
+ * Header names registered at startup (config or mod_init). The headers
+ * with such a name stay HDR_OTHER_T, but get their own type in the header
+ * index, so they are fetched by id (get_header_by_id()) instead of by
+ * comparing names.
+ */
+#define HDR_DYN_MAX      32
+
+/* header index type of a registered name */
+#define HDR_DYN_T(_id)   (HDR_EOH_T + 1 + (_id))
+
+extern int hname_dyn_no;
+
+/* returns the id of the name or -1; must not be called after startup */
+int register_hdr_name(str *name);
+
+/* id of a registered name or -1 */
+int get_hdr_name_id(char *s, int len);
+
+/* "header_name" core param */
+int add_hdr_name(char *s);
+
 #endif /* PARSE_HNAME2_H */
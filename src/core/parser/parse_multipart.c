@@ -24,6 +24,7 @@
 #include "parse_content.h"
 #include "parse_hname2.h"
 #include "parser_f.h"
+#include "scan.h"
 #include "../utils.h"
 #include "sdp/sdp_helpr_funcs.h"
 
@@ -33,7 +34,7 @@ struct part * new_part(void)
 {
 	struct part * temp;
 
-	temp = pkg_malloc(sizeof (struct part));
+	temp = parser_malloc(sizeof (struct part));
 
 	if (temp == 0)
 	{
@@ -80,22 +81,15 @@ char* get_hdr_field_unparsed(char* buf, char* end, struct hdr_field* hdr)
 
 	/* just skip over it */
 	hdr->body.s = tmp;
-	/* find end of header */
-	/* find lf */
-	do
+	/* find end of header (lf not followed by whitespace) */
+	match = scan_hdr_end(tmp, end);
+	if (match == NULL)
 	{
-		match = q_memchr(tmp, '\n', end - tmp);
-		if (match)
-		{
-			match++;
-		} else
-		{
-			LM_ERR("bad body for <%s>(%d)\n", hdr->name.s, hdr->type);
-			tmp = end;
-			goto error_bad_hdr;
-		}
-		tmp = match;
-	} while (match < end && ((*match == ' ') || (*match == '\t')));
+		LM_ERR("bad body for <%.*s>(%d)\n", hdr->name.len,
+			hdr->name.s, hdr->type);
+		tmp = end;
+		goto error_bad_hdr;
+	}
 	tmp = match;
 	hdr->body.len = match - hdr->body.s;
 
@@ -140,7 +134,7 @@ struct part * parse_single_part(char * start, char * end)
 		if (tmp == NULL || hd.type == HDR_ERROR_T)
 		{
 			LM_ERR("Error parsing header\n");
-			return 0;
+			goto error;
 		}
 
 
@@ -152,7 +146,7 @@ struct part * parse_single_part(char * start, char * end)
 			if (mime_end == NULL)
 			{
 				LM_ERR("Error parsing MIME\n");
-				return 0;
+				goto error;
 			}
 			ret->content_type = mime;
 		}
@@ -173,7 +167,9 @@ struct part * parse_single_part(char * start, char * end)
 
 
 	return ret;
-
+error:
+	parser_free(ret);
+	return 0;
 };
 
 inline struct multi_body * get_all_bodies(struct sip_msg * msg)
@@ -182,17 +178,20 @@ inline struct multi_body * get_all_bodies(struct sip_msg * msg)
 	int type = 0;
 	struct part ** cur, * temp;
 	str delimiter;
+	long len;
 
 	start = get_body(msg);
 
 	if (start == NULL)
 		return 0;
 
-	if (msg->buf + msg->len - start < get_content_length(msg))
+	/* no Content-Length, the body is the rest of the message */
+	len = msg->content_length ? get_content_length(msg) :
+		msg->buf + msg->len - start;
+	if (msg->buf + msg->len - start < len)
 	{
 		LM_ERR("Message is shorter than indicated by content length:"
-			" got %ld expected %ld\n", msg->buf + msg->len - start,
-			get_content_length(msg));
+			" got %ld expected %ld\n", msg->buf + msg->len - start, len);
 		return NULL;
 	}
 
@@ -203,7 +202,7 @@ inline struct multi_body * get_all_bodies(struct sip_msg * msg)
 		return 0;
 
 
-	msg->multi = pkg_malloc(sizeof (struct multi_body));
+	msg->multi = parser_malloc(sizeof (struct multi_body));
 
 	if (msg->multi == 0)
 	{
@@ -224,6 +223,12 @@ inline struct multi_body * get_all_bodies(struct sip_msg * msg)
 		LM_DBG("Starting parsing with boundary = [%.*s]\n", delimiter.len, delimiter.s);
 
 		start = find_sdp_line_delimiter(start, msg->buf + msg->len, delimiter);
+		if (start == NULL)
+		{
+			LM_ERR("no boundary [%.*s] in the body\n",
+				delimiter.len, delimiter.s);
+			return 0;
+		}
 		while (1)
 		{
 			end = find_sdp_line_delimiter(start + 1, msg->buf + msg->len, delimiter);
@@ -256,10 +261,10 @@ inline struct multi_body * get_all_bodies(struct sip_msg * msg)
 		temp->content_type = type;
 
 		temp->body.s = start;
-		temp->body.len = get_content_length(msg);
+		temp->body.len = len;
 
 		temp->all_data.s = start;
-		temp->all_data.len = get_content_length(msg);
+		temp->all_data.len = len;
 
 		*cur = temp;
 		msg->multi->part_count++;
@@ -282,8 +287,8 @@ void free_multi_body(struct multi_body * multi)
 	{
 		tmp =  p;
 		p = p->next;
-		pkg_free(tmp);
+		parser_free(tmp);
 	}
-	pkg_free(multi);
+	parser_free(multi);
 }
 
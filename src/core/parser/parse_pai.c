@@ -55,7 +55,7 @@ int parse_pai_header( struct sip_msg *msg )
  
     /* bad luck! :-( - we have to parse it */
     /* first, get some memory */
-    pai_b = pkg_malloc(sizeof(struct to_body));
+    pai_b = parser_malloc(sizeof(struct to_body));
     if (pai_b == 0) {
 	LM_ERR("out of pkg_memory\n");
 	goto error;
@@ -68,7 +68,7 @@ int parse_pai_header( struct sip_msg *msg )
 	     pai_b);
     if (pai_b->error == PARSE_ERROR) {
 	LM_ERR("bad P-Asserted-Identity header\n");
-	pkg_free(pai_b);
+	parser_free(pai_b);
 	/* TODO - error
 	set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 		"error parsing PAI header");
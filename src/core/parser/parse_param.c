@@ -35,6 +35,7 @@
 #include "../trim.h"
 #include "../mem/mem.h"
 #include "../mem/shm_mem.h"
+#include "msg_arena.h"
 #include "parse_param.h"
 
 
@@ -362,7 +363,7 @@ int parse_params(str* _s, pclass_t _c, param_hooks_t* _h, param_t** _p)
 	LM_DBG("Parsing params for:[%.*s]\n",_s->len,_s->s);
 
 	while(1) {
-		t = (param_t*)pkg_malloc(sizeof(param_t));
+		t = (param_t*)parser_malloc(sizeof(param_t));
 		if (t == 0) {
 			LM_ERR("no pkg memory left\n");
 			goto error;
@@ -424,7 +425,7 @@ int parse_params(str* _s, pclass_t _c, param_hooks_t* _h, param_t** _p)
 	}
 
 error:
-	if (t) pkg_free(t);
+	if (t) parser_free(t);
 	free_params(*_p);
 	*_p = 0;
 	return -2;
@@ -447,7 +448,7 @@ static inline void do_free_params(param_t* _p, int _shm)
 		ptr = _p;
 		_p = _p->next;
 		if (_shm) shm_free(ptr);
-		else pkg_free(ptr);
+		else parser_free(ptr);
 	}	
 }
 
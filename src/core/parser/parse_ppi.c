@@ -56,7 +56,7 @@ int parse_ppi_header( struct sip_msg *msg )
  
     /* bad luck! :-( - we have to parse it */
     /* first, get some memory */
-    ppi_b = pkg_malloc(sizeof(struct to_body));
+    ppi_b = parser_malloc(sizeof(struct to_body));
     if (ppi_b == 0) {
 	LM_ERR("out of pkg_memory\n");
 	goto error;
@@ -69,7 +69,7 @@ int parse_ppi_header( struct sip_msg *msg )
 	     ppi_b);
     if (ppi_b->error == PARSE_ERROR) {
 	LM_ERR("bad P-Preferred-Identity header\n");
-	pkg_free(ppi_b);
+	parser_free(ppi_b);
 	/* TODO -error
 	set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 			"error parsing PPI header");
@@ -52,7 +52,7 @@ int parse_refer_to_header( struct sip_msg *msg )
 
 	/* bad luck! :-( - we have to parse it */
 	/* first, get some memory */
-	refer_to_b = pkg_malloc(sizeof(struct to_body));
+	refer_to_b = parser_malloc(sizeof(struct to_body));
 	if (refer_to_b == 0) {
 		LM_ERR("out of pkg_memory\n");
 		goto error;
@@ -65,7 +65,7 @@ int parse_refer_to_header( struct sip_msg *msg )
 		refer_to_b);
 	if (refer_to_b->error == PARSE_ERROR) {
 		LM_ERR("bad Refer-To header\n");
-		pkg_free(refer_to_b);
+		parser_free(refer_to_b);
 		/* TODO -error
 		set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 			"error parsing REFER-TO header");
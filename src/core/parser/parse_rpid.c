@@ -52,7 +52,7 @@ int parse_rpid_header( struct sip_msg *msg )
 
 	/* bad luck! :-( - we have to parse it */
 	/* first, get some memory */
-	rpid_b = pkg_malloc(sizeof(struct to_body));
+	rpid_b = parser_malloc(sizeof(struct to_body));
 	if (rpid_b == 0) {
 		LM_ERR("out of pkg_memory\n");
 		goto error;
@@ -63,7 +63,7 @@ int parse_rpid_header( struct sip_msg *msg )
 	parse_to(msg->rpid->body.s,msg->rpid->body.s+msg->rpid->body.len+1,rpid_b);
 	if (rpid_b->error == PARSE_ERROR) {
 		LM_ERR("bad rpid header\n");
-		pkg_free(rpid_b);
+		parser_free(rpid_b);
 		/* TODO error
 		set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 			"error parsing RPID header");
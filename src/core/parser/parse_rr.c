@@ -62,7 +62,7 @@ static inline int do_parse_rr_body(char *buf, int len, rr_t **head)
 
 	while(1) {
 		/* Allocate and clear rr structure */
-		r = (rr_t*)pkg_malloc(sizeof(rr_t));
+		r = (rr_t*)parser_malloc(sizeof(rr_t));
 		if (!r) {
 			LM_ERR("no pkg memory left\n");
 			goto error;
@@ -132,7 +132,7 @@ static inline int do_parse_rr_body(char *buf, int len, rr_t **head)
  parse_error:
 	LM_ERR("failed to parse RR headers\n");
  error:
-	if (r) pkg_free(r);
+	if (r) parser_free(r);
 	free_rr(head); /* Free any contacts created so far */
 	return -1;
 
@@ -195,7 +195,7 @@ static inline void do_free_rr(rr_t** _r, int _shm)
 			else free_params(ptr->params);
 		}
 		if (_shm) shm_free(ptr);
-		else pkg_free(ptr);
+		else parser_free(ptr);
 	}
 }
 
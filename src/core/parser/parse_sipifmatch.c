@@ -26,6 +26,7 @@
 #include "../log.h"
 #include "parse_def.h"
 #include "../mem/mem.h"
+#include "msg_arena.h"
 #include "../trim.h"
 //#include "../errinfo.h"
 
@@ -81,7 +82,7 @@ parse_sipifmatch(struct hdr_field* _h)
                 return 0;
         }
 
-        e = (str*)pkg_malloc(sizeof(str));
+        e = (str*)parser_malloc(sizeof(str));
         if (e == 0) {
                 LM_ERR("no pkg memory left\n");
                 return -1;
@@ -91,7 +92,7 @@ parse_sipifmatch(struct hdr_field* _h)
 
         if (etag_parser(_h->body.s, _h->body.len, e) < 0) {
                 LM_ERR("error in etag_parser\n");
-                pkg_free(e);
+                parser_free(e);
 				/* TODO -error
 				set_err_info(OSER_EC_PARSER, OSER_EL_MEDIUM,
 					"error parsing etag headers");
@@ -108,6 +109,6 @@ parse_sipifmatch(struct hdr_field* _h)
 void free_sipifmatch(str** _e)
 {
 	if (*_e)
-		pkg_free(*_e);
+		parser_free(*_e);
 	*_e = 0;
 }
@@ -57,7 +57,7 @@ struct session_expires *
 malloc_session_expires( void )
 {
 	struct session_expires *se = (struct session_expires *)
-		pkg_malloc( sizeof(struct session_expires) );
+		parser_malloc( sizeof(struct session_expires) );
 	if ( se )
 		memset( se, 0, sizeof(struct session_expires) );
 	return se;
@@ -68,7 +68,7 @@ void
 free_session_expires( struct session_expires *se )
 {
 	if ( se )
-		pkg_free( se );
+		parser_free( se );
 }
 
 
@@ -33,7 +33,8 @@
 #define LOWER_BYTE(b) ((b) | 0x20)
 #define LOWER_DWORD(d) ((d) | 0x20202020)
 #define READ(val) \
-	(*(val + 0) + (*(val + 1) << 8) + (*(val + 2) << 16) + (*(val + 3) << 24))
+	((unsigned char)*(val + 0) + ((unsigned char)*(val + 1) << 8) + \
+	((unsigned char)*(val + 2) << 16) + ((unsigned)(unsigned char)*(val + 3) << 24))
 
 
 /*
@@ -132,7 +133,7 @@ int parse_supported( struct sip_msg *msg)
 			continue;
 		}
 
-		sb = (struct supported_body*)pkg_malloc(sizeof(struct supported_body));
+		sb = (struct supported_body*)parser_malloc(sizeof(struct supported_body));
 		if (sb == 0) {
 			LM_ERR("out of pkg_memory\n");
 			return -1;
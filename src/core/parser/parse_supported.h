@@ -33,6 +33,7 @@
 
 #include "msg_parser.h"
 #include "../mem/mem.h"
+#include "msg_arena.h"
 
 
 #define F_SUPPORTED_PATH		(1 << 0)
@@ -77,7 +78,7 @@ int parse_supported( struct sip_msg *msg);
 static inline void free_supported(struct supported_body **sb)
 {
 	if (sb && *sb) {
-		pkg_free(*sb);
+		parser_free(*sb);
 		*sb = 0;
 	}
 }
@@ -25,6 +25,8 @@
  * 2006-05-29 removed the NO_PINGTEL_TAG_HACK - it's conflicting the RFC 3261;
  *            TAG parameter must have value; other parameters are accepted
  *            without value (bogdan)
+ * 2010-09-xx free_to_params() empties the list (no double free after a
+ *            parse error), a param not added to the list is freed
  */
 
 
@@ -73,16 +75,17 @@ inline static void free_to_params(struct to_body* tb)
 	struct to_param *foo;
 	while (tp){
 		foo = tp->next;
-		pkg_free(tp);
+		parser_free(tp);
 		tp=foo;
 	}
+	tb->param_lst = tb->last_param = 0;
 }
 
 
 void free_to(struct to_body* tb)
 {
 	free_to_params(tb);
-	pkg_free(tb);
+	parser_free(tb);
 }
 
 
@@ -273,7 +276,7 @@ static inline char* parse_to_param(char *buffer, char *end,
 						add_param(param,to_b);
 					case E_PARA_VALUE:
 						param = (struct to_param*)
-							pkg_malloc(sizeof(struct to_param));
+							parser_malloc(sizeof(struct to_param));
 						if (!param){
 							LM_ERR("out of pkg memory\n" );
 							goto error;
@@ -452,6 +455,8 @@ endofheader:
 			goto parse_error;
 		add_param(param, to_b);
 	}
+	/* a param started but not added (e.g. after a trailing ';') */
+	if (param) parser_free(param);
 	*returned_status=saved_status;
 	return tmp;
 
@@ -459,7 +464,7 @@ parse_error:
 	LM_ERR("unexpected char [%c] in status %d: <<%.*s>> .\n",
 		*tmp,status, (int)(tmp-buffer), ZSW(buffer));
 error:
-	if (param) pkg_free(param);
+	if (param) parser_free(param);
 	free_to_params(to_b);
 	to_b->error=PARSE_ERROR;
 	*returned_status = status;
@@ -32,6 +32,10 @@
  * 2005-03-03  more tel uri fixes (andrei)
  * 2006-11-28  Added statistic support for the number of bad URI's
  *             (Jeffrey Magder - SOMA Networks
+ * 2010-09-xx  renamed to parse_uri_legacy(); parse_uri() uses the table
+ *             driven parser (parse_uri_fsm.c) unless LEGACY_URI_PARSER
+ * 2010-09-xx  uris ending in a "maddr" param are no longer an error
+ * 2010-09-xx  scheme read as unsigned chars (no shift of negative values)
  */
 
 
@@ -43,11 +47,21 @@
 //#include "../errinfo.h"
 //#include "../core_stats.h"
 
+int parse_uri(char* buf, int len, struct sip_uri* uri)
+{
+#ifdef LEGACY_URI_PARSER
+	return parse_uri_legacy(buf, len, uri);
+#else
+	return parse_uri_fsm(buf, len, uri);
+#endif
+}
+
+
 /* buf= pointer to begining of uri (sip:x@foo.bar:5060;a=b?h=i)
  * len= len of uri
  * returns: fills uri & returns <0 on error or 0 if ok 
  */
-int parse_uri(char* buf, int len, struct sip_uri* uri)
+int parse_uri_legacy(char* buf, int len, struct sip_uri* uri)
 {
 	enum states  {	URI_INIT, URI_USER, URI_PASSWORD, URI_PASSWORD_ALPHA,
 					URI_HOST, URI_HOST_P,
@@ -326,7 +340,8 @@ int parse_uri(char* buf, int len, struct sip_uri* uri)
 	memset(uri, 0, sizeof(struct sip_uri)); /* zero it all, just to be sure*/
 	/*look for sip:, sips: or tel:*/
 	if (len<5) goto error_too_short;
-	scheme=buf[0]+(buf[1]<<8)+(buf[2]<<16)+(buf[3]<<24);
+	scheme=(unsigned char)buf[0]+((unsigned char)buf[1]<<8)+
+		((unsigned char)buf[2]<<16)+((unsigned)(unsigned char)buf[3]<<24);
 	scheme|=0x20202020;
 	if (scheme==SIP_SCH){
 		uri->type=SIP_URI_T;
@@ -886,6 +901,11 @@ int parse_uri(char* buf, int len, struct sip_uri* uri)
 		case PM_O:
 		case PM_D:
 		case PM_eq:
+		case PMA_A: /* maddr */
+		case PMA_D:
+		case PMA_D2:
+		case PMA_R:
+		case PMA_eq:
 		case PLR_L: /* lr */
 		case PR2_R:  /* r2 */
 			uri->params.s=s;
@@ -38,6 +38,11 @@
  * returns: fills uri & returns <0 on error or 0 if ok 
  */
 int parse_uri(char *buf, int len, struct sip_uri* uri);
+
+/* the two implementations behind parse_uri(): the table driven one
+ * (default) and the original state machine (-DLEGACY_URI_PARSER) */
+int parse_uri_fsm(char *buf, int len, struct sip_uri* uri);
+int parse_uri_legacy(char *buf, int len, struct sip_uri* uri);
 int parse_sip_msg_uri(struct sip_msg* msg);
 int parse_orig_ruri(struct sip_msg* msg);
 
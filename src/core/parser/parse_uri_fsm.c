@@ -0,0 +1,611 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  scheme read as unsigned chars (no shift of negative values)
+ */
+
+/*
+ * Table driven SIP URI parser - fills the sip_uri exactly as the legacy
+ * parser (parse_uri_legacy()), quirks included, but:
+ *  - each char is first mapped to a class (uri_cls[]) and the action is
+ *    looked up by state and class (uri_fsm[][]), instead of the nested
+ *    switches;
+ *  - the known parameters (and the transport values) are matched once,
+ *    at their end, instead of char by char;
+ *  - in the states where only the delimiters matter (user, password,
+ *    host, parameter names and values, headers) the runs of other chars
+ *    are skipped 16 bytes at a time (SSE2 on x86_64).
+ */
+
+#include <string.h>
+
+#include "../log.h"
+#include "../utils.h"   /* q_memchr */
+#include "parse_uri.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define URI_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/* char classes; all the ones from UC_AT on are delimiters */
+enum uri_cls { UC_OTHER=0, UC_DIGIT, UC_AT, UC_COLON, UC_SEMI, UC_QM,
+	UC_LBR, UC_RBR, UC_AMP, UC_EQ, UC_NO };
+
+static const unsigned char uri_cls[256] = {
+	['0' ... '9'] = UC_DIGIT,
+	['@'] = UC_AT, [':'] = UC_COLON, [';'] = UC_SEMI, ['?'] = UC_QM,
+	['['] = UC_LBR, [']'] = UC_RBR, ['&'] = UC_AMP, ['='] = UC_EQ,
+};
+
+enum uri_state { US_INIT=0, US_USER, US_PASS, US_PASS_ALPHA,
+	US_HOST, US_HOST_P, US_HOST6_P, US_HOST6_END, US_PORT,
+	US_PNAME, US_PARAM_P, US_PEQ, US_VAL, US_HEADERS, US_NO };
+
+/* the actions; A_NOP keeps the state and is used only in the states
+ * where all the non delimiter chars are A_NOP (so runs can be skipped) */
+enum uri_action { A_NOP=0, A_BAD_CHAR, A_BAD_HOST, A_BAD_PORT,
+	A_INIT_USER, A_INIT_HOST6,
+	A_USER_AT, A_USER_COLON, A_USER_SEMI, A_USER_QM,
+	A_PASS_AT, A_PASS_SEMI, A_PASS_QM, A_PASS_ALPHA, A_PALPHA_AT,
+	A_HOST6, A_HOST_P, A_HOST6_END, A_HEND_COLON, A_HEND_SEMI, A_HEND_QM,
+	A_DIGIT, A_PORT_SEMI, A_PORT_QM,
+	A_AT, A_SEMI, A_QM, A_COLON,
+	A_PNAME_SEMI, A_PNAME_QM, A_PNAME_EQ, A_VAL,
+	A_VAL_SEMI, A_VAL_QM, A_VAL_COLON,
+	A_HDR_SEMI, A_HDR_QM, A_HDR_COLON };
+
+/* the delimiters common to the parameters, values and headers */
+#define UC_PARAM(_other, _semi, _qm, _colon) \
+	{ [UC_OTHER]=_other, [UC_DIGIT]=_other, [UC_LBR]=_other, \
+	  [UC_RBR]=_other, [UC_AMP]=_other, [UC_EQ]=_other, \
+	  [UC_AT]=A_AT, [UC_SEMI]=_semi, [UC_QM]=_qm, [UC_COLON]=_colon }
+
+static const unsigned char uri_fsm[US_NO][UC_NO] = {
+	[US_INIT] = {
+		[UC_OTHER]=A_INIT_USER, [UC_DIGIT]=A_INIT_USER,
+		[UC_AMP]=A_INIT_USER, [UC_EQ]=A_INIT_USER,
+		[UC_SEMI]=A_INIT_USER, [UC_QM]=A_INIT_USER,
+		[UC_LBR]=A_INIT_HOST6,
+		[UC_RBR]=A_BAD_CHAR, [UC_COLON]=A_BAD_CHAR, [UC_AT]=A_BAD_CHAR },
+	[US_USER] = {
+		[UC_AT]=A_USER_AT, [UC_COLON]=A_USER_COLON,
+		[UC_SEMI]=A_USER_SEMI, [UC_QM]=A_USER_QM,
+		[UC_LBR]=A_BAD_CHAR, [UC_RBR]=A_BAD_CHAR },
+	/* the password or the port, if there is no user */
+	[US_PASS] = {
+		[UC_OTHER]=A_PASS_ALPHA, [UC_AMP]=A_PASS_ALPHA,
+		[UC_EQ]=A_PASS_ALPHA, [UC_DIGIT]=A_DIGIT,
+		[UC_AT]=A_PASS_AT, [UC_SEMI]=A_PASS_SEMI, [UC_QM]=A_PASS_QM,
+		[UC_LBR]=A_BAD_CHAR, [UC_RBR]=A_BAD_CHAR, [UC_COLON]=A_BAD_CHAR },
+	[US_PASS_ALPHA] = {
+		[UC_AT]=A_PALPHA_AT,
+		[UC_SEMI]=A_BAD_PORT, [UC_QM]=A_BAD_PORT,
+		[UC_LBR]=A_BAD_CHAR, [UC_RBR]=A_BAD_CHAR, [UC_COLON]=A_BAD_CHAR },
+	[US_HOST] = {
+		[UC_OTHER]=A_HOST_P, [UC_DIGIT]=A_HOST_P, [UC_RBR]=A_HOST_P,
+		[UC_EQ]=A_HOST_P, [UC_LBR]=A_HOST6,
+		[UC_COLON]=A_BAD_HOST, [UC_SEMI]=A_BAD_HOST, [UC_QM]=A_BAD_HOST,
+		[UC_AMP]=A_BAD_HOST, [UC_AT]=A_BAD_HOST },
+	[US_HOST_P] = {
+		[UC_COLON]=A_HEND_COLON, [UC_SEMI]=A_HEND_SEMI, [UC_QM]=A_HEND_QM,
+		[UC_AMP]=A_BAD_CHAR, [UC_AT]=A_BAD_CHAR },
+	[US_HOST6_P] = {
+		[UC_RBR]=A_HOST6_END,
+		[UC_LBR]=A_BAD_HOST, [UC_AMP]=A_BAD_HOST, [UC_AT]=A_BAD_HOST,
+		[UC_SEMI]=A_BAD_HOST, [UC_QM]=A_BAD_HOST },
+	[US_HOST6_END] = {
+		[UC_OTHER]=A_BAD_HOST, [UC_DIGIT]=A_BAD_HOST, [UC_LBR]=A_BAD_HOST,
+		[UC_RBR]=A_BAD_HOST, [UC_EQ]=A_BAD_HOST,
+		[UC_COLON]=A_HEND_COLON, [UC_SEMI]=A_HEND_SEMI, [UC_QM]=A_HEND_QM,
+		[UC_AMP]=A_BAD_CHAR, [UC_AT]=A_BAD_CHAR },
+	[US_PORT] = {
+		[UC_OTHER]=A_BAD_PORT, [UC_LBR]=A_BAD_PORT, [UC_RBR]=A_BAD_PORT,
+		[UC_EQ]=A_BAD_PORT, [UC_AMP]=A_BAD_PORT, [UC_AT]=A_BAD_PORT,
+		[UC_COLON]=A_BAD_PORT, [UC_DIGIT]=A_DIGIT,
+		[UC_SEMI]=A_PORT_SEMI, [UC_QM]=A_PORT_QM },
+	/* name of the parameter starting at "b" */
+	[US_PNAME] = {
+		[UC_AT]=A_AT, [UC_SEMI]=A_PNAME_SEMI, [UC_QM]=A_PNAME_QM,
+		[UC_COLON]=A_COLON, [UC_EQ]=A_PNAME_EQ },
+	/* rest of an ignored parameter */
+	[US_PARAM_P] = UC_PARAM(A_NOP, A_SEMI, A_QM, A_COLON),
+	/* right after the '=' of a known parameter */
+	[US_PEQ] = UC_PARAM(A_VAL, A_SEMI, A_QM, A_COLON),
+	/* value (starting at "v") of a known parameter */
+	[US_VAL] = UC_PARAM(A_NOP, A_VAL_SEMI, A_VAL_QM, A_VAL_COLON),
+	[US_HEADERS] = UC_PARAM(A_NOP, A_HDR_SEMI, A_HDR_QM, A_HDR_COLON),
+};
+
+
+/* first delimiter in [p, end) or end */
+static inline char* uri_skip(char *p, char *end)
+{
+#ifdef URI_SSE2
+	__m128i b, m;
+	unsigned int bits;
+
+	/* ':' ... '@' (with '<' and '>' - no delimiters, but no harm either),
+	 * '&', '[' and ']' */
+	for( ; end-p>=16 ; p+=16 ) {
+		b = _mm_loadu_si128((const __m128i*)p);
+		m = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(':'-1)),
+			_mm_cmplt_epi8(b, _mm_set1_epi8('@'+1)));
+		m = _mm_or_si128(m, _mm_or_si128(
+			_mm_cmpeq_epi8(b, _mm_set1_epi8('&')),
+			_mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('[')),
+				_mm_cmpeq_epi8(b, _mm_set1_epi8(']')))));
+		bits = _mm_movemask_epi8(m);
+		if (bits)
+			return p + __builtin_ctz(bits);
+	}
+#endif
+	for( ; p<end && uri_cls[(unsigned char)*p]<UC_AT ; p++ );
+	return p;
+}
+
+
+/* "s" equal to the lower case "ls" (letters only) */
+static inline int uri_eq_lc(const char *s, const char *ls, int len)
+{
+	for( ; len ; len--,s++,ls++ )
+		if ((*s|0x20)!=*ls)
+			return 0;
+	return 1;
+}
+
+#define is_lr(_s, _len)  ((_len)==2 && uri_eq_lc(_s, "lr", 2))
+
+/* the value of the known parameter with the name [s, s+len) or NULL */
+static inline str* uri_param_val(struct sip_uri *uri, char *s, int len,
+															str **param)
+{
+	switch (len) {
+		case 9:
+			if (!uri_eq_lc(s, "transport", 9)) return 0;
+			*param = &uri->transport;
+			return &uri->transport_val;
+		case 3:
+			if (!uri_eq_lc(s, "ttl", 3)) return 0;
+			*param = &uri->ttl;
+			return &uri->ttl_val;
+		case 4:
+			if (!uri_eq_lc(s, "user", 4)) return 0;
+			*param = &uri->user_param;
+			return &uri->user_param_val;
+		case 6:
+			if (!uri_eq_lc(s, "method", 6)) return 0;
+			*param = &uri->method;
+			return &uri->method_val;
+		case 5:
+			if (!uri_eq_lc(s, "maddr", 5)) return 0;
+			*param = &uri->maddr;
+			return &uri->maddr_val;
+		case 2:
+			if (!uri_eq_lc(s, "lr", 2)) return 0;
+			*param = &uri->lr;
+			return &uri->lr_val;
+	}
+	return 0;
+}
+
+static inline int uri_proto(char *s, int len)
+{
+	if (len==3) {
+		if (uri_eq_lc(s, "udp", 3)) return PROTO_UDP;
+		if (uri_eq_lc(s, "tcp", 3)) return PROTO_TCP;
+		if (uri_eq_lc(s, "tls", 3)) return PROTO_TLS;
+	} else if (len==4 && uri_eq_lc(s, "sctp", 4)) {
+		return PROTO_SCTP;
+	}
+	return PROTO_NONE;
+}
+
+
+int parse_uri_fsm(char* buf, int len, struct sip_uri* uri)
+{
+	enum uri_state state;
+	char *p, *end;
+	char *s;            /* start of the current part */
+	char *b;            /* start of the current param */
+	char *v;            /* start of the current value */
+	char *pass;         /* ':' in the params, if they may be the user */
+	str *param, *param_val;
+	str user;
+	unsigned int scheme;
+	uri_type backup;
+	int found_user;
+	int error_headers;
+	int port_no;
+	int proto;
+
+#define SIP_SCH		0x3a706973
+#define SIPS_SCH	0x73706973
+#define TEL_SCH		0x3a6c6574
+
+/* the param value ends at p */
+#define val_end() \
+	do { \
+		param->s = b; \
+		param->len = p - b; \
+		param_val->s = v; \
+		param_val->len = p - v; \
+		if (param==&uri->transport && \
+		(proto=uri_proto(v, p-v))!=PROTO_NONE) \
+			uri->proto = proto; \
+	} while(0)
+
+	end = buf + len;
+	p = buf + 4;
+	found_user = 0;
+	error_headers = 0;
+	b = v = pass = 0;
+	param = param_val = 0;
+	port_no = 0;
+	state = US_INIT;
+	memset(uri, 0, sizeof(struct sip_uri));
+
+	if (len<5) goto error_too_short;
+	scheme=(unsigned char)buf[0]+((unsigned char)buf[1]<<8)+
+		((unsigned char)buf[2]<<16)+((unsigned)(unsigned char)buf[3]<<24);
+	scheme|=0x20202020;
+	if (scheme==SIP_SCH) {
+		uri->type = SIP_URI_T;
+	} else if (scheme==SIPS_SCH) {
+		if (buf[4]!=':') goto error_bad_uri;
+		p++;
+		uri->type = SIPS_URI_T;
+	} else if (scheme==TEL_SCH) {
+		uri->type = TEL_URI_T;
+	} else goto error_bad_uri;
+
+	s = p;
+	while (p<end) {
+		switch (uri_fsm[state][uri_cls[(unsigned char)*p]]) {
+			case A_NOP:
+				p = uri_skip(p+1, end);
+				continue;
+			case A_BAD_CHAR:
+				goto error_bad_char;
+			case A_BAD_HOST:
+				goto error_bad_host;
+			case A_BAD_PORT:
+				goto error_bad_port;
+
+			case A_INIT_USER:
+				/* the user or the host */
+				state = US_USER;
+				break;
+			case A_INIT_HOST6:
+				s = p;
+				state = US_HOST6_P;
+				break;
+
+			case A_USER_AT:
+				uri->user.s = s;
+				uri->user.len = p - s;
+				found_user = 1;
+				s = p + 1;
+				state = US_HOST;
+				break;
+			case A_USER_COLON:
+				/* the password follows, or the port if this was the host */
+				uri->user.s = s;
+				uri->user.len = p - s;
+				s = p + 1;
+				state = US_PASS;
+				break;
+			case A_USER_SEMI:
+			case A_USER_QM:
+				/* the host, unless an '@' shows up later */
+				uri->host.s = s;
+				uri->host.len = p - s;
+				s = b = p + 1;
+				state = (*p==';') ? US_PNAME : US_HEADERS;
+				break;
+
+			case A_PASS_AT:
+				port_no = 0;
+				/* no break */
+			case A_PALPHA_AT:
+				uri->passwd.s = s;
+				uri->passwd.len = p - s;
+				found_user = 1;
+				s = p + 1;
+				state = US_HOST;
+				break;
+			case A_PASS_SEMI:
+			case A_PASS_QM:
+				/* it was the host and the port, there is no user */
+				uri->port.s = s;
+				uri->port.len = p - s;
+				uri->port_no = port_no;
+				uri->host = uri->user;
+				uri->user.s = 0;
+				uri->user.len = 0;
+				found_user = 1;
+				s = b = p + 1;
+				state = (*p==';') ? US_PNAME : US_HEADERS;
+				break;
+			case A_PASS_ALPHA:
+				/* cannot be the port anymore */
+				port_no = 0;
+				state = US_PASS_ALPHA;
+				break;
+
+			case A_HOST6:
+				state = US_HOST6_P;
+				break;
+			case A_HOST_P:
+				state = US_HOST_P;
+				break;
+			case A_HOST6_END:
+				state = US_HOST6_END;
+				break;
+			case A_HEND_COLON:
+			case A_HEND_SEMI:
+			case A_HEND_QM:
+				uri->host.s = s;
+				uri->host.len = p - s;
+				s = b = p + 1;
+				state = (*p==':') ? US_PORT :
+					((*p==';') ? US_PNAME : US_HEADERS);
+				break;
+
+			case A_DIGIT:
+				port_no = port_no*10 + *p - '0';
+				break;
+			case A_PORT_SEMI:
+			case A_PORT_QM:
+				uri->port.s = s;
+				uri->port.len = p - s;
+				uri->port_no = port_no;
+				s = b = p + 1;
+				state = (*p==';') ? US_PNAME : US_HEADERS;
+				break;
+
+			case A_PNAME_SEMI:
+			case A_PNAME_QM:
+				if (is_lr(b, p-b)) {
+					uri->lr.s = b;
+					uri->lr.len = p - b;
+				}
+				goto param_end;
+			case A_VAL_SEMI:
+			case A_VAL_QM:
+				val_end();
+				/* no break */
+			case A_SEMI:
+			case A_QM:
+param_end:
+				if (pass) {
+					/* the params cannot contain the user (no ';' or '?'
+					 * in the password) */
+					found_user = 1;
+					pass = 0;
+				}
+				if (*p==';') {
+					b = p + 1;
+					state = US_PNAME;
+				} else {
+					uri->params.s = s;
+					uri->params.len = p - s;
+					s = p + 1;
+					state = US_HEADERS;
+				}
+				break;
+			case A_COLON:
+			case A_VAL_COLON:
+			case A_HDR_COLON:
+				/* user:pass@host if an '@' shows up later */
+				if (found_user==0) {
+					if (pass) {
+						found_user = 1;
+						pass = 0;
+					} else {
+						pass = p;
+					}
+				}
+				if (state!=US_VAL && state!=US_HEADERS)
+					state = US_PARAM_P;
+				break;
+			case A_PNAME_EQ:
+				if ((param_val=uri_param_val(uri, b, p-b, &param))!=0)
+					state = US_PEQ;
+				else
+					state = US_PARAM_P;
+				break;
+			case A_VAL:
+				v = p;
+				state = US_VAL;
+				break;
+
+			case A_HDR_SEMI:
+				/* may still be the user (sip:user?x;y@host) */
+				if (found_user) goto error_bad_char;
+				error_headers = 1;
+				if (pass) goto error_headers;
+				break;
+			case A_HDR_QM:
+				if (pass) {
+					found_user = 1;
+					pass = 0;
+				}
+				break;
+
+			case A_AT:
+				/* all so far was the user (and the password) */
+				if (found_user) goto error_bad_char;
+				user.s = uri->host.s;
+				user.len = (pass ? pass : p) - user.s;
+				backup = uri->type;
+				memset(uri, 0, sizeof(struct sip_uri));
+				uri->type = backup;
+				uri->user = user;
+				if (pass) {
+					uri->passwd.s = pass + 1;
+					uri->passwd.len = p - uri->passwd.s;
+				}
+				s = p + 1;
+				found_user = 1;
+				error_headers = 0;
+				state = US_HOST;
+				break;
+
+			default:
+				goto error_bug;
+		}
+		p++;
+	}
+
+	/* end of uri */
+	switch (state) {
+		case US_INIT:
+			goto error_too_short;
+		case US_USER:
+			/* it was the host */
+			if (found_user) goto error_bad_uri;
+			uri->host.s = s;
+			uri->host.len = p - s;
+			break;
+		case US_PASS:
+			/* it was the host and the port */
+			if (found_user) goto error_bad_port;
+			uri->port.s = s;
+			uri->port.len = p - s;
+			uri->port_no = port_no;
+			uri->host = uri->user;
+			uri->user.s = 0;
+			uri->user.len = 0;
+			break;
+		case US_PASS_ALPHA:
+			goto error_bad_port;
+		case US_HOST_P:
+		case US_HOST6_END:
+			uri->host.s = s;
+			uri->host.len = p - s;
+			break;
+		case US_HOST:
+		case US_HOST6_P:
+			goto error_bad_host;
+		case US_PORT:
+			uri->port.s = s;
+			uri->port.len = p - s;
+			uri->port_no = port_no;
+			break;
+		case US_PNAME:
+			if (is_lr(b, p-b)) {
+				uri->lr.s = b;
+				uri->lr.len = p - b;
+			}
+			/* no break */
+		case US_PARAM_P:
+			uri->params.s = s;
+			uri->params.len = p - s;
+			break;
+		case US_PEQ:
+			/* empty value - only "lr=" is kept */
+			uri->params.s = s;
+			uri->params.len = p - s;
+			if (param==&uri->lr) {
+				uri->lr.s = b;
+				uri->lr.len = p - b;
+			}
+			break;
+		case US_VAL:
+			uri->params.s = s;
+			uri->params.len = p - s;
+			val_end();
+			break;
+		case US_HEADERS:
+			uri->headers.s = s;
+			uri->headers.len = p - s;
+			if (error_headers) goto error_headers;
+			break;
+		default:
+			goto error_bug;
+	}
+
+	switch (uri->type) {
+		case SIP_URI_T:
+		case SIPS_URI_T:
+			if (uri->user_param_val.len==5 &&
+			strncasecmp(uri->user_param_val.s, "phone", 5)==0) {
+				uri->type = (uri->type==SIP_URI_T) ? TEL_URI_T : TELS_URI_T;
+				/* move params from user into uri->params */
+				p = q_memchr(uri->user.s, ';', uri->user.len);
+				if (p) {
+					uri->params.s = p + 1;
+					uri->params.len = uri->user.s + uri->user.len - p - 1;
+					uri->user.len = p - uri->user.s;
+				}
+			}
+			break;
+		case TEL_URI_T:
+		case TELS_URI_T:
+			/* the number is in the host, move it to the user */
+			uri->user = uri->host;
+			uri->host.s = "";
+			uri->host.len = 0;
+			break;
+		case ERROR_URI_T:
+			LM_CRIT("BUG - unexpected uri type\n");
+			goto error_bad_uri;
+	}
+	return 0;
+
+error_too_short:
+	LM_ERR("uri too short: <%.*s> (%d)\n", len, ZSW(buf), len);
+	goto error_exit;
+error_bad_char:
+	LM_ERR("bad char '%c' in state %d parsed: <%.*s> (%d) / <%.*s> (%d)\n",
+		*p, state, (int)(p-buf), ZSW(buf), (int)(p-buf), len, ZSW(buf), len);
+	goto error_exit;
+error_bad_host:
+	LM_ERR("bad host in uri (error at char %c in state %d) parsed: "
+		"<%.*s>(%d) /<%.*s> (%d)\n", *p, state, (int)(p-buf), ZSW(buf),
+		(int)(p-buf), len, ZSW(buf), len);
+	goto error_exit;
+error_bad_port:
+	LM_ERR("bad port in uri (error at char %c in state %d) parsed: "
+		"<%.*s>(%d) /<%.*s> (%d)\n", *p, state, (int)(p-buf), ZSW(buf),
+		(int)(p-buf), len, ZSW(buf), len);
+	goto error_exit;
+error_bad_uri:
+	LM_ERR("bad uri, state %d parsed: <%.*s> (%d) / <%.*s> (%d)\n",
+		state, (int)(p-buf), ZSW(buf), (int)(p-buf), len, ZSW(buf), len);
+	goto error_exit;
+error_headers:
+	LM_ERR("bad uri headers: <%.*s>(%d) / <%.*s>(%d)\n",
+		uri->headers.len, ZSW(uri->headers.s), uri->headers.len,
+		len, ZSW(buf), len);
+	goto error_exit;
+error_bug:
+	LM_CRIT("BUG - bad state %d parsed: <%.*s> (%d) / <%.*s> (%d)\n",
+		state, (int)(p-buf), ZSW(buf), (int)(p-buf), len, ZSW(buf), len);
+error_exit:
+	uri->type = ERROR_URI_T;
+	return -1;
+#undef val_end
+}
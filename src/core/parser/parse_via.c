@@ -743,7 +743,7 @@ static /*inline*/ char* parse_via_param(char* p, char* end,
 	
  find_value:
 	tmp++;
-	for(;*tmp;tmp++){
+	for(;tmp<end;tmp++){
 		switch(*tmp){
 			case ' ':
 			case '\t':
@@ -1334,7 +1334,7 @@ parse_again:
 	tmp++;
 	c_nest=0;
 	/*state should always be F_HOST here*/;
-	for(;*tmp;tmp++){
+	for(;tmp<end;tmp++){
 		switch(*tmp){
 		case ' ':
 		case '\t':
@@ -1772,7 +1772,7 @@ parse_again:
 					case F_PARAM:
 						/*state=P_PARAM*/;
 						if(vb->params.s==0) vb->params.s=param_start;
-						param=pkg_malloc(sizeof(struct via_param));
+						param=parser_malloc(sizeof(struct via_param));
 						if (param==0){
 							LM_ERR("no pkg memory left\n");
 							goto error;
@@ -1798,10 +1798,10 @@ parse_again:
 												-vb->params.s;
 								break;
 							case PARAM_ERROR:
-								pkg_free(param);
+								parser_free(param);
 								goto parse_error;
 							default:
-								pkg_free(param);
+								parser_free(param);
 								LM_ERR(" after parse_via_param: invalid "
 										"char <%c> on state %d\n",*tmp, state);
 								goto parse_error;
@@ -1930,7 +1930,7 @@ nextvia:
 					goto parse_error;
 		}
 	}
-	vb->next=pkg_malloc(sizeof(struct via_body));
+	vb->next=parser_malloc(sizeof(struct via_body));
 	if (vb->next==0){
 		LM_ERR(" out of pkg memory\n");
 		goto error;
@@ -1964,7 +1964,7 @@ static inline void free_via_param_list(struct via_param* vp)
 	while(vp){
 		foo=vp;
 		vp=vp->next;
-		pkg_free(foo);
+		parser_free(foo);
 	}
 }
 
@@ -1976,6 +1976,6 @@ void free_via_list(struct via_body* vb)
 		foo=vb;
 		vb=vb->next;
 		if (foo->param_lst) free_via_param_list(foo->param_lst);
-		pkg_free(foo);
+		parser_free(foo);
 	}
 }
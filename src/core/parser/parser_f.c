@@ -24,7 +24,7 @@
 
 
 #include  "parser_f.h"
-#include "../utils.h"
+#include "scan.h"
 
 /* returns pointer to next line or after the end of buffer */
 char* eat_line(char* buffer, unsigned int len)
@@ -34,7 +34,7 @@ char* eat_line(char* buffer, unsigned int len)
 	/* jku .. replace for search with a library function; not conforming
  		  as I do not care about CR
 	*/
-	nl=(char *)q_memchr( buffer, '\n', len );
+	nl=scan_chr( buffer, buffer+len, '\n' );
 	if ( nl ) { 
 		if ( nl + 1 < buffer+len)  nl++;
 		if (( nl+1<buffer+len) && * nl=='\r')  nl++;
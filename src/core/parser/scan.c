@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  scan_get()
+ */
+
+#include <string.h>
+
+#include "../log.h"
+#include "scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+/*********************** plain C ************************/
+
+static char* scan_chr_c(const char *p, const char *end, int c)
+{
+	for( ; p<end ; p++ )
+		if (*p==(char)c)
+			return (char*)p;
+	return NULL;
+}
+
+static char* scan_any_c(const char *p, const char *end, int c0, int c1,
+															int c2, int c3)
+{
+	for( ; p<end ; p++ )
+		if (*p==(char)c0 || *p==(char)c1 || *p==(char)c2 || *p==(char)c3)
+			return (char*)p;
+	return NULL;
+}
+
+static char* scan_skip_c(const char *p, const char *end, int c0, int c1)
+{
+	for( ; p<end && (*p==(char)c0 || *p==(char)c1) ; p++ );
+	return (char*)p;
+}
+
+struct scan_funcs scan_f_c = {
+	scan_chr_c, scan_any_c, scan_skip_c, "c"
+};
+
+
+#ifdef SCAN_X86
+
+/*********************** SSE2 ************************/
+
+#define load16(_p)  _mm_loadu_si128((const __m128i*)(_p))
+
+static char* scan_chr_sse2(const char *p, const char *end, int c)
+{
+	__m128i v = _mm_set1_epi8((char)c);
+	unsigned int m;
+
+	for( ; end-p>=16 ; p+=16 ) {
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(load16(p), v));
+		if (m)
+			return (char*)p + __builtin_ctz(m);
+	}
+	return scan_chr_c(p, end, c);
+}
+
+static char* scan_any_sse2(const char *p, const char *end, int c0, int c1,
+															int c2, int c3)
+{
+	__m128i v0 = _mm_set1_epi8((char)c0);
+	__m128i v1 = _mm_set1_epi8((char)c1);
+	__m128i v2 = _mm_set1_epi8((char)c2);
+	__m128i v3 = _mm_set1_epi8((char)c3);
+	__m128i b;
+	unsigned int m;
+
+	for( ; end-p>=16 ; p+=16 ) {
+		b = load16(p);
+		m = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(b, v0), _mm_cmpeq_epi8(b, v1)),
+			_mm_or_si128(_mm_cmpeq_epi8(b, v2), _mm_cmpeq_epi8(b, v3))));
+		if (m)
+			return (char*)p + __builtin_ctz(m);
+	}
+	return scan_any_c(p, end, c0, c1, c2, c3);
+}
+
+static char* scan_skip_sse2(const char *p, const char *end, int c0, int c1)
+{
+	__m128i v0 = _mm_set1_epi8((char)c0);
+	__m128i v1 = _mm_set1_epi8((char)c1);
+	__m128i b;
+	unsigned int m;
+
+	for( ; end-p>=16 ; p+=16 ) {
+		b = load16(p);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(b, v0),
+			_mm_cmpeq_epi8(b, v1))) ^ 0xffff;
+		if (m)
+			return (char*)p + __builtin_ctz(m);
+	}
+	return scan_skip_c(p, end, c0, c1);
+}
+
+static struct scan_funcs scan_f_sse2 = {
+	scan_chr_sse2, scan_any_sse2, scan_skip_sse2, "sse2"
+};
+
+
+/*********************** AVX2 ************************/
+
+#define AVX2 __attribute__((target("avx2")))
+#define load32(_p)  _mm256_loadu_si256((const __m256i*)(_p))
+
+static AVX2 char* scan_chr_avx2(const char *p, const char *end, int c)
+{
+	__m256i v = _mm256_set1_epi8((char)c);
+	unsigned int m;
+
+	for( ; end-p>=32 ; p+=32 ) {
+		m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(load32(p), v));
+		if (m)
+			return (char*)p + __builtin_ctz(m);
+	}
+	return scan_chr_sse2(p, end, c);
+}
+
+static AVX2 char* scan_any_avx2(const char *p, const char *end, int c0,
+													int c1, int c2, int c3)
+{
+	__m256i v0 = _mm256_set1_epi8((char)c0);
+	__m256i v1 = _mm256_set1_epi8((char)c1);
+	__m256i v2 = _mm256_set1_epi8((char)c2);
+	__m256i v3 = _mm256_set1_epi8((char)c3);
+	__m256i b;
+	unsigned int m;
+
+	for( ; end-p>=32 ; p+=32 ) {
+		b = load32(p);
+		m = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(b, v0),
+				_mm256_cmpeq_epi8(b, v1)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(b, v2),
+				_mm256_cmpeq_epi8(b, v3))));
+		if (m)
+			return (char*)p + __builtin_ctz(m);
+	}
+	return scan_any_sse2(p, end, c0, c1, c2, c3);
+}
+
+static AVX2 char* scan_skip_avx2(const char *p, const char *end, int c0,
+																	int c1)
+{
+	__m256i v0 = _mm256_set1_epi8((char)c0);
+	__m256i v1 = _mm256_set1_epi8((char)c1);
+	__m256i b;
+	unsigned int m;
+
+	for( ; end-p>=32 ; p+=32 ) {
+		b = load32(p);
+		m = ~(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(b, v0), _mm256_cmpeq_epi8(b, v1)));
+		if (m)
+			return (char*)p + __builtin_ctz(m);
+	}
+	return scan_skip_sse2(p, end, c0, c1);
+}
+
+static struct scan_funcs scan_f_avx2 = {
+	scan_chr_avx2, scan_any_avx2, scan_skip_avx2, "avx2"
+};
+
+struct scan_funcs scan_f = {
+	scan_chr_sse2, scan_any_sse2, scan_skip_sse2, "sse2"
+};
+
+#else
+
+struct scan_funcs scan_f = {
+	scan_chr_c, scan_any_c, scan_skip_c, "c"
+};
+
+#endif
+
+
+void scan_init(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan_f = scan_f_avx2;
+	else
+		scan_f = scan_f_sse2;
+#endif
+	LM_DBG("using the %s scanning kernels\n", scan_f.name);
+}
+
+
+struct scan_funcs* scan_get(char *name)
+{
+	if (strcmp(name, scan_f_c.name)==0)
+		return &scan_f_c;
+#ifdef SCAN_X86
+	if (strcmp(name, scan_f_sse2.name)==0)
+		return &scan_f_sse2;
+	__builtin_cpu_init();
+	if (strcmp(name, scan_f_avx2.name)==0 && __builtin_cpu_supports("avx2"))
+		return &scan_f_avx2;
+#endif
+	return NULL;
+}
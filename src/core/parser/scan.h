@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  scan_get()
+ */
+
+/*
+ * Byte scanning kernels for the parser (SSE2 / AVX2 on x86_64, plain C
+ * elsewhere). The kernels never read outside [p, end). The best variant
+ * supported by the CPU is picked by scan_init(); before that the SSE2
+ * (x86_64 baseline) or the C one is used.
+ */
+
+#ifndef _PARSER_SCAN_H
+#define _PARSER_SCAN_H
+
+#include <stddef.h>
+
+struct scan_funcs {
+	/* first "c" in [p, end) or NULL */
+	char* (*chr)(const char *p, const char *end, int c);
+	/* first of the 4 chars in [p, end) or NULL (repeat a char to look
+	 * for less than 4) */
+	char* (*any)(const char *p, const char *end, int c0, int c1, int c2,
+		int c3);
+	/* first char in [p, end) other than c0 and c1, or end */
+	char* (*skip)(const char *p, const char *end, int c0, int c1);
+	char *name;
+};
+
+extern struct scan_funcs scan_f;
+
+/* the plain C kernels (the reference for the vectorized ones) */
+extern struct scan_funcs scan_f_c;
+
+/* picks the kernels for the running CPU */
+void scan_init(void);
+
+/* the kernels with the given name ("c", "sse2", "avx2"), NULL if unknown
+ * or not supported by the running CPU - for the tests and benchmarks */
+struct scan_funcs* scan_get(char *name);
+
+#define scan_chr(_p, _end, _c)  scan_f.chr(_p, _end, _c)
+
+/* first CR, LF, ':' or ',' */
+#define scan_delim(_p, _end)    scan_f.any(_p, _end, '\r', '\n', ':', ',')
+
+/* end of a header field - right after its LF, folded lines included;
+ * NULL if the LF is missing */
+static inline char* scan_hdr_end(const char *p, const char *end)
+{
+	while ( (p=scan_chr(p, end, '\n'))!=NULL ) {
+		p++;
+		if (p>=end || (*p!=' ' && *p!='\t'))
+			return (char*)p;
+	}
+	return NULL;
+}
+
+/* end of the headers - right after the empty line (LF LF or LF CR LF);
+ * if not found, returns NULL and "*resume" is set to where a later scan
+ * (with more data) should start from */
+static inline char* scan_eoh(const char *p, const char *end,
+														const char **resume)
+{
+	for( ; (p=scan_chr(p, end, '\n'))!=NULL ; p++ ) {
+		if (p+1>=end)
+			break;
+		if (p[1]=='\n')
+			return (char*)p + 2;
+		if (p[1]=='\r') {
+			if (p+2>=end)
+				break;
+			if (p[2]=='\n')
+				return (char*)p + 3;
+		}
+	}
+	*resume = p ? p : end;
+	return NULL;
+}
+
+/* skips linear white space (SP, HT and line folding); the common case,
+ * no or one space, does not go to the kernels */
+static inline char* scan_lws_end(const char *p, const char *end)
+{
+	while (p<end) {
+		if (*p==' ' || *p=='\t') {
+			if (p+1<end && (p[1]==' ' || p[1]=='\t'))
+				p = scan_f.skip(p+2, end, ' ', '\t');
+			else
+				p++;
+		} else if (*p=='\n' && p+1<end && (p[1]==' ' || p[1]=='\t')) {
+			p += 2;
+		} else if (*p=='\r' && p+2<end && p[1]=='\n' &&
+		(p[2]==' ' || p[2]=='\t')) {
+			p += 3;
+		} else
+			break;
+	}
+	return (char*)p;
+}
+
+#endif
@@ -26,6 +26,8 @@
  * --------
  * 2007-09-09 osas: ported and enhanced sdp parsing functions from nathelper module
  * 2008-04-22 osas: integrated RFC4975 attributes - patch provided by Denis Bilenko (denik)
+ * 2010-09-xx  sdp structures allocated from the message arena
+ * 2010-09-xx  no double free of a bad multipart sdp
  *
  */
 
@@ -47,7 +49,7 @@ static inline int new_sdp(struct sip_msg* _m)
 {
 	sdp_info_t* sdp;
 
-	sdp = (sdp_info_t*)pkg_malloc(sizeof(sdp_info_t));
+	sdp = (sdp_info_t*)parser_malloc(sizeof(sdp_info_t));
 	if (sdp == 0) {
 		LM_ERR("No memory left\n");
 		return -1;
@@ -68,7 +70,7 @@ static inline sdp_session_cell_t *add_sdp_session(sdp_info_t* _sdp, int session_
 	int len;
 
 	len = sizeof(sdp_session_cell_t);
-	session = (sdp_session_cell_t*)pkg_malloc(len);
+	session = (sdp_session_cell_t*)parser_malloc(len);
 	if (session == 0) {
 		LM_ERR("No memory left\n");
 		return 0;
@@ -99,7 +101,7 @@ static inline sdp_stream_cell_t *add_sdp_stream(sdp_session_cell_t* _session, in
 	int len;
 
 	len = sizeof(sdp_stream_cell_t);
-	stream = (sdp_stream_cell_t*)pkg_malloc(len);
+	stream = (sdp_stream_cell_t*)parser_malloc(len);
 	if (stream == 0) {
 		LM_ERR("No memory left\n");
 		return 0;
@@ -138,7 +140,7 @@ static inline sdp_payload_attr_t *add_sdp_payload(sdp_stream_cell_t* _stream, in
 	int len;
 
 	len = sizeof(sdp_payload_attr_t);
-	payload_attr = (sdp_payload_attr_t*)pkg_malloc(len);
+	payload_attr = (sdp_payload_attr_t*)parser_malloc(len);
 	if (payload_attr == 0) {
 		LM_ERR("No memory left\n");
 		return 0;
@@ -175,7 +177,7 @@ static inline sdp_payload_attr_t** init_p_payload_attr(sdp_stream_cell_t* _strea
 		return 0;
 	}
 	if (pkg == USE_PKG_MEM) {
-		_stream->p_payload_attr = (sdp_payload_attr_t**)pkg_malloc(payloads_num * sizeof(sdp_payload_attr_t*));
+		_stream->p_payload_attr = (sdp_payload_attr_t**)parser_malloc(payloads_num * sizeof(sdp_payload_attr_t*));
 	} else if (pkg == USE_SHM_MEM) {
 		_stream->p_payload_attr = (sdp_payload_attr_t**)shm_malloc(payloads_num * sizeof(sdp_payload_attr_t*));
 	} else {
@@ -647,8 +649,7 @@ static int parse_mixed_content(str *mixed_body, str delimiter, sdp_info_t* _sdp)
 			/* LM_DBG("we need to check session %d: <%.*s>\n", session_num, sdp_body.len, sdp_body.s); */
 			res = parse_sdp_session(&sdp_body, session_num, &cnt_disp, _sdp);
 			if (res != 0) {
-				LM_DBG("free_sdp\n");
-				free_sdp((sdp_info_t**)(void*)&(_sdp));
+				/* freed by the caller */
 				return -1;
 			}
 			session_num++;
@@ -663,7 +664,7 @@ static int parse_mixed_content(str *mixed_body, str delimiter, sdp_info_t* _sdp)
  * returns 0 on success.
  * non zero on error.
  */
-int parse_sdp(struct sip_msg* _m)
+static int _parse_sdp(struct sip_msg* _m)
 {
 	int res;
 	str body, mp_delimiter;
@@ -749,6 +750,19 @@ int parse_sdp(struct sip_msg* _m)
 /**
  * Free all memory.
  */
+int parse_sdp(struct sip_msg* _m)
+{
+	struct msg_arena *bk;
+	int ret;
+
+	msg_arena_enter( _m, bk);
+	ret = _parse_sdp( _m);
+	msg_arena_leave( bk);
+
+	return ret;
+}
+
+
 void free_sdp(sdp_info_t** _sdp)
 {
 	sdp_info_t *sdp = *_sdp;
@@ -772,16 +786,16 @@ void free_sdp(sdp_info_t** _sdp)
 			while (payload) {
 				l_payload = payload;
 				payload = payload->next;
-				pkg_free(l_payload);
+				parser_free(l_payload);
 			}
 			if (l_stream->p_payload_attr) {
-				pkg_free(l_stream->p_payload_attr);
+				parser_free(l_stream->p_payload_attr);
 			}
-			pkg_free(l_stream);
+			parser_free(l_stream);
 		}
-		pkg_free(l_session);
+		parser_free(l_session);
 	}
-	pkg_free(sdp);
+	parser_free(sdp);
 	*_sdp = NULL;
 }
 
@@ -26,6 +26,9 @@
  * --------
  * 2007-09-09 ported helper functions from nathelper module (osas)
  * 2008-04-22 integrated RFC4975 attributes - patch provided by Denis Bilenko (denik)
+ * 2010-09-xx extract_field() no longer matches a body shorter than the field,
+ *            extract_rtpmap() checks for the '/' of the encoding,
+ *            extract_mediaip() stops at a stray CR (was looping)
  *
  */
 
@@ -47,7 +50,8 @@ static str sup_ptypes[] = {
 
 
 #define READ(val) \
-	(*(val + 0) + (*(val + 1) << 8) + (*(val + 2) << 16) + (*(val + 3) << 24))
+	((unsigned char)*(val + 0) + ((unsigned char)*(val + 1) << 8) + \
+	((unsigned char)*(val + 2) << 16) + ((unsigned)(unsigned char)*(val + 3) << 24))
 #define advance(_ptr,_n,_str,_error) \
 	do{\
 		if ((_ptr)+(_n)>(_str).s+(_str).len)\
@@ -161,7 +165,7 @@ int extract_rtpmap(str *body,
 	char *cp, *cp1;
 	int len;
 
-	if (strncasecmp(body->s, "a=rtpmap:", 9) !=0) {
+	if (body->len < 9 || strncasecmp(body->s, "a=rtpmap:", 9) !=0) {
 		/*LM_DBG("We are not pointing to an a=rtpmap: attribute =>`%.*s'\n", body->len, body->s); */
 		return -1;
 	}
@@ -192,11 +196,11 @@ int extract_rtpmap(str *body,
 
 	rtpmap_encoding->s = cp;
 	cp1 = (char*)ser_memmem(cp, "/", len, 1);
-	len -= cp1 - cp;
-	if (len <= 0 || cp == cp1) {
+	if (cp1 == NULL || cp == cp1) {
 		LM_ERR("invalid encoding in `a=rtpmap'\n");
 		return -1;
 	}
+	len -= cp1 - cp;
 	rtpmap_encoding->len = cp1 - cp;
 
 	cp = cp1;
@@ -224,7 +228,7 @@ int extract_fmtp( str *body, str *fmtp_payload, str *fmtp_string )
 	char *cp, *cp1;
 	int len;
 
-	if (strncasecmp(body->s, "a=fmtp:", 7) !=0) {
+	if (body->len < 7 || strncasecmp(body->s, "a=fmtp:", 7) !=0) {
 		/*LM_DBG("We are not pointing to an a=rtpmap: attribute =>`%.*s'\n", body->len, body->s); */
 		return -1;
 	}
@@ -268,7 +272,7 @@ int extract_fmtp( str *body, str *fmtp_payload, str *fmtp_string )
  * field must has format "a=attrname:" */
 int extract_field(str *body, str *value, str field)
 {
-	if (strncmp(body->s, field.s, field.len < body->len ? field.len : body->len) !=0) {
+	if (body->len < field.len || strncmp(body->s, field.s, field.len) !=0) {
 		/*LM_DBG("We are not pointing to an %.* attribute =>`%.*s'\n", field.len, field.s, body->len, body->s); */
 		return -1;
 	}
@@ -318,6 +322,8 @@ int extract_sendrecv_mode(str *body, str *sendrecv_mode)
 	char *cp1;
 
 	cp1 = body->s;
+	if (body->len < 10)
+		return -1;
 	if ( !( (strncasecmp(cp1, "a=sendrecv", 10) == 0) ||
 		(strncasecmp(cp1, "a=inactive", 10) == 0) ||
 		(strncasecmp(cp1, "a=recvonly", 10) == 0) ||
@@ -394,6 +400,9 @@ int extract_mediaip(str *body, str *mediaip, int *pf, char *line)
 	nextisip = 0;
 	for (cp = mediaip->s; cp < mediaip->s + mediaip->len;) {
 		len = eat_token_end(cp, mediaip->s + mediaip->len) - cp;
+		/* a stray CR / LF ends the field */
+		if (len == 0)
+			break;
 		if (nextisip == 1) {
 			mediaip->s = cp;
 			mediaip->len = len;
@@ -636,7 +645,8 @@ char* get_sdp_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 				if (match){
 					match++;
 				}else {
-					LM_ERR("bad body for <%s>(%d)\n", hdr->name.s, hdr->type);
+					LM_ERR("bad body for <%.*s>(%d)\n", hdr->name.len,
+						hdr->name.s, hdr->type);
 					tmp=end;
 					goto error;
 				}
@@ -677,7 +687,8 @@ char *find_sdp_line_delimiter(char* p, char* plimit, str delimiter)
 	return NULL;
       /* We matched '--',
        * now let's match the boundary delimiter */
-      if (strncmp(cp1+2, delimiter.s, delimiter.len) == 0)
+      if (delimiter.len == 0 || (cp1+2+delimiter.len <= plimit &&
+      strncmp(cp1+2, delimiter.s, delimiter.len) == 0))
 	break;
       else
 	cp = cp1 + 2 + delimiter.len;
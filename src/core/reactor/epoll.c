@@ -21,6 +21,14 @@
  * history:
  * ---------
  *  2010-04-xx  created (adragus)
+ *  2010-09-xx  fds registered once as EPOLLONESHOT and re-armed with
+ *              EPOLL_CTL_MOD; EPOLL_CTL_DEL only on close
+ *  2010-09-xx  event array sized by ev_batch, registration flags kept in
+ *              the fd table pages
+ *  2010-09-xx  commands taken from the control ring, the eventfd is only
+ *              a doorbell
+ *  2010-09-xx  epoll_ctl_apply(), also for the commands of the reactor
+ *              thread itself
  */
 
 
@@ -28,6 +36,9 @@
 #include "general.h"
 #include "reactor.h"
 
+/* the fd is in the epoll set (its page must exist) */
+#define ep_registered(_h, _fd) \
+	(fd_page_of(_h, _fd)->registered[(_fd) & FD_PAGE_MASK])
 
 
 int epoll_init(io_wait_h *h)
@@ -36,16 +47,17 @@ int epoll_init(io_wait_h *h)
 	struct epoll_event ep_event;
 	struct fd_map * e;
 
-	h->ep_array = shm_malloc(sizeof (*(h->ep_array)) * h->max_fd_no);
+	/* only the events of a loop iteration, not one slot per fd */
+	h->ep_array = shm_malloc(sizeof (*(h->ep_array)) * h->ev_batch);
 	if (h->ep_array == 0)
 	{
 		LM_CRIT("could not alloc epoll array\n");
 		goto error;
 	}
-	memset((void*) h->ep_array, 0, sizeof (*(h->ep_array)) * h->max_fd_no);
+	memset((void*) h->ep_array, 0, sizeof (*(h->ep_array)) * h->ev_batch);
 
 again:
-	h->epfd = epoll_create(h->max_fd_no);
+	h->epfd = epoll_create(h->ev_batch);
 	if (h->epfd == -1)
 	{
 		if (errno == EINTR) goto again;
@@ -53,15 +65,15 @@ again:
 		goto error;
 	}
 
-	if ((e = safe_add_to_hash(h, h->control_pipe[0], 0, 0, NULL, NULL)) == NULL)
+	if ((e = safe_add_to_hash(h, h->ctl_fd[0], 0, 0, NULL, NULL)) == NULL)
 		goto error;
 
 	ep_event.events = EPOLLIN;
 	ep_event.data.ptr = e;
 
-	if( epoll_ctl(h->epfd, EPOLL_CTL_ADD, h->control_pipe[0], &ep_event) )
+	if( epoll_ctl(h->epfd, EPOLL_CTL_ADD, h->ctl_fd[0], &ep_event) )
 	{
-		LM_ERR("Unable to add control pipe\n");
+		LM_ERR("Unable to add control doorbell\n");
 		goto error;
 	}
 
@@ -81,15 +93,65 @@ void epoll_destroy(io_wait_h *h)
 	}
 }
 
+/* the fd was activated - it is taken out of the hash, but it stays in
+ * the epoll set; if still armed (fired fd), it is disarmed */
+static inline int epoll_disarm(io_wait_h *h, int fd, int armed)
+{
+	struct epoll_event ep_event;
+
+	if (safe_remove_from_hash(h, fd))
+		return -1;
+
+	if (armed)
+	{
+		ep_event.events = EPOLLONESHOT;
+		ep_event.data.ptr = get_fd_map(h, fd);
+		if (epoll_ctl(h->epfd, EPOLL_CTL_MOD, fd, &ep_event) == -1)
+			LM_DBG("disarming fd %d failed: %s [%d]\n",
+				fd, strerror(errno), errno);
+	}
+
+	return 0;
+}
+
+/* runs a control command - by the reactor thread only */
+void epoll_ctl_apply(io_wait_h *h, struct ctl_cmd *cmd)
+{
+	reactor_t * rec = (reactor_t *) h->arg;
+	struct fd_map e, *m;
+	int fd = cmd->fd;
+
+	if( cmd->op == FIRE_FD )
+	{
+		/* the fd may be gone (removed) since the command was sent */
+		if( (m = get_fd_map(h,fd)) == NULL )
+			return;
+		e = *m;
+		if( e.fd != -1 )
+		{
+			LM_DBG("Firing event on fd =%d\n",fd);
+			if( !epoll_disarm(h,fd,1) )
+				reactor_dispatch(rec, &e);
+		}
+	}
+	else
+	{
+		LM_ERR("epoll received (%d,%d,%d) from control ring\n",
+			 cmd->op, fd, cmd->arg );
+	}
+}
+
 int epoll_loop(io_wait_h *h, int t)
 {
-	int n, r, i;
+	int n, r, i, k, rung;
 	reactor_t * rec = (reactor_t *) h->arg;
-	int buff[1<<12];
+	struct ctl_cmd cmds[CTL_BATCH];
+	struct fd_map e;
 
 again:
 	LM_DBG("Waiting in epoll\n");
-	n = epoll_wait(h->epfd, h->ep_array, h->max_fd_no, t * 1000);
+	n = epoll_wait(h->epfd, h->ep_array, h->ev_batch,
+		ctl_wait_start(h, t * 1000));
 	LM_DBG("Woke up from epoll type = %d with n= %d \n", n, h->type);
 
 	if (n == -1)
@@ -100,6 +162,7 @@ again:
 			LM_ERR("epoll_wait(%d, %p, %d, %d): %s [%d]\n",
 				h->epfd, h->ep_array, h->fd_no, t * 1000,
 				strerror(errno), errno);
+			ctl_wait_end(h, 0);
 			goto error;
 		}
 	}
@@ -114,63 +177,34 @@ again:
 	}
 #endif
 
-	for (r = 0; r < n; r++)
-	{
-		struct fd_map e,ctrl;
-		int len;
-		
-		ctrl = *(struct fd_map*) h->ep_array[r].data.ptr;
+	/*
+	 * Process the control ring
+	 */
 
-		if( ctrl.fd == h->control_pipe[0] && (h->ep_array[r].events & EPOLLIN ) )
-		{
-			if ((len = read(h->control_pipe[0], buff, sizeof (buff))) < 0)
-			{
-				LM_ERR("unable to read command from control pipe\n");
-				return -1;
-			}
+	rung = 0;
+	for (r = 0; r < n; r++)
+		if( ((struct fd_map*)h->ep_array[r].data.ptr)->fd == h->ctl_fd[0] )
+			rung = 1;
+	ctl_wait_end(h, rung);
 
-			for (i = 0; i < len / sizeof (int); i += CONTROL_SIZE)
-			{
-				int op = buff[i];
-				int fd = buff[i + 1];
-				int ev = buff[i + 2];
-
-
-				if( op == FIRE_FD )
-				{
-					e = *get_fd_map(h,fd);
-					if( e.fd != -1 )
-					{
-						LM_DBG("Firing event on fd =%d\n",fd);
-						if( !epoll_del(h,fd) )
-							put_task(rec->disp, e);
-					}
-				}
-				else
-				{
-					LM_ERR("epoll received (%d,%d,%d) from control pipe\n",
-						 op, fd, ev );
-				}
-				
-			}
-		}
-	}
+	while ((k = ctl_fetch(h, cmds, CTL_BATCH)) > 0)
+		for (i = 0; i < k; i++)
+			epoll_ctl_apply(h, &cmds[i]);
 
 
 	for (r = 0; r < n; r++)
 	{
-		struct fd_map e;
-		
 		e = *(struct fd_map*) h->ep_array[r].data.ptr;
 
 		if (
 		(h->ep_array[r].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLOUT) )
 			)
 		{
-			if( (e.fd != -1) && ( e.fd != h->control_pipe[0] ) )
+			if( (e.fd != -1) && ( e.fd != h->ctl_fd[0] ) )
 			{
-				if( !epoll_del(h,e.fd) )
-					put_task(rec->disp, e);
+				/* one-shot - the kernel already disarmed it */
+				if( !epoll_disarm(h,e.fd,0) )
+					reactor_dispatch(rec, &e);
 			}
 
 		} else
@@ -187,6 +221,7 @@ error:
 
 }
 
+/* removes the fd from the epoll set - to be done before closing it */
 int epoll_del(io_wait_h *h, int fd)
 {
 
@@ -196,9 +231,13 @@ int epoll_del(io_wait_h *h, int fd)
 	if (safe_remove_from_hash(h, fd))
 		goto error;
 
+	if (get_fd_map(h, fd) == NULL || !ep_registered(h, fd))
+		return 0;
+	ep_registered(h, fd) = 0;
+
 	LM_DBG("epfd=%d, fd=%d\n",h->epfd,fd);
 	n = epoll_ctl(h->epfd, EPOLL_CTL_DEL, fd, &ep_event);
-	if (n == -1 && errno != EBADF)
+	if (n == -1 && errno != EBADF && errno != ENOENT)
 	{
 		LM_ERR("removing fd %d from epoll "
 			"list failed: %s [%d]\n", fd,strerror(errno), errno);
@@ -215,7 +254,7 @@ int epoll_add(io_wait_h* h, int fd, int type, int priority,
 {
 
 	struct epoll_event ep_event;
-	int n;
+	int n, op;
 	struct fd_map * e;
 
 	if ((e = safe_add_to_hash(h, fd, type, priority, cb, cb_param)) == NULL)
@@ -224,27 +263,42 @@ int epoll_add(io_wait_h* h, int fd, int type, int priority,
 	
 	if( h->type == REACTOR_IN)
 	{
-		ep_event.events = EPOLLIN;
+		ep_event.events = EPOLLIN | EPOLLONESHOT;
 	}
 	
 	if( h->type == REACTOR_OUT )
 	{
-		ep_event.events = EPOLLOUT;
+		ep_event.events = EPOLLOUT | EPOLLONESHOT;
 	}
 
 	ep_event.data.ptr = e;
 
+	/* already in the set (disarmed) -> just re-arm it */
+	op = ep_registered(h, fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
 again1:
-	LM_DBG("epfd=%d, fd=%d\n",h->epfd,fd);
-	n = epoll_ctl(h->epfd, EPOLL_CTL_ADD, fd, &ep_event);
+	LM_DBG("epfd=%d, fd=%d, op=%d\n",h->epfd,fd,op);
+	n = epoll_ctl(h->epfd, op, fd, &ep_event);
 
 	if (n == -1)
 	{
 		if (errno == EAGAIN) goto again1;
+		/* fd closed without epoll_del (and maybe reused) */
+		if (op == EPOLL_CTL_MOD && errno == ENOENT)
+		{
+			op = EPOLL_CTL_ADD;
+			goto again1;
+		}
+		if (op == EPOLL_CTL_ADD && errno == EEXIST)
+		{
+			op = EPOLL_CTL_MOD;
+			goto again1;
+		}
 		LM_ERR("epoll_ctl failed: %s [%d]\n",
 			strerror(errno), errno);
 		goto error;
 	}
+	ep_registered(h, fd) = 1;
 
 	return 0;
 error:
@@ -33,6 +33,7 @@
 
 int epoll_init(io_wait_h *h);
 int epoll_loop(io_wait_h *h, int t);
+void epoll_ctl_apply(io_wait_h *h, struct ctl_cmd *cmd);
 int epoll_del(io_wait_h *h, int fd);
 int epoll_add(io_wait_h* h, int fd, int type, int priority,
 		fd_callback *cb, void *cb_param);
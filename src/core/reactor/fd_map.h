@@ -21,6 +21,7 @@
  * history:
  * ---------
  *  2010-04-xx  created (adragus)
+ *  2010-09-xx  CALLBACK_INLINE_F added
  */
 
 #ifndef _FD_MAP
@@ -29,6 +30,10 @@
 struct _reactor;
 
 #define CALLBACK_COMPLEX_F 1
+/* the callback is short and never blocks - it may be run directly by the
+ * reactor thread instead of going through the dispatcher (see
+ * reactor_inline_budget) */
+#define CALLBACK_INLINE_F  2
 
 
 typedef int (fd_callback)(void *param);
@@ -21,27 +21,157 @@
  * history:
  * ---------
  *  2010-04-xx  created (adragus)
+ *  2010-09-xx  sparse, growable fd table
+ *  2010-09-xx  control ring with eventfd doorbell (replaces send_fire()
+ *              writing each command in a pipe)
+ *  2010-09-xx  the commands of the reactor thread itself are run directly
+ *  2010-09-xx  the poll array grows with the number of watched fds
  */
 
+#include <sched.h>
+
 #include "general.h"
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 #include "reactor.h"
+#include "../mem/mem.h"
+#include "../locking/atomic_ops.h"
+
+
+__thread io_wait_h *io_wait_self = NULL;
+
+
+static struct fd_dir* fd_dir_new(int size)
+{
+	struct fd_dir *d;
+
+	d = shm_malloc(sizeof(struct fd_dir) + size*sizeof(struct fd_page*));
+	if (d == NULL)
+	{
+		LM_CRIT("could not alloc fd table directory (%d pages)\n", size);
+		return NULL;
+	}
+	memset(d, 0, sizeof(struct fd_dir) + size*sizeof(struct fd_page*));
+	d->size = size;
+	return d;
+}
+
+int fd_table_init(io_wait_h* h, int max_fd)
+{
+	if (max_fd <= 0)
+		max_fd = FD_PAGE_SIZE;
+
+	lock_init(&h->fd_dir_lock);
+	h->fd_dir = fd_dir_new((max_fd + FD_PAGE_SIZE - 1) >> FD_PAGE_SHIFT);
+
+	return h->fd_dir ? 0 : -1;
+}
+
+void fd_table_destroy(io_wait_h* h)
+{
+	struct fd_dir *d, *old;
+	int i;
+
+	if ((d = h->fd_dir) == NULL)
+		return;
+
+	/* the pages are shared by all the directories - free them once */
+	for (i = 0; i < d->size; i++)
+		if (d->pages[i])
+			shm_free(d->pages[i]);
+
+	for (; d; d = old)
+	{
+		old = d->old;
+		shm_free(d);
+	}
+	h->fd_dir = NULL;
+	lock_destroy(&h->fd_dir_lock);
+}
+
+/* replaces the directory with a bigger one, able to hold page "idx"
+ * (fd_dir_lock must be held) */
+static struct fd_dir* fd_dir_grow(io_wait_h* h, int idx)
+{
+	struct fd_dir *d, *old;
+	int size;
+
+	old = h->fd_dir;
+	size = old->size * 2;
+	if (size <= idx)
+		size = idx + 1;
+
+	if ((d = fd_dir_new(size)) == NULL)
+		return NULL;
+	memcpy(d->pages, old->pages, old->size * sizeof(struct fd_page*));
+	d->old = old;
+
+	/* the readers may still use the old directory, so it is kept */
+	membar_full();
+	h->fd_dir = d;
+
+	LM_DBG("fd table of reactor %p grown to %d fds\n",
+		h->rec, size << FD_PAGE_SHIFT);
+	return d;
+}
+
+struct fd_page* fd_page_get(io_wait_h* h, int fd)
+{
+	struct fd_dir *d;
+	struct fd_page *p;
+	int idx, i;
+
+	idx = fd >> FD_PAGE_SHIFT;
+
+	d = h->fd_dir;
+	if (idx < d->size && (p = d->pages[idx]) != NULL)
+		return p;
+
+	lock_get(&h->fd_dir_lock);
+
+	d = h->fd_dir;
+	if (idx >= d->size && (d = fd_dir_grow(h, idx)) == NULL)
+		goto error;
+
+	if ((p = d->pages[idx]) == NULL)
+	{
+		p = shm_malloc(sizeof(struct fd_page));
+		if (p == NULL)
+		{
+			LM_CRIT("could not alloc fd table page\n");
+			goto error;
+		}
+		memset(p, 0, sizeof(struct fd_page));
+		for (i = 0; i < FD_PAGE_SIZE; i++)
+			p->map[i].fd = -1;
+		/* page fully built before being visible */
+		membar_full();
+		d->pages[idx] = p;
+	}
+
+	lock_release(&h->fd_dir_lock);
+	return p;
+error:
+	lock_release(&h->fd_dir_lock);
+	return NULL;
+}
 
 int safe_remove_from_hash(io_wait_h * h, int fd)
 {
 	struct fd_map * e;
-	if (fd < 0 || fd > h->max_fd_no)
+	if (fd < 0 || fd >= FD_TABLE_MAX)
 	{
-		LM_ERR("Invalid fd : fd = %d max_fd = %d\n", fd, h->max_fd_no);
+		LM_ERR("Invalid fd : fd = %d\n", fd);
 		goto error;
 	}
 
 	e = get_fd_map(h, fd);
 
+	/* never added */
 	if (e == NULL)
-	{
-		LM_ERR("Cannot get fd_map from hash\n");
-		goto error;
-	}
+		return 0;
+
 	unhash_fd_map(e);
 
 	return 0;
@@ -54,9 +184,9 @@ struct fd_map * safe_add_to_hash(io_wait_h * h, int fd,
 {
 	struct fd_map * e;
 
-	if (fd < 0 || fd > h->max_fd_no)
+	if (fd < 0 || fd >= FD_TABLE_MAX)
 	{
-		LM_ERR("Invalid fd : fd = %d max_fd = %d\n", fd, h->max_fd_no);
+		LM_ERR("Invalid fd : fd = %d max_fd = %d\n", fd, FD_TABLE_MAX);
 		goto error;
 	}
 
@@ -74,7 +204,7 @@ error:
 	return NULL;
 }
 
-int inline array_fd_del(io_wait_h * h, int fd1, int idx)
+int array_fd_del(io_wait_h * h, int fd1, int idx)
 {
 
 	if (idx == -1)
@@ -96,8 +226,34 @@ int inline array_fd_del(io_wait_h * h, int fd1, int idx)
 	}
 }
 
-void inline array_fd_add(io_wait_h * h, int fd1, int ev)
+/* the poll array holds every watched fd, so it grows like the fd table
+ * (it was sized for the expected number of fds only); reactor thread only */
+static int array_fd_grow(io_wait_h * h)
+{
+	struct pollfd *a;
+	int size;
+
+	size = h->max_fd_no * 2;
+	a = shm_malloc(size * sizeof (*(h->fd_array)));
+	if (a == NULL)
+	{
+		LM_ERR("could not grow the fd array to %d fds\n", size);
+		return -1;
+	}
+	memcpy(a, h->fd_array, h->fd_no * sizeof (*(h->fd_array)));
+	shm_free(h->fd_array);
+	h->fd_array = a;
+	h->max_fd_no = size;
+
+	LM_DBG("fd array of reactor %p grown to %d fds\n", h->rec, size);
+	return 0;
+}
+
+int array_fd_add(io_wait_h * h, int fd1, int ev)
 {
+	if (h->fd_no == h->max_fd_no && array_fd_grow(h) < 0)
+		return -1;
+
 	h->fd_array[h->fd_no].fd = fd1;
 
 	if( ev == REACTOR_IN )
@@ -112,24 +268,170 @@ void inline array_fd_add(io_wait_h * h, int fd1, int ev)
 	h->fd_array[h->fd_no].revents = 0; /* useless for select */
 	h->fd_no++;
 
+	return 0;
 }
 
-int send_fire(io_wait_h *h, int fd)
+int ctl_init(io_wait_h *h)
 {
-	int ops[CONTROL_SIZE];
+	unsigned int i;
 
-	ops[0] = FIRE_FD;
-	ops[1] = fd;
+	h->ctl = shm_malloc(sizeof (struct ctl_ring));
+	if (h->ctl == NULL)
+	{
+		LM_CRIT("could not alloc control ring\n");
+		goto error;
+	}
+	h->ctl->head = h->ctl->tail = 0;
+	for (i = 0; i < CTL_RING_SIZE; i++)
+		h->ctl->slots[i].seq = i;
+	h->ctl_sleeping = 0;
 
-	if (write(h->control_pipe[1], ops, sizeof (ops)) < 0)
+#ifdef HAVE_EVENTFD
+	h->ctl_fd[0] = h->ctl_fd[1] = eventfd(0, EFD_NONBLOCK);
+	if (h->ctl_fd[0] != -1)
+		return 0;
+	LM_WARN("eventfd failed (%s), using a pipe as doorbell\n",
+		strerror(errno));
+#endif
+
+	if (pipe(h->ctl_fd) == -1)
 	{
-		LM_ERR("Unable to send message through control pipe\n");
+		LM_CRIT("could not open doorbell pipe for reactor\n");
 		goto error;
 	}
+	set_fd_flags(O_NONBLOCK, h->ctl_fd[0]);
+	set_fd_flags(O_NONBLOCK, h->ctl_fd[1]);
 
 	return 0;
 error:
 	return -1;
+}
+
+void ctl_destroy(io_wait_h *h)
+{
+	if (h->ctl_fd[0] != -1)
+	{
+		close(h->ctl_fd[0]);
+		if (h->ctl_fd[1] != h->ctl_fd[0])
+			close(h->ctl_fd[1]);
+		h->ctl_fd[0] = h->ctl_fd[1] = -1;
+	}
+	if (h->ctl)
+	{
+		shm_free(h->ctl);
+		h->ctl = NULL;
+	}
+}
+
+static inline void ctl_ring_doorbell(io_wait_h *h)
+{
+#ifdef HAVE_EVENTFD
+	uint64_t one = 1;
+#else
+	char one = 1;
+#endif
+
+	/* a full pipe / eventfd is as good as a written one */
+	if (write(h->ctl_fd[1], &one, sizeof (one)) < 0 && errno != EAGAIN)
+		LM_ERR("failed to ring the reactor doorbell: %s\n", strerror(errno));
+}
+
+int ctl_send(io_wait_h *h, int op, int fd, int arg)
+{
+	struct ctl_ring *q = h->ctl;
+	struct ctl_slot *slot;
+	unsigned int pos;
+	int dif;
+	struct ctl_cmd cmd;
+
+	if (h == io_wait_self)
+	{
+		cmd.op = op;
+		cmd.fd = fd;
+		cmd.arg = arg;
+		ctl_apply(h, &cmd);
+		return 0;
+	}
+
+	do
+	{
+		pos = q->head;
+		slot = &q->slots[pos & (CTL_RING_SIZE - 1)];
+		dif = (int)(slot->seq - pos);
+		if (dif == 0)
+		{
+			if (atomic_cas(&q->head, pos, pos + 1))
+				break;
+		} else if (dif < 0)
+		{
+			/* ring full - make sure the reactor is awake and let it
+			 * drain the ring */
+			ctl_ring_doorbell(h);
+			sched_yield();
+		}
+	} while (1);
+
+	slot->cmd.op = op;
+	slot->cmd.fd = fd;
+	slot->cmd.arg = arg;
+	/* publish the command */
+	membar_full();
+	slot->seq = pos + 1;
+
+	/* the reactor sets ctl_sleeping and then checks the ring - after
+	 * this barrier, one of us sees the other's write */
+	membar_full();
+	if (h->ctl_sleeping && atomic_cas(&h->ctl_sleeping, 1, 0))
+		ctl_ring_doorbell(h);
+
+	return 0;
+}
+
+#define ctl_pending(_q) \
+	((_q)->slots[(_q)->tail & (CTL_RING_SIZE - 1)].seq == (_q)->tail + 1)
+
+int ctl_wait_start(io_wait_h *h, int timeout)
+{
+	h->ctl_sleeping = 1;
+	membar_full();
+	if (ctl_pending(h->ctl))
+	{
+		h->ctl_sleeping = 0;
+		return 0;
+	}
+	return timeout;
+}
+
+void ctl_wait_end(io_wait_h *h, int rung)
+{
+	char buf[64];
+
+	h->ctl_sleeping = 0;
+
+	/* drain the doorbell - it only says "look in the ring" */
+	if (rung)
+		while (read(h->ctl_fd[0], buf, sizeof (buf)) > 0);
+}
+
+int ctl_fetch(io_wait_h *h, struct ctl_cmd *cmds, int max)
+{
+	struct ctl_ring *q = h->ctl;
+	struct ctl_slot *slot;
+	int n;
+
+	for (n = 0; n < max; n++)
+	{
+		slot = &q->slots[q->tail & (CTL_RING_SIZE - 1)];
+		if (slot->seq != q->tail + 1)
+			break;
+		membar_full();
+		cmds[n] = slot->cmd;
+		membar_full();
+		/* free the slot for the next lap */
+		slot->seq = q->tail + CTL_RING_SIZE;
+		q->tail++;
+	}
 
+	return n;
 }
 
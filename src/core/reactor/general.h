@@ -21,6 +21,9 @@
  * history:
  * ---------
  *  2010-04-xx  created (adragus)
+ *  2010-09-xx  sparse, growable fd table; event array decoupled from it
+ *  2010-09-xx  control pipe replaced by a lock-free command ring and an
+ *              eventfd doorbell
  */
 
 
@@ -55,11 +58,14 @@
 #include <sys/poll.h>
 #include <fcntl.h>
 #include "../log.h"
+#include "../locking/locking.h"
 #include "fd_map.h"
 
-/*********************POLL TYPES SECTION ******************************/
+#ifdef __OS_linux
+#define HAVE_EVENTFD
+#endif
 
-#define CONTROL_SIZE 3
+/*********************POLL TYPES SECTION ******************************/
 
 enum poll_types
 {
@@ -86,10 +92,37 @@ enum poll_types get_poll_type(char* s);
 
 /****************************STRUCTURE SECTION *****************************/
 
+/* commands passed to the reactor thread via its control ring */
 #define ADD_FD 0
 #define DEL_FD 1
 #define FIRE_FD 2
 
+struct ctl_cmd
+{
+	int op;
+	int fd;
+	int arg;
+};
+
+/* size of the control ring, power of 2 */
+#define CTL_RING_SIZE  4096
+/* max commands taken from the ring in one go */
+#define CTL_BATCH      256
+
+/* bounded MPSC queue: the producers reserve slots by moving "head" with a
+ * CAS; a slot is ready for the reactor when its sequence is position+1 and
+ * free for the producers when it is position */
+struct ctl_ring
+{
+	volatile unsigned int head;
+	unsigned int tail; /* used only by the reactor thread */
+	struct ctl_slot
+	{
+		volatile unsigned int seq;
+		struct ctl_cmd cmd;
+	} slots[CTL_RING_SIZE];
+};
+
 
 #ifdef HAVE_KQUEUE
 #ifndef KQ_CHANGES_ARRAY_SIZE
@@ -115,7 +148,7 @@ struct io_wait_handler
 	int type;
 
 #ifdef HAVE_EPOLL
-	struct epoll_event* ep_array;
+	struct epoll_event* ep_array; /* ev_batch events */
 	int epfd; /* epoll ctrl fd */
 #endif
 
@@ -137,14 +170,22 @@ struct io_wait_handler
 #endif
 
 
+	/* control channel - commands from other threads go through the ring;
+	 * the doorbell (eventfd or pipe; [0] is polled, [1] is written) is
+	 * rung only if the reactor thread may be blocked in a wait */
+	struct ctl_ring *ctl;
+	int ctl_fd[2];
+	volatile int ctl_sleeping;
+
 	/* common stuff for POLL,  and SELECT
 	 * since poll support is always compiled => this will always be compiled */
-	int control_pipe[2];
-	struct fd_map* fd_hash;
+	struct fd_dir* volatile fd_dir; /* fd table, see get_fd_map() */
+	gen_lock_t fd_dir_lock; /* taken only to add pages or to grow */
 	struct pollfd* fd_array;
 	int fd_no; /*  current index used in fd_array */
-	int max_fd_no; /* maximum fd no, is also the size of fd_array,
-						       fd_hash  and ep_array*/
+	int max_fd_no; /* size of fd_array (grows with the watched fds),
+						the initial size of the fd table */
+	int ev_batch; /* max events returned by a wait (ep_array, kq_array) */
 	enum poll_types poll_method;
 	int flags;
 
@@ -157,8 +198,52 @@ typedef struct io_wait_handler io_wait_h;
 
 /**********************HELPER SECTION *******************************/
 
-/*! \brief get the corresponding fd_map structure pointer */
-#define get_fd_map(h, fd)		(&(h)->fd_hash[(fd)])
+/*! \brief the fd table is sparse: a directory of pages of FD_PAGE_SIZE
+ * fd_maps, allocated only when a fd from their range is first used.
+ * The pages never move (epoll keeps pointers to their fd_maps); when a fd
+ * over the directory size shows up, a bigger directory is built and the
+ * old one is kept (readers may still use it) until the handler is
+ * destroyed */
+#define FD_PAGE_SHIFT  8
+#define FD_PAGE_SIZE   (1<<FD_PAGE_SHIFT)
+#define FD_PAGE_MASK   (FD_PAGE_SIZE-1)
+/* upper limit for the fd numbers */
+#define FD_TABLE_MAX   (1<<24)
+
+struct fd_page
+{
+	struct fd_map map[FD_PAGE_SIZE];
+	/* fds added to the epoll set - they stay there (disarmed, as
+	 * one-shot) between activations, until closed */
+	unsigned char registered[FD_PAGE_SIZE];
+};
+
+struct fd_dir
+{
+	int size;               /* number of pages */
+	struct fd_dir *old;     /* replaced directories */
+	struct fd_page *pages[0];
+};
+
+/*! \brief get the corresponding fd_map structure pointer;
+ * NULL if the fd was never used */
+static inline struct fd_map* get_fd_map(io_wait_h* h, int fd)
+{
+	struct fd_dir *d = h->fd_dir;
+	struct fd_page *p;
+
+	if (fd < 0 || (fd >> FD_PAGE_SHIFT) >= d->size)
+		return NULL;
+	p = d->pages[fd >> FD_PAGE_SHIFT];
+	return p ? &p->map[fd & FD_PAGE_MASK] : NULL;
+}
+
+/*! \brief same as get_fd_map(), but allocates the page (and grows the
+ * table) if needed */
+struct fd_page* fd_page_get(io_wait_h* h, int fd);
+
+#define fd_page_of(h, fd) \
+	((h)->fd_dir->pages[(fd) >> FD_PAGE_SHIFT])
 
 /*! \brief remove a fd_map structure from the hash;
  * the pointer must be returned by get_fd_map or hash_fd_map
@@ -172,15 +257,24 @@ typedef struct io_wait_handler io_wait_h;
 static inline struct fd_map* hash_fd_map(io_wait_h* h, int fd, int flags,
 		int priority, fd_callback cb, void* cb_param)
 {
-	h->fd_hash[fd].last_reactor = h->rec;
-	h->fd_hash[fd].fd = fd;
-	h->fd_hash[fd].flags = flags;
-	h->fd_hash[fd].priority = priority;
-	h->fd_hash[fd].cb = cb;
-	h->fd_hash[fd].cb_param = cb_param;
-	return &h->fd_hash[fd];
+	struct fd_page *p;
+	struct fd_map *e;
+
+	if ( (p=fd_page_get(h, fd))==NULL )
+		return NULL;
+	e = &p->map[fd & FD_PAGE_MASK];
+	e->last_reactor = h->rec;
+	e->fd = fd;
+	e->flags = flags;
+	e->priority = priority;
+	e->cb = cb;
+	e->cb_param = cb_param;
+	return e;
 }
 
+int fd_table_init(io_wait_h* h, int max_fd);
+void fd_table_destroy(io_wait_h* h);
+
 #define set_fd_flags(f,fd) \
 	do{		static int flags;\
 			flags=fcntl(fd, F_GETFL); \
@@ -197,13 +291,38 @@ static inline struct fd_map* hash_fd_map(io_wait_h* h, int fd, int flags,
 	}while(0)
 
 
-int inline array_fd_del(io_wait_h * h, int fd1, int idx);
-void inline array_fd_add(io_wait_h * h, int fd1, int ev);
+int array_fd_del(io_wait_h * h, int fd1, int idx);
+int array_fd_add(io_wait_h * h, int fd1, int ev);
 int inline safe_remove_from_hash(io_wait_h * h, int fd1);
 struct fd_map * safe_add_to_hash(io_wait_h * h, int fd,
 		int flags, int priority, fd_callback cb, void *cb_param);
 
-int send_fire(io_wait_h *h, int fd);
+int ctl_init(io_wait_h *h);
+void ctl_destroy(io_wait_h *h);
+
+/* the handler of the reactor running in this thread (NULL if none) */
+extern __thread io_wait_h *io_wait_self;
+
+/* queues a command for the reactor thread; must be thread-safe. The
+ * commands of the reactor thread itself are run right away (ctl_apply()) -
+ * it would wait for room in a ring only it drains */
+int ctl_send(io_wait_h *h, int op, int fd, int arg);
+
+/* runs a command, as taken from the ring - by the reactor thread only */
+void ctl_apply(io_wait_h *h, struct ctl_cmd *cmd);
+
+/* to be called by the reactor right before waiting for events; returns
+ * the timeout to use (0 if commands are already queued) */
+int ctl_wait_start(io_wait_h *h, int timeout);
+
+/* to be called by the reactor after the wait; "rung" - the doorbell was
+ * reported as readable */
+void ctl_wait_end(io_wait_h *h, int rung);
+
+/* takes up to "max" queued commands; returns their number */
+int ctl_fetch(io_wait_h *h, struct ctl_cmd *cmds, int max);
+
+#define send_fire(_h, _fd)  ctl_send(_h, FIRE_FD, _fd, 0)
 
 
 #endif
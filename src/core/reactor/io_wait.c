@@ -22,6 +22,7 @@
  *  2005-06-15  created by andrei
  *  2005-06-26  added kqueue (andrei)
  *  2005-07-04  added /dev/poll (andrei)
+ *  2010-09-xx  ctl_apply() runs a control command directly
  */
 
 /*!
@@ -290,10 +291,12 @@ enum poll_types get_poll_type(char* s)
 /*!
  * \brief initializes the static vars/arrays
  * \param  h - pointer to the io_wait_h that will be initialized
- * \param  max_fd - maximum allowed fd number
+ * \param  max_fd - expected number of fds (the fd table grows past it)
+ * \param  ev_batch - max number of events fetched in a loop iteration
  * \param  poll_method - poll method (0 for automatic best fit)
  */
-int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, enum poll_types poll_method,int type)
+int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, int ev_batch,
+						enum poll_types poll_method,int type)
 {
 	char * poll_err;
 
@@ -302,6 +305,7 @@ int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, enum poll_types p
 	h->rec = r;
 	h->type = type;
 	h->max_fd_no = max_fd;
+	h->ev_batch = ev_batch > 0 ? ev_batch : 1;
 
 	#ifdef HAVE_EPOLL
 	h->epfd = -1;
@@ -335,23 +339,18 @@ int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, enum poll_types p
 
 	h->poll_method = poll_method;
 
-	if (pipe(h->control_pipe) == -1)
+	if (ctl_init(h) < 0)
 	{
-		LM_CRIT("could not open pipe for reactor\n");
+		LM_CRIT("could not init the control channel of the reactor\n");
 		goto error;
 	}
 
-	/* common stuff, everybody has fd_hash */
-	h->fd_hash = local_malloc(sizeof (*(h->fd_hash)) * h->max_fd_no);
-
-	if (h->fd_hash == 0)
+	/* common stuff, everybody has the fd table */
+	if (fd_table_init(h, h->max_fd_no) < 0)
 	{
-		LM_CRIT("could not alloc fd hashtable (%ld bytes)\n",
-				(long) sizeof (*(h->fd_hash)) * h->max_fd_no);
+		LM_CRIT("could not alloc fd table (%d fds)\n", h->max_fd_no);
 		goto error;
 	}
-
-	memset((void*) h->fd_hash, 0, sizeof (*(h->fd_hash)) * h->max_fd_no);
 	
 	switch (poll_method)
 	{
@@ -368,7 +367,7 @@ int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, enum poll_types p
 		if (h->fd_array == 0)
 		{
 			LM_CRIT("could not alloc fd array (%ld bytes)\n",
-					(long) sizeof (*(h->fd_hash)) * h->max_fd_no);
+					(long) sizeof (*(h->fd_array)) * h->max_fd_no);
 			goto error;
 		}
 		memset((void*) h->fd_array, 0, sizeof (*(h->fd_array)) * h->max_fd_no);
@@ -412,14 +411,14 @@ int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, enum poll_types p
 
 	#ifdef HAVE_KQUEUE
 	case POLL_KQUEUE:
-		h->kq_array = local_malloc(sizeof (*(h->kq_array)) * h->max_fd_no);
+		h->kq_array = local_malloc(sizeof (*(h->kq_array)) * h->ev_batch);
 		if (h->kq_array == 0)
 		{
 			LM_CRIT("could not alloc kqueue event array\n");
 			goto error;
 		}
 
-		memset((void*) h->kq_array, 0, sizeof (*(h->kq_array)) * h->max_fd_no);
+		memset((void*) h->kq_array, 0, sizeof (*(h->kq_array)) * h->ev_batch);
 
 		if (kqueue_init(h) < 0)
 		{
@@ -494,11 +493,40 @@ void destroy_io_wait(io_wait_h* h)
 	}
 
 
-	if (h->fd_hash)
-	{
-		local_free(h->fd_hash);
-		h->fd_hash = 0;
-	}
+	ctl_destroy(h);
+
+	fd_table_destroy(h);
 
 }
 
+
+/*!
+ * \brief runs a control command with the method of the handler
+ * \param h IO handle
+ * \param cmd the command, as taken from the control ring
+ */
+void ctl_apply(io_wait_h* h, struct ctl_cmd *cmd)
+{
+	switch (h->poll_method)
+	{
+	#ifdef HAVE_EPOLL
+	case POLL_EPOLL:
+		epoll_ctl_apply(h, cmd);
+		break;
+	#endif
+
+	#ifdef HAVE_SELECT
+	case POLL_SELECT:
+		select_ctl_apply(h, cmd);
+		break;
+	#endif
+
+	case POLL_POLL:
+		poll_ctl_apply(h, cmd);
+		break;
+
+	default:
+		LM_ERR("control command %d on fd %d not supported by %s\n",
+			cmd->op, cmd->fd, poll_method_name(h->poll_method));
+	}
+}
@@ -22,6 +22,8 @@
  *  2005-06-13  created by andrei
  *  2005-06-26  added kqueue (andrei)
  *  2005-07-01  added /dev/poll (andrei)
+ *  2010-09-xx  io_watch_del() also drops the fd from the poll/select
+ *              arrays (DEL command via the control ring)
  */
 
 #ifndef _io_wait_h
@@ -60,6 +62,28 @@ inline static int io_watch_add(io_wait_h* h,int fd, int type,
 	}
 }
 
+/* the fd is about to be closed; epoll keeps fds between activations, the
+ * poll/select arrays may still hold it if it was not activated */
+inline static int io_watch_del(io_wait_h* h, int fd)
+{
+	switch (h->poll_method) {
+		case POLL_SELECT:
+		case POLL_POLL:
+			/* the reactor drops it from the arrays (if still there) */
+			if (safe_remove_from_hash(h, fd))
+				return -1;
+			return ctl_send(h, DEL_FD, fd, 0);
+
+		#ifdef HAVE_EPOLL
+		case POLL_EPOLL:
+			return epoll_del(h, fd);
+		#endif
+
+		default:
+			return 0;
+	}
+}
+
 inline static int io_watch_fire(io_wait_h* h, int fd)
 {
 	return send_fire(h, fd);
@@ -93,7 +117,8 @@ inline static int io_wait_loop(io_wait_h* h, int t)
 }
 
 
-int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, enum poll_types poll_method, int type);
+int init_io_wait(struct _reactor *r, io_wait_h* h, int max_fd, int ev_batch,
+						enum poll_types poll_method, int type);
 
 
 void destroy_io_wait(io_wait_h* h);
@@ -60,7 +60,7 @@ int kqueue_loop(io_wait_h *h, int t)
 
 
 again:
-	n = kevent(h->kq_fd, NULL, 0, h->kq_array, h->max_fd_no, &tspec);
+	n = kevent(h->kq_fd, NULL, 0, h->kq_array, h->ev_batch, &tspec);
 
 	if (n == -1)
 	{
@@ -92,7 +92,7 @@ again:
 		{
 			e = *(struct fd_map*) h->kq_array[r].udata;
 			kqueue_del(h, e.fd);
-			put_task(rec->disp, e);
+			reactor_dispatch(rec, &e);
 
 		}
 	}
@@ -25,31 +25,60 @@
 
 int poll_init(io_wait_h *h)
 {
-	array_fd_add(h, h->control_pipe[0], REACTOR_IN);
-	set_fd_flags(O_NONBLOCK, h->control_pipe[0]);
-
-	return 0;
-error:
-	return -1;
+	/* the doorbell is always the first in the array */
+	return array_fd_add(h, h->ctl_fd[0], REACTOR_IN);
 }
 
 void poll_destroy(io_wait_h *h)
 {
-	close(h->control_pipe[0]);
-	close(h->control_pipe[1]);
+	/* the doorbell is closed by ctl_destroy() */
+}
+
+/* runs a control command - by the reactor thread only */
+void poll_ctl_apply(io_wait_h *h, struct ctl_cmd *cmd)
+{
+	reactor_t * rec = (reactor_t *) h->arg;
+	struct fd_map e;
+	struct fd_map *m;
+	int fd = cmd->fd;
+
+	/* the fd may be gone (removed) since the command was sent */
+	m = get_fd_map(h, fd);
+
+	if (cmd->op == ADD_FD)
+	{
+		if (m && m->fd != -1 && array_fd_add(h, fd, cmd->arg) < 0)
+			LM_ERR("fd %d cannot be watched\n", fd);
+	}
+	else if (cmd->op == DEL_FD)
+	{
+		array_fd_del(h, fd, -1);
+	}
+	else if (cmd->op == FIRE_FD)
+	{
+		if (m == NULL)
+			return;
+		e = *m;
+		if( e.fd != -1 )
+		{
+			LM_DBG("Firing event on fd =%d\n",fd);
+			if( !array_fd_del(h,fd,-1) )
+				reactor_dispatch(rec, &e);
+		}
+	}
 }
 
 int poll_loop(io_wait_h *h, int t)
 {
-	int n, ret, len;
+	int n, ret, k;
 	int r, i;
-	int buff[4096];
+	struct ctl_cmd cmds[CTL_BATCH];
 	struct fd_map e;
 	reactor_t * rec = (reactor_t *) h->arg;
 
 again:
 	LM_DBG("Sleeping with %d fds\n", h->fd_no);
-	ret = n = poll(h->fd_array, h->fd_no, t * 1000);
+	ret = n = poll(h->fd_array, h->fd_no, ctl_wait_start(h, t * 1000));
 	LM_DBG("Woke up with: %d fds\n", n);
 
 	if (n < 0)
@@ -61,53 +90,30 @@ again:
 	}
 	
 	/*
-	 * Go through the control pipe to process change events
+	 * Go through the control ring to process change events
 	 */
 	
 	if( h->fd_array[0].revents & ( POLLERR | POLLHUP ) )
 	{
-		LM_ERR("Error on control pipe for poll [events =%d]\n",
+		LM_ERR("Error on control doorbell for poll [events =%d]\n",
 			 h->fd_array[0].revents);
 	}
 
-	if (h->fd_array[0].revents & POLLIN )
+	ctl_wait_end(h, h->fd_array[0].revents & POLLIN);
+	if (h->fd_array[0].revents)
 	{
-
-		if ((len = read(h->control_pipe[0], buff, sizeof (buff))) < 0)
-		{
-			LM_ERR("unable to read command from control pipe\n");
-			return -1;
-		}
-
-		for (i = 0; i < len / sizeof (int); i += 3)
-		{
-			int op = buff[i];
-			int fd = buff[i + 1];
-			int ev = buff[i + 2];
-
-			if (op == ADD_FD)
-			{
-				array_fd_add(h, fd, ev);
-			}
-
-			if( op == FIRE_FD )
-			{
-				e = *get_fd_map(h,fd);
-				if( e.fd != -1 )
-				{
-					LM_DBG("Firing event on fd =%d\n",fd);
-					if( !array_fd_del(h,fd,-1) )
-						put_task(rec->disp, e);
-				}
-			}
-
-		}
-
+		h->fd_array[0].revents = 0;
+		if (n > 0)
+			n--;
 	}
 
+	while ((k = ctl_fetch(h, cmds, CTL_BATCH)) > 0)
+		for (i = 0; i < k; i++)
+			poll_ctl_apply(h, &cmds[i]);
+
 	/*
 	 * Process all the events,
-	 * except the first one which is the control pipe
+	 * except the first one which is the control doorbell
 	 */
 
 	r = 1;
@@ -117,7 +123,9 @@ again:
 		{
 			e = *get_fd_map(h, h->fd_array[r].fd);
 			array_fd_del(h, h->fd_array[r].fd, r);
-			put_task(rec->disp, e);
+			/* removed (closed) meanwhile, the DEL command is pending */
+			if (e.fd != -1)
+				reactor_dispatch(rec, &e);
 			n--;
 
 		} else
@@ -129,7 +137,7 @@ again:
 }
 
 /*
- * poll_add just sends messages through the control pipe
+ * poll_add just sends messages through the control ring
  */
 
 int poll_add(io_wait_h* h, int fd, int type, int priority,
@@ -137,20 +145,12 @@ int poll_add(io_wait_h* h, int fd, int type, int priority,
 {
 
 	struct fd_map* e;
-	int ops[CONTROL_SIZE];
 
 	if ((e = safe_add_to_hash(h, fd, type, priority, cb, cb_param)) == NULL)
 		goto error;
 
-	ops[0] = ADD_FD;
-	ops[1] = fd;
-	ops[2] = h->type;
-
-	if (write(h->control_pipe[1], ops, sizeof (ops)) < 0)
-	{
-		LM_ERR("Unable to send message through control pipe\n");
+	if (ctl_send(h, ADD_FD, fd, h->type) < 0)
 		goto error;
-	}
 
 	return 0;
 error:
@@ -28,6 +28,7 @@
 
 int poll_init(io_wait_h *h);
 int poll_loop(io_wait_h *h, int t);
+void poll_ctl_apply(io_wait_h *h, struct ctl_cmd *cmd);
 int poll_add(io_wait_h* h, int fd, int type, int priority,
 		fd_callback cb, void *cb_param);
 void poll_destroy(io_wait_h *h);
@@ -21,11 +21,23 @@
  * history:
  * ---------
  *  2010-04-xx  created (adragus)
+ *  2010-09-xx  submit_read_task() added - overload aware submit
+ *  2010-09-xx  remove_fd() added - fds stay in the epoll set (one-shot)
+ *  2010-09-xx  reactor thread may be pinned on a CPU
+ *  2010-09-xx  fd table sized from RLIMIT_NOFILE, tunable event batch
+ *  2010-09-xx  several reactors per direction; fds routed to their reactor
+ *              by fd_reactor() (hash or least-loaded)
+ *  2010-09-xx  fd events which cannot be queued are run by the reactor
  */
 
-
+#ifdef __OS_linux
+#define _GNU_SOURCE  /* pthread_setaffinity_np */
+#endif
 
 #include <time.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <string.h>
 
 
 #include <pthread.h>
@@ -38,15 +50,76 @@
 #include "../mem/mem.h"
 #include "../mem/shm_mem.h"
 #include "../locking/locking.h"
+#include "../locking/atomic_ops.h"
+#include "../globals.h"
 #include "io_wait.h"
 
 /*
- * TODO check out the possibility of ONE-SHOT events with epoll and kqueue
+ * TODO check out the possibility of ONE-SHOT events with kqueue
+ *      (epoll already uses them)
  */
 
 //TODO add control pipe to the listening kqueue
 //TODO react to fire event (select,poll,kqueue,)
 
+int reactor_max_fds = 0;
+int reactor_ev_batch = 256;
+
+int reactors_in = 1;
+int reactors_out = 1;
+int reactor_policy = REACTOR_POLICY_HASH;
+int reactor_inline_budget = 200;
+
+/* the reactors of a direction */
+struct reactor_set
+{
+	int no;
+	reactor_t *r[REACTOR_MAX];
+	/* reactor owning each fd (index+1, 0 - none yet); used by the
+	 * least-loaded policy for the fds below "owner_size" */
+	unsigned char *owner;
+	int owner_size;
+};
+
+/* indexed by type-1 */
+static struct reactor_set reactor_sets[2];
+
+int set_reactor_policy(char *s)
+{
+	if (strcasecmp(s, "hash") == 0)
+		reactor_policy = REACTOR_POLICY_HASH;
+	else if (strcasecmp(s, "least-loaded") == 0)
+		reactor_policy = REACTOR_POLICY_LEAST_LOADED;
+	else
+	{
+		LM_ERR("invalid reactor policy %s - allowed: hash, least-loaded\n",
+			s);
+		return -1;
+	}
+	return 0;
+}
+
+/* how many fds the reactors should expect */
+static int reactor_fd_limit(void)
+{
+	struct rlimit lim;
+
+	if (reactor_max_fds > 0)
+		return reactor_max_fds < FD_TABLE_MAX ? reactor_max_fds : FD_TABLE_MAX;
+
+	if (getrlimit(RLIMIT_NOFILE, &lim) < 0)
+	{
+		LM_ERR("getrlimit failed: %s\n", strerror(errno));
+		return MAX_TASKS;
+	}
+
+	/* an unlimited table is not what we want to start with */
+	if (lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur > FD_TABLE_MAX)
+		return FD_TABLE_MAX >> 8;
+
+	return lim.rlim_cur > MAX_TASKS ? (int)lim.rlim_cur : MAX_TASKS;
+}
+
 reactor_t * new_reactor(int type , dispatcher_t * disp)
 {
 
@@ -70,8 +143,10 @@ reactor_t * new_reactor(int type , dispatcher_t * disp)
 		return NULL;
 	}
 
+	memset(ret, 0, sizeof (*ret));
 	ret->disp = disp;
 	ret->type = type;
+	ret->cpu = -1;
 
 	ret->io_handler = shm_malloc(sizeof (*ret->io_handler));
 
@@ -83,7 +158,8 @@ reactor_t * new_reactor(int type , dispatcher_t * disp)
 
 	memset(ret->io_handler, 0, sizeof (*ret->io_handler));
 
-	if (init_io_wait(ret, ret->io_handler, MAX_TASKS, 0, type) < 0)
+	if (init_io_wait(ret, ret->io_handler, reactor_fd_limit(),
+			reactor_ev_batch, 0, type) < 0)
 	{
 		LM_ERR("Initializing I/O wait handler\n");
 		return NULL;
@@ -100,27 +176,294 @@ void destroy_reactor(reactor_t * reactor)
 	shm_free(reactor);
 }
 
+static int init_reactor_set(struct reactor_set *set, int type, int no,
+														dispatcher_t *disp)
+{
+	int i;
+
+	if (no < 1 || no > REACTOR_MAX)
+	{
+		LM_ERR("invalid number of reactors %d (1..%d allowed)\n",
+			no, REACTOR_MAX);
+		return -1;
+	}
+
+	for (i = 0; i < no; i++)
+	{
+		set->r[i] = new_reactor(type, disp);
+		if (set->r[i] == NULL)
+		{
+			LM_ERR("failed to create reactor %d\n", i);
+			return -1;
+		}
+		set->r[i]->idx = i;
+		set->no = i + 1;
+	}
+
+	if (no > 1 && reactor_policy == REACTOR_POLICY_LEAST_LOADED)
+	{
+		set->owner_size = reactor_fd_limit();
+		set->owner = shm_malloc(set->owner_size);
+		if (set->owner == NULL)
+		{
+			LM_ERR("no more shm memory\n");
+			return -1;
+		}
+		memset(set->owner, 0, set->owner_size);
+	}
+
+	return 0;
+}
+
+int init_reactors(dispatcher_t *disp)
+{
+	if (init_reactor_set(&reactor_sets[REACTOR_IN - 1], REACTOR_IN,
+			reactors_in, disp) < 0)
+	{
+		LM_ERR("failed to create the in reactors\n");
+		return -1;
+	}
+	if (init_reactor_set(&reactor_sets[REACTOR_OUT - 1], REACTOR_OUT,
+			reactors_out, disp) < 0)
+	{
+		LM_ERR("failed to create the out reactors\n");
+		return -1;
+	}
+
+	/* the default ones (their dispatcher is shared by all) */
+	reactor_in = reactor_sets[REACTOR_IN - 1].r[0];
+	reactor_out = reactor_sets[REACTOR_OUT - 1].r[0];
+
+	return 0;
+}
+
+int start_reactors(void)
+{
+	struct reactor_set *set;
+	int i, t;
+
+	for (t = 0; t < 2; t++)
+	{
+		set = &reactor_sets[t];
+		for (i = 0; i < set->no; i++)
+		{
+			if (reactor_start(set->r[i],
+					(t == REACTOR_IN - 1) ? "reactor in" : "reactor out") < 0)
+			{
+				LM_ERR("failed to start reactor %d\n", i);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+void destroy_reactors(void)
+{
+	struct reactor_set *set;
+	int i, t;
+
+	for (t = 0; t < 2; t++)
+	{
+		set = &reactor_sets[t];
+		for (i = 0; i < set->no; i++)
+			destroy_reactor(set->r[i]);
+		set->no = 0;
+		if (set->owner)
+		{
+			shm_free(set->owner);
+			set->owner = NULL;
+		}
+	}
+	reactor_in = reactor_out = NULL;
+}
+
+reactor_t* fd_reactor(int type, int fd)
+{
+	struct reactor_set *set = &reactor_sets[type - 1];
+	int i, k;
+
+	if (set->no == 1)
+		return set->r[0];
+
+	if (set->owner == NULL || fd < 0 || fd >= set->owner_size)
+		return set->r[(unsigned int)fd % set->no];
+
+	if ((k = set->owner[fd]) != 0)
+		return set->r[k - 1];
+
+	/* first op on this fd -> to the reactor with the fewest fds; the fd
+	 * is not yet known to other threads, so there is no race on it */
+	for (i = 1, k = 0; i < set->no; i++)
+		if (set->r[i]->fds < set->r[k]->fds)
+			k = i;
+	atomic_inc(&set->r[k]->fds);
+	set->owner[fd] = k + 1;
+
+	return set->r[k];
+}
+
+reactor_t* get_reactor(int type, int idx)
+{
+	struct reactor_set *set = &reactor_sets[type - 1];
+
+	return (idx >= 0 && idx < set->no) ? set->r[idx] : NULL;
+}
+
 /* must be thread-safe */
 void submit_task(reactor_t* rec, fd_callback cb, void *cb_param, int priority, int fd, int flags)
 {
 	io_watch_add(rec->io_handler, fd, flags, priority, cb, cb_param);
 }
 
+struct read_resubmit
+{
+	reactor_t* rec;
+	fd_callback *cb;
+	void *cb_param;
+	int priority;
+	int fd;
+	int flags;
+};
+
+static int do_read_resubmit(void *param)
+{
+	struct read_resubmit *rs = (struct read_resubmit*)param;
+
+	submit_task(rs->rec, rs->cb, rs->cb_param, rs->priority, rs->fd,
+		rs->flags);
+	shm_free(rs);
+	return 0;
+}
+
+/* must be thread-safe */
+void submit_read_task(reactor_t* rec, fd_callback cb, void *cb_param,
+											int priority, int fd, int flags)
+{
+	struct read_resubmit *rs;
+	heap_node_t task;
+
+	if (!dispatcher_overloaded(rec->disp))
+		goto submit;
+
+	rs = shm_malloc(sizeof(*rs));
+	if (rs == NULL)
+	{
+		LM_ERR("no more shm memory\n");
+		goto submit;
+	}
+	rs->rec = rec;
+	rs->cb = cb;
+	rs->cb_param = cb_param;
+	rs->priority = priority;
+	rs->fd = fd;
+	rs->flags = flags;
+
+	task.fd = -1;
+	task.flags = 0;
+	task.priority = priority;
+	task.cb = do_read_resubmit;
+	task.cb_param = rs;
+	task.last_reactor = NULL;
+
+	LM_DBG("dispatcher overloaded, holding fd %d\n", fd);
+	if (dispatcher_defer(rec->disp, task) == 0)
+		return;
+	shm_free(rs);
+
+submit:
+	submit_task(rec, cb, cb_param, priority, fd, flags);
+}
+
 /* must be thread-safe */
 void fire_fd(reactor_t* rec, int fd)
 {
 	io_watch_fire(rec->io_handler, fd);
 }
 
+static inline unsigned long long reactor_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void reactor_dispatch(reactor_t* rec, heap_node_t *task)
+{
+	unsigned long long now;
+
+	if (!(task->flags & CALLBACK_INLINE_F) || reactor_inline_budget <= 0)
+		goto queue;
+
+	/* the time of the previous inline callbacks is charged when the next
+	 * one is about to run - one clock read per callback */
+	now = reactor_now_us();
+	if (rec->inline_start == 0)
+		rec->inline_start = now;
+	else if (now - rec->inline_start >= (unsigned long long)reactor_inline_budget)
+	{
+		rec->inline_over++;
+		goto queue;
+	}
+
+	rec->inlined++;
+	run_task(task);
+	return;
+
+queue:
+	/* the fd is out of the reactor - its event must not be lost */
+	if (put_task_force(rec->disp, *task) < 0)
+		run_task(task);
+}
+
+/* must be thread-safe */
+void remove_fd(reactor_t* rec, int fd)
+{
+	struct reactor_set *set = &reactor_sets[rec->type - 1];
+
+	io_watch_del(rec->io_handler, fd);
+
+	/* the fd number may be reused for something else */
+	if (set->owner && fd >= 0 && fd < set->owner_size &&
+	set->owner[fd] == rec->idx + 1)
+	{
+		set->owner[fd] = 0;
+		atomic_dec(&rec->fds);
+	}
+}
+
 
 void* receive_loop(void * x)
 {
 	reactor_t* r = (reactor_t *) x;
 	io_wait_h* io_w = r->io_handler;
+	int n;
+#ifdef __OS_linux
+	cpu_set_t cpus;
+
+	if (r->cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(r->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			LM_WARN("failed to pin reactor on CPU %d\n", r->cpu);
+		else
+			LM_DBG("reactor pinned on CPU %d\n", r->cpu);
+	}
+#endif
+
+	/* our own commands are not queued in our own control ring */
+	io_wait_self = io_w;
 
 	while (1)
 	{
-		io_wait_loop(io_w, 4000);
+		/* new budget for the inline callbacks */
+		r->inline_start = 0;
+		n = io_wait_loop(io_w, 4000);
+		r->loops++;
+		if (n > 0)
+			r->events += n;
 	}
 
 	return NULL;
@@ -21,6 +21,14 @@
  * history:
  * ---------
  *  2010-04-xx  created (adragus)
+ *  2010-09-xx  submit_read_task() added - overload aware submit
+ *  2010-09-xx  remove_fd() added - fds stay in the epoll set (one-shot)
+ *  2010-09-xx  reactor thread may be pinned on a CPU
+ *  2010-09-xx  fd table sized from RLIMIT_NOFILE, tunable event batch
+ *  2010-09-xx  several reactors per direction; fds routed to their reactor
+ *              by fd_reactor() (hash or least-loaded)
+ *  2010-09-xx  CALLBACK_INLINE_F callbacks run by the reactor thread, within
+ *              a time budget per loop iteration
  */
 
 
@@ -41,14 +49,73 @@ enum REACTOR_TYPES
 	REACTOR_OUT = 2,
 };
 
+enum REACTOR_POLICIES
+{
+	REACTOR_POLICY_HASH = 0,   /* fd modulo the number of reactors */
+	REACTOR_POLICY_LEAST_LOADED = 1, /* to the reactor with fewer fds */
+};
+
+/* max number of reactors per direction */
+#define REACTOR_MAX  64
+
 typedef struct _reactor
 {
 	int type;
+	int idx; /* index among the reactors of the same type */
 	io_wait_h* io_handler;
 	dispatcher_t* disp;
+	int cpu; /* CPU to pin the reactor thread on, -1 if none */
+	/* stats */
+	volatile int fds; /* fds assigned by the least-loaded policy */
+	unsigned long loops; /* wait calls */
+	unsigned long events; /* events reported by the waits */
+	unsigned long last_events; /* "events" at the last rate computation */
+	unsigned long long last_ms; /* time of the last rate computation */
+	unsigned long inlined; /* callbacks run by the reactor thread */
+	unsigned long inline_over; /* inline ones sent to the dispatcher as
+	                            * the budget was used up */
+	/* start (us) of the inline callbacks of this loop iteration, 0 if
+	 * none run yet */
+	unsigned long long inline_start;
 } reactor_t;
 
 
+/* number of fds the fd table of a reactor is sized for
+ * (0 - the RLIMIT_NOFILE soft limit); the table grows past it if needed */
+extern int reactor_max_fds;
+/* max number of events fetched by a reactor in a loop iteration */
+extern int reactor_ev_batch;
+
+/* number of IN and OUT reactors */
+extern int reactors_in;
+extern int reactors_out;
+/* how the fds are spread over the reactors of a direction */
+extern int reactor_policy;
+/* time (us) a reactor may spend per loop iteration running
+ * CALLBACK_INLINE_F callbacks itself (0 - all go to the dispatcher) */
+extern int reactor_inline_budget;
+
+int set_reactor_policy(char *s);
+
+/* creates the IN and OUT reactors (reactors_in / reactors_out of them);
+ * reactor_in and reactor_out are set to the first ones */
+int init_reactors(dispatcher_t *disp);
+
+int start_reactors(void);
+
+void destroy_reactors(void);
+
+/* returns the reactor of the given type owning the fd - all the ops on a
+ * fd (submit, fire, remove) must go to the same reactor; must be
+ * thread-safe */
+reactor_t* fd_reactor(int type, int fd);
+
+#define in_reactor(_fd)   fd_reactor(REACTOR_IN, _fd)
+#define out_reactor(_fd)  fd_reactor(REACTOR_OUT, _fd)
+
+/* the "idx"-th reactor of the given type, NULL if none */
+reactor_t* get_reactor(int type, int idx);
+
 /* will create a thread that is listening */
 reactor_t* new_reactor(int type, dispatcher_t * disp);
 
@@ -61,13 +128,30 @@ dispatcher_t get_dispacther(reactor_t* reactor);
 /*
  * The flags parameter can be
  * CALLBACK_COMPLEX_F, if you want the callback to be called with the fd_map structure
+ * CALLBACK_INLINE_F, if the callback is short and non-blocking
  *
  */
 /* must be thread-safe */
 void submit_task(reactor_t* rec, fd_callback cb, void *cb_param,
 		int priority, int fd, int flags);
 
+/* same as submit_task, but for fds bringing new work in (listeners):
+ * if the dispatcher is overloaded, the fd is put back in the reactor
+ * only after the overload is over */
+void submit_read_task(reactor_t* rec, fd_callback cb, void *cb_param,
+		int priority, int fd, int flags);
+
 /* must be thread-safe */
 void fire_fd(reactor_t* rec, int fd);
 
+/* hands an activated fd to its callback - run right away if inline-safe
+ * and the budget allows it, queued in the dispatcher otherwise; to be
+ * called only by the reactor thread */
+void reactor_dispatch(reactor_t* rec, heap_node_t *task);
+
+/* to be called before closing a fd that was given to the reactor (it
+ * also drops the fd from its reactor, see fd_reactor()); must be
+ * thread-safe */
+void remove_fd(reactor_t* rec, int fd);
+
 #endif
@@ -24,21 +24,32 @@
 #include "reactor.h"
 
 
-int inline select_local_del(io_wait_h *h, int fd, int idx)
+static inline int select_local_del(io_wait_h *h, int fd, int idx)
 {
+	/* never added if too big for the sets */
+	if (fd >= FD_SETSIZE)
+		return -1;
 	FD_CLR(fd, &h->master_set);
 	FD_CLR(fd, &h->out_set);
 	return array_fd_del(h, fd, idx);
 
 }
 
-void inline select_local_add(io_wait_h *h, int fd, int ev)
+static inline int select_local_add(io_wait_h *h, int fd, int ev)
 {
+	/* the fd sets are fixed size */
+	if (fd >= FD_SETSIZE)
+	{
+		LM_ERR("fd %d too big for select (max %d)\n", fd, FD_SETSIZE - 1);
+		return -1;
+	}
+
+	if (array_fd_add(h, fd, ev) < 0)
+		return -1;
+
 	if (fd > h->max_fd_select)
 		h->max_fd_select = fd;
 
-	array_fd_add(h, fd, ev);
-
 	if (ev == REACTOR_IN)
 	{
 		FD_SET(fd, &h->master_set);
@@ -48,33 +59,65 @@ void inline select_local_add(io_wait_h *h, int fd, int ev)
 	{
 		FD_SET(fd, &h->out_set);
 	}
+
+	return 0;
 }
 
 int select_init(io_wait_h *h)
 {
 	FD_ZERO(&h->master_set);
-	select_local_add(h, h->control_pipe[0], REACTOR_IN);
-	set_fd_flags(O_NONBLOCK, h->control_pipe[0]);
 	FD_ZERO(&h->out_set);
-
-	return 0;
-error:
-	return -1;
+	/* the doorbell is always the first in the array */
+	return select_local_add(h, h->ctl_fd[0], REACTOR_IN);
 }
 
 void select_destroy(io_wait_h *h)
 {
-	close(h->control_pipe[0]);
-	close(h->control_pipe[1]);
+	/* the doorbell is closed by ctl_destroy() */
 }
 
 
+/* runs a control command - by the reactor thread only */
+void select_ctl_apply(io_wait_h *h, struct ctl_cmd *cmd)
+{
+	reactor_t * rec = (reactor_t *) h->arg;
+	struct fd_map e;
+	struct fd_map *m;
+	int fd = cmd->fd;
+
+	/* the fd may be gone (removed) since the command was sent */
+	m = get_fd_map(h, fd);
+
+	if (cmd->op == ADD_FD)
+	{
+		LM_DBG("Adding fd = %d events = %d\n", fd, cmd->arg);
+		if (m && m->fd != -1 && select_local_add(h, fd, cmd->arg) < 0)
+			LM_ERR("fd %d cannot be watched\n", fd);
+	}
+	else if (cmd->op == DEL_FD)
+	{
+		select_local_del(h, fd, -1);
+	}
+	else if (cmd->op == FIRE_FD)
+	{
+		if (m == NULL)
+			return;
+		e = *m;
+		if( e.fd != -1 )
+		{
+			LM_DBG("Firing event on fd =%d\n",fd);
+			if( !select_local_del(h,fd,-1) )
+				reactor_dispatch(rec, &e);
+		}
+	}
+}
+
 int select_loop(io_wait_h *h, int t)
 {
-	int n, ret,len;
+	int n, ret, k, rung;
 	struct timeval timeout;
 	int r, i;
-	int buff[4096];
+	struct ctl_cmd cmds[CTL_BATCH];
 	fd_set local_set;
 	fd_set local_out_set;
 	struct fd_map e;
@@ -84,7 +127,7 @@ again:
 
 	local_set = h->master_set;
 	local_out_set = h->out_set;
-	timeout.tv_sec = t;
+	timeout.tv_sec = ctl_wait_start(h, t);
 	timeout.tv_usec = 0;
 
 	ret = n = select(h->max_fd_select + 1, &local_set, &local_out_set,
@@ -96,59 +139,47 @@ again:
 		if (errno == EINTR) goto again; /* just a signal */
 		LM_ERR("select: %s [%d]\n", strerror(errno), errno);
 		n = 0;
+		FD_ZERO(&local_set);
+		FD_ZERO(&local_out_set);
 		/* continue */
 	}
 
 	/*
-	 * Process the control pipe
+	 * Process the control ring
 	 */
 
-	if (FD_ISSET(h->control_pipe[0], &local_set))
+	rung = FD_ISSET(h->ctl_fd[0], &local_set);
+	ctl_wait_end(h, rung);
+	if (rung)
 	{
+		FD_CLR(h->ctl_fd[0], &local_set);
+		n--;
+	}
 
-		if ((len = read(h->control_pipe[0], buff, sizeof (buff))) < 0)
-		{
-			LM_ERR("unable to read command from control pipe\n");
-			return -1;
-		}
+	/* mark the ready fds in the array, as poll does - the fds added from
+	 * now on (by the commands or re-armed by inline callbacks) must not
+	 * be taken for ready ones */
+	for (r = 1; r < h->fd_no; r++)
+		h->fd_array[r].revents =
+			(FD_ISSET(h->fd_array[r].fd, &local_set) ||
+			FD_ISSET(h->fd_array[r].fd, &local_out_set)) ? POLLIN : 0;
 
-		for (i = 0; i < len / sizeof (int); i += CONTROL_SIZE)
-		{
-			int op = buff[i];
-			int fd = buff[i + 1];
-			int ev = buff[i + 2];
-
-			if (op == ADD_FD)
-			{
-				LM_DBG("Adding fd = %d events = %d\n",fd,ev);
-				select_local_add(h, fd, ev);
-			}
-
-			if( op == FIRE_FD )
-			{
-				e = *get_fd_map(h,fd);
-				if( e.fd != -1 )
-				{
-					LM_DBG("Firing event on fd =%d\n",fd);
-					if( !select_local_del(h,fd,-1) )
-						put_task(rec->disp, e);
-				}
-			}
-			
-		}
-	}
+	while ((k = ctl_fetch(h, cmds, CTL_BATCH)) > 0)
+		for (i = 0; i < k; i++)
+			select_ctl_apply(h, &cmds[i]);
 
 	/* use poll fd array to process all events except the first */
 
 	r = 1;
 	while (n > 0 && r < h->fd_no)
 	{
-		if (FD_ISSET(h->fd_array[r].fd, &local_set)
-					 || FD_ISSET(h->fd_array[r].fd, &local_out_set) )
+		if (h->fd_array[r].revents)
 		{
 			e = *get_fd_map(h, h->fd_array[r].fd);
 			select_local_del(h, h->fd_array[r].fd, r);
-			put_task(rec->disp, e);
+			/* removed (closed) meanwhile, the DEL command is pending */
+			if (e.fd != -1)
+				reactor_dispatch(rec, &e);
 			n--;
 
 		} else
@@ -160,7 +191,7 @@ again:
 }
 
 /*
- * select_add just sends messages through the control pipe
+ * select_add just sends messages through the control ring
  */
 
 
@@ -169,20 +200,12 @@ int select_add(io_wait_h* h, int fd, int type, int priority,
 {
 
 	struct fd_map* e;
-	int ops[CONTROL_SIZE];
 
 	if ((e = safe_add_to_hash(h, fd, type, priority, cb, cb_param)) == NULL)
 		goto error;
 
-	ops[0] = ADD_FD;
-	ops[1] = fd;
-	ops[2] = h->type;
-
-	if (write(h->control_pipe[1], ops, sizeof (ops)) < 0)
-	{
-		LM_ERR("Unable to send message through control pipe\n");
+	if (ctl_send(h, ADD_FD, fd, h->type) < 0)
 		goto error;
-	}
 
 	return 0;
 error:
@@ -29,6 +29,7 @@
 
 int select_init(io_wait_h *h);
 int select_loop(io_wait_h *h, int t);
+void select_ctl_apply(io_wait_h *h, struct ctl_cmd *cmd);
 int select_add(io_wait_h* h, int fd, int type, int priority,
 		fd_callback cb, void *cb_param);
 void select_destroy(io_wait_h *h);
@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <arpa/nameser.h>
+
+#include "../mem/mem.h"
+#include "../mem/shm_mem.h"
+#include "../locking/locking.h"
+#include "../mi/mi.h"
+#include "../reactor/reactor.h"
+#include "../timer.h"
+#include "resolve.h"
+#include "dns_globals.h"
+#include "dns_cache.h"
+
+
+#define DNS_CACHE_BUCKETS  1024      /* must be power of 2 */
+#define DNS_CACHE_TIMER    5         /* expired entries sweep, in seconds */
+#define DNS_EVICT_STEPS    8         /* max entries checked for eviction */
+
+#define DNS_CE_PENDING     (1<<0)    /* upstream query in progress */
+#define DNS_CE_UNLINKED    (1<<1)    /* not in cache anymore */
+
+int dns_cache_size = 8192;
+int dns_neg_ttl = 60;
+int dns_max_ttl = 3600;
+
+__thread int dns_cache_sync = 0;
+
+struct dns_waiter {
+	ares_callback func;
+	void *arg;
+	struct dns_waiter *next;
+};
+
+struct dns_cache_entry {
+	/* hash bucket */
+	struct dns_cache_entry *next;
+	struct dns_cache_entry *prev;
+	/* LRU list */
+	struct dns_cache_entry *lru_next;
+	struct dns_cache_entry *lru_prev;
+
+	unsigned int hash;
+	int type;
+	int search;
+	int flags;
+	int ref;
+
+	/* the answer */
+	int status;
+	unsigned int expires;
+	unsigned char *abuf;
+	int alen;
+
+	/* lookups waiting for the pending query */
+	struct dns_waiter *waiters;
+
+	int name_len;
+	char name[1];
+};
+
+struct dns_cache {
+	gen_lock_t lock;
+	struct dns_cache_entry *buckets[DNS_CACHE_BUCKETS];
+	/* LRU sentinel - lru_next is the most recently used */
+	struct dns_cache_entry lru;
+	unsigned int entries;
+	/* statistics */
+	unsigned long hits;
+	unsigned long neg_hits;
+	unsigned long misses;
+	unsigned long coalesced;
+	unsigned long evictions;
+	unsigned long expired;
+};
+
+static struct dns_cache *dns_cache = NULL;
+
+
+static int dns_cache_timer(void *param);
+static struct mi_root* mi_dns_cache_stats(struct mi_root *cmd, void *param);
+
+static mi_funcs_t mi_dns_cmds[] = {
+	{ "dns_cache_stats", mi_dns_cache_stats, MI_NO_INPUT_FLAG,  0,  0 },
+	{ 0, 0, 0, 0, 0}
+};
+
+
+int dns_cache_init(void)
+{
+	if (dns_cache_size<=0) {
+		LM_INFO("DNS cache disabled\n");
+		return 0;
+	}
+	if (dns_neg_ttl<0)
+		dns_neg_ttl = 0;
+	if (dns_max_ttl<=0)
+		dns_max_ttl = 1;
+
+	dns_cache = (struct dns_cache*)shm_malloc(sizeof(struct dns_cache));
+	if (dns_cache==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset( dns_cache, 0, sizeof(struct dns_cache));
+	lock_init( &dns_cache->lock );
+	dns_cache->lru.lru_next = dns_cache->lru.lru_prev = &dns_cache->lru;
+
+	if (register_timer( dns_cache_timer, NULL, DNS_CACHE_TIMER)<0) {
+		LM_ERR("failed to register DNS cache timer\n");
+		return -1;
+	}
+
+	if (register_mi_mod( "dns", mi_dns_cmds)<0) {
+		LM_ERR("failed to register MI commands\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static inline unsigned int dns_hash(char *name, int len, int type,
+																int search)
+{
+	unsigned int h;
+	int i;
+
+	/* FNV-1a over the lowercased name */
+	h = 2166136261u;
+	for( i=0 ; i<len ; i++ ) {
+		h ^= (unsigned char)(name[i] | 0x20);
+		h *= 16777619u;
+	}
+	h ^= (unsigned int)type * 2654435761u;
+	return h ^ (search ? 0x5bd1e995u : 0);
+}
+
+
+/* min TTL of the answer records (0 if the answer cannot be parsed) */
+static unsigned int dns_answer_ttl(unsigned char *abuf, int alen)
+{
+	ns_msg h;
+	ns_rr rr;
+	unsigned int ttl;
+	int i, n;
+
+	if (ns_initparse( abuf, alen, &h)<0)
+		return 0;
+	n = ns_msg_count( h, ns_s_an);
+	if (n==0)
+		return dns_neg_ttl;
+
+	ttl = dns_max_ttl;
+	for( i=0 ; i<n ; i++ ) {
+		if (ns_parserr( &h, ns_s_an, i, &rr)<0)
+			return 0;
+		if (ns_rr_ttl(rr)<ttl)
+			ttl = ns_rr_ttl(rr);
+	}
+	return ttl;
+}
+
+
+static inline void ce_free(struct dns_cache_entry *e)
+{
+	struct dns_waiter *w;
+
+	while ( (w=e->waiters)!=NULL ) {
+		e->waiters = w->next;
+		shm_free(w);
+	}
+	if (e->abuf)
+		shm_free(e->abuf);
+	shm_free(e);
+}
+
+
+/* removes the entry from hash and LRU; it is freed here only if nobody
+ * holds a reference (cache lock must be held) */
+static inline void ce_unlink(struct dns_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		dns_cache->buckets[e->hash&(DNS_CACHE_BUCKETS-1)] = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+
+	e->flags |= DNS_CE_UNLINKED;
+	dns_cache->entries--;
+
+	if (e->ref==0)
+		ce_free(e);
+}
+
+
+static inline void ce_unref(struct dns_cache_entry *e)
+{
+	lock_get( &dns_cache->lock );
+	if (--e->ref==0 && (e->flags&DNS_CE_UNLINKED))
+		ce_free(e);
+	lock_release( &dns_cache->lock );
+}
+
+
+static inline void lru_to_front(struct dns_cache_entry *e)
+{
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+	e->lru_next = dns_cache->lru.lru_next;
+	e->lru_prev = &dns_cache->lru;
+	dns_cache->lru.lru_next->lru_prev = e;
+	dns_cache->lru.lru_next = e;
+}
+
+
+/* makes room by dropping the least recently used entries which are not
+ * in use (cache lock must be held) */
+static inline void ce_evict(void)
+{
+	struct dns_cache_entry *e, *prev;
+	int n;
+
+	e = dns_cache->lru.lru_prev;
+	for( n=0 ; n<DNS_EVICT_STEPS && e!=&dns_cache->lru &&
+	dns_cache->entries>=(unsigned int)dns_cache_size ; n++ ) {
+		prev = e->lru_prev;
+		if (e->ref==0) {
+			ce_unlink(e);
+			dns_cache->evictions++;
+		}
+		e = prev;
+	}
+}
+
+
+static inline void ce_link(struct dns_cache_entry *e)
+{
+	struct dns_cache_entry **b;
+
+	if (dns_cache->entries>=(unsigned int)dns_cache_size)
+		ce_evict();
+
+	b = &dns_cache->buckets[e->hash&(DNS_CACHE_BUCKETS-1)];
+	e->prev = NULL;
+	e->next = *b;
+	if (*b)
+		(*b)->prev = e;
+	*b = e;
+
+	e->lru_next = dns_cache->lru.lru_next;
+	e->lru_prev = &dns_cache->lru;
+	dns_cache->lru.lru_next->lru_prev = e;
+	dns_cache->lru.lru_next = e;
+
+	dns_cache->entries++;
+}
+
+
+static inline struct dns_cache_entry* ce_lookup(char *name, int len,
+								int type, int search, unsigned int hash)
+{
+	struct dns_cache_entry *e;
+
+	for( e=dns_cache->buckets[hash&(DNS_CACHE_BUCKETS-1)] ; e ; e=e->next ){
+		if (e->hash==hash && e->type==type && e->search==search &&
+		e->name_len==len && strncasecmp( e->name, name, len)==0)
+			return e;
+	}
+	return NULL;
+}
+
+
+static inline void dns_send_query(char *name, int type, int search,
+												ares_callback func, void *arg)
+{
+	int locked;
+
+	/* the answer callbacks run with the ares lock already held */
+	locked = ares_locked;
+	if (!locked)
+		ares_lock_get();
+
+	if (search)
+		ares_search( channel, name, ns_c_in, type, func, arg);
+	else
+		ares_query( channel, name, ns_c_in, type, func, arg);
+
+	if (!locked)
+		ares_lock_release();
+}
+
+
+/* c-ares callback for the pending entries */
+static void dns_cache_answer(void *arg, int status, int timeouts,
+											unsigned char *abuf, int alen)
+{
+	struct dns_cache_entry *e = (struct dns_cache_entry*)arg;
+	struct dns_waiter *w, *next;
+	unsigned char *copy;
+	unsigned int ttl;
+
+	/* how long to keep it ? */
+	if (status==ARES_SUCCESS)
+		ttl = dns_answer_ttl( abuf, alen);
+	else if (status==ARES_ENOTFOUND || status==ARES_ENODATA ||
+	status==ARES_ESERVFAIL)
+		ttl = dns_neg_ttl;
+	else
+		/* timeouts, shutdown... - do not cache */
+		ttl = 0;
+	if (ttl>(unsigned int)dns_max_ttl)
+		ttl = dns_max_ttl;
+
+	copy = NULL;
+	if (ttl && status==ARES_SUCCESS) {
+		copy = (unsigned char*)shm_malloc(alen);
+		if (copy==NULL) {
+			LM_ERR("no more shm memory, not caching %s\n", e->name);
+			ttl = 0;
+		} else {
+			memcpy( copy, abuf, alen);
+		}
+	}
+
+	lock_get( &dns_cache->lock );
+
+	w = e->waiters;
+	e->waiters = NULL;
+	e->flags &= ~DNS_CE_PENDING;
+	e->status = status;
+	e->abuf = copy;
+	e->alen = copy ? alen : 0;
+	e->expires = get_ticks() + ttl;
+	if (ttl==0 && !(e->flags&DNS_CE_UNLINKED))
+		ce_unlink(e);
+
+	lock_release( &dns_cache->lock );
+
+	/* pass the answer to all the lookups waiting for it */
+	while (w) {
+		next = w->next;
+		w->func( w->arg, status, timeouts, abuf, alen);
+		shm_free(w);
+		w = next;
+	}
+
+	/* release the ref of the pending query */
+	ce_unref(e);
+}
+
+
+void dns_cache_query(char *name, int type, int search,
+											ares_callback func, void *arg)
+{
+	struct dns_cache_entry *e;
+	struct dns_waiter *w;
+	unsigned int hash;
+	int len;
+	int sync_bk;
+
+	if (dns_cache==NULL) {
+		dns_send_query( name, type, search, func, arg);
+		return;
+	}
+
+	len = strlen(name);
+	hash = dns_hash( name, len, type, search);
+
+	w = (struct dns_waiter*)shm_malloc(sizeof(struct dns_waiter));
+	if (w==NULL) {
+		LM_ERR("no more shm memory\n");
+		goto direct;
+	}
+	w->func = func;
+	w->arg = arg;
+	w->next = NULL;
+
+	lock_get( &dns_cache->lock );
+
+	e = ce_lookup( name, len, type, search, hash);
+	if (e && !(e->flags&DNS_CE_PENDING) && e->expires<=get_ticks()) {
+		dns_cache->expired++;
+		ce_unlink(e);
+		e = NULL;
+	}
+
+	if (e==NULL) {
+		/* miss -> new pending entry, we do the query */
+		dns_cache->misses++;
+		e = (struct dns_cache_entry*)shm_malloc
+			(sizeof(struct dns_cache_entry) + len);
+		if (e==NULL) {
+			lock_release( &dns_cache->lock );
+			LM_ERR("no more shm memory\n");
+			shm_free(w);
+			goto direct;
+		}
+		memset( e, 0, sizeof(struct dns_cache_entry));
+		e->hash = hash;
+		e->type = type;
+		e->search = search;
+		e->flags = DNS_CE_PENDING;
+		e->ref = 1;
+		e->waiters = w;
+		e->name_len = len;
+		memcpy( e->name, name, len+1);
+		ce_link(e);
+
+		lock_release( &dns_cache->lock );
+
+		LM_DBG("DNS cache miss for %s type %d\n", name, type);
+		dns_send_query( e->name, type, search, dns_cache_answer, e);
+		return;
+	}
+
+	if (e->flags&DNS_CE_PENDING) {
+		/* same query already in progress -> wait for its answer */
+		dns_cache->coalesced++;
+		w->next = e->waiters;
+		e->waiters = w;
+		lock_release( &dns_cache->lock );
+		return;
+	}
+
+	/* hit */
+	if (e->abuf)
+		dns_cache->hits++;
+	else
+		dns_cache->neg_hits++;
+	e->ref++;
+	lru_to_front(e);
+
+	lock_release( &dns_cache->lock );
+
+	shm_free(w);
+
+	/* deliver right away; with the ares lock held (answer callbacks)
+	 * the user must still be reached via the dispatcher */
+	sync_bk = dns_cache_sync;
+	dns_cache_sync = !ares_locked;
+	func( arg, e->status, 0, e->abuf, e->alen);
+	dns_cache_sync = sync_bk;
+
+	ce_unref(e);
+	return;
+
+direct:
+	dns_send_query( name, type, search, func, arg);
+}
+
+
+static int dns_cache_timer(void *param)
+{
+	struct dns_cache_entry *e, *prev;
+	unsigned int now;
+
+	now = get_ticks();
+
+	lock_get( &dns_cache->lock );
+	for( e=dns_cache->lru.lru_prev ; e!=&dns_cache->lru ; e=prev ) {
+		prev = e->lru_prev;
+		if (!(e->flags&DNS_CE_PENDING) && e->ref==0 && e->expires<=now) {
+			dns_cache->expired++;
+			ce_unlink(e);
+		}
+	}
+	lock_release( &dns_cache->lock );
+
+	return 0;
+}
+
+
+static struct mi_root* mi_dns_cache_stats(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct dns_cache st;
+	unsigned long lookups;
+
+	if (dns_cache==NULL)
+		return init_mi_tree( 400, MI_SSTR("DNS cache disabled"));
+
+	/* take a snapshot of the counters */
+	lock_get( &dns_cache->lock );
+	st.entries = dns_cache->entries;
+	st.hits = dns_cache->hits;
+	st.neg_hits = dns_cache->neg_hits;
+	st.misses = dns_cache->misses;
+	st.coalesced = dns_cache->coalesced;
+	st.evictions = dns_cache->evictions;
+	st.expired = dns_cache->expired;
+	lock_release( &dns_cache->lock );
+
+	rpl_tree = init_mi_tree( 200, MI_SSTR(MI_OK));
+	if (rpl_tree==0)
+		return 0;
+
+	lookups = st.hits + st.neg_hits + st.misses + st.coalesced;
+
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Size"), "%u/%d",
+	st.entries, dns_cache_size)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Hits"), "%lu",
+	st.hits)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Negative_hits"),
+	"%lu", st.neg_hits)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Misses"), "%lu",
+	st.misses)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Coalesced"), "%lu",
+	st.coalesced)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Hit_ratio"),
+	"%lu%%", lookups ? (st.hits+st.neg_hits)*100/lookups : 0)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Evictions"), "%lu",
+	st.evictions)==0)
+		goto error;
+	if (addf_mi_node_child( &rpl_tree->node, 0, MI_SSTR("Expired"), "%lu",
+	st.expired)==0)
+		goto error;
+
+	return rpl_tree;
+error:
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * history:
+ * ---------
+ *  2010-09-xx  created
+ *  2010-09-xx  answers refused by the dispatcher delivered directly
+ *  2010-09-xx  ... but only after the ares lock is released
+ *  2010-09-xx  under the ares lock all the answers are parked
+ */
+
+/*
+ * Shared cache of DNS answers, keyed by (name, type).
+ *
+ * The raw answers are kept for the min TTL of their records; NXDOMAIN,
+ * NODATA and SERVFAIL are kept as negative entries for dns_neg_ttl
+ * seconds. Concurrent lookups for the same key are merged: only the first
+ * one goes to c-ares, the others wait on the pending entry and they all
+ * get the same answer.
+ *
+ * The answer callback gets the same parameters as an ares_callback. On a
+ * cache hit it is called right away, by the calling thread, with
+ * dns_cache_sync set - the callback may then pass the result directly to
+ * the user instead of going through the dispatcher (see dns_deliver()).
+ */
+
+#ifndef _DNS_CACHE_H
+#define _DNS_CACHE_H
+
+#include <ares.h>
+
+/* max number of cached entries (0 disables the cache) */
+extern int dns_cache_size;
+/* how long negative answers are kept (seconds) */
+extern int dns_neg_ttl;
+/* upper limit for the TTL of the cached answers (seconds) */
+extern int dns_max_ttl;
+
+/* set while the answer is delivered synchronously, from a cache hit */
+extern __thread int dns_cache_sync;
+
+int dns_cache_init(void);
+
+/* looks up (name,type) in the cache and, if not there, queries c-ares
+ * (with ares_search() if "search" is set, ares_query() otherwise) */
+void dns_cache_query(char *name, int type, int search,
+		ares_callback func, void *arg);
+
+/* passes a resolved pack to the user function - directly if we are
+ * serving a cache hit, via the dispatcher otherwise (directly if it
+ * refuses it). The answer callbacks run with the ares lock held: there
+ * the pack is parked (in its "pending" entry) until the lock is released,
+ * as the dispatcher may make us wait for the workers, which may wait for
+ * the ares lock */
+#define dns_deliver( _f, _pack) \
+	do { \
+		if (dns_cache_sync) \
+			_f(_pack); \
+		else if (ares_locked) \
+			dns_deliver_later( &(_pack)->pending, _f, _pack); \
+		else if (put_task_simple( reactor_in->disp, \
+		TASK_PRIO_RESUME_EXEC, _f, _pack)<0) \
+			_f(_pack); \
+	}while(0)
+
+#endif
@@ -21,11 +21,15 @@
  * history:
  * ---------
  *  2010-07-xx  created (adragus)
+ *  2010-09-xx  track the ares lock holder (dns cache)
+ *  2010-09-xx  answers pending on the ares lock delivered at its release
+ *  2010-09-xx  all the answers parked while holding the ares lock
  */
 
 
 
 #include <time.h>
+#include "../locking/locking.h"
 
 
 #ifndef _DNS_GLOBALS
@@ -34,5 +38,47 @@
 extern ares_channel channel;
 extern gen_lock_t ares_lock;
 
+/* set while the thread holds ares_lock (the ares callbacks run with it) */
+extern __thread int ares_locked;
+
+/* answers produced while holding the ares lock (see dns_deliver()); no
+ * user code and no wait for the dispatcher may happen with the lock held,
+ * so they are passed on when the lock is released. The entry is embedded
+ * in the answer pack - parking an answer needs no memory */
+struct dns_pending {
+	int (*func)(void *pack);
+	void *pack;
+	struct dns_pending *next;
+};
+
+extern __thread struct dns_pending *dns_pending;
+
+/* parks an answer until the ares lock is released */
+#define dns_deliver_later( _p, _f, _pack) \
+	do { \
+		(_p)->func = (_f); \
+		(_p)->pack = (_pack); \
+		(_p)->next = dns_pending; \
+		dns_pending = (_p); \
+	}while(0)
+
+/* passes the parked answers to the dispatcher (or directly to the user,
+ * if refused) - the ares lock must not be held */
+void dns_deliver_pending(void);
+
+#define ares_lock_get() \
+	do { \
+		lock_get(&ares_lock); \
+		ares_locked = 1; \
+	}while(0)
+
+#define ares_lock_release() \
+	do { \
+		ares_locked = 0; \
+		lock_release(&ares_lock); \
+		if (dns_pending) \
+			dns_deliver_pending(); \
+	}while(0)
+
 #endif
 
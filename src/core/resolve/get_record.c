@@ -21,6 +21,7 @@
  * history:
  * ---------
  *  2010-07-xx  created (adragus)
+ *  2010-09-xx  lookups go through the DNS cache
  */
 
 
@@ -30,6 +31,7 @@
 
 #include "resolve.h"
 #include "dns_globals.h"
+#include "dns_cache.h"
 
 typedef struct _get_record_pack
 {
@@ -37,6 +39,8 @@ typedef struct _get_record_pack
 	void * arg;
 	struct rdata * answer;
 
+	struct dns_pending pending;	/* parked under the ares lock */
+
 } get_record_pack_t;
 
 
@@ -64,8 +68,7 @@ void get_record_ares_to_dns(void *arg, int status, int timeouts,
 		pack->answer = NULL;
 	}
 
-	put_task_simple( reactor_in->disp, TASK_PRIO_RESUME_EXEC,
-		get_record_dns_to_user, pack);
+	dns_deliver( get_record_dns_to_user, pack);
 }
 
 
@@ -82,9 +85,7 @@ void get_record(char* name, int type, dns_get_record_answer func, void * param)
 	pack->func = func;
 	pack->arg = param;
 
-	lock_get(&ares_lock);
-	ares_search(channel, name, ns_c_in, type, get_record_ares_to_dns, pack);
-	lock_release(&ares_lock);
+	dns_cache_query(name, type, 1, get_record_ares_to_dns, pack);
 
 	return;
 
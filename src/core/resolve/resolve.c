@@ -21,6 +21,12 @@
  * history:
  * ---------
  *  2010-07-xx  created (adragus)
+ *  2010-09-xx  DNS cache (dns_cache.c)
+ *  2010-09-xx  ares fds handled by the reactor thread (CALLBACK_INLINE_F)
+ *  2010-09-xx  answers refused by the dispatcher parked until the ares
+ *              lock is released (dns_deliver_later)
+ *  2010-09-xx  all the answers produced under the ares lock parked, the
+ *              dispatcher is never waited for with the lock held
  */
 
 #include <sys/types.h>
@@ -33,6 +39,8 @@
 #include "../mem/mem.h"
 #include "../mem/shm_mem.h"
 #include "resolve.h"
+#include "dns_globals.h"
+#include "dns_cache.h"
 #include "../log.h"
 #include "../utils.h"
 #include "../globals.h"
@@ -58,20 +66,46 @@ enum
 
 ares_channel channel;
 gen_lock_t ares_lock;
+__thread int ares_locked = 0;
+__thread struct dns_pending *dns_pending = NULL;
 int dns_try_ipv6 = 0;
 
 unsigned char fd_state[DNS_MAX_FD];
 
 void reactor_to_ares(reactor_t * rec, int fd, void * param);
 
+void dns_deliver_pending(void)
+{
+	struct dns_pending *p, *next, *l;
+
+	/* detach the list (the user functions may park new answers) and
+	 * restore the order of the answers */
+	l = NULL;
+	for( p=dns_pending ; p ; p=next ) {
+		next = p->next;
+		p->next = l;
+		l = p;
+	}
+	dns_pending = NULL;
+
+	/* the entry lives in the pack, which is gone once delivered */
+	for( p=l ; p ; p=next ) {
+		next = p->next;
+		if (put_task_simple( reactor_in->disp, TASK_PRIO_RESUME_EXEC,
+		p->func, p->pack)<0)
+			p->func(p->pack);
+	}
+}
+
+
 int timeout_func(void * param)
 {
 	//LM_DBG("DNS timer \n");
-	lock_get(&ares_lock);
+	ares_lock_get();
 
 	ares_process_fd(channel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
 
-	lock_release(&ares_lock);
+	ares_lock_release();
 
 	return 0;
 };
@@ -89,8 +123,8 @@ void socket_change_callback(void *data, ares_socket_t fd,
 		if (!(fd_state[fd] & IN_INSIDE_REACTOR))
 		{
 			LM_DBG("submiting to reactor\n");
-			submit_task(reactor_in, (fd_callback*) reactor_to_ares, NULL,
-					TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F);
+			submit_task(in_reactor(fd), (fd_callback*) reactor_to_ares, NULL,
+					TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F|CALLBACK_INLINE_F);
 			fd_state[fd] |= IN_INSIDE_REACTOR;
 		}
 	} else
@@ -103,8 +137,8 @@ void socket_change_callback(void *data, ares_socket_t fd,
 		fd_state[fd] |= OUT_USED_BY_ARES;
 		if (!(fd_state[fd] & OUT_INSIDE_REACTOR))
 		{
-			submit_task(reactor_out, (fd_callback*) reactor_to_ares, NULL, 
-					 TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F);
+			submit_task(out_reactor(fd), (fd_callback*) reactor_to_ares, NULL, 
+					 TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F|CALLBACK_INLINE_F);
 			fd_state[fd] |= OUT_INSIDE_REACTOR;
 		}
 	} else
@@ -134,6 +168,13 @@ int resolv_init(void)
 	if (ret != ARES_SUCCESS)
 	{
 		LM_ERR("Error initializing ares:[%d]\n", ret);
+		return ret;
+	}
+
+	if (dns_cache_init() != 0)
+	{
+		LM_ERR("failed to init the DNS cache\n");
+		return -1;
 	}
 
 	return ret;
@@ -147,7 +188,7 @@ void reactor_to_ares(reactor_t * rec, int fd, void * param)
 {
 
 	LM_DBG("woke up from reactor fd = %d\n", fd);
-	lock_get(&ares_lock);
+	ares_lock_get();
 
 	if (rec->type == REACTOR_IN)
 	{
@@ -158,7 +199,7 @@ void reactor_to_ares(reactor_t * rec, int fd, void * param)
 		if ((fd_state[fd] & IN_USED_BY_ARES) && !(fd_state[fd] & IN_INSIDE_REACTOR))
 		{
 			submit_task(rec, (fd_callback*) reactor_to_ares, NULL,
-					 TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F);
+					 TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F|CALLBACK_INLINE_F);
 			fd_state[fd] |= IN_INSIDE_REACTOR;
 		}
 
@@ -172,13 +213,13 @@ void reactor_to_ares(reactor_t * rec, int fd, void * param)
 		if ((fd_state[fd] & OUT_USED_BY_ARES) && !(fd_state[fd] & OUT_INSIDE_REACTOR))
 		{
 			submit_task(rec, (fd_callback*) reactor_to_ares, NULL,
-					 TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F);
+					 TASK_PRIO_READ_IO, fd, CALLBACK_COMPLEX_F|CALLBACK_INLINE_F);
 			fd_state[fd] |= OUT_INSIDE_REACTOR;
 		}
 
 	}
 
-	lock_release(&ares_lock);
+	ares_lock_release();
 
 }
 
@@ -21,10 +21,12 @@
  * history:
  * ---------
  *  2010-07-xx  created (adragus)
+ *  2010-09-xx  A/AAAA queries go through the DNS cache
  */
 
 #include "resolve.h"
 #include "dns_globals.h"
+#include "dns_cache.h"
 
 typedef struct _resolve_pack
 {
@@ -35,6 +37,8 @@ typedef struct _resolve_pack
 	char * name;
 	int type;
 
+	struct dns_pending pending;	/* parked under the ares lock */
+
 } resolve_pack_t;
 
 int resolve_dns_to_user(void * arg)
@@ -46,40 +50,67 @@ int resolve_dns_to_user(void * arg)
 }
 
 void resolve_ares_to_dns(void *arg, int status, int timeouts,
-						 struct hostent * he)
+						 unsigned char *abuf, int alen)
 {
-	//TODO speed improvement if we skip the first query through the dispatcher
 	resolve_pack_t * pack = (resolve_pack_t *) arg;
+	struct hostent * he;
+	int ret;
 
 	if (status == ARES_SUCCESS)
 	{
-		pack->answer = hostent_cpy(he);
-	} else
-	{
-		if( dns_try_ipv6 && pack->type == AF_INET)
-		{
-			LM_DBG("Trying IPv6 query for %s \n", pack->name);
-			pack->type = AF_INET6;
-			ares_gethostbyname(channel, pack->name, pack->type,
-										resolve_ares_to_dns, pack);
-			return;
-		}
+		if (pack->type == AF_INET)
+			ret = ares_parse_a_reply(abuf, alen, &he, NULL, NULL);
 		else
+			ret = ares_parse_aaaa_reply(abuf, alen, &he, NULL, NULL);
+
+		if (ret == ARES_SUCCESS)
 		{
-			LM_ERR("Error in dns reply: %s\n", ares_strerror(status));
-			pack->answer = NULL;
+			pack->answer = hostent_cpy(he);
+			ares_free_hostent(he);
+			goto done;
 		}
+		status = ret;
+	}
+
+	if( dns_try_ipv6 && pack->type == AF_INET)
+	{
+		LM_DBG("Trying IPv6 query for %s \n", pack->name);
+		pack->type = AF_INET6;
+		dns_cache_query(pack->name, ns_t_aaaa, 1, resolve_ares_to_dns, pack);
+		return;
 	}
 
-	put_task_simple(reactor_in->disp, TASK_PRIO_RESUME_EXEC,
-					resolve_dns_to_user, pack);
+	LM_ERR("Error in dns reply: %s\n", ares_strerror(status));
+	pack->answer = NULL;
 
+done:
+	dns_deliver( resolve_dns_to_user, pack);
 }
 
 void resolvehost(char * name, dns_resolve_answer func, void * param)
 {
-	resolve_pack_t * pack = (resolve_pack_t *) shm_malloc(sizeof (*pack));
+	resolve_pack_t * pack;
+	struct hostent * he;
+	struct ip_addr ip;
+	str s;
+
+	/* IP address or hosts file entry - no DNS query needed */
+	s.s = name;
+	s.len = strlen(name);
+	if ( str2ip(&s,&ip) == 0 || str2ip6(&s,&ip) == 0 )
+	{
+		func(param, ip_addr2he(&s,&ip));
+		return;
+	}
 
+	if (ares_gethostbyname_file(channel, name, AF_INET, &he) == ARES_SUCCESS)
+	{
+		func(param, hostent_cpy(he));
+		ares_free_hostent(he);
+		return;
+	}
+
+	pack = (resolve_pack_t *) shm_malloc(sizeof (*pack));
 	if (pack == NULL)
 	{
 		LM_ERR("Out of memory\n");
@@ -91,10 +122,7 @@ void resolvehost(char * name, dns_resolve_answer func, void * param)
 	pack->name = name;
 	pack->type = AF_INET;
 
-	lock_get(&ares_lock);
-	ares_gethostbyname(channel, pack->name, pack->type,
-						resolve_ares_to_dns, pack);
-	lock_release(&ares_lock);
+	dns_cache_query(pack->name, ns_t_a, 1, resolve_ares_to_dns, pack);
 
 	return;
 
@@ -102,4 +130,3 @@ error:
 	func(param, NULL);
 
 }
-
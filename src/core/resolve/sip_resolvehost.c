@@ -21,9 +21,11 @@
  * history:
  * ---------
  *  2010-07-xx  created (adragus)
+ *  2010-09-xx  lookups go through the DNS cache
  */
 #include "resolve.h"
 #include "dns_globals.h"
+#include "dns_cache.h"
 
 /*
  * Types of nodes in the dns_request list
@@ -54,6 +56,8 @@ typedef struct _sip_pack
 	struct hostent * he;
 	dns_request_t * requests;
 
+	struct dns_pending pending;	/* parked under the ares lock */
+
 } sip_pack_t;
 
 
@@ -350,8 +354,8 @@ search_again:
 	{
 		LM_DBG("Submiting query for %s type %d\n",
 			   pack->requests->name, pack->requests->type);
-		ares_search(channel, pack->requests->name, ns_c_in,
-					pack->requests->type, sip_ares_to_dns, pack);
+		dns_cache_query(pack->requests->name, pack->requests->type, 1,
+					sip_ares_to_dns, pack);
 	}else
 	{
 		goto error;
@@ -365,8 +369,7 @@ error:
 
 submit:
 	/* return the answer to the user using the dispatcher */
-	put_task_simple(reactor_in->disp, TASK_PRIO_RESUME_EXEC,
-					sip_dns_to_user, pack);
+	dns_deliver( sip_dns_to_user, pack);
 
 free_request:
 	/* free current request */
@@ -545,13 +548,10 @@ void next_he(dns_request_t * requests, dns_sip_resolve_answer func, void * arg)
 	pack->arg = arg;
 	pack->requests = requests;
 
-	lock_get(&ares_lock);
-
 	LM_DBG("Querying for %s with type %d\n", requests->name,
 		requests->type);
-	ares_query(channel, requests->name, ns_c_in,
-			requests->type, sip_ares_to_dns, pack);
-	lock_release(&ares_lock);
+	dns_cache_query(requests->name, requests->type, 0,
+			sip_ares_to_dns, pack);
 
 	return;
 
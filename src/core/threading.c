@@ -21,6 +21,7 @@
  * history:
  * ---------
  *  2010-01-xx  created (bogdan)
+ *  2010-09-xx  flush the shm thread cache when a thread ends
  */
 
 
@@ -271,6 +272,11 @@ static void* thread_startup( void *idx)
 
 	(void)tt[(long)idx].thread_routine( tt[(long)idx].thread_arg );
 
+#ifdef SHM_TCACHE
+	/* give back to the pool what the thread cached */
+	shm_tcache_flush_all();
+#endif
+
 	/* if we get here, it means the thread failed to init or the thread
 	 * ended - which should not happen */
 failed:
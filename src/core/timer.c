@@ -20,11 +20,16 @@
  * History:
  * --------
  *  2010-03-26  created (bogdan)
+ *  2010-09-xx  the timer wheel is advanced at each utimer tick
+ *  2010-09-xx  ticks scheduled on absolute CLOCK_MONOTONIC deadlines (no
+ *              drift); late ticks are caught up; lateness stats
  */
 
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -35,6 +40,7 @@
 #include "dispatcher/dispatcher.h"
 #include "mem/mem.h"
 #include "timer.h"
+#include "timer_wheel.h"
 
 
 
@@ -47,6 +53,10 @@ struct timer_task {
 
 static utime_t  jiffies=0;
 static utime_t  ujiffies=0;
+static volatile utime_t  mjiffies=0;
+
+/* written only by the timer thread */
+static struct timer_stats tstats;
 
 static struct timer_task *ttasks = NULL;
 static struct timer_task *uttasks = NULL;
@@ -65,6 +75,18 @@ utime_t get_uticks(void)
 }
 
 
+utime_t get_mticks(void)
+{
+	return mjiffies;
+}
+
+
+void get_timer_stats(struct timer_stats *st)
+{
+	*st = tstats;
+}
+
+
 static inline struct timer_task* build_ttask( timer_function f, void *param,
 														unsigned int interval)
 {
@@ -180,6 +202,14 @@ static inline void utimer_ticker(void)
 			put_task( reactor_in->disp, t->task);
 		}
 	}
+
+	timer_wheel_tick();
+}
+
+
+static inline utime_t ts2us(struct timespec *ts)
+{
+	return (utime_t)ts->tv_sec*1000000 + ts->tv_nsec/1000;
 }
 
 
@@ -187,55 +217,49 @@ static void* timer_thread(void *param)
 {
 	unsigned int multiple;
 	unsigned int cnt;
-	struct timeval o_tv;
-	struct timeval tv;
-
-	if ( (uttasks==NULL) || ((TIMER_TICK*1000000) == UTIMER_TICK) ) {
-		o_tv.tv_sec = TIMER_TICK;
-		o_tv.tv_usec = 0;
-		multiple = 1;
-	} else {
-		o_tv.tv_sec = UTIMER_TICK / 1000000;
-		o_tv.tv_usec = UTIMER_TICK % 1000000;
-		multiple = (( TIMER_TICK * 1000000 ) / UTIMER_TICK ) / 1000000;
-	}
-
-	LM_DBG("tv = %ld, %ld , m=%d\n",
-		(long int)o_tv.tv_sec, (long int)o_tv.tv_usec,multiple);
-
-	if (uttasks==NULL) {
-		for( ; ; ) {
-			tv = o_tv;
-			select( 0, 0, 0, 0, &tv);
-			timer_ticker();
-		}
-
-	} else
-	if (ttasks==NULL) {
-		for( ; ; ) {
-			tv = o_tv;
-			select( 0, 0, 0, 0, &tv);
-			utimer_ticker();
-		}
-
-	} else
-	if (multiple==1) {
-		for( ; ; ) {
-			tv = o_tv;
-			select( 0, 0, 0, 0, &tv);
+	struct timespec ts;
+	utime_t start;
+	utime_t next;
+	utime_t now;
+	utime_t late;
+
+	/* the timer wheel needs the utimer resolution, so always tick at it */
+	multiple = ( TIMER_TICK * 1000000 ) / UTIMER_TICK;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	start = next = ts2us(&ts);
+
+	LM_DBG("tick = %d us, m=%d\n", UTIMER_TICK, multiple);
+
+	for( cnt=1 ; ; cnt++ ) {
+		/* sleep until an absolute deadline, so the time spent in the
+		 * tickers and the oversleeping do not add up */
+		next += UTIMER_TICK;
+		ts.tv_sec = next / 1000000;
+		ts.tv_nsec = (next % 1000000) * 1000;
+		while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+		NULL)==EINTR );
+
+		clock_gettime( CLOCK_MONOTONIC, &ts);
+		now = ts2us(&ts);
+		mjiffies = (now - start) / 1000;
+
+		/* if we are late, the next deadlines are already due and the
+		 * ticks are run back to back until we catch up */
+		late = (now>next) ? now-next : 0;
+		tstats.ticks++;
+		tstats.sum_lateness += late;
+		if (late>tstats.max_lateness)
+			tstats.max_lateness = late;
+		if (late>TIMER_LATE_THRESHOLD)
+			tstats.late++;
+		if (late>=UTIMER_TICK)
+			tstats.skipped++;
+
+		utimer_ticker();
+		if (cnt==multiple) {
 			timer_ticker();
-			utimer_ticker();
-		}
-
-	} else {
-		for( cnt=1 ; ; cnt++ ) {
-			tv = o_tv;
-			select( 0, 0, 0, 0, &tv);
-			utimer_ticker();
-			if (cnt==multiple) {
-				timer_ticker();
-				cnt = 0;
-			}
+			cnt = 0;
 		}
 	}
 	return NULL;
@@ -256,6 +280,8 @@ int start_timer_thread(void)
 
 	jiffies=0;
 	ujiffies=0;
+	mjiffies=0;
+	memset( &tstats, 0, sizeof(tstats));
 
 	/* start timer thread */
 	if (pt_create_thread( "timer", timer_thread, NULL)<0 ) {
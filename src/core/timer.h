@@ -20,6 +20,8 @@
  * History:
  * --------
  *  2010-03-26  created (bogdan)
+ *  2010-09-xx  UTIMER_TICK parenthesized (used in divisions)
+ *  2010-09-xx  monotonic, drift free ticking; get_mticks(); stats
  */
 
 #ifndef  _CORE_TIMER_H
@@ -27,7 +29,7 @@
 
 
 #define TIMER_TICK   1  				/*!< one second */
-#define UTIMER_TICK  100*1000			/*!< 100 miliseconds*/
+#define UTIMER_TICK  (100*1000)			/*!< 100 miliseconds*/
 
 typedef fd_callback timer_function;
 
@@ -37,6 +39,25 @@ unsigned int get_ticks(void);
 
 utime_t get_uticks(void);
 
+/* miliseconds since the timer start, on the monotonic clock (the value
+ * is taken once per utimer tick, so it is cheap to read) */
+utime_t get_mticks(void);
+
+/* a tick running later than this (in us) is counted as late */
+#define TIMER_LATE_THRESHOLD  (UTIMER_TICK/10)
+
+struct timer_stats {
+	unsigned long ticks;        /* utimer ticks done */
+	unsigned long late;         /* ticks later than TIMER_LATE_THRESHOLD */
+	unsigned long skipped;      /* ticks whose time passed before the
+	                             * previous one was done (run back to back
+	                             * to catch up) */
+	utime_t max_lateness;       /* us */
+	utime_t sum_lateness;       /* us */
+};
+
+void get_timer_stats(struct timer_stats *st);
+
 int register_timer( timer_function f, void *param, unsigned int interval);
 
 int register_utimer( timer_function f, void *param, unsigned int interval);
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * History:
+ * --------
+ *  2010-09-xx  created
+ *  2010-09-xx  expired timers which cannot be queued are run in place
+ */
+
+#include "log.h"
+#include "globals.h"
+#include "dispatcher/dispatcher.h"
+#include "reactor/reactor.h"
+#include "locking/locking.h"
+#include "timer_wheel.h"
+
+/* expired timers passed to the dispatcher in one go (outside the lock) */
+#define WHEEL_BATCH   64
+
+static struct {
+	gen_lock_t lock;
+	utime_t now;
+	/* per level, per slot circular lists (the heads are sentinels) */
+	struct wheel_timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel;
+
+
+static inline void wheel_link(struct wheel_timer *head, struct wheel_timer *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+
+static inline void wheel_unlink(struct wheel_timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+}
+
+
+/* puts the timer in the slot matching its expire time
+ * (the lock must be held, t->expires must not be in the past) */
+static inline void wheel_insert(struct wheel_timer *t)
+{
+	utime_t delta;
+	int lvl;
+
+	delta = t->expires - wheel.now;
+	for( lvl=0 ; lvl<WHEEL_LEVELS-1 &&
+	delta>=((utime_t)1<<(WHEEL_BITS*(lvl+1))) ; lvl++ );
+
+	wheel_link( &wheel.slots[lvl][(t->expires>>(WHEEL_BITS*lvl))&WHEEL_MASK],
+		t);
+}
+
+
+static inline utime_t ms2wticks(unsigned int ms)
+{
+	utime_t ticks;
+
+	ticks = ((utime_t)ms*1000 + WHEEL_TICK - 1) / WHEEL_TICK;
+	if (ticks==0)
+		return 1;
+	return (ticks>WHEEL_MAX_TICKS) ? WHEEL_MAX_TICKS : ticks;
+}
+
+
+int init_timer_wheel(void)
+{
+	int i, j;
+
+	if (lock_init(&wheel.lock)==0) {
+		LM_ERR("failed to init the timer wheel lock\n");
+		return -1;
+	}
+
+	for( i=0 ; i<WHEEL_LEVELS ; i++ )
+		for( j=0 ; j<WHEEL_SLOTS ; j++ )
+			wheel.slots[i][j].next = wheel.slots[i][j].prev =
+				&wheel.slots[i][j];
+	wheel.now = 0;
+
+	return 0;
+}
+
+
+void destroy_timer_wheel(void)
+{
+	/* the timers belong to their owners - nothing to free */
+	lock_destroy(&wheel.lock);
+}
+
+
+int wtimer_add(struct wheel_timer *t, unsigned int ms)
+{
+	lock_get(&wheel.lock);
+
+	if (wtimer_pending(t)) {
+		lock_release(&wheel.lock);
+		return -1;
+	}
+
+	t->expires = wheel.now + ms2wticks(ms);
+	wheel_insert(t);
+
+	lock_release(&wheel.lock);
+	return 0;
+}
+
+
+int wtimer_mod(struct wheel_timer *t, unsigned int ms)
+{
+	lock_get(&wheel.lock);
+
+	if (!wtimer_pending(t)) {
+		lock_release(&wheel.lock);
+		return 0;
+	}
+
+	wheel_unlink(t);
+	t->expires = wheel.now + ms2wticks(ms);
+	wheel_insert(t);
+
+	lock_release(&wheel.lock);
+	return 1;
+}
+
+
+int wtimer_del(struct wheel_timer *t)
+{
+	int ret;
+
+	/* cheap check first - most of the owners delete expired timers */
+	if (!wtimer_pending(t))
+		return 0;
+
+	lock_get(&wheel.lock);
+
+	if ( (ret=wtimer_pending(t))!=0 )
+		wheel_unlink(t);
+
+	lock_release(&wheel.lock);
+	return ret;
+}
+
+
+/* re-distributes the timers of a slot on the lower levels */
+static inline void wheel_cascade(int lvl, int idx)
+{
+	struct wheel_timer *head;
+	struct wheel_timer *t;
+
+	head = &wheel.slots[lvl][idx];
+	while ( (t=head->next)!=head ) {
+		wheel_unlink(t);
+		wheel_insert(t);
+	}
+}
+
+
+void timer_wheel_tick(void)
+{
+	heap_node_t tasks[WHEEL_BATCH];
+	struct wheel_timer *head;
+	struct wheel_timer *t;
+	int lvl, idx;
+	int n, i;
+
+	lock_get(&wheel.lock);
+
+	wheel.now++;
+
+	/* a lap of a level done -> bring down the next slot of the upper one */
+	idx = wheel.now & WHEEL_MASK;
+	for( lvl=1 ; idx==0 && lvl<WHEEL_LEVELS ; lvl++ ) {
+		idx = (wheel.now>>(WHEEL_BITS*lvl)) & WHEEL_MASK;
+		wheel_cascade( lvl, idx);
+	}
+
+	head = &wheel.slots[0][wheel.now & WHEEL_MASK];
+	do {
+		/* the timers are no longer pending once out of the wheel, so they
+		 * can be re-added or freed by the owners as soon as the lock is
+		 * released - keep only a copy of the callbacks */
+		for( n=0 ; n<WHEEL_BATCH && (t=head->next)!=head ; n++ ) {
+			wheel_unlink(t);
+			tasks[n].fd = 0;
+			tasks[n].flags = 0;
+			tasks[n].priority = t->priority;
+			tasks[n].cb = t->f;
+			tasks[n].cb_param = t->param;
+			tasks[n].last_reactor = NULL;
+		}
+
+		lock_release(&wheel.lock);
+
+		for( i=0 ; i<n ; i++ )
+			if (put_task_force( reactor_in->disp, tasks[i])<0)
+				run_task( &tasks[i] );
+
+		if (n<WHEEL_BATCH)
+			return;
+
+		lock_get(&wheel.lock);
+	} while(1);
+}
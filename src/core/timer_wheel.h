@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2010 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *
+ * History:
+ * --------
+ *  2010-09-xx  created
+ */
+
+/*
+ * Hierarchical timing wheel for one-shot timers owned by objects
+ * (connections, pending requests...).
+ *
+ * The timer structure is embedded in the owner and it is never allocated
+ * by the wheel; adding, moving and deleting a timer are O(1). The wheel is
+ * advanced by the timer thread every WHEEL_TICK; the expired timers are
+ * taken out of the wheel as a batch and their callbacks are passed to the
+ * dispatcher as tasks.
+ *
+ * Once expired, a timer is no longer pending - wtimer_del() returns 0 for
+ * it and the owner must expect the callback to run (it may re-add the
+ * timer from there).
+ */
+
+#ifndef  _CORE_TIMER_WHEEL_H
+#define  _CORE_TIMER_WHEEL_H
+
+#include "reactor/fd_map.h"
+#include "timer.h"
+
+#define WHEEL_TICK        (UTIMER_TICK) /*!< wheel resolution, in us */
+
+#define WHEEL_BITS        6
+#define WHEEL_SLOTS       (1<<WHEEL_BITS)
+#define WHEEL_MASK        (WHEEL_SLOTS-1)
+#define WHEEL_LEVELS      4
+/* longer timeouts are capped to this number of ticks */
+#define WHEEL_MAX_TICKS   ((1<<(WHEEL_BITS*WHEEL_LEVELS))-1)
+
+/* default priority of the timer tasks (same as the periodic timers) */
+#define WHEEL_TASK_PRIO   100
+
+struct wheel_timer {
+	struct wheel_timer *next;
+	struct wheel_timer *prev;   /* NULL if not pending */
+	utime_t expires;            /* in wheel ticks */
+	timer_function *f;
+	void *param;
+	int priority;
+};
+
+
+static inline void wtimer_init(struct wheel_timer *t, timer_function f,
+															void *param)
+{
+	t->next = t->prev = NULL;
+	t->expires = 0;
+	t->f = f;
+	t->param = param;
+	t->priority = WHEEL_TASK_PRIO;
+}
+
+#define wtimer_pending(_t)  ((_t)->prev!=NULL)
+
+int init_timer_wheel(void);
+
+void destroy_timer_wheel(void);
+
+/* arms the timer to expire after "ms" miliseconds;
+ * returns -1 if the timer is already pending */
+int wtimer_add(struct wheel_timer *t, unsigned int ms);
+
+/* moves a pending timer to expire after "ms" miliseconds;
+ * returns 1 if moved, 0 if the timer was not pending (nothing done) */
+int wtimer_mod(struct wheel_timer *t, unsigned int ms);
+
+/* returns 1 if the timer was pending and it was removed, 0 if it was not
+ * pending (never added or already expired) */
+int wtimer_del(struct wheel_timer *t);
+
+/* advances the wheel with one tick - called by the timer thread */
+void timer_wheel_tick(void);
+
+#endif